@@ -12,12 +12,16 @@ let package = Package(
         .library(
             name: "SymRez",
             targets: ["SymRez"]),
+        .executable(
+            name: "symrez",
+            targets: ["SymRezTool"]),
     ],
     targets: [
         .target(
             name: "SymRez",
             dependencies: [],
             path: "Sources",
+            exclude: ["compat"],
             publicHeadersPath: "include",
             cSettings: [
                 .headerSearchPath("include"),
@@ -29,10 +33,15 @@ let package = Package(
                     .when(configuration: .release)),
             ]
         ),
+        .executableTarget(
+            name: "SymRezTool",
+            dependencies: ["SymRez"],
+            path: "Tools/symrez"),
         .testTarget(
             name: "SymRezTests",
             dependencies: ["SymRez"],
-            path: "Tests"),
+            path: "Tests",
+            exclude: ["Portable"]),
     ],
     cLanguageStandard: .c17,
     cxxLanguageStandard: .cxx17
@@ -0,0 +1,458 @@
+//
+//  Bloom.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+#include <math.h>
+#include <pthread.h>
+
+/*
+ Blocked Bloom filter over every name an image defines: nlist names and
+ export trie names (re-exports included, they resolve through the image).
+ Each key touches a single 512 bit block, i.e. one cache line.
+
+ Filters are immutable and live in a process-wide registry keyed by mach
+ header, so temporary objects used to search dependents share them. They
+ are built after the first miss in an image and dropped when it unloads.
+ Filters are reference counted. An object looks its image's filter up once
+ and keeps a reference, so later lookups test it without the registry lock
+ and an unload can't free it underneath them.
+ */
+
+#define SR_BLOOM_BLOCK_BITS 512
+#define SR_BLOOM_BLOCK_WORDS (SR_BLOOM_BLOCK_BITS / 64)
+#define SR_BLOOM_MAX_HASHES 16
+#define SR_BLOOM_TRIE_STACK 256
+
+struct sr_bloom {
+    _Atomic(uint32_t) refs;
+    mach_header_t header;
+    uint32_t nblocks;
+    uint32_t nhashes;
+    uint32_t nkeys;
+    uint64_t bits[];
+};
+
+static struct {
+    sr_lock_t lock;
+    sr_bloom_config_t config;
+    mach_header_t *headers;
+    struct sr_bloom **filters;
+    uint32_t nfilters;
+    uint32_t capacity;
+} _g_bloom = {
+    .lock = SR_LOCK_INIT,
+    .config = { .fp_rate = 0.01, .max_bytes = 0x400000 },
+};
+
+static pthread_once_t _g_bloom_once = PTHREAD_ONCE_INIT;
+
+#define SR_BLOOM_SEED 0xCBF29CE484222325ULL
+
+SR_INLINE uint64_t
+sr_bloom_step(uint64_t h, uint8_t c) {
+    return (h ^ c) * 0x100000001B3ULL;
+}
+
+SR_INLINE uint64_t
+sr_bloom_finish(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+SR_INLINE uint64_t
+sr_bloom_hash(const char *symbol) {
+    uint64_t h = SR_BLOOM_SEED;
+    for (const uint8_t *p = (const uint8_t *)symbol; *p; ++p) {
+        h = sr_bloom_step(h, *p);
+    }
+
+    return sr_bloom_finish(h);
+}
+
+// Block from the high half of the hash, bit positions from 9 bit slices of a remix
+SR_INLINE uint64_t *
+sr_bloom_block(const struct sr_bloom *filter, uint64_t hash) {
+    uint64_t block = ((hash >> 32) * filter->nblocks) >> 32;
+    return (uint64_t *)&filter->bits[block * SR_BLOOM_BLOCK_WORDS];
+}
+
+SR_INLINE uint32_t
+sr_bloom_bit(uint64_t *g, uint32_t i) {
+    if (i && !(i % 7)) {
+        *g = sr_bloom_finish(*g + i);
+    }
+
+    return (uint32_t)(*g >> ((i % 7) * 9)) & (SR_BLOOM_BLOCK_BITS - 1);
+}
+
+SR_INLINE void
+sr_bloom_add(struct sr_bloom *filter, uint64_t hash) {
+    uint64_t *block = sr_bloom_block(filter, hash);
+    uint64_t g = hash * 0x9E3779B97F4A7C15ULL;
+    for (uint32_t i = 0; i < filter->nhashes; ++i) {
+        uint32_t bit = sr_bloom_bit(&g, i);
+        block[bit >> 6] |= 1ULL << (bit & 63);
+    }
+}
+
+SR_INLINE bool
+sr_bloom_test(const struct sr_bloom *filter, uint64_t hash) {
+    const uint64_t *block = sr_bloom_block(filter, hash);
+    uint64_t g = hash * 0x9E3779B97F4A7C15ULL;
+    for (uint32_t i = 0; i < filter->nhashes; ++i) {
+        uint32_t bit = sr_bloom_bit(&g, i);
+        if (!(block[bit >> 6] & (1ULL << (bit & 63)))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct sr_bloom_keys {
+    uint64_t *hashes;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+static bool
+sr_bloom_keys_push(struct sr_bloom_keys *keys, uint64_t hash) {
+    if (unlikely(keys->count == keys->capacity)) {
+        uint32_t capacity = keys->capacity ? keys->capacity * 2 : 0x1000;
+        uint64_t *hashes = realloc(keys->hashes, capacity * sizeof(uint64_t));
+        if (unlikely(!hashes)) {
+            return false;
+        }
+
+        keys->hashes = hashes;
+        keys->capacity = capacity;
+    }
+
+    keys->hashes[keys->count++] = hash;
+    return true;
+}
+
+struct sr_bloom_node {
+    const uint8_t *node;
+    uint64_t hash;
+};
+
+/*
+ FNV is streamed, so export names are hashed edge by edge as the trie is
+ walked and never assembled. The walk is a DFS with pending children on a
+ heap stack; wide nodes (the root especially) can have hundreds.
+ */
+static bool
+sr_bloom_collect_exports(symrez_t symrez, struct sr_bloom_keys *keys) {
+    if (!symrez->exports_size) {
+        return true;
+    }
+
+    const uint8_t *start = symrez->exports;
+    const uint8_t *end = start + symrez->exports_size;
+    uint32_t capacity = SR_BLOOM_TRIE_STACK;
+    struct sr_bloom_node *stack = malloc(capacity * sizeof(struct sr_bloom_node));
+    uint32_t top = 0;
+    bool ok = stack != NULL;
+
+    if (likely(ok)) {
+        stack[top].node = start;
+        stack[top++].hash = SR_BLOOM_SEED;
+    }
+
+    while (ok && top) {
+        --top;
+        const uint8_t *p = stack[top].node;
+        uint64_t hash = stack[top].hash;
+
+        uint64_t terminal_size = read_uleb128((void **)&p);
+        if (terminal_size && !(ok = sr_bloom_keys_push(keys, sr_bloom_finish(hash)))) {
+            break;
+        }
+
+        p += terminal_size;
+        if (unlikely(p >= end)) continue;
+
+        uint8_t children = *p++;
+        for (uint8_t i = 0; i < children && p < end; ++i) {
+            uint64_t child_hash = hash;
+            while (p < end && *p) {
+                child_hash = sr_bloom_step(child_hash, *p++);
+            }
+            ++p;
+
+            // A malformed trie must fail the build; a filter missing names would be wrong
+            uint64_t offset = read_uleb128((void **)&p);
+            if (unlikely(offset >= symrez->exports_size)) {
+                ok = false;
+                break;
+            }
+
+            if (unlikely(top == capacity)) {
+                struct sr_bloom_node *grown = realloc(stack, capacity * 2 * sizeof(struct sr_bloom_node));
+                if (unlikely(!grown)) {
+                    ok = false;
+                    break;
+                }
+                stack = grown;
+                capacity *= 2;
+            }
+
+            stack[top].node = start + offset;
+            stack[top++].hash = child_hash;
+        }
+    }
+
+    free(stack);
+    return ok;
+}
+
+static struct sr_bloom *
+sr_bloom_create(symrez_t symrez, const sr_bloom_config_t *config) {
+    struct sr_bloom_keys keys = { 0 };
+
+    nlist64_t end = &symrez->symtab[symrez->nsyms];
+    for (nlist64_t nl = symrez->symtab; nl < end; ++nl) {
+        if (!nl->n_un.n_strx || !nl->n_value) continue;
+        if (unlikely(!sr_bloom_keys_push(&keys, sr_bloom_hash((const char *)symrez->strtab + nl->n_un.n_strx))))  {
+            free(keys.hashes);
+            return NULL;
+        }
+    }
+
+    if (unlikely(!sr_bloom_collect_exports(symrez, &keys))) {
+        free(keys.hashes);
+        return NULL;
+    }
+
+    // m = -n ln(p) / ln(2)^2, rounded up to whole blocks and capped
+    double n = keys.count ? keys.count : 1;
+    double bits = -n * log(config->fp_rate) / (M_LN2 * M_LN2);
+    uint64_t nblocks = (uint64_t)ceil(bits / SR_BLOOM_BLOCK_BITS);
+    uint64_t max_blocks = config->max_bytes / (SR_BLOOM_BLOCK_BITS / 8);
+    if (nblocks > max_blocks) nblocks = max_blocks;
+    if (nblocks < 1) nblocks = 1;
+    if (nblocks > UINT32_MAX) nblocks = UINT32_MAX;
+
+    uint32_t nhashes = (uint32_t)lround((double)(nblocks * SR_BLOOM_BLOCK_BITS) / n * M_LN2);
+    if (nhashes < 1) nhashes = 1;
+    if (nhashes > SR_BLOOM_MAX_HASHES) nhashes = SR_BLOOM_MAX_HASHES;
+
+    size_t size = nblocks * (SR_BLOOM_BLOCK_BITS / 8);
+    struct sr_bloom *filter = calloc(1, sizeof(struct sr_bloom) + size);
+    if (unlikely(!filter)) {
+        free(keys.hashes);
+        return NULL;
+    }
+
+    atomic_init(&filter->refs, 1);
+    filter->header = symrez->header;
+    filter->nblocks = (uint32_t)nblocks;
+    filter->nhashes = nhashes;
+    filter->nkeys = keys.count;
+    for (uint32_t i = 0; i < keys.count; ++i) {
+        sr_bloom_add(filter, keys.hashes[i]);
+    }
+
+    free(keys.hashes);
+    return filter;
+}
+
+// Must be called with `_g_bloom.lock` held. Headers are scanned on their own to stay in cache
+static struct sr_bloom *
+sr_bloom_find(mach_header_t header, uint32_t *index) {
+    for (uint32_t i = 0; i < _g_bloom.nfilters; ++i) {
+        if (_g_bloom.headers[i] == header) {
+            if (index) *index = i;
+            return _g_bloom.filters[i];
+        }
+    }
+
+    return NULL;
+}
+
+SR_INLINE struct sr_bloom *
+sr_bloom_retain(struct sr_bloom *filter) {
+    atomic_fetch_add_explicit(&filter->refs, 1, memory_order_relaxed);
+    return filter;
+}
+
+static void
+sr_bloom_release(struct sr_bloom *filter) {
+    if (atomic_fetch_sub_explicit(&filter->refs, 1, memory_order_acq_rel) == 1) {
+        free(filter);
+    }
+}
+
+#if defined(__APPLE__)
+static void
+sr_bloom_image_removed(const struct mach_header *mh, intptr_t vmaddr_slide) {
+    sr_lock(&_g_bloom.lock);
+
+    uint32_t i;
+    struct sr_bloom *filter = sr_bloom_find((mach_header_t)mh, &i);
+    if (filter) {
+        uint32_t last = --_g_bloom.nfilters;
+        _g_bloom.headers[i] = _g_bloom.headers[last];
+        _g_bloom.filters[i] = _g_bloom.filters[last];
+        sr_bloom_release(filter);
+    }
+
+    sr_unlock(&_g_bloom.lock);
+}
+
+static void
+sr_bloom_register(void) {
+    _dyld_register_func_for_remove_image(sr_bloom_image_removed);
+}
+#else
+// Without dyld no image is ever unloaded
+static void
+sr_bloom_register(void) {
+}
+#endif
+
+// Must be called with `_g_bloom.lock` held
+static bool
+sr_bloom_reserve(void) {
+    if (likely(_g_bloom.nfilters < _g_bloom.capacity)) {
+        return true;
+    }
+
+    uint32_t capacity = _g_bloom.capacity ? _g_bloom.capacity * 2 : 0x100;
+    mach_header_t *headers = realloc(_g_bloom.headers, capacity * sizeof(mach_header_t));
+    if (unlikely(!headers)) {
+        return false;
+    }
+    _g_bloom.headers = headers;
+
+    struct sr_bloom **filters = realloc(_g_bloom.filters, capacity * sizeof(struct sr_bloom *));
+    if (unlikely(!filters)) {
+        return false;
+    }
+    _g_bloom.filters = filters;
+    _g_bloom.capacity = capacity;
+    return true;
+}
+
+SR_INLINE bool
+sr_bloom_enabled(symrez_t symrez) {
+    // Snapshot views can be unmapped and their addresses reused without dyld knowing
+    return !symrez->snapshot && _g_bloom.config.fp_rate > 0;
+}
+
+enum sr_bloom_result sr_bloom_check(mach_header_t header, const char *symbol) {
+    uint64_t hash = sr_bloom_hash(symbol);
+    enum sr_bloom_result ret = SR_BLOOM_UNKNOWN;
+
+    sr_lock(&_g_bloom.lock);
+    const struct sr_bloom *filter = sr_bloom_find(header, NULL);
+    if (filter) {
+        ret = sr_bloom_test(filter, hash) ? SR_BLOOM_MAYBE : SR_BLOOM_ABSENT;
+    }
+    sr_unlock(&_g_bloom.lock);
+
+    return ret;
+}
+
+enum sr_bloom_result sr_bloom_check_symrez(symrez_t symrez, const char *symbol) {
+    if (unlikely(!sr_bloom_enabled(symrez))) {
+        return SR_BLOOM_UNKNOWN;
+    }
+
+    // Only until the image has a filter; the object keeps it from then on
+    if (unlikely(!symrez->bloom)) {
+        sr_lock(&_g_bloom.lock);
+        struct sr_bloom *filter = sr_bloom_find(symrez->header, NULL);
+        if (filter) {
+            symrez->bloom = sr_bloom_retain(filter);
+        }
+        sr_unlock(&_g_bloom.lock);
+
+        if (!filter) {
+            return SR_BLOOM_UNKNOWN;
+        }
+    }
+
+    return sr_bloom_test(symrez->bloom, sr_bloom_hash(symbol)) ? SR_BLOOM_MAYBE : SR_BLOOM_ABSENT;
+}
+
+void sr_bloom_free(symrez_t symrez) {
+    if (symrez->bloom) {
+        sr_bloom_release(symrez->bloom);
+        symrez->bloom = NULL;
+    }
+}
+
+void sr_bloom_build(symrez_t symrez) {
+    if (unlikely(!sr_bloom_enabled(symrez))) {
+        return;
+    }
+
+    pthread_once(&_g_bloom_once, sr_bloom_register);
+
+    sr_lock(&_g_bloom.lock);
+    bool exists = sr_bloom_find(symrez->header, NULL) != NULL;
+    sr_bloom_config_t config = _g_bloom.config;
+    sr_unlock(&_g_bloom.lock);
+
+    if (exists) {
+        return;
+    }
+
+    // Build outside the lock
+    struct sr_bloom *filter = sr_bloom_create(symrez, &config);
+    if (unlikely(!filter)) {
+        return;
+    }
+
+    sr_lock(&_g_bloom.lock);
+    if (unlikely(sr_bloom_find(symrez->header, NULL))) {
+        // Lost the race
+    } else if (likely(sr_bloom_reserve())) {
+        _g_bloom.headers[_g_bloom.nfilters] = symrez->header;
+        _g_bloom.filters[_g_bloom.nfilters++] = filter;
+        filter = NULL;
+    }
+    sr_unlock(&_g_bloom.lock);
+
+    free(filter);
+}
+
+void sr_bloom_set_config(const sr_bloom_config_t *config) {
+    sr_lock(&_g_bloom.lock);
+    _g_bloom.config = *config;
+    if (_g_bloom.config.fp_rate >= 1) {
+        _g_bloom.config.fp_rate = 0;
+    }
+    sr_unlock(&_g_bloom.lock);
+}
+
+bool sr_bloom_get_stats(symrez_t symrez, sr_bloom_stats_t *stats) {
+    sr_bloom_build(symrez);
+
+    bool found = false;
+    sr_lock(&_g_bloom.lock);
+    const struct sr_bloom *filter = sr_bloom_find(symrez->header, NULL);
+    if (filter) {
+        double m = (double)filter->nblocks * SR_BLOOM_BLOCK_BITS;
+        double k = filter->nhashes;
+        stats->keys = filter->nkeys;
+        stats->bytes = (size_t)filter->nblocks * (SR_BLOOM_BLOCK_BITS / 8);
+        stats->hashes = filter->nhashes;
+        stats->fp_rate = pow(1 - exp(-k * filter->nkeys / m), k);
+        found = true;
+    }
+    sr_unlock(&_g_bloom.lock);
+
+    return found;
+}
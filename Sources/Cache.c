@@ -0,0 +1,300 @@
+//
+//  Cache.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+#include <pthread.h>
+
+#define SR_CACHE_SIZE 16
+
+/*
+ Small LRU of parsed images for the one-shot lookup functions. `lock`
+ guards the slots; each entry has its own lock, held for the duration of a
+ lookup since lazily built state isn't thread safe. An entry in use when
+ its image is unloaded is marked dead and torn down by its last user.
+ Teardown happens outside `lock`: the entry is claimed first (dead, with
+ a reference) so that nothing finds or reuses it meanwhile.
+
+ Image names resolved by `symrez_resolve_once` are remembered as well, so
+ repeated lookups don't walk the image list.
+ */
+
+struct sr_cache_entry {
+    struct symrez symrez;
+    mach_header_t key;
+    sr_lock_t lock;
+    uint32_t refs;
+    uint32_t stamp;
+    bool dead;
+};
+
+struct sr_cache_name {
+    char *name;
+    mach_header_t header;
+    uint32_t stamp;
+};
+
+static struct {
+    sr_lock_t lock;
+    uint32_t clock;
+    struct sr_cache_entry entries[SR_CACHE_SIZE];
+    struct sr_cache_name names[SR_CACHE_SIZE];
+} _g_cache = { .lock = SR_LOCK_INIT };
+
+static pthread_once_t _g_cache_once = PTHREAD_ONCE_INIT;
+
+// Must be called with `_g_cache.lock` held. Keeps the entry from being found or reused
+SR_INLINE void
+sr_cache_entry_claim(struct sr_cache_entry *e) {
+    e->dead = true;
+    e->refs = 1;
+}
+
+// Must be called without `_g_cache.lock` on a claimed entry
+static void
+sr_cache_entry_clear(struct sr_cache_entry *e) {
+    symrez_destroy(&e->symrez);
+
+    sr_lock(&_g_cache.lock);
+    e->key = NULL;
+    e->dead = false;
+    e->refs = 0;
+    sr_unlock(&_g_cache.lock);
+}
+
+#if defined(__APPLE__)
+static void
+sr_cache_image_removed(const struct mach_header *mh, intptr_t vmaddr_slide) {
+    struct sr_cache_entry *idle[SR_CACHE_SIZE];
+    uint32_t nidle = 0;
+
+    sr_lock(&_g_cache.lock);
+    for (uint32_t i = 0; i < SR_CACHE_SIZE; ++i) {
+        struct sr_cache_name *n = &_g_cache.names[i];
+        if (n->name && n->header == (mach_header_t)mh) {
+            free(n->name);
+            n->name = NULL;
+        }
+    }
+
+    for (uint32_t i = 0; i < SR_CACHE_SIZE; ++i) {
+        struct sr_cache_entry *e = &_g_cache.entries[i];
+        if (!e->key || e->dead || e->symrez.header != (mach_header_t)mh) continue;
+
+        if (e->refs) {
+            e->dead = true;
+        } else {
+            sr_cache_entry_claim(e);
+            idle[nidle++] = e;
+        }
+    }
+    sr_unlock(&_g_cache.lock);
+
+    for (uint32_t i = 0; i < nidle; ++i) {
+        sr_cache_entry_clear(idle[i]);
+    }
+}
+#endif
+
+static void
+sr_cache_register(void) {
+    for (uint32_t i = 0; i < SR_CACHE_SIZE; ++i) {
+        _g_cache.entries[i].lock = SR_LOCK_INIT;
+    }
+
+#if defined(__APPLE__)
+    _dyld_register_func_for_remove_image(sr_cache_image_removed);
+#endif
+}
+
+// Must be called with `_g_cache.lock` held
+static struct sr_cache_entry *
+sr_cache_find(mach_header_t header) {
+    for (uint32_t i = 0; i < SR_CACHE_SIZE; ++i) {
+        struct sr_cache_entry *e = &_g_cache.entries[i];
+        if (e->key && e->key == header && !e->dead) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+// Must be called with `_g_cache.lock` held. Free slot or least recently used idle one
+static struct sr_cache_entry *
+sr_cache_victim(void) {
+    struct sr_cache_entry *victim = NULL;
+    for (uint32_t i = 0; i < SR_CACHE_SIZE; ++i) {
+        struct sr_cache_entry *e = &_g_cache.entries[i];
+        if (!e->key) {
+            return e;
+        }
+
+        if (!e->refs && (!victim || e->stamp < victim->stamp)) {
+            victim = e;
+        }
+    }
+
+    return victim;
+}
+
+SR_INLINE struct sr_cache_entry *
+sr_cache_retain(struct sr_cache_entry *e) {
+    ++e->refs;
+    e->stamp = ++_g_cache.clock;
+    return e;
+}
+
+static struct sr_cache_entry * SR_NULLABLE
+sr_cache_acquire(mach_header_t header, struct symrez *fallback) {
+    // Free slots have no key; don't hand one out for a NULL header
+    if (unlikely(!header)) {
+        fallback->header = NULL;
+        return NULL;
+    }
+
+    pthread_once(&_g_cache_once, sr_cache_register);
+
+    sr_lock(&_g_cache.lock);
+    struct sr_cache_entry *e = sr_cache_find(header);
+    if (likely(e)) {
+        sr_cache_retain(e);
+        sr_unlock(&_g_cache.lock);
+        return e;
+    }
+    sr_unlock(&_g_cache.lock);
+
+    // Parse outside the lock
+    if (unlikely(!symrez_init_mh(fallback, header))) {
+        fallback->header = NULL;
+        return NULL;
+    }
+
+    bool lost = false;
+    sr_lock(&_g_cache.lock);
+    for (;;) {
+        if (unlikely((e = sr_cache_find(header)) != NULL)) {
+            // Lost the race
+            lost = true;
+            break;
+        }
+
+        if (unlikely(!(e = sr_cache_victim()))) {
+            break;
+        }
+
+        if (likely(!e->key)) {
+            e->symrez = *fallback;
+            e->key = header;
+            fallback->header = NULL;
+            break;
+        }
+
+        // Evict the least recently used image, then look again
+        sr_cache_entry_claim(e);
+        sr_unlock(&_g_cache.lock);
+        sr_cache_entry_clear(e);
+        sr_lock(&_g_cache.lock);
+    }
+
+    if (likely(e)) {
+        sr_cache_retain(e);
+    }
+    sr_unlock(&_g_cache.lock);
+
+    if (unlikely(lost)) {
+        symrez_destroy(fallback);
+        fallback->header = NULL;
+    }
+
+    // Every slot busy: `fallback` stays initialized for a one-off lookup
+    return e;
+}
+
+static void
+sr_cache_release(struct sr_cache_entry *e) {
+    sr_lock(&_g_cache.lock);
+    // The last user of a dead entry keeps its reference through the teardown
+    bool clear = e->refs == 1 && e->dead;
+    if (likely(!clear)) {
+        --e->refs;
+    }
+    sr_unlock(&_g_cache.lock);
+
+    if (unlikely(clear)) {
+        sr_cache_entry_clear(e);
+    }
+}
+
+static mach_header_t
+sr_cache_find_image(const char *image_name) {
+    pthread_once(&_g_cache_once, sr_cache_register);
+
+    sr_lock(&_g_cache.lock);
+    for (uint32_t i = 0; i < SR_CACHE_SIZE; ++i) {
+        struct sr_cache_name *n = &_g_cache.names[i];
+        if (n->name && !strcmp(n->name, image_name)) {
+            n->stamp = ++_g_cache.clock;
+            mach_header_t header = n->header;
+            sr_unlock(&_g_cache.lock);
+            return header;
+        }
+    }
+    sr_unlock(&_g_cache.lock);
+
+    mach_header_t header = find_image(image_name);
+    char *name = header ? strdup(image_name) : NULL;
+    if (unlikely(!name)) {
+        return header;
+    }
+
+    // Replace a free or the least recently used name
+    sr_lock(&_g_cache.lock);
+    struct sr_cache_name *slot = &_g_cache.names[0];
+    for (uint32_t i = 0; i < SR_CACHE_SIZE && slot->name; ++i) {
+        struct sr_cache_name *n = &_g_cache.names[i];
+        if (!n->name || n->stamp < slot->stamp) {
+            slot = n;
+        }
+    }
+    char *old = slot->name;
+    slot->name = name;
+    slot->header = header;
+    slot->stamp = ++_g_cache.clock;
+    sr_unlock(&_g_cache.lock);
+
+    free(old);
+    return header;
+}
+
+sr_ptr_t symrez_resolve_once_mh(mach_header_t header, const char *symbol) {
+    struct symrez fallback;
+    struct sr_cache_entry *e = sr_cache_acquire(header, &fallback);
+    sr_ptr_t addr = NULL;
+
+    if (likely(e)) {
+        sr_lock(&e->lock);
+        addr = sr_resolve_symbol(&e->symrez, symbol);
+        sr_unlock(&e->lock);
+        sr_cache_release(e);
+    } else if (fallback.header) {
+        addr = sr_resolve_symbol(&fallback, symbol);
+        symrez_destroy(&fallback);
+    }
+
+    return addr;
+}
+
+sr_ptr_t symrez_resolve_once(const char *image_name, const char *symbol) {
+    mach_header_t hdr = NULL;
+
+    if(unlikely(!(hdr = sr_cache_find_image(image_name)))) {
+        return NULL;
+    }
+
+    return symrez_resolve_once_mh(hdr, symbol);
+}
@@ -0,0 +1,324 @@
+//
+//  Compact.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ Symbol table names, sorted and front coded in blocks. The first name of a
+ block is stored whole; every other one as (bytes shared with the previous
+ name, suffix). Each name is followed by its nlist index. A directory of
+ block offsets is binary searched on the first names, then one block is
+ scanned.
+
+ The scan never rebuilds names. It only tracks how many leading bytes the
+ current name shares with the symbol: a name sharing more with its
+ predecessor than that is still smaller, one sharing less is already
+ larger, and only names sharing exactly that much need their suffix
+ compared.
+
+ Names are sorted as 4 byte nlist indices, which count against the
+ caller's budget along with the index. Larger blocks are tried until both
+ fit.
+ */
+
+#define SR_COMPACT_MIN_BLOCK 16
+#define SR_COMPACT_MAX_BLOCK 256
+
+struct sr_compact_index {
+    uint32_t nsymbols;
+    uint32_t nblocks;
+    uint32_t block_size;
+    uint32_t *blocks;
+    uint8_t *data;
+    size_t data_size;
+};
+
+SR_INLINE const char *
+sr_compact_name(symrez_t symrez, uint32_t index) {
+    return (const char *)symrez->strtab + symrez->symtab[index].n_un.n_strx;
+}
+
+SR_INLINE bool
+sr_compact_key_less(symrez_t symrez, uint32_t a, uint32_t b) {
+    int cmp = strcmp(sr_compact_name(symrez, a), sr_compact_name(symrez, b));
+    return cmp ? cmp < 0 : a < b;
+}
+
+static void
+sr_compact_sift(symrez_t symrez, uint32_t *keys, uint32_t root, uint32_t count) {
+    uint32_t key = keys[root];
+    for (uint32_t child; (child = 2 * root + 1) < count; root = child) {
+        if (child + 1 < count && sr_compact_key_less(symrez, keys[child], keys[child + 1])) ++child;
+        if (!sr_compact_key_less(symrez, key, keys[child])) break;
+        keys[root] = keys[child];
+    }
+    keys[root] = key;
+}
+
+// Heapsort, since qsort can't pass the symbol table to its comparator
+static void
+sr_compact_sort(symrez_t symrez, uint32_t *keys, uint32_t count) {
+    for (uint32_t i = count / 2; i-- > 0;) {
+        sr_compact_sift(symrez, keys, i, count);
+    }
+
+    for (uint32_t end = count; end-- > 1;) {
+        uint32_t top = keys[0];
+        keys[0] = keys[end];
+        keys[end] = top;
+        sr_compact_sift(symrez, keys, 0, end);
+    }
+}
+
+SR_INLINE size_t
+sr_compact_uleb_size(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        ++n;
+    }
+
+    return n;
+}
+
+SR_INLINE uint8_t *
+sr_compact_put_uleb(uint8_t *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+SR_INLINE size_t
+sr_compact_shared(const char *a, const char *b) {
+    size_t n = 0;
+    while (a[n] && a[n] == b[n]) ++n;
+    return n;
+}
+
+// Size of the encoded names with `block_size` names per block. Only sizes when `data` is NULL
+static size_t
+sr_compact_encode(symrez_t symrez, const uint32_t *keys, uint32_t count, uint32_t block_size, uint8_t *data, uint32_t *blocks) {
+    size_t size = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const char *name = sr_compact_name(symrez, keys[i]);
+        size_t shared = 0;
+        if (i % block_size == 0) {
+            if (blocks) blocks[i / block_size] = (uint32_t)size;
+        } else {
+            shared = sr_compact_shared(sr_compact_name(symrez, keys[i - 1]), name);
+        }
+
+        size_t suffix = strlen(name + shared);
+        if (data) {
+            uint8_t *p = data + size;
+            if (i % block_size) {
+                p = sr_compact_put_uleb(p, shared);
+            }
+            p = sr_compact_put_uleb(p, suffix);
+            memcpy(p, name + shared, suffix);
+            p = sr_compact_put_uleb(p + suffix, keys[i]);
+        }
+
+        if (i % block_size) {
+            size += sr_compact_uleb_size(shared);
+        }
+        size += sr_compact_uleb_size(suffix) + suffix + sr_compact_uleb_size(keys[i]);
+    }
+
+    return size;
+}
+
+SR_INLINE size_t
+sr_compact_total(uint32_t count, uint32_t block_size, size_t data_size) {
+    uint32_t nblocks = (count + block_size - 1) / block_size;
+    return sizeof(struct sr_compact_index) + nblocks * sizeof(uint32_t) + data_size;
+}
+
+SR_INLINE bool
+sr_compact_indexable(symrez_t symrez, uint32_t index) {
+    nlist64_t nl = &symrez->symtab[index];
+    return nl->n_un.n_strx && nl->n_value && nl->n_un.n_strx < symrez->strsize;
+}
+
+// Keys are what `sr_find_nlist` can return: the nlist index of the first named entry with a value, per name.
+// Their buffer is taken out of `*budget`
+static uint32_t *
+sr_compact_collect(symrez_t symrez, size_t *budget, uint32_t *count) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < symrez->nsyms; ++i) {
+        n += sr_compact_indexable(symrez, i);
+    }
+
+    if ((size_t)n * sizeof(uint32_t) > *budget) {
+        return NULL;
+    }
+    *budget -= (size_t)n * sizeof(uint32_t);
+
+    uint32_t *keys = sr_alloc(symrez, (n ? n : 1) * sizeof(uint32_t));
+    if (unlikely(!keys)) {
+        return NULL;
+    }
+
+    n = 0;
+    for (uint32_t i = 0; i < symrez->nsyms; ++i) {
+        if (sr_compact_indexable(symrez, i)) keys[n++] = i;
+    }
+
+    sr_compact_sort(symrez, keys, n);
+
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (unique && !strcmp(sr_compact_name(symrez, keys[unique - 1]), sr_compact_name(symrez, keys[i]))) continue;
+        keys[unique++] = keys[i];
+    }
+
+    *count = unique;
+    return keys;
+}
+
+void sr_compact_free(symrez_t symrez) {
+    struct sr_compact_index *index = symrez->compact;
+    if (!index) {
+        return;
+    }
+
+    sr_dealloc(symrez, index->blocks);
+    sr_dealloc(symrez, index->data);
+    sr_dealloc(symrez, index);
+    symrez->compact = NULL;
+}
+
+bool sr_build_compact_index(symrez_t symrez, size_t max_bytes) {
+    sr_compact_free(symrez);
+
+    // The keys are still live while the index is written
+    size_t budget = max_bytes;
+    uint32_t count = 0;
+    uint32_t *keys = sr_compact_collect(symrez, &budget, &count);
+    if (!keys) {
+        return false;
+    }
+
+    uint32_t block_size = SR_COMPACT_MIN_BLOCK;
+    size_t data_size = sr_compact_encode(symrez, keys, count, block_size, NULL, NULL);
+    while (sr_compact_total(count, block_size, data_size) > budget && block_size < SR_COMPACT_MAX_BLOCK) {
+        block_size *= 2;
+        data_size = sr_compact_encode(symrez, keys, count, block_size, NULL, NULL);
+    }
+
+    if (sr_compact_total(count, block_size, data_size) > budget) {
+        sr_dealloc(symrez, keys);
+        return false;
+    }
+
+    uint32_t nblocks = (count + block_size - 1) / block_size;
+    struct sr_compact_index *index = sr_calloc(symrez, sizeof(struct sr_compact_index));
+    uint32_t *blocks = sr_alloc(symrez, (nblocks ? nblocks : 1) * sizeof(uint32_t));
+    uint8_t *data = sr_alloc(symrez, data_size ? data_size : 1);
+    if (unlikely(!index || !blocks || !data)) {
+        sr_dealloc(symrez, index);
+        sr_dealloc(symrez, blocks);
+        sr_dealloc(symrez, data);
+        sr_dealloc(symrez, keys);
+        return false;
+    }
+
+    sr_compact_encode(symrez, keys, count, block_size, data, blocks);
+    sr_dealloc(symrez, keys);
+
+    index->nsymbols = count;
+    index->nblocks = nblocks;
+    index->block_size = block_size;
+    index->blocks = blocks;
+    index->data = data;
+    index->data_size = data_size;
+    symrez->compact = index;
+    return true;
+}
+
+// Compare `len` stored bytes with `symbol` past its first `*shared` bytes, adding the common bytes to `*shared`
+SR_INLINE int
+sr_compact_cmp(const uint8_t *name, size_t len, const char *symbol, size_t *shared) {
+    const uint8_t *s = (const uint8_t *)symbol + *shared;
+    size_t i = 0;
+    while (i < len && s[i] && name[i] == s[i]) ++i;
+    *shared += i;
+
+    if (i == len) {
+        return s[i] ? -1 : 0;
+    }
+
+    return name[i] < s[i] ? -1 : 1;
+}
+
+SR_INLINE const uint8_t *
+sr_compact_block(const struct sr_compact_index *index, uint32_t block) {
+    return index->data + index->blocks[block];
+}
+
+nlist64_t sr_compact_find_nlist(symrez_t symrez, const char *symbol) {
+    const struct sr_compact_index *index = symrez->compact;
+    if (unlikely(!index->nblocks)) {
+        return NULL;
+    }
+
+    // Last block whose first name is <= symbol
+    uint32_t lo = 0, n = index->nblocks;
+    while (n > 1) {
+        uint32_t half = n / 2;
+        const uint8_t *p = sr_compact_block(index, lo + half);
+        size_t len = read_uleb128((void **)&p);
+        size_t shared = 0;
+        if (sr_compact_cmp(p, len, symbol, &shared) <= 0) {
+            lo += half;
+            n -= half;
+        } else {
+            n = half;
+        }
+    }
+
+    const uint8_t *p = sr_compact_block(index, lo);
+    const uint8_t *end = lo + 1 < index->nblocks ? sr_compact_block(index, lo + 1) : index->data + index->data_size;
+
+    size_t matched = 0;
+    size_t len = read_uleb128((void **)&p);
+    int cmp = sr_compact_cmp(p, len, symbol, &matched);
+    p += len;
+    uint64_t nlist_index = read_uleb128((void **)&p);
+
+    while (cmp < 0 && p < end) {
+        size_t shared = read_uleb128((void **)&p);
+        len = read_uleb128((void **)&p);
+        const uint8_t *suffix = p;
+        p += len;
+        nlist_index = read_uleb128((void **)&p);
+
+        if (shared > matched) continue;
+        if (shared < matched) return NULL;
+
+        cmp = sr_compact_cmp(suffix, len, symbol, &matched);
+    }
+
+    return cmp ? NULL : &symrez->symtab[nlist_index];
+}
+
+bool sr_compact_index_get_stats(symrez_t symrez, sr_compact_index_stats_t *stats) {
+    const struct sr_compact_index *index = symrez->compact;
+    if (!index) {
+        return false;
+    }
+
+    stats->symbols = index->nsymbols;
+    stats->bytes = sr_compact_total(index->nsymbols, index->block_size, index->data_size);
+    stats->block_size = index->block_size;
+    stats->bytes_per_symbol = index->nsymbols ? (double)stats->bytes / index->nsymbols : 0;
+    return true;
+}
@@ -0,0 +1,221 @@
+//
+//  Definitions.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ `sr_resolve_symbol` stops at the first definition, but images can hold
+ several for one name: file statics in different objects, N_PEXT copies.
+ Every symbol table definition is kept in a multimap, a `sr_table` keyed
+ on the name hash with nlist indices as payload, built on first use. All
+ definitions of a name share a chain. Entries are inserted last to first,
+ and chains are LIFO, so a chain lists them in symbol table order.
+
+ Exports and Objective-C methods have at most one definition per name.
+ They are reported after the symbol table unless a symbol table entry
+ already has their address. Shared cache locals come last, all of them:
+ they are where a cache image's file statics went.
+ */
+
+struct sr_definitions {
+    struct sr_table table;
+    uint32_t *nlists;
+};
+
+SR_INLINE bool
+sr_definition_nlist(symrez_t symrez, nlist64_t nl) {
+    if (nl->n_type & N_STAB) {
+        return false;
+    }
+
+    uint8_t type = nl->n_type & N_TYPE;
+    return (type == N_SECT || type == N_ABS) && nl->n_un.n_strx && nl->n_un.n_strx < symrez->strsize;
+}
+
+void sr_definitions_destroy(symrez_t symrez, struct sr_definitions *defs) {
+    sr_table_free(symrez, &defs->table);
+    sr_dealloc(symrez, defs->nlists);
+    sr_dealloc(symrez, defs);
+}
+
+void sr_definitions_free(symrez_t symrez) {
+    sr_planner_sync(symrez);
+    if (symrez->definitions) {
+        sr_definitions_destroy(symrez, symrez->definitions);
+        symrez->definitions = NULL;
+    }
+}
+
+// Only reads the symbol table, so the lookup planner can build it on another thread
+struct sr_definitions *sr_definitions_create(symrez_t symrez) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < symrez->nsyms; ++i) {
+        count += sr_definition_nlist(symrez, &symrez->symtab[i]);
+    }
+
+    struct sr_definitions *defs = sr_calloc(symrez, sizeof(struct sr_definitions));
+    if (unlikely(!defs)) {
+        return NULL;
+    }
+
+    defs->nlists = sr_alloc(symrez, (count ? count : 1) * sizeof(uint32_t));
+    if (unlikely(!defs->nlists || !sr_table_reserve(symrez, &defs->table, count ? count : 1))) {
+        sr_definitions_destroy(symrez, defs);
+        return NULL;
+    }
+
+    const char *strtab = symrez->strtab;
+    for (uint32_t i = symrez->nsyms; i-- > 0;) {
+        nlist64_t nl = &symrez->symtab[i];
+        if (!sr_definition_nlist(symrez, nl)) continue;
+
+        uint32_t idx = sr_table_insert(symrez, &defs->table, sr_hash_symbol(strtab + nl->n_un.n_strx, NULL));
+        defs->nlists[idx] = i;
+    }
+
+    return defs;
+}
+
+struct sr_definitions *sr_definitions_get(symrez_t symrez) {
+    sr_planner_sync(symrez);
+    if (!symrez->definitions) {
+        symrez->definitions = sr_definitions_create(symrez);
+    }
+
+    return symrez->definitions;
+}
+
+SR_INLINE uint64_t
+sr_definition_nlist_address(symrez_t symrez, nlist64_t nl) {
+    return (nl->n_type & N_TYPE) == N_ABS ? nl->n_value : nl->n_value + symrez->slide;
+}
+
+// First chain entry from `i` on that defines `symbol`. Iterate with `i = sr_definitions_match(..., next[i])`
+SR_INLINE uint32_t
+sr_definitions_match(symrez_t symrez, const struct sr_definitions *defs, const char *symbol, uint32_t hash, uint32_t i) {
+    const char *strtab = symrez->strtab;
+    for (i = sr_table_next(&defs->table, i, hash); i != SR_TABLE_NONE; i = sr_table_next(&defs->table, defs->table.next[i], hash)) {
+        if (!strcmp(strtab + symrez->symtab[defs->nlists[i]].n_un.n_strx, symbol)) {
+            break;
+        }
+    }
+
+    return i;
+}
+
+SR_INLINE uint32_t
+sr_definitions_first(symrez_t symrez, const struct sr_definitions *defs, const char *symbol, uint32_t hash) {
+    return sr_definitions_match(symrez, defs, symbol, hash, sr_table_first(&defs->table, hash));
+}
+
+// Same entry as a scan of the symbol table: the first definition with a value
+nlist64_t sr_definitions_find_nlist(symrez_t symrez, const char *symbol) {
+    const struct sr_definitions *defs = symrez->definitions;
+    uint32_t hash = sr_hash_symbol(symbol, NULL);
+    for (uint32_t i = sr_definitions_first(symrez, defs, symbol, hash); i != SR_TABLE_NONE; i = sr_definitions_match(symrez, defs, symbol, hash, defs->table.next[i])) {
+        nlist64_t nl = &symrez->symtab[defs->nlists[i]];
+        if (likely(nl->n_value > 0)) {
+            return nl;
+        }
+    }
+
+    return NULL;
+}
+
+static bool
+sr_definitions_has_address(symrez_t symrez, const struct sr_definitions *defs, const char *symbol, uint32_t hash, uint64_t addr) {
+    if (!defs) {
+        return false;
+    }
+
+    for (uint32_t i = sr_definitions_first(symrez, defs, symbol, hash); i != SR_TABLE_NONE; i = sr_definitions_match(symrez, defs, symbol, hash, defs->table.next[i])) {
+        if (sr_definition_nlist_address(symrez, &symrez->symtab[defs->nlists[i]]) == addr) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void
+sr_definition_fill(symrez_t symrez, sr_definition_t *def, uint64_t addr, uint8_t n_type, uint32_t n_sect, uint32_t tier, uint32_t flags) {
+    memset(def, 0, sizeof(*def));
+    def->n_type = n_type;
+    def->n_sect = (uint8_t)n_sect;
+    def->tier = tier;
+    def->flags = flags;
+
+    // Re-exports come back from their own image already signed
+    bool sign = !(flags & (SR_ENTRY_ABSOLUTE | SR_ENTRY_REEXPORT));
+    def->addr = sign ? sr_sign_symbol(symrez, (sr_ptr_t)addr) : (sr_ptr_t)addr;
+
+    section_t sec = n_sect && n_sect < symrez->nordinals ? symrez->ordinals[n_sect] : NULL;
+    if (sec) {
+        memcpy(def->segname, sec->segname, sizeof(sec->segname));
+        memcpy(def->sectname, sec->sectname, sizeof(sec->sectname));
+    }
+}
+
+SR_INLINE uint32_t
+sr_definition_ordinal(symrez_t symrez, uint64_t addr) {
+    const struct sr_section_range *r = sr_sections_lookup(symrez, (sr_ptr_t)addr);
+    return r && r->section ? r->ordinal : NO_SECT;
+}
+
+size_t sr_resolve_all(symrez_t symrez, const char *symbol, sr_definition_t *out, size_t cap) {
+    size_t found = 0;
+    uint32_t hash = sr_hash_symbol(symbol, NULL);
+    struct sr_definitions *defs = NULL;
+
+    if (likely(sr_bloom_check_symrez(symrez, symbol) != SR_BLOOM_ABSENT)) {
+        defs = sr_definitions_get(symrez);
+        if (likely(defs)) {
+            for (uint32_t i = sr_definitions_first(symrez, defs, symbol, hash); i != SR_TABLE_NONE; i = sr_definitions_match(symrez, defs, symbol, hash, defs->table.next[i])) {
+                nlist64_t nl = &symrez->symtab[defs->nlists[i]];
+                if (found < cap) {
+                    sr_definition_fill(symrez, &out[found], sr_definition_nlist_address(symrez, nl), nl->n_type, nl->n_sect, SR_TIER_SYMTAB, sr_entry_flags_for_nlist(nl));
+                }
+                ++found;
+            }
+        }
+
+        const uint8_t *terminal = sr_find_export(symrez, symbol);
+        if (terminal) {
+            uint32_t flags = sr_entry_flags_for_export(terminal);
+            uint64_t addr = (uint64_t)sr_export_address(symrez, terminal, symbol);
+            // Thread locals have no address; unresolvable re-exports neither
+            if (addr && !sr_definitions_has_address(symrez, defs, symbol, hash, addr)) {
+                uint8_t type = flags & SR_ENTRY_REEXPORT ? N_INDR : flags & SR_ENTRY_ABSOLUTE ? N_ABS : N_SECT;
+                uint32_t n_sect = type == N_SECT ? sr_definition_ordinal(symrez, addr) : NO_SECT;
+                uint8_t n_type = N_EXT | type;
+                if (found < cap) {
+                    sr_definition_fill(symrez, &out[found], addr, n_type, n_sect, SR_TIER_EXPORT, flags);
+                }
+                ++found;
+            }
+        }
+    }
+
+    uint64_t objc = (uint64_t)sr_objc_resolve_symbol(symrez, symbol);
+    if (objc && !sr_definitions_has_address(symrez, defs, symbol, hash, objc)) {
+        if (found < cap) {
+            sr_definition_fill(symrez, &out[found], objc, N_SECT, sr_definition_ordinal(symrez, objc), SR_TIER_OBJC, 0);
+        }
+        ++found;
+    }
+
+    uint32_t cursor = 0;
+    for (nlist64_t local; (local = sr_locals_next_nlist(symrez, symbol, &cursor));) {
+        if (found < cap) {
+            sr_definition_fill(symrez, &out[found], sr_definition_nlist_address(symrez, local), local->n_type, local->n_sect, SR_TIER_CACHE_LOCALS, sr_entry_flags_for_nlist(local));
+        }
+        ++found;
+    }
+
+    return found;
+}
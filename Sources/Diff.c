@@ -0,0 +1,324 @@
+//
+//  Diff.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ Both images are flattened into a view of (name, offset, section, flags)
+ items, the same symbols `sr_for_each` visits, sorted by name and offset.
+ One linear merge of the two views then yields every difference. Offsets
+ are from the start of __TEXT, so they don't depend on either slide.
+
+ Symbol table names point into the image. Export trie names are built in a
+ buffer while walking, so they are copied to an arena owned by the view;
+ until the walk is done their items hold an arena offset instead.
+ */
+
+#define SR_DIFF_NAME_MAX 0x2000
+
+struct sr_diff_item {
+    const char *name;
+    uint64_t offset;
+    const char * _Nullable segname;
+    const char * _Nullable sectname;
+    uint32_t flags;
+};
+
+struct sr_diff_view {
+    symrez_t symrez;
+    struct sr_diff_item *items;
+    uint32_t count;
+    uint32_t cap;
+    char *names;
+    size_t names_used;
+    size_t names_cap;
+};
+
+static struct sr_diff_item *
+sr_diff_append(struct sr_diff_view *view) {
+    if (unlikely(view->count == view->cap)) {
+        uint32_t cap = view->cap ? view->cap * 2 : 0x400;
+        struct sr_diff_item *items = sr_realloc(view->symrez, view->items, view->cap * sizeof(struct sr_diff_item), cap * sizeof(struct sr_diff_item));
+        if (unlikely(!items)) {
+            return NULL;
+        }
+
+        view->items = items;
+        view->cap = cap;
+    }
+
+    return &view->items[view->count++];
+}
+
+static bool
+sr_diff_copy_name(struct sr_diff_view *view, const char *name, size_t len, size_t *offset) {
+    if (unlikely(view->names_cap - view->names_used < len + 1)) {
+        size_t cap = view->names_cap ? view->names_cap * 2 : 0x10000;
+        while (cap - view->names_used < len + 1) cap *= 2;
+
+        char *names = sr_realloc(view->symrez, view->names, view->names_cap, cap);
+        if (unlikely(!names)) {
+            return false;
+        }
+
+        view->names = names;
+        view->names_cap = cap;
+    }
+
+    *offset = view->names_used;
+    memcpy(&view->names[view->names_used], name, len + 1);
+    view->names_used += len + 1;
+    return true;
+}
+
+SR_INLINE void
+sr_diff_set_section(struct sr_diff_item *item, section_t _Nullable sec) {
+    item->segname = sec ? sec->segname : NULL;
+    item->sectname = sec ? sec->sectname : NULL;
+}
+
+static bool
+sr_diff_collect_symtab(struct sr_diff_view *view) {
+    symrez_t symrez = view->symrez;
+    uint64_t base = symrez->image.text->vmaddr;
+
+    nlist64_t end = &symrez->symtab[symrez->nsyms];
+    for (nlist64_t nl = symrez->symtab; nl < end; ++nl) {
+        if (nl->n_un.n_strx == 0) continue;
+        if ((nl->n_type & N_STAB) || nl->n_sect == 0 || ((nl->n_type & N_EXT) && symrez->exports)) {
+            continue;
+        }
+
+        struct sr_diff_item *item = sr_diff_append(view);
+        if (unlikely(!item)) {
+            return false;
+        }
+
+        item->name = (const char *)symrez->strtab + nl->n_un.n_strx;
+        item->flags = sr_entry_flags_for_nlist(nl);
+        item->offset = (item->flags & SR_ENTRY_ABSOLUTE) ? nl->n_value : nl->n_value - base;
+        sr_diff_set_section(item, nl->n_sect < symrez->nordinals ? symrez->ordinals[nl->n_sect] : NULL);
+    }
+
+    return true;
+}
+
+static bool
+sr_diff_add_export(struct sr_diff_view *view, const uint8_t *terminal, const char *sym, size_t len) {
+    symrez_t symrez = view->symrez;
+    struct sr_diff_item *item = sr_diff_append(view);
+    size_t name = 0;
+    if (unlikely(!item || !sr_diff_copy_name(view, sym, len, &name))) {
+        return false;
+    }
+
+    item->name = (const char *)(uintptr_t)name;
+    item->flags = sr_entry_flags_for_export(terminal);
+    item->offset = 0;
+    item->segname = NULL;
+    item->sectname = NULL;
+
+    // Re-exports have no address in this image
+    if (item->flags & SR_ENTRY_REEXPORT) {
+        return true;
+    }
+
+    const uint8_t *p = terminal;
+    read_uleb128((void **)&p);
+    item->offset = read_uleb128((void **)&p);
+    if (item->flags & SR_ENTRY_ABSOLUTE) {
+        return true;
+    }
+
+    sr_ptr_t addr = (sr_ptr_t)(symrez->image.text->vmaddr + item->offset + symrez->slide);
+    const struct sr_section_range *r = sr_sections_lookup(symrez, addr);
+    if (likely(r)) {
+        item->segname = r->segment->segname;
+        item->sectname = r->section ? r->section->sectname : NULL;
+    }
+
+    return true;
+}
+
+static bool
+sr_diff_collect_node(struct sr_diff_view *view, const uint8_t *node, char *sym, size_t len) {
+    symrez_t symrez = view->symrez;
+    const uint8_t *p = node;
+    uintptr_t terminal_size = read_uleb128((void **)&p);
+
+    const uint8_t *children = p + terminal_size;
+    uint8_t child_count = *children++;
+
+    if (terminal_size != 0 && !sr_diff_add_export(view, p, sym, len)) {
+        return false;
+    }
+
+    p = children;
+    for (; child_count > 0; --child_count) {
+        size_t child_len = strlen((const char *)p);
+        if (unlikely(len + child_len >= SR_DIFF_NAME_MAX)) {
+            return false;
+        }
+
+        memcpy(&sym[len], p, child_len + 1);
+        p += child_len + 1;
+
+        uintptr_t offset = read_uleb128((void **)&p);
+        if (likely(offset != 0 && offset < symrez->exports_size)) {
+            const uint8_t *child = (const uint8_t *)symrez->exports + offset;
+            if (unlikely(!sr_diff_collect_node(view, child, sym, len + child_len))) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static int
+sr_diff_item_cmp(const void *a, const void *b) {
+    const struct sr_diff_item *ia = a;
+    const struct sr_diff_item *ib = b;
+    int cmp = strcmp(ia->name, ib->name);
+    if (cmp) {
+        return cmp;
+    }
+
+    if (ia->offset < ib->offset) return -1;
+    return ia->offset > ib->offset;
+}
+
+static void
+sr_diff_view_free(struct sr_diff_view *view) {
+    sr_dealloc(view->symrez, view->items);
+    sr_dealloc(view->symrez, view->names);
+}
+
+static bool
+sr_diff_view_build(struct sr_diff_view *view, symrez_t symrez) {
+    memset(view, 0, sizeof(*view));
+    view->symrez = symrez;
+
+    if (unlikely(!sr_diff_collect_symtab(view))) {
+        return false;
+    }
+
+    if (symrez->exports_size) {
+        char sym[SR_DIFF_NAME_MAX] = { 0 };
+        if (unlikely(!sr_diff_collect_node(view, symrez->exports, sym, 0))) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < view->count; ++i) {
+        struct sr_diff_item *item = &view->items[i];
+        if (item->flags & SR_ENTRY_EXPORT) {
+            item->name = view->names + (uintptr_t)item->name;
+        }
+    }
+
+    qsort(view->items, view->count, sizeof(struct sr_diff_item), sr_diff_item_cmp);
+    return true;
+}
+
+SR_INLINE bool
+sr_diff_name_eq(const char * _Nullable a, const char * _Nullable b, size_t size) {
+    if (!a || !b) {
+        return a == b;
+    }
+
+    return !strncmp(a, b, size);
+}
+
+static void
+sr_diff_fill(sr_diff_symbol_t *out, const struct sr_diff_item * _Nullable item) {
+    memset(out, 0, sizeof(*out));
+    if (!item) {
+        return;
+    }
+
+    out->offset = item->offset;
+    out->flags = item->flags;
+    if (item->segname) {
+        memcpy(out->segname, item->segname, 16);
+    }
+    if (item->sectname) {
+        memcpy(out->sectname, item->sectname, 16);
+    }
+}
+
+SR_INLINE uint32_t
+sr_diff_changes(const struct sr_diff_item *a, const struct sr_diff_item *b) {
+    uint32_t change = 0;
+    if (a->offset != b->offset) {
+        change |= SR_DIFF_OFFSET;
+    }
+    if (!sr_diff_name_eq(a->segname, b->segname, 16) || !sr_diff_name_eq(a->sectname, b->sectname, 16)) {
+        change |= SR_DIFF_SECTION;
+    }
+    if (a->flags != b->flags) {
+        change |= SR_DIFF_KIND;
+    }
+
+    return change;
+}
+
+const uint8_t *sr_get_uuid(symrez_t symrez) {
+    return symrez->image.uuid;
+}
+
+bool sr_diff(symrez_t a, symrez_t b, void *context, sr_diff_function_t callback) {
+    const uint8_t *uuid_a = a->image.uuid;
+    const uint8_t *uuid_b = b->image.uuid;
+    if (uuid_a && uuid_b && !memcmp(uuid_a, uuid_b, 16)) {
+        return true;
+    }
+
+    struct sr_diff_view va, vb;
+    bool ok = sr_diff_view_build(&va, a);
+    ok = sr_diff_view_build(&vb, b) && ok;
+    if (unlikely(!ok)) {
+        sr_diff_view_free(&va);
+        sr_diff_view_free(&vb);
+        return false;
+    }
+
+    sr_diff_entry_t entry;
+    uint32_t i = 0, j = 0;
+    while (i < va.count || j < vb.count) {
+        const struct sr_diff_item *ia = i < va.count ? &va.items[i] : NULL;
+        const struct sr_diff_item *ib = j < vb.count ? &vb.items[j] : NULL;
+        int cmp = !ia ? 1 : !ib ? -1 : strcmp(ia->name, ib->name);
+
+        if (cmp < 0) {
+            ib = NULL;
+            entry.change = SR_DIFF_REMOVED;
+            ++i;
+        } else if (cmp > 0) {
+            ia = NULL;
+            entry.change = SR_DIFF_ADDED;
+            ++j;
+        } else {
+            entry.change = sr_diff_changes(ia, ib);
+            ++i;
+            ++j;
+            if (!entry.change) continue;
+        }
+
+        entry.name = ia ? ia->name : ib->name;
+        sr_diff_fill(&entry.a, ia);
+        sr_diff_fill(&entry.b, ib);
+        if (unlikely(callback(&entry, context))) {
+            break;
+        }
+    }
+
+    sr_diff_view_free(&va);
+    sr_diff_view_free(&vb);
+    return true;
+}
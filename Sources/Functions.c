@@ -0,0 +1,240 @@
+//
+//  Functions.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ LC_FUNCTION_STARTS is a zero terminated stream of ULEB128 deltas. The first
+ delta is relative to the start of __TEXT, every following one to the
+ previous function. Nearly all functions are < 128 bytes apart, so the stream
+ is mostly single byte deltas. Check 16 bytes at a time for "no continuation
+ bits and no terminator" and, when that holds, accumulate them without any
+ ULEB bookkeeping.
+ */
+SR_INLINE bool
+sr_fstarts_block_is_simple(const uint8_t *p) {
+#if defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    int high = _mm_movemask_epi8(v);
+    int zero = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    return (high | zero) == 0;
+#elif defined(__ARM_NEON)
+    uint8x16_t v = vld1q_u8(p);
+    return vmaxvq_u8(v) < 0x80 && vminvq_u8(v) != 0;
+#else
+    uint64_t lo, hi;
+    memcpy(&lo, p, sizeof(lo));
+    memcpy(&hi, p + 8, sizeof(hi));
+    uint64_t cont = (lo | hi) & 0x8080808080808080ULL;
+    uint64_t zlo = (lo - 0x0101010101010101ULL) & ~lo & 0x8080808080808080ULL;
+    uint64_t zhi = (hi - 0x0101010101010101ULL) & ~hi & 0x8080808080808080ULL;
+    return (cont | zlo | zhi) == 0;
+#endif
+}
+
+SR_STATIC uint32_t
+sr_decode_function_starts(const uint8_t *p, const uint8_t *end, uint64_t addr, uint64_t *out) {
+    uint64_t *o = out;
+
+    while (p < end) {
+        if (likely((end - p) >= 16 && sr_fstarts_block_is_simple(p))) {
+            for (int i = 0; i < 16; ++i) {
+                addr += p[i];
+                *o++ = addr;
+            }
+            p += 16;
+            continue;
+        }
+
+        uint64_t delta = 0;
+        int bit = 0;
+        do {
+            delta |= (uint64_t)(*p & 0x7f) << bit;
+            bit += 7;
+        } while ((*p++ & 0x80) && p < end);
+
+        if (unlikely(delta == 0)) {
+            break;
+        }
+
+        addr += delta;
+        *o++ = addr;
+    }
+
+    return (uint32_t)(o - out);
+}
+
+static int
+sr_function_cmp(const void *a, const void *b) {
+    const struct sr_function *fa = a;
+    const struct sr_function *fb = b;
+    if (fa->start != fb->start) {
+        return fa->start < fb->start ? -1 : 1;
+    }
+
+    // Named entries sort first so dedupe keeps them
+    return (fa->strx == 0) - (fb->strx == 0);
+}
+
+SR_STATIC bool
+sr_functions_build(symrez_t symrez) {
+    segment_command_t text = symrez->image.text;
+    const uint8_t *fstarts = NULL;
+    uint32_t fstarts_size = 0;
+    const struct linkedit_data_command *fcmd = symrez->image.function_starts;
+    if (likely(fcmd)) {
+        fstarts = sr_linkedit_ptr(symrez, fcmd->dataoff);
+        fstarts_size = fcmd->datasize;
+    }
+
+    // Every ULEB is at least one byte
+    uint64_t capacity = (uint64_t)fstarts_size + symrez->nsyms;
+    struct sr_function *functions = sr_alloc(symrez, capacity * sizeof(struct sr_function));
+    uint64_t *starts = sr_alloc(symrez, ((uint64_t)fstarts_size + 1) * sizeof(uint64_t));
+    if (unlikely(!functions || !starts)) {
+        sr_dealloc(symrez, functions);
+        sr_dealloc(symrez, starts);
+        return false;
+    }
+
+    uint32_t count = 0;
+    uint32_t nstarts = 0;
+    if (fstarts) {
+        nstarts = sr_decode_function_starts(fstarts, fstarts + fstarts_size, text->vmaddr, starts);
+    }
+
+    for (uint32_t i = 0; i < nstarts; ++i) {
+        functions[count].start = starts[i];
+        functions[count].strx = 0;
+        ++count;
+    }
+    sr_dealloc(symrez, starts);
+
+    nlist64_t end = &symrez->symtab[symrez->nsyms];
+    for (nlist64_t nl = symrez->symtab; nl < end; ++nl) {
+        if ((nl->n_type & N_STAB) || (nl->n_type & N_TYPE) != N_SECT) continue;
+        if (nl->n_sect >= symrez->nordinals || nl->n_un.n_strx == 0) continue;
+        if (!sr_section_is_code(symrez->ordinals[nl->n_sect])) continue;
+
+        functions[count].start = nl->n_value;
+        functions[count].strx = nl->n_un.n_strx;
+        ++count;
+    }
+
+    qsort(functions, count, sizeof(struct sr_function), sr_function_cmp);
+
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (unique && functions[unique - 1].start == functions[i].start) continue;
+        functions[unique++] = functions[i];
+    }
+
+    // Only worth shrinking in place
+    if (likely(!symrez->allocator.alloc)) {
+        struct sr_function *shrunk = realloc(functions, (unique ? unique : 1) * sizeof(struct sr_function));
+        functions = shrunk ? shrunk : functions;
+    }
+
+    symrez->functions = functions;
+    symrez->nfunctions = unique;
+    return true;
+}
+
+SR_INLINE const struct sr_function *
+sr_functions_lookup(symrez_t symrez, uint64_t addr) {
+    if (unlikely(!symrez->functions && !sr_functions_build(symrez))) {
+        return NULL;
+    }
+
+    const struct sr_function *base = symrez->functions;
+    uint32_t n = symrez->nfunctions;
+    if (unlikely(!n || addr < base->start)) {
+        return NULL;
+    }
+
+    while (n > 1) {
+        uint32_t half = n / 2;
+        if (base[half].start <= addr) {
+            base += half;
+            n -= half;
+        } else {
+            n = half;
+        }
+    }
+
+    return base;
+}
+
+// A function ends at the next boundary or at the end of its section
+SR_INLINE uint64_t
+sr_function_end(symrez_t symrez, const struct sr_function *fn) {
+    uint64_t end = UINT64_MAX;
+    if (fn + 1 < &symrez->functions[symrez->nfunctions]) {
+        end = fn[1].start;
+    }
+
+    const struct sr_section_range *r = sr_sections_lookup(symrez, (sr_ptr_t)(fn->start + symrez->slide));
+    if (likely(r) && r->end < end) {
+        end = r->end;
+    }
+
+    return end == UINT64_MAX ? fn->start : end;
+}
+
+bool sr_function_extent(symrez_t symrez, sr_ptr_t addr, sr_ptr_t *start, size_t *size) {
+    uint64_t a = (uint64_t)sr_strip_ptr(addr) - symrez->slide;
+    const struct sr_function *fn = sr_functions_lookup(symrez, a);
+    if (unlikely(!fn)) {
+        return false;
+    }
+
+    uint64_t end = sr_function_end(symrez, fn);
+    if (unlikely(a >= end)) {
+        return false;
+    }
+
+    if (start) {
+        *start = sr_sign_symbol(symrez, (sr_ptr_t)(fn->start + symrez->slide));
+    }
+
+    if (size) {
+        *size = (size_t)(end - fn->start);
+    }
+
+    return true;
+}
+
+void sr_for_each_function(symrez_t symrez, void *context, symrez_function_t work) {
+    if (unlikely(!symrez->functions && !sr_functions_build(symrez))) {
+        return;
+    }
+
+    strtab_t strtab = symrez->strtab;
+    intptr_t slide = symrez->slide;
+    char name[sizeof("func_") + 16];
+
+    const struct sr_function *end = &symrez->functions[symrez->nfunctions];
+    for (const struct sr_function *fn = symrez->functions; fn < end; ++fn) {
+        char *str = name;
+        if (likely(fn->strx)) {
+            str = (char *)strtab + fn->strx;
+        } else {
+            snprintf(name, sizeof(name), "func_%llx", (unsigned long long)fn->start);
+        }
+
+        if (unlikely(work(str, (sr_ptr_t)(fn->start + slide), context))) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,369 @@
+//
+//  Global.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+#include <pthread.h>
+
+#define SR_GLOBAL_NONE UINT32_MAX
+#define SR_GLOBAL_ARENA_SIZE 0x10000
+#define SR_GLOBAL_MIN_BUCKETS 0x10000
+
+/*
+ The merged index is a chained hash table over every definition in every
+ image dyld has told us about. Images are kept in the order dyld reports them
+ (`infoArray` order), which is also their lookup precedence.
+
+ Images are only parsed when a lookup needs them: `_g_index.indexed` is the
+ length of the prefix of `images` that has been indexed. A hit in image N is
+ only returned once every image before N has been indexed, so the result is
+ always the highest precedence definition. A miss indexes everything.
+ */
+
+typedef struct sr_global_arena {
+    struct sr_global_arena *next;
+    size_t used;
+    char data[];
+} *sr_global_arena_t;
+
+struct sr_global_image {
+    mach_header_t header;
+    sr_global_arena_t names;
+    uint32_t first;
+    uint32_t count;
+};
+
+struct sr_global_entry {
+    const char *name;
+    sr_ptr_t addr;
+    uint32_t hash;
+    uint32_t image;
+    uint32_t next;
+    bool code;  // signed as a function pointer
+};
+
+static struct {
+    sr_lock_t lock;
+    struct sr_global_image *images;
+    uint32_t nimages;
+    uint32_t images_cap;
+    uint32_t indexed;
+    struct sr_global_entry *entries;
+    uint32_t nentries;
+    uint32_t entries_cap;
+    uint32_t ndead;
+    uint32_t *buckets;
+    uint32_t nbuckets;
+} _g_index = { .lock = SR_LOCK_INIT };
+
+static pthread_once_t _g_index_once = PTHREAD_ONCE_INIT;
+
+struct sr_global_walk {
+    symrez_t symrez;
+    uint32_t image;
+    struct sr_global_image *img;
+    const char *strtab;
+    uint32_t strsize;
+};
+
+static const char *
+sr_global_copy_name(struct sr_global_image *img, const char *name) {
+    size_t len = strlen(name) + 1;
+    sr_global_arena_t arena = img->names;
+
+    if (unlikely(!arena || (arena->used + len) > SR_GLOBAL_ARENA_SIZE)) {
+        size_t size = len > SR_GLOBAL_ARENA_SIZE ? len : SR_GLOBAL_ARENA_SIZE;
+        sr_global_arena_t next = malloc(sizeof(struct sr_global_arena) + size);
+        if (unlikely(!next)) {
+            return NULL;
+        }
+
+        next->next = arena;
+        next->used = 0;
+        img->names = arena = next;
+    }
+
+    char *ret = &arena->data[arena->used];
+    memcpy(ret, name, len);
+    arena->used += len;
+    return ret;
+}
+
+static void
+sr_global_rechain(void) {
+    uint32_t mask = _g_index.nbuckets - 1;
+    memset(_g_index.buckets, 0xFF, _g_index.nbuckets * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < _g_index.nentries; ++i) {
+        struct sr_global_entry *e = &_g_index.entries[i];
+        if (unlikely(!e->name)) continue;
+
+        uint32_t bucket = e->hash & mask;
+        e->next = _g_index.buckets[bucket];
+        _g_index.buckets[bucket] = i;
+    }
+}
+
+static bool
+sr_global_reserve(void) {
+    if (unlikely(_g_index.nentries == _g_index.entries_cap)) {
+        uint32_t cap = _g_index.entries_cap ? _g_index.entries_cap * 2 : SR_GLOBAL_MIN_BUCKETS;
+        struct sr_global_entry *entries = realloc(_g_index.entries, cap * sizeof(struct sr_global_entry));
+        if (unlikely(!entries)) {
+            return false;
+        }
+
+        _g_index.entries = entries;
+        _g_index.entries_cap = cap;
+    }
+
+    if (unlikely(_g_index.nentries >= _g_index.nbuckets)) {
+        uint32_t count = _g_index.nbuckets ? _g_index.nbuckets * 2 : SR_GLOBAL_MIN_BUCKETS;
+        uint32_t *buckets = realloc(_g_index.buckets, count * sizeof(uint32_t));
+        if (unlikely(!buckets)) {
+            return false;
+        }
+
+        _g_index.buckets = buckets;
+        _g_index.nbuckets = count;
+        sr_global_rechain();
+    }
+
+    return true;
+}
+
+static bool
+sr_global_add_symbol(sr_symbol_t symbol, sr_ptr_t ptr, void *context) {
+    struct sr_global_walk *walk = context;
+    if (unlikely(!ptr || !*symbol)) {
+        return false;
+    }
+
+    // nlist names live in the image's string table for as long as the image
+    // is loaded. Export trie names are built on the stack and must be copied.
+    const char *name = symbol;
+    if (unlikely(((uintptr_t)name - (uintptr_t)walk->strtab) >= walk->strsize)) {
+        if (unlikely(!(name = sr_global_copy_name(walk->img, symbol)))) {
+            return true;
+        }
+    }
+
+    if (unlikely(!sr_global_reserve())) {
+        return true;
+    }
+
+    uint32_t idx = _g_index.nentries++;
+    struct sr_global_entry *e = &_g_index.entries[idx];
+    uint32_t bucket;
+
+    e->name = name;
+    e->addr = ptr;
+    e->hash = sr_hash_symbol(name, NULL);
+    e->image = walk->image;
+    e->code = false;
+#if __has_feature(ptrauth_calls)
+    // Decided now, while the image's sections are at hand
+    e->code = sr_symbol_is_code(walk->symrez, ptr);
+#endif
+
+    bucket = e->hash & (_g_index.nbuckets - 1);
+    e->next = _g_index.buckets[bucket];
+    _g_index.buckets[bucket] = idx;
+
+    return false;
+}
+
+static void
+sr_global_index_image(uint32_t image) {
+    struct sr_global_image *img = &_g_index.images[image];
+    img->first = _g_index.nentries;
+    img->count = 0;
+
+    if (unlikely(!img->header)) {
+        return;
+    }
+
+    struct symrez sr;
+    if (unlikely(!symrez_init_mh(&sr, img->header))) {
+        return;
+    }
+
+    struct sr_global_walk walk = {
+        .symrez = &sr,
+        .image = image,
+        .img = img,
+        .strtab = sr.strtab,
+        .strsize = sr.strsize,
+    };
+
+    // Re-exports are indexed under the image that actually defines them
+    sr_filter_t filter = { .mask = SR_FILTER_ALL & ~SR_FILTER_REEXPORTS };
+    _sr_for_each(&sr, &filter, &walk, sr_global_add_symbol);
+    symrez_destroy(&sr);
+    img->count = _g_index.nentries - img->first;
+}
+
+static const struct sr_global_entry *
+sr_global_find(const char *symbol, uint32_t hash) {
+    if (unlikely(!_g_index.nbuckets)) {
+        return NULL;
+    }
+
+    const struct sr_global_entry *best = NULL;
+    uint32_t idx = _g_index.buckets[hash & (_g_index.nbuckets - 1)];
+    while (idx != SR_GLOBAL_NONE) {
+        const struct sr_global_entry *e = &_g_index.entries[idx];
+        if (e->hash == hash && (!best || e->image < best->image) && !strcmp(e->name, symbol)) {
+            best = e;
+        }
+
+        idx = e->next;
+    }
+
+    return best;
+}
+
+#if defined(__APPLE__)
+static void
+sr_global_free_names(struct sr_global_image *img) {
+    sr_global_arena_t arena = img->names;
+    while (arena) {
+        sr_global_arena_t next = arena->next;
+        free(arena);
+        arena = next;
+    }
+
+    img->names = NULL;
+}
+
+static void
+sr_global_compact(void) {
+    uint32_t live = 0;
+    for (uint32_t i = 0; i < _g_index.nimages; ++i) {
+        struct sr_global_image *img = &_g_index.images[i];
+        uint32_t first = live;
+        for (uint32_t j = img->first; j < img->first + img->count; ++j) {
+            _g_index.entries[live++] = _g_index.entries[j];
+        }
+
+        img->first = first;
+    }
+
+    _g_index.nentries = live;
+    _g_index.ndead = 0;
+    sr_global_rechain();
+}
+
+static void
+sr_global_image_added(const struct mach_header *mh, intptr_t vmaddr_slide) {
+    sr_lock(&_g_index.lock);
+
+    if (unlikely(_g_index.nimages == _g_index.images_cap)) {
+        uint32_t cap = _g_index.images_cap ? _g_index.images_cap * 2 : 0x400;
+        struct sr_global_image *images = realloc(_g_index.images, cap * sizeof(struct sr_global_image));
+        if (unlikely(!images)) {
+            sr_unlock(&_g_index.lock);
+            return;
+        }
+
+        _g_index.images = images;
+        _g_index.images_cap = cap;
+    }
+
+    struct sr_global_image *img = &_g_index.images[_g_index.nimages++];
+    img->header = (mach_header_t)mh;
+    img->names = NULL;
+    img->first = _g_index.nentries;
+    img->count = 0;
+
+    sr_unlock(&_g_index.lock);
+}
+
+static void
+sr_global_image_removed(const struct mach_header *mh, intptr_t vmaddr_slide) {
+    sr_lock(&_g_index.lock);
+
+    for (uint32_t i = 0; i < _g_index.nimages; ++i) {
+        struct sr_global_image *img = &_g_index.images[i];
+        if (img->header != (mach_header_t)mh) continue;
+
+        uint32_t mask = _g_index.nbuckets - 1;
+        for (uint32_t j = img->first; j < img->first + img->count; ++j) {
+            struct sr_global_entry *e = &_g_index.entries[j];
+            uint32_t *link = &_g_index.buckets[e->hash & mask];
+            while (*link != j) {
+                link = &_g_index.entries[*link].next;
+            }
+
+            *link = e->next;
+            e->name = NULL;
+        }
+
+        _g_index.ndead += img->count;
+        img->header = NULL;
+        img->count = 0;
+        sr_global_free_names(img);
+        break;
+    }
+
+    if (unlikely(_g_index.ndead > (_g_index.nentries / 2))) {
+        sr_global_compact();
+    }
+
+    sr_unlock(&_g_index.lock);
+}
+
+static void
+sr_global_register(void) {
+    // dyld calls back synchronously for every image already loaded, in load
+    // order, before returning. That seeds `images` in `infoArray` order.
+    _dyld_register_func_for_add_image(sr_global_image_added);
+    _dyld_register_func_for_remove_image(sr_global_image_removed);
+}
+#else
+// Without dyld there are no images to index
+static void
+sr_global_register(void) {
+}
+#endif
+
+sr_ptr_t symrez_resolve_global(const char *symbol, mach_header_t *image_out) {
+    pthread_once(&_g_index_once, sr_global_register);
+
+    uint32_t hash = sr_hash_symbol(symbol, NULL);
+    sr_ptr_t addr = NULL;
+    mach_header_t header = NULL;
+
+    sr_lock(&_g_index.lock);
+
+    const struct sr_global_entry *hit = sr_global_find(symbol, hash);
+    while (_g_index.indexed < (hit ? hit->image : _g_index.nimages)) {
+        uint32_t image = _g_index.indexed++;
+        sr_global_index_image(image);
+        if (_g_index.images[image].count) {
+            hit = sr_global_find(symbol, hash);
+        }
+    }
+
+    if (likely(hit)) {
+        addr = hit->addr;
+        header = _g_index.images[hit->image].header;
+#if __has_feature(ptrauth_calls)
+        if (hit->code) {
+            addr = ptrauth_sign_unauthenticated(addr, ptrauth_key_function_pointer, 0);
+        }
+#endif
+    }
+
+    sr_unlock(&_g_index.lock);
+
+    if (image_out) {
+        *image_out = header;
+    }
+
+    return addr;
+}
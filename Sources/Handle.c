@@ -0,0 +1,91 @@
+//
+//  Handle.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ A handle keeps where a symbol came from and its unslid value, so its
+ address under any slide is one add. Absolute symbols never move, and
+ invalid handles (no flags) always map to 0; both are folded into masks
+ so rebasing an array has no branches.
+ */
+
+SR_INLINE uint64_t
+sr_handle_rebased(const sr_symbol_handle_t *handle, uint64_t slide) {
+    uint64_t valid = 0 - (uint64_t)(handle->flags != 0);
+    uint64_t slid = 0 - (uint64_t)!(handle->flags & SR_ENTRY_ABSOLUTE);
+    return (handle->value + (slide & slid)) & valid;
+}
+
+static bool
+sr_handle_from_nlist(symrez_t symrez, nlist64_t nl, sr_symbol_handle_t *out) {
+    out->value = nl->n_value;
+    out->source = (uint32_t)(nl - symrez->symtab);
+    out->flags = sr_entry_flags_for_nlist(nl);
+    return true;
+}
+
+static bool
+sr_handle_from_export(symrez_t symrez, const uint8_t *terminal, sr_symbol_handle_t *out) {
+    uint32_t flags = sr_entry_flags_for_export(terminal);
+
+    // Re-exports and thread locals have no address in this image
+    if (flags & (SR_ENTRY_REEXPORT | SR_ENTRY_THREAD_LOCAL)) {
+        return false;
+    }
+
+    const uint8_t *p = terminal;
+    read_uleb128((void **)&p);
+    uint64_t value = read_uleb128((void **)&p);
+    if (!(flags & SR_ENTRY_ABSOLUTE)) {
+        value += symrez->image.text->vmaddr;
+    }
+
+    out->value = value;
+    out->source = (uint32_t)(terminal - (const uint8_t *)symrez->exports);
+    out->flags = flags;
+    return true;
+}
+
+bool sr_resolve_symbol_handle(symrez_t symrez, const char *symbol, sr_symbol_handle_t *out) {
+    memset(out, 0, sizeof(*out));
+
+    bool found = false;
+    if (likely(sr_bloom_check_symrez(symrez, symbol) != SR_BLOOM_ABSENT)) {
+        nlist64_t nl = sr_find_nlist(symrez, symbol);
+        if (nl) {
+            found = sr_handle_from_nlist(symrez, nl, out);
+        } else {
+            const uint8_t *terminal = sr_find_export(symrez, symbol);
+            found = terminal && sr_handle_from_export(symrez, terminal, out);
+        }
+    }
+
+    if (unlikely(!found)) {
+        memset(out, 0, sizeof(*out));
+        return false;
+    }
+
+    out->address = sr_handle_rebased(out, (uint64_t)symrez->slide);
+    return true;
+}
+
+sr_ptr_t sr_handle_address(symrez_t symrez, sr_symbol_handle_t handle) {
+    sr_ptr_t addr = (sr_ptr_t)sr_handle_rebased(&handle, (uint64_t)symrez->slide);
+    if (handle.flags & SR_ENTRY_ABSOLUTE) {
+        return addr;
+    }
+
+    return sr_sign_symbol(symrez, addr);
+}
+
+void sr_handles_rebase(sr_symbol_handle_t *handles, size_t count, intptr_t slide) {
+    for (size_t i = 0; i < count; ++i) {
+        handles[i].address = sr_handle_rebased(&handles[i], (uint64_t)slide);
+    }
+}
@@ -0,0 +1,108 @@
+//
+//  Image.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ Everything symrez needs from the load commands, gathered in one walk.
+ `segments` and `dylibs` share one allocation sized by `ncmds`, which bounds
+ both. Dylibs are kept in load command order, so a bind/re-export ordinal N
+ is `dylibs[N - 1]`.
+ */
+
+SR_INLINE bool
+sr_image_is_dylib_command(uint32_t cmd) {
+    switch (cmd) {
+        case LC_LOAD_DYLIB:
+        case LC_LOAD_WEAK_DYLIB:
+        case LC_REEXPORT_DYLIB:
+        case LC_LOAD_UPWARD_DYLIB:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool sr_image_decode(symrez_t symrez, mach_header_t mh) {
+    struct sr_image *image = &symrez->image;
+    memset(image, 0, sizeof(*image));
+
+    uint32_t ncmds = mh->ncmds;
+    void *storage = sr_alloc(symrez, ncmds * (sizeof(segment_command_t) + sizeof(struct sr_dylib)) + 1);
+    if (unlikely(!storage)) {
+        return false;
+    }
+
+    image->dylibs = storage;
+    image->segments = (segment_command_t *)&image->dylibs[ncmds];
+
+    mh_for_each_lc(mh, lc) {
+        switch (lc->cmd) {
+            case LC_SEGMENT_64: {
+                segment_command_t seg = (segment_command_t)lc;
+                image->segments[image->nsegments++] = seg;
+                image->nsects += seg->nsects;
+                if (!image->text && sr_strneq(seg->segname, SEG_TEXT, sizeof(seg->segname))) {
+                    image->text = seg;
+                } else if (!image->linkedit && sr_strneq(seg->segname, SEG_LINKEDIT, sizeof(seg->segname))) {
+                    image->linkedit = seg;
+                }
+                break;
+            }
+            case LC_SYMTAB:
+                image->symtab = (const void *)lc;
+                break;
+            case LC_DYSYMTAB:
+                image->dysymtab = (const void *)lc;
+                break;
+            case LC_DYLD_EXPORTS_TRIE:
+                image->exports_trie = (const void *)lc;
+                break;
+            case LC_DYLD_INFO:
+            case LC_DYLD_INFO_ONLY:
+                if (!image->dyld_info) {
+                    image->dyld_info = (const void *)lc;
+                }
+                break;
+            case LC_DYLD_CHAINED_FIXUPS:
+                image->chained_fixups = (const void *)lc;
+                break;
+            case LC_FUNCTION_STARTS:
+                image->function_starts = (const void *)lc;
+                break;
+            case LC_UUID:
+                image->uuid = ((const struct uuid_command *)lc)->uuid;
+                break;
+            default:
+                if (sr_image_is_dylib_command(lc->cmd)) {
+                    const struct dylib_command *dylib = (const void *)lc;
+                    // A name outside the command would be read from whatever follows it
+                    if (unlikely(lc->cmdsize < sizeof(struct dylib_command) || dylib->dylib.name.offset >= lc->cmdsize)) {
+                        break;
+                    }
+
+                    struct sr_dylib *d = &image->dylibs[image->ndylibs++];
+                    d->name = (const char *)lc + dylib->dylib.name.offset;
+                    d->cmd = lc->cmd;
+                }
+                break;
+        }
+    }
+
+    if (unlikely(!image->text)) {
+        sr_image_free(symrez);
+        return false;
+    }
+
+    return true;
+}
+
+void sr_image_free(symrez_t symrez) {
+    sr_dealloc(symrez, symrez->image.dylibs);
+    memset(&symrez->image, 0, sizeof(symrez->image));
+}
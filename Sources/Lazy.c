@@ -0,0 +1,286 @@
+//
+//  Lazy.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+#include <stdatomic.h>
+
+/*
+ Lazy functions work like dyld's lazy stubs. A fixed pool of trampolines
+ is assembled into __TEXT, so nothing is ever written to executable memory.
+ Trampoline i jumps through `sr_lazy_slots[i]`, which starts out pointing at
+ the second half of the same trampoline: it records i and enters the
+ binder. The binder saves the argument registers, resolves the symbol,
+ stores the target in the slot and jumps to it with the registers restored,
+ as if the caller had called the target directly. Later calls take the
+ first jump straight to the target.
+
+ Threads racing on a first call all resolve the same address and store it
+ with release semantics; loads of an aligned pointer can't tear, so a
+ trampoline always jumps either to the binder or to the target.
+
+ Trampolines are never freed. A request for a name that already has one
+ returns it.
+ */
+
+#define SR_LAZY_MAX 256
+
+struct sr_lazy_entry {
+    mach_header_t header;
+    char *name;
+    sr_ptr_t _Nullable handler;
+};
+
+static struct {
+    sr_lock_t lock;
+    uint32_t count;
+    struct sr_lazy_entry entries[SR_LAZY_MAX];
+} _g_lazy = {
+    .lock = SR_LOCK_INIT,
+};
+
+SR_HIDDEN _Atomic(uintptr_t) sr_lazy_slots[SR_LAZY_MAX];
+SR_HIDDEN extern const uint8_t sr_lazy_stubs[];
+SR_HIDDEN uintptr_t sr_lazy_bind(uintptr_t index);
+
+// Expands `m` with every index from 0x00 to 0xff
+#define SR_LAZY_X16(m, p) \
+    m(p##0) m(p##1) m(p##2) m(p##3) m(p##4) m(p##5) m(p##6) m(p##7) \
+    m(p##8) m(p##9) m(p##a) m(p##b) m(p##c) m(p##d) m(p##e) m(p##f)
+#define SR_LAZY_X256(m) \
+    SR_LAZY_X16(m, 0x0) SR_LAZY_X16(m, 0x1) SR_LAZY_X16(m, 0x2) SR_LAZY_X16(m, 0x3) \
+    SR_LAZY_X16(m, 0x4) SR_LAZY_X16(m, 0x5) SR_LAZY_X16(m, 0x6) SR_LAZY_X16(m, 0x7) \
+    SR_LAZY_X16(m, 0x8) SR_LAZY_X16(m, 0x9) SR_LAZY_X16(m, 0xa) SR_LAZY_X16(m, 0xb) \
+    SR_LAZY_X16(m, 0xc) SR_LAZY_X16(m, 0xd) SR_LAZY_X16(m, 0xe) SR_LAZY_X16(m, 0xf)
+
+// Mach-O and ELF spell symbols, local labels and hidden visibility differently
+#define SR_LAZY_STR(x) #x
+#define SR_LAZY_XSTR(x) SR_LAZY_STR(x)
+#define SR_LAZY_SYM(name) SR_LAZY_XSTR(__USER_LABEL_PREFIX__) #name
+
+#if defined(__APPLE__)
+#define SR_LAZY_LABEL(name) "L" #name
+#define SR_LAZY_TEXT "    .text\n"
+#define SR_LAZY_TEXT_END ""
+#define SR_LAZY_HIDDEN(sym) "    .private_extern " sym "\n"
+#define SR_LAZY_FUNCTION(sym) ""
+#define SR_LAZY_FUNCTION_END(sym) ""
+#elif defined(__ELF__)
+#define SR_LAZY_LABEL(name) ".L" #name
+#define SR_LAZY_TEXT "    .pushsection .text\n"
+#define SR_LAZY_TEXT_END "    .popsection\n"
+#define SR_LAZY_HIDDEN(sym) "    .hidden " sym "\n"
+#define SR_LAZY_FUNCTION(sym) "    .type " sym ", @function\n"
+#define SR_LAZY_FUNCTION_END(sym) "    .size " sym ", . - " sym "\n"
+#endif
+
+#if defined(__x86_64__) && defined(SR_LAZY_LABEL)
+
+// jmp *slot (6 bytes), then the binder entry: push index (2 or 5 bytes), jmp (at most 5 bytes)
+#define SR_LAZY_STUB_SIZE 16
+#define SR_LAZY_BIND_OFFSET 6
+
+#define SR_LAZY_STUB(i) \
+    "    jmpq *" SR_LAZY_SYM(sr_lazy_slots) " + 8 * " #i "(%rip)\n" \
+    "    pushq $" #i "\n" \
+    "    jmp " SR_LAZY_LABEL(sr_lazy_binder) "\n" \
+    "    .p2align 4, 0xcc\n"
+
+/*
+ Entered with the index on the stack above the caller's return address,
+ so the stack is 16 byte aligned. Integer and vector argument registers,
+ and %al for variadic callees, are preserved. Stack-passed arguments are
+ left where the caller put them.
+ */
+__asm__(
+    SR_LAZY_TEXT
+    "    .p2align 4\n"
+    SR_LAZY_HIDDEN(SR_LAZY_SYM(sr_lazy_stubs))
+    "    .globl " SR_LAZY_SYM(sr_lazy_stubs) "\n"
+    SR_LAZY_FUNCTION(SR_LAZY_SYM(sr_lazy_stubs))
+    SR_LAZY_SYM(sr_lazy_stubs) ":\n"
+    SR_LAZY_X256(SR_LAZY_STUB)
+    SR_LAZY_LABEL(sr_lazy_binder) ":\n"
+    "    pushq %rbp\n"
+    "    movq %rsp, %rbp\n"
+    "    subq $184, %rsp\n"
+    "    movaps %xmm0, 0(%rsp)\n"
+    "    movaps %xmm1, 16(%rsp)\n"
+    "    movaps %xmm2, 32(%rsp)\n"
+    "    movaps %xmm3, 48(%rsp)\n"
+    "    movaps %xmm4, 64(%rsp)\n"
+    "    movaps %xmm5, 80(%rsp)\n"
+    "    movaps %xmm6, 96(%rsp)\n"
+    "    movaps %xmm7, 112(%rsp)\n"
+    "    movq %rdi, 128(%rsp)\n"
+    "    movq %rsi, 136(%rsp)\n"
+    "    movq %rdx, 144(%rsp)\n"
+    "    movq %rcx, 152(%rsp)\n"
+    "    movq %r8, 160(%rsp)\n"
+    "    movq %r9, 168(%rsp)\n"
+    "    movq %rax, 176(%rsp)\n"
+    "    movq 8(%rbp), %rdi\n"
+    "    callq " SR_LAZY_SYM(sr_lazy_bind) "\n"
+    "    movq %rax, %r11\n"
+    "    movaps 0(%rsp), %xmm0\n"
+    "    movaps 16(%rsp), %xmm1\n"
+    "    movaps 32(%rsp), %xmm2\n"
+    "    movaps 48(%rsp), %xmm3\n"
+    "    movaps 64(%rsp), %xmm4\n"
+    "    movaps 80(%rsp), %xmm5\n"
+    "    movaps 96(%rsp), %xmm6\n"
+    "    movaps 112(%rsp), %xmm7\n"
+    "    movq 128(%rsp), %rdi\n"
+    "    movq 136(%rsp), %rsi\n"
+    "    movq 144(%rsp), %rdx\n"
+    "    movq 152(%rsp), %rcx\n"
+    "    movq 160(%rsp), %r8\n"
+    "    movq 168(%rsp), %r9\n"
+    "    movq 176(%rsp), %rax\n"
+    "    movq %rbp, %rsp\n"
+    "    popq %rbp\n"
+    "    addq $8, %rsp\n"
+    "    jmpq *%r11\n"
+    SR_LAZY_FUNCTION_END(SR_LAZY_SYM(sr_lazy_stubs))
+    SR_LAZY_TEXT_END
+);
+
+#elif defined(__arm64__)
+
+// Load and branch through the slot (16 bytes), then the binder entry: index in x17, branch
+#define SR_LAZY_STUB_SIZE 32
+#define SR_LAZY_BIND_OFFSET 16
+
+#define SR_LAZY_STUB(i) \
+    "    adrp x16, _sr_lazy_slots@PAGE\n" \
+    "    add x16, x16, _sr_lazy_slots@PAGEOFF\n" \
+    "    ldr x16, [x16, #(8 * " #i ")]\n" \
+    "    br x16\n" \
+    "    mov x17, #" #i "\n" \
+    "    b Lsr_lazy_binder\n" \
+    "    .p2align 5\n"
+
+// x0-x8 and q0-q7 are preserved. Slots hold unsigned pointers, so plain `br` is used on arm64e
+__asm__(
+    "    .text\n"
+    "    .p2align 5\n"
+    "    .private_extern _sr_lazy_stubs\n"
+    "    .globl _sr_lazy_stubs\n"
+    "_sr_lazy_stubs:\n"
+    SR_LAZY_X256(SR_LAZY_STUB)
+    "Lsr_lazy_binder:\n"
+    "    stp x29, x30, [sp, #-16]!\n"
+    "    mov x29, sp\n"
+    "    sub sp, sp, #208\n"
+    "    stp x0, x1, [sp, #0]\n"
+    "    stp x2, x3, [sp, #16]\n"
+    "    stp x4, x5, [sp, #32]\n"
+    "    stp x6, x7, [sp, #48]\n"
+    "    str x8, [sp, #64]\n"
+    "    stp q0, q1, [sp, #80]\n"
+    "    stp q2, q3, [sp, #112]\n"
+    "    stp q4, q5, [sp, #144]\n"
+    "    stp q6, q7, [sp, #176]\n"
+    "    mov x0, x17\n"
+    "    bl _sr_lazy_bind\n"
+    "    mov x16, x0\n"
+    "    ldp x0, x1, [sp, #0]\n"
+    "    ldp x2, x3, [sp, #16]\n"
+    "    ldp x4, x5, [sp, #32]\n"
+    "    ldp x6, x7, [sp, #48]\n"
+    "    ldr x8, [sp, #64]\n"
+    "    ldp q0, q1, [sp, #80]\n"
+    "    ldp q2, q3, [sp, #112]\n"
+    "    ldp q4, q5, [sp, #144]\n"
+    "    ldp q6, q7, [sp, #176]\n"
+    "    mov sp, x29\n"
+    "    ldp x29, x30, [sp], #16\n"
+    "    br x16\n"
+);
+
+#endif
+
+#ifdef SR_LAZY_STUB_SIZE
+
+static void
+sr_lazy_unresolved(void) {
+    abort();
+}
+
+SR_INLINE uintptr_t
+sr_lazy_strip(sr_ptr_t _Nullable ptr) {
+#if __has_feature(ptrauth_calls)
+    return (uintptr_t)ptrauth_strip(ptr, ptrauth_key_function_pointer);
+#else
+    return (uintptr_t)ptr;
+#endif
+}
+
+uintptr_t sr_lazy_bind(uintptr_t index) {
+    const struct sr_lazy_entry *entry = &_g_lazy.entries[index];
+    uintptr_t target = sr_lazy_strip(symrez_resolve_once_mh(entry->header, entry->name));
+    if (unlikely(!target)) {
+        target = entry->handler ? sr_lazy_strip(entry->handler) : sr_lazy_strip((sr_ptr_t)sr_lazy_unresolved);
+    }
+
+    atomic_store_explicit(&sr_lazy_slots[index], target, memory_order_release);
+    return target;
+}
+
+SR_INLINE sr_ptr_t
+sr_lazy_stub(uint32_t index) {
+    sr_ptr_t stub = (sr_ptr_t)&sr_lazy_stubs[index * SR_LAZY_STUB_SIZE];
+#if __has_feature(ptrauth_calls)
+    stub = ptrauth_sign_unauthenticated(stub, ptrauth_key_function_pointer, 0);
+#endif
+    return stub;
+}
+
+sr_ptr_t sr_lazy_function(symrez_t symrez, const char *symbol, sr_ptr_t handler) {
+    // Trampolines are called in this process; snapshot images can't be
+    if (unlikely(symrez->snapshot)) {
+        return NULL;
+    }
+
+    mach_header_t header = symrez->header;
+    sr_ptr_t stub = NULL;
+
+    sr_lock(&_g_lazy.lock);
+    for (uint32_t i = 0; i < _g_lazy.count; ++i) {
+        struct sr_lazy_entry *e = &_g_lazy.entries[i];
+        if (e->header == header && !strcmp(e->name, symbol)) {
+            stub = sr_lazy_stub(i);
+            break;
+        }
+    }
+
+    char *name = NULL;
+    if (!stub && likely(_g_lazy.count < SR_LAZY_MAX) && likely((name = strdup(symbol)) != NULL)) {
+        uint32_t i = _g_lazy.count++;
+        struct sr_lazy_entry *e = &_g_lazy.entries[i];
+        e->header = header;
+        e->name = name;
+        e->handler = handler;
+
+        uintptr_t bind = (uintptr_t)&sr_lazy_stubs[i * SR_LAZY_STUB_SIZE + SR_LAZY_BIND_OFFSET];
+        atomic_store_explicit(&sr_lazy_slots[i], bind, memory_order_release);
+        stub = sr_lazy_stub(i);
+    }
+    sr_unlock(&_g_lazy.lock);
+
+    return stub;
+}
+
+#else
+
+// No trampolines for this architecture: resolve now
+sr_ptr_t sr_lazy_function(symrez_t symrez, const char *symbol, sr_ptr_t handler) {
+    sr_ptr_t addr = sr_resolve_symbol(symrez, symbol);
+    return addr ? addr : handler;
+}
+
+#endif
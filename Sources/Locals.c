@@ -0,0 +1,376 @@
+//
+//  Locals.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ The cache builder strips local symbols out of every image's symbol table
+ and keeps them in one region of the cache file, or of the `.symbols`
+ subcache on split caches. The region holds a single nlist array and
+ string pool for all images, plus a table telling which slice of the
+ array belongs to which image.
+
+ The region is mapped once, on the first lookup that needs it. Each image
+ gets its own index over its slice, built the first time it misses, so
+ one framework never pays for the others. Cache images are never
+ unloaded, so indexes live in a process-wide registry keyed by mach
+ header, like Bloom filters, and are shared with temporary objects.
+ */
+
+#ifndef MH_DYLIB_IN_CACHE
+#define MH_DYLIB_IN_CACHE 0x80000000
+#endif
+
+// The parts of dyld's cache header (dyld_cache_format.h) needed to find the local symbols
+struct sr_locals_header {
+    char magic[16];
+    uint32_t mappingOffset;
+    uint32_t mappingCount;
+    uint32_t imagesOffsetOld;
+    uint32_t imagesCountOld;
+    uint64_t dyldBaseAddress;
+    uint64_t codeSignatureOffset;
+    uint64_t codeSignatureSize;
+    uint64_t slideInfoOffsetUnused;
+    uint64_t slideInfoSizeUnused;
+    uint64_t localSymbolsOffset;
+    uint64_t localSymbolsSize;
+    uint8_t uuid[16];
+};
+
+// Caches with this field use 64-bit VM offsets in the entry table, and may keep locals in a subcache
+#define SR_LOCALS_SYMBOL_FILE_UUID 0x190
+
+struct sr_locals_info {
+    uint32_t nlistOffset;
+    uint32_t nlistCount;
+    uint32_t stringsOffset;
+    uint32_t stringsSize;
+    uint32_t entriesOffset;
+    uint32_t entriesCount;
+};
+
+struct sr_locals_entry {
+    uint32_t dylibOffset;
+    uint32_t nlistStartIndex;
+    uint32_t nlistCount;
+};
+
+struct sr_locals_entry_64 {
+    uint64_t dylibOffset;
+    uint32_t nlistStartIndex;
+    uint32_t nlistCount;
+};
+
+// Open addressed, slots hold (hash << 32) | (index + 1). 0 is empty
+struct sr_locals {
+    nlist64_t nlist;
+    uint32_t count;
+    uint32_t mask;
+    uint64_t slots[];
+};
+
+static struct {
+    sr_lock_t lock;
+    uintptr_t cache;
+    const struct sr_locals_info *info;
+    nlist64_t nlist;
+    const char *strings;
+    bool entries_64;
+    mach_header_t *headers;
+    struct sr_locals **indexes;
+    uint32_t nindexes;
+    uint32_t capacity;
+} _g_locals = {
+    .lock = SR_LOCK_INIT,
+};
+
+static pthread_once_t _g_locals_once = PTHREAD_ONCE_INIT;
+
+#if defined(__APPLE__)
+extern const char *dyld_shared_cache_file_path(void) __attribute__((weak_import));
+
+static int
+sr_locals_open_file(const struct sr_locals_header *cache, struct sr_locals_header *hdr) {
+    char path[PATH_MAX];
+    const char *cache_path = dyld_shared_cache_file_path ? dyld_shared_cache_file_path() : NULL;
+    if (unlikely(!cache_path)) {
+        return -1;
+    }
+
+    const uint8_t *expected = cache->uuid;
+    const uint8_t *symbol_file = (const uint8_t *)cache + SR_LOCALS_SYMBOL_FILE_UUID;
+    static const uint8_t zero[16] = { 0 };
+    if (cache->mappingOffset >= SR_LOCALS_SYMBOL_FILE_UUID + 16 && memcmp(symbol_file, zero, 16)) {
+        snprintf(path, sizeof(path), "%s.symbols", cache_path);
+        expected = symbol_file;
+    } else {
+        snprintf(path, sizeof(path), "%s", cache_path);
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (unlikely(fd < 0)) {
+        return -1;
+    }
+
+    // A file from another boot's cache would have the wrong offsets
+    if (unlikely(pread(fd, hdr, sizeof(*hdr), 0) != sizeof(*hdr) || memcmp(hdr->uuid, expected, 16))) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+#else
+// Without dyld there is no shared cache in the process
+static int
+sr_locals_open_file(const struct sr_locals_header *cache, struct sr_locals_header *hdr) {
+    (void)cache;
+    (void)hdr;
+    return -1;
+}
+#endif
+
+static void
+sr_locals_open(void) {
+    dyld_all_image_infos_t aii = get_all_image_infos();
+    if (unlikely(!aii || aii->version < 15 || !aii->sharedCacheBaseAddress)) {
+        return;
+    }
+
+    const struct sr_locals_header *cache = (const void *)aii->sharedCacheBaseAddress;
+    if (unlikely(strncmp(cache->magic, "dyld_v1", 7))) {
+        return;
+    }
+
+    struct sr_locals_header hdr;
+    int fd = sr_locals_open_file(cache, &hdr);
+    if (unlikely(fd < 0)) {
+        return;
+    }
+
+    size_t page = (size_t)getpagesize();
+    uint64_t start = hdr.localSymbolsOffset & ~(uint64_t)(page - 1);
+    size_t skew = (size_t)(hdr.localSymbolsOffset - start);
+    size_t size = (size_t)hdr.localSymbolsSize + skew;
+    void *map = hdr.localSymbolsSize ? mmap(NULL, size, PROT_READ, MAP_FILE | MAP_PRIVATE, fd, (off_t)start) : MAP_FAILED;
+    close(fd);
+    if (unlikely(map == MAP_FAILED)) {
+        return;
+    }
+
+    const uint8_t *region = (const uint8_t *)map + skew;
+    const struct sr_locals_info *info = (const void *)region;
+    uint64_t region_size = hdr.localSymbolsSize;
+    size_t entry_size = cache->mappingOffset >= SR_LOCALS_SYMBOL_FILE_UUID ? sizeof(struct sr_locals_entry_64) : sizeof(struct sr_locals_entry);
+    if (unlikely(region_size < sizeof(*info) ||
+                 info->nlistOffset + (uint64_t)info->nlistCount * sizeof(struct nlist_64) > region_size ||
+                 info->stringsOffset + (uint64_t)info->stringsSize > region_size ||
+                 info->entriesOffset + (uint64_t)info->entriesCount * entry_size > region_size)) {
+        munmap(map, size);
+        return;
+    }
+
+    _g_locals.cache = aii->sharedCacheBaseAddress;
+    _g_locals.info = info;
+    _g_locals.nlist = (nlist64_t)(region + info->nlistOffset);
+    _g_locals.strings = (const char *)region + info->stringsOffset;
+    _g_locals.entries_64 = entry_size == sizeof(struct sr_locals_entry_64);
+}
+
+// The image's slice of the nlist array. Entries are keyed by offset from the cache header
+static bool
+sr_locals_slice(mach_header_t header, uint32_t *first, uint32_t *count) {
+    const struct sr_locals_info *info = _g_locals.info;
+    const uint8_t *entries = (const uint8_t *)info + info->entriesOffset;
+    uint64_t offset = (uintptr_t)header - _g_locals.cache;
+
+    for (uint32_t i = 0; i < info->entriesCount; ++i) {
+        uint64_t dylib;
+        uint32_t start, n;
+        if (_g_locals.entries_64) {
+            const struct sr_locals_entry_64 *e = &((const struct sr_locals_entry_64 *)entries)[i];
+            dylib = e->dylibOffset;
+            start = e->nlistStartIndex;
+            n = e->nlistCount;
+        } else {
+            const struct sr_locals_entry *e = &((const struct sr_locals_entry *)entries)[i];
+            dylib = e->dylibOffset;
+            start = e->nlistStartIndex;
+            n = e->nlistCount;
+        }
+
+        if (dylib != offset) continue;
+
+        if (unlikely((uint64_t)start + n > info->nlistCount)) {
+            return false;
+        }
+
+        *first = start;
+        *count = n;
+        return true;
+    }
+
+    return false;
+}
+
+static struct sr_locals *
+sr_locals_create(mach_header_t header) {
+    uint32_t first, count;
+    if (!sr_locals_slice(header, &first, &count)) {
+        count = 0;
+        first = 0;
+    }
+
+    // Load factor of at most 1/2
+    uint32_t nslots = 16;
+    while (nslots < count * 2) nslots <<= 1;
+
+    struct sr_locals *locals = calloc(1, sizeof(struct sr_locals) + nslots * sizeof(uint64_t));
+    if (unlikely(!locals)) {
+        return NULL;
+    }
+
+    locals->nlist = &_g_locals.nlist[first];
+    locals->count = count;
+    locals->mask = nslots - 1;
+
+    uint32_t strings_size = _g_locals.info->stringsSize;
+    for (uint32_t i = 0; i < count; ++i) {
+        nlist64_t nl = &locals->nlist[i];
+        if (!nl->n_un.n_strx || !nl->n_value || (nl->n_type & N_STAB) || nl->n_un.n_strx >= strings_size) continue;
+
+        size_t len;
+        uint32_t hash = sr_hash_symbol(_g_locals.strings + nl->n_un.n_strx, &len);
+        uint32_t slot = hash & locals->mask;
+        while (locals->slots[slot]) {
+            slot = (slot + 1) & locals->mask;
+        }
+        locals->slots[slot] = ((uint64_t)hash << 32) | (i + 1);
+    }
+
+    return locals;
+}
+
+// Must be called with `_g_locals.lock` held
+static struct sr_locals *
+sr_locals_find(mach_header_t header) {
+    for (uint32_t i = 0; i < _g_locals.nindexes; ++i) {
+        if (_g_locals.headers[i] == header) {
+            return _g_locals.indexes[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Must be called with `_g_locals.lock` held
+static bool
+sr_locals_reserve(void) {
+    if (likely(_g_locals.nindexes < _g_locals.capacity)) {
+        return true;
+    }
+
+    uint32_t capacity = _g_locals.capacity ? _g_locals.capacity * 2 : 0x40;
+    mach_header_t *headers = realloc(_g_locals.headers, capacity * sizeof(mach_header_t));
+    if (unlikely(!headers)) {
+        return false;
+    }
+    _g_locals.headers = headers;
+
+    struct sr_locals **indexes = realloc(_g_locals.indexes, capacity * sizeof(struct sr_locals *));
+    if (unlikely(!indexes)) {
+        return false;
+    }
+    _g_locals.indexes = indexes;
+    _g_locals.capacity = capacity;
+    return true;
+}
+
+static const struct sr_locals *
+sr_locals_get(symrez_t symrez) {
+    mach_header_t header = symrez->header;
+
+    // Snapshot views aren't the cache this process has mapped
+    if (symrez->snapshot || !(header->flags & MH_DYLIB_IN_CACHE)) {
+        return NULL;
+    }
+
+    pthread_once(&_g_locals_once, sr_locals_open);
+    if (unlikely(!_g_locals.info || (uintptr_t)header < _g_locals.cache)) {
+        return NULL;
+    }
+
+    sr_lock(&_g_locals.lock);
+    struct sr_locals *locals = sr_locals_find(header);
+    sr_unlock(&_g_locals.lock);
+    if (locals) {
+        return locals;
+    }
+
+    // Build outside the lock
+    struct sr_locals *built = sr_locals_create(header);
+    if (unlikely(!built)) {
+        return NULL;
+    }
+
+    sr_lock(&_g_locals.lock);
+    locals = sr_locals_find(header);
+    if (unlikely(locals)) {
+        // Lost the race
+    } else if (likely(sr_locals_reserve())) {
+        _g_locals.headers[_g_locals.nindexes] = header;
+        _g_locals.indexes[_g_locals.nindexes++] = built;
+        locals = built;
+        built = NULL;
+    }
+    sr_unlock(&_g_locals.lock);
+
+    free(built);
+    return locals;
+}
+
+// Entries named `symbol`, one per call. `*cursor` starts at 0 and is where the probe resumes, plus one
+nlist64_t sr_locals_next_nlist(symrez_t symrez, const char *symbol, uint32_t *cursor) {
+    const struct sr_locals *locals = sr_locals_get(symrez);
+    if (!locals || !locals->count) {
+        return NULL;
+    }
+
+    size_t len;
+    uint32_t hash = sr_hash_symbol(symbol, &len);
+    uint32_t slot = *cursor ? *cursor - 1 : hash & locals->mask;
+    for (; locals->slots[slot]; slot = (slot + 1) & locals->mask) {
+        uint64_t entry = locals->slots[slot];
+        if ((uint32_t)(entry >> 32) != hash) continue;
+
+        nlist64_t nl = &locals->nlist[(uint32_t)entry - 1];
+        if (likely(sr_strneq(_g_locals.strings + nl->n_un.n_strx, symbol, len + 1))) {
+            *cursor = ((slot + 1) & locals->mask) + 1;
+            return nl;
+        }
+    }
+
+    return NULL;
+}
+
+sr_ptr_t sr_locals_resolve_symbol(symrez_t symrez, const char *symbol) {
+    uint32_t cursor = 0;
+    nlist64_t nl = sr_locals_next_nlist(symrez, symbol, &cursor);
+    return nl ? (sr_ptr_t)(nl->n_value + symrez->slide) : NULL;
+}
+
+size_t sr_get_cache_local_count(symrez_t symrez) {
+    const struct sr_locals *locals = sr_locals_get(symrez);
+    return locals ? locals->count : 0;
+}
@@ -0,0 +1,282 @@
+//
+//  Manifest.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/*
+ Requests are sorted by image name, so each name is looked up once, then
+ by header so each image is parsed once. A group's symbol table is then
+ swept once for all of its names: names of at least three characters are
+ hashed on their first four bytes, the same block `resolve_local_symbol`
+ compares, so most entries cost one load and an empty bucket. Names the
+ sweep misses go through the remaining tiers one by one.
+
+ Groups are independent and are handed out to threads through a shared
+ counter; the calling thread works too.
+ */
+
+#define SR_MANIFEST_MAX_THREADS 16
+
+struct sr_manifest_item {
+    const char *image;
+    mach_header_t header;
+    uint32_t request;
+};
+
+struct sr_manifest_group {
+    uint32_t first;
+    uint32_t count;
+};
+
+struct sr_manifest {
+    const sr_request_t *requests;
+    sr_ptr_t *out;
+    uint8_t *status;
+    struct sr_manifest_item *items;
+    struct sr_manifest_group *groups;
+    uint32_t ngroups;
+    _Atomic uint32_t next;
+    _Atomic size_t resolved;
+};
+
+static int
+sr_manifest_item_cmp(const void *a, const void *b) {
+    const struct sr_manifest_item *ia = a;
+    const struct sr_manifest_item *ib = b;
+    if (ia->header != ib->header) {
+        return (uintptr_t)ia->header < (uintptr_t)ib->header ? -1 : 1;
+    }
+
+    return (ia->request > ib->request) - (ia->request < ib->request);
+}
+
+// NULL (the main executable) first
+static int
+sr_manifest_item_name_cmp(const void *a, const void *b) {
+    const struct sr_manifest_item *ia = a;
+    const struct sr_manifest_item *ib = b;
+    if (!ia->image || !ib->image) {
+        return !!ia->image - !!ib->image;
+    }
+
+    return strcmp(ia->image, ib->image);
+}
+
+SR_INLINE uint32_t
+sr_manifest_block_hash(uint32_t block, uint32_t shift) {
+    return (block * 0x9E3779B1U) >> shift;
+}
+
+SR_INLINE bool
+sr_manifest_sweepable(const char *symbol) {
+    return symbol[0] && symbol[1] && symbol[2];
+}
+
+// The string's NUL keeps all four bytes of a sweepable name in bounds
+SR_INLINE uint32_t
+sr_manifest_block(const char *symbol) {
+    uint32_t block;
+    memcpy(&block, symbol, sizeof(block));
+    return block;
+}
+
+// One pass over the symbol table for every sweepable name of the group
+static bool
+sr_manifest_sweep(struct sr_manifest *m, symrez_t symrez, const struct sr_manifest_group *group, bool *found) {
+    uint32_t nbuckets = 16, shift = 28;
+    while (nbuckets < group->count * 2) {
+        nbuckets <<= 1;
+        --shift;
+    }
+
+    uint32_t *buckets = malloc(nbuckets * sizeof(uint32_t));
+    uint32_t *next = malloc(group->count * sizeof(uint32_t));
+    if (unlikely(!buckets || !next)) {
+        free(buckets);
+        free(next);
+        return false;
+    }
+
+    memset(buckets, 0xFF, nbuckets * sizeof(uint32_t));
+    uint32_t pending = 0;
+    for (uint32_t i = 0; i < group->count; ++i) {
+        const char *symbol = m->requests[m->items[group->first + i].request].symbol;
+        if (!sr_manifest_sweepable(symbol)) continue;
+
+        uint32_t bucket = sr_manifest_block_hash(sr_manifest_block(symbol), shift);
+        next[i] = buckets[bucket];
+        buckets[bucket] = i;
+        ++pending;
+    }
+
+    strtab_t strtab = symrez->strtab;
+    intptr_t slide = symrez->slide;
+    nlist64_t end = &symrez->symtab[symrez->nsyms];
+    for (nlist64_t nl = symrez->symtab; pending && nl < end; ++nl) {
+        const char *str = (const char *)strtab + nl->n_un.n_strx;
+        if (unlikely(!sr_manifest_sweepable(str))) continue;
+
+        uint32_t block = sr_manifest_block(str);
+        uint32_t i = buckets[sr_manifest_block_hash(block, shift)];
+        if (likely(i == UINT32_MAX)) continue;
+
+        for (; i != UINT32_MAX; i = next[i]) {
+            uint32_t request = m->items[group->first + i].request;
+            const char *symbol = m->requests[request].symbol;
+            if (found[i] || sr_manifest_block(symbol) != block || !nl->n_value || strcmp(str, symbol)) continue;
+
+            m->out[request] = sr_sign_symbol(symrez, (sr_ptr_t)(nl->n_value + slide));
+            found[i] = true;
+            --pending;
+        }
+    }
+
+    free(buckets);
+    free(next);
+    return true;
+}
+
+static void
+sr_manifest_set_status(struct sr_manifest *m, uint32_t request, uint8_t status) {
+    if (m->status) {
+        m->status[request] = status;
+    }
+}
+
+static void
+sr_manifest_resolve_group(struct sr_manifest *m, const struct sr_manifest_group *group) {
+    mach_header_t header = m->items[group->first].header;
+    struct symrez symrez;
+    if (unlikely(!header || !symrez_init_mh(&symrez, header))) {
+        for (uint32_t i = 0; i < group->count; ++i) {
+            sr_manifest_set_status(m, m->items[group->first + i].request, SR_MANIFEST_NO_IMAGE);
+        }
+        return;
+    }
+
+    bool *found = calloc(group->count, sizeof(bool));
+    bool swept = found && sr_manifest_sweep(m, &symrez, group, found);
+
+    size_t resolved = 0;
+    for (uint32_t i = 0; i < group->count; ++i) {
+        uint32_t request = m->items[group->first + i].request;
+        const char *symbol = m->requests[request].symbol;
+        if (!swept || !found[i]) {
+            m->out[request] = sr_resolve_symbol_from(&symrez, symbol, !swept || !sr_manifest_sweepable(symbol));
+        }
+
+        bool ok = m->out[request] != NULL;
+        resolved += ok;
+        sr_manifest_set_status(m, request, ok ? SR_MANIFEST_OK : SR_MANIFEST_NO_SYMBOL);
+    }
+
+    free(found);
+    symrez_destroy(&symrez);
+    atomic_fetch_add_explicit(&m->resolved, resolved, memory_order_relaxed);
+}
+
+static void *
+sr_manifest_worker(void *context) {
+    struct sr_manifest *m = context;
+    uint32_t group;
+    while ((group = atomic_fetch_add_explicit(&m->next, 1, memory_order_relaxed)) < m->ngroups) {
+        sr_manifest_resolve_group(m, &m->groups[group]);
+    }
+
+    return NULL;
+}
+
+static bool
+sr_manifest_group(struct sr_manifest *m, size_t count) {
+    struct sr_manifest_item *items = malloc(count * sizeof(struct sr_manifest_item));
+    struct sr_manifest_group *groups = malloc(count * sizeof(struct sr_manifest_group));
+    if (unlikely(!items || !groups)) {
+        free(items);
+        free(groups);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        items[i].image = m->requests[i].image;
+        items[i].request = i;
+    }
+
+    // Requests for the same image name, wherever they are in the manifest, only look it up once
+    qsort(items, count, sizeof(struct sr_manifest_item), sr_manifest_item_name_cmp);
+    for (uint32_t i = 0; i < count; ++i) {
+        const char *image = items[i].image;
+        if (!image) {
+            items[i].header = SR_EXEC_HDR;
+        } else if (i && items[i - 1].image && !strcmp(image, items[i - 1].image)) {
+            items[i].header = items[i - 1].header;
+        } else {
+            items[i].header = find_image(image);
+        }
+    }
+
+    qsort(items, count, sizeof(struct sr_manifest_item), sr_manifest_item_cmp);
+
+    uint32_t ngroups = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (!i || items[i].header != items[i - 1].header) {
+            groups[ngroups].first = i;
+            groups[ngroups++].count = 0;
+        }
+        ++groups[ngroups - 1].count;
+    }
+
+    m->items = items;
+    m->groups = groups;
+    m->ngroups = ngroups;
+    return true;
+}
+
+size_t symrez_resolve_manifest(const sr_request_t *requests, size_t count, sr_ptr_t *out, sr_manifest_options_t *options) {
+    uint64_t start = sr_ticks();
+    memset(out, 0, count * sizeof(sr_ptr_t));
+
+    struct sr_manifest m = {
+        .requests = requests,
+        .out = out,
+        .status = options ? options->status : NULL,
+    };
+
+    if (likely(count && count <= UINT32_MAX && sr_manifest_group(&m, count))) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        uint32_t nthreads = options && options->threads ? options->threads : (uint32_t)(cpus > 0 ? cpus : 1);
+        if (nthreads > m.ngroups) nthreads = m.ngroups;
+        if (nthreads > SR_MANIFEST_MAX_THREADS) nthreads = SR_MANIFEST_MAX_THREADS;
+
+        pthread_t threads[SR_MANIFEST_MAX_THREADS];
+        uint32_t started = 0;
+        for (; started + 1 < nthreads; ++started) {
+            if (unlikely(pthread_create(&threads[started], NULL, sr_manifest_worker, &m))) {
+                break;
+            }
+        }
+
+        sr_manifest_worker(&m);
+        for (uint32_t i = 0; i < started; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+
+        free(m.items);
+        free(m.groups);
+    } else if (m.status) {
+        memset(m.status, SR_MANIFEST_NO_IMAGE, count);
+    }
+
+    if (options) {
+        options->elapsed_ns = sr_ticks_to_ns(sr_ticks() - start);
+    }
+
+    return atomic_load_explicit(&m.resolved, memory_order_relaxed);
+}
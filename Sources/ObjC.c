@@ -0,0 +1,453 @@
+//
+//  ObjC.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ Minimal mirror of the objc4 metadata layout, enough to walk method lists
+ without calling into (and taking the locks of) the runtime.
+
+ Classes the runtime has already realized have their data pointer swapped
+ for a heap allocated class_rw_t, which still points back at the original
+ class_ro_t. Both forms are handled.
+ */
+
+#define SR_OBJC_FAST_DATA_MASK      0x00007ffffffffff8ULL
+#define SR_OBJC_RW_REALIZED         (1U << 31)
+#define SR_OBJC_ML_SMALL            0x80000000U
+#define SR_OBJC_ML_DIRECT_SELS      0x40000000U
+#define SR_OBJC_ML_FLAGS_MASK       0xFFFF0003U
+#define SR_OBJC_NAME_MAX            1024
+
+struct sr_objc_class {
+    uintptr_t isa;
+    uintptr_t superclass;
+    uintptr_t cache[2];
+    uintptr_t bits;
+};
+
+struct sr_objc_class_ro {
+    uint32_t flags;
+    uint32_t instance_start;
+    uint32_t instance_size;
+    uint32_t reserved;
+    uintptr_t ivar_layout;
+    uintptr_t name;
+    uintptr_t base_methods;
+};
+
+struct sr_objc_class_rw {
+    uint32_t flags;
+    uint16_t witness;
+    uint16_t index;
+    uintptr_t ro_or_rw_ext;
+};
+
+struct sr_objc_category {
+    uintptr_t name;
+    uintptr_t cls;
+    uintptr_t instance_methods;
+    uintptr_t class_methods;
+};
+
+struct sr_objc_method_list {
+    uint32_t entsize_and_flags;
+    uint32_t count;
+};
+
+struct sr_objc_method_big {
+    uintptr_t name;
+    uintptr_t types;
+    uintptr_t imp;
+};
+
+struct sr_objc_method_small {
+    int32_t name;
+    int32_t types;
+    int32_t imp;
+};
+
+struct sr_objc_list_list {
+    uint32_t entsize;
+    uint32_t count;
+};
+
+struct sr_objc_method {
+    const char *cls;
+    const char *sel;
+    sr_ptr_t imp;
+    bool meta;
+};
+
+struct sr_objc_index {
+    struct sr_table table;
+    struct sr_objc_method *methods;
+    uint32_t capacity;
+};
+
+SR_INLINE const void *
+sr_objc_ptr(uintptr_t p) {
+    return sr_strip_ptr((sr_ptr_t)p);
+}
+
+SR_INLINE uint32_t
+sr_objc_hash(const char *cls, const char *sel, bool meta) {
+    return (sr_hash_symbol(cls, NULL) * 0x9E3779B1U) ^ sr_hash_symbol(sel, NULL) ^ (uint32_t)meta;
+}
+
+SR_INLINE const struct sr_objc_class_ro *
+sr_objc_class_ro(const struct sr_objc_class *cls) {
+    const void *data = (const void *)(cls->bits & SR_OBJC_FAST_DATA_MASK);
+    if (unlikely(!data)) {
+        return NULL;
+    }
+
+    const struct sr_objc_class_rw *rw = data;
+    if (!(rw->flags & SR_OBJC_RW_REALIZED)) {
+        return data;
+    }
+
+    // Realized. Low bit set means class_rw_ext_t, whose first field is the ro.
+    uintptr_t ro = rw->ro_or_rw_ext;
+    if (ro & 1) {
+        ro = *(const uintptr_t *)(ro & ~1ULL);
+    }
+
+    return sr_objc_ptr(ro);
+}
+
+SR_INLINE const char *
+sr_objc_class_name(const struct sr_objc_class *cls) {
+    const struct sr_objc_class_ro *ro = sr_objc_class_ro(cls);
+    return ro ? sr_objc_ptr(ro->name) : NULL;
+}
+
+/*
+ Selectors of relative method lists in the shared cache are offsets from a
+ fixed selector, @selector(🤯), instead of offsets to a selector reference.
+ The cache's objc optimisation header records where it is. Caches older
+ than that header keep the same offset in libobjc's __objc_opt_ro.
+ */
+
+// The parts of dyld's cache header (dyld_cache_format.h) needed to find objc's optimisations
+struct sr_objc_cache_header {
+    char magic[16];
+    uint32_t mappingOffset;
+};
+
+// uint64_t objcOptsOffset, objcOptsSize. Present when the header (mappingOffset) reaches past them
+#define SR_OBJC_CACHE_OPTS_OFFSET 0x1d0
+
+struct sr_objc_cache_opts {
+    uint64_t offset;
+    uint64_t size;
+};
+
+// ObjCOptimizationHeader. Offsets are from the cache header
+struct sr_objc_opt_header {
+    uint32_t version;
+    uint32_t flags;
+    uint64_t header_info_ro;
+    uint64_t header_info_rw;
+    uint64_t selector_table;
+    uint64_t class_table;
+    uint64_t protocol_table;
+    uint64_t selector_base;
+};
+
+// objc_opt_t, version 16. Offsets are from the struct
+#define SR_OBJC_OPT_LEGACY_VERSION 16
+
+struct sr_objc_opt_legacy {
+    uint32_t version;
+    uint32_t flags;
+    int32_t offsets[8];
+    int64_t selector_base;
+};
+
+static const char *
+sr_objc_cache_selector_base(uintptr_t cache) {
+    const struct sr_objc_cache_header *hdr = (const void *)cache;
+    if (unlikely(strncmp(hdr->magic, "dyld_v1", 7) ||
+                 hdr->mappingOffset < SR_OBJC_CACHE_OPTS_OFFSET + sizeof(struct sr_objc_cache_opts))) {
+        return NULL;
+    }
+
+    const struct sr_objc_cache_opts *opts = (const void *)(cache + SR_OBJC_CACHE_OPTS_OFFSET);
+    if (!opts->offset || opts->size < sizeof(struct sr_objc_opt_header)) {
+        return NULL;
+    }
+
+    const struct sr_objc_opt_header *opt = (const void *)(cache + opts->offset);
+    return opt->selector_base ? (const char *)(cache + opt->selector_base) : NULL;
+}
+
+static const char *
+sr_objc_legacy_selector_base(void) {
+    mach_header_t mh = find_image("libobjc.A.dylib");
+    segment_command_t text = mh ? find_lc_segment(mh, SEG_TEXT) : NULL;
+    if (unlikely(!text)) {
+        return NULL;
+    }
+
+    intptr_t slide = (intptr_t)mh - (intptr_t)text->vmaddr;
+    const struct section_64 *sect = (const struct section_64 *)(text + 1);
+    for (uint32_t i = 0; i < text->nsects; ++i) {
+        if (strncmp(sect[i].sectname, "__objc_opt_ro", sizeof(sect[i].sectname))) continue;
+
+        const struct sr_objc_opt_legacy *opt = (const void *)(sect[i].addr + slide);
+        if (sect[i].size < sizeof(*opt) || opt->version != SR_OBJC_OPT_LEGACY_VERSION || !opt->selector_base) {
+            return NULL;
+        }
+        return (const char *)opt + opt->selector_base;
+    }
+
+    return NULL;
+}
+
+static const char *
+sr_objc_direct_selector_base(void) {
+    static const char *_g_base = NULL;
+    if (likely(_g_base)) {
+        return _g_base;
+    }
+
+    dyld_all_image_infos_t aii = get_all_image_infos();
+    if (unlikely(!aii || aii->version < 15 || !aii->sharedCacheBaseAddress)) {
+        return NULL;
+    }
+
+    const char *base = sr_objc_cache_selector_base(aii->sharedCacheBaseAddress);
+    if (!base) {
+        base = sr_objc_legacy_selector_base();
+    }
+
+    _g_base = base;
+    return base;
+}
+
+static bool
+sr_objc_add_method(symrez_t symrez, struct sr_objc_index *index, const char *cls, const char *sel, sr_ptr_t imp, bool meta) {
+    // Grow the payload in step with the table
+    if (unlikely(!sr_table_reserve(symrez, &index->table, index->table.count + 1))) {
+        return false;
+    }
+
+    if (unlikely(index->table.capacity > index->capacity)) {
+        uint32_t capacity = index->table.capacity;
+        struct sr_objc_method *methods = sr_realloc(symrez, index->methods, index->capacity * sizeof(struct sr_objc_method), capacity * sizeof(struct sr_objc_method));
+        if (unlikely(!methods)) {
+            return false;
+        }
+        index->methods = methods;
+        index->capacity = capacity;
+    }
+
+    uint32_t idx = sr_table_insert(symrez, &index->table, sr_objc_hash(cls, sel, meta));
+    index->methods[idx].cls = cls;
+    index->methods[idx].sel = sel;
+    index->methods[idx].imp = imp;
+    index->methods[idx].meta = meta;
+    return true;
+}
+
+static void
+sr_objc_add_method_list(symrez_t symrez, struct sr_objc_index *index, const char *cls, uintptr_t list_ptr, bool meta) {
+    const struct sr_objc_method_list *list = sr_objc_ptr(list_ptr);
+    if (!list) {
+        return;
+    }
+
+    uint32_t flags = list->entsize_and_flags;
+    uint32_t entsize = flags & ~SR_OBJC_ML_FLAGS_MASK;
+    const uint8_t *m = (const uint8_t *)(list + 1);
+
+    for (uint32_t i = 0; i < list->count; ++i, m += entsize) {
+        const char *sel = NULL;
+        sr_ptr_t imp = NULL;
+
+        if (flags & SR_OBJC_ML_SMALL) {
+            const struct sr_objc_method_small *method = (const void *)m;
+            if (flags & SR_OBJC_ML_DIRECT_SELS) {
+                const char *base = sr_objc_direct_selector_base();
+                if (unlikely(!base)) return;
+                sel = base + method->name;
+            } else {
+                const uintptr_t *selref = (const uintptr_t *)((const uint8_t *)&method->name + method->name);
+                sel = sr_objc_ptr(*selref);
+            }
+
+            if (method->imp) {
+                imp = (sr_ptr_t)((const uint8_t *)&method->imp + method->imp);
+            }
+        } else {
+            const struct sr_objc_method_big *method = (const void *)m;
+            sel = sr_objc_ptr(method->name);
+            imp = (sr_ptr_t)sr_objc_ptr(method->imp);
+        }
+
+        if (likely(sel && imp)) {
+            sr_objc_add_method(symrez, index, cls, sel, imp, meta);
+        }
+    }
+}
+
+// `base_methods` can also be a relative list of method lists (low bit set)
+static void
+sr_objc_add_base_methods(symrez_t symrez, struct sr_objc_index *index, const char *cls, uintptr_t methods, bool meta) {
+    if (!(methods & 1)) {
+        sr_objc_add_method_list(symrez, index, cls, methods, meta);
+        return;
+    }
+
+    const struct sr_objc_list_list *lists = sr_objc_ptr(methods & ~1ULL);
+    const uint8_t *e = (const uint8_t *)(lists + 1);
+    for (uint32_t i = 0; i < lists->count; ++i, e += lists->entsize) {
+        int64_t entry = *(const int64_t *)e;
+        int64_t offset = entry >> 16;
+        sr_objc_add_method_list(symrez, index, cls, (uintptr_t)(e + offset), meta);
+    }
+}
+
+static void
+sr_objc_add_class(symrez_t symrez, struct sr_objc_index *index, const struct sr_objc_class *cls) {
+    const struct sr_objc_class_ro *ro = sr_objc_class_ro(cls);
+    if (unlikely(!ro)) {
+        return;
+    }
+
+    const char *name = sr_objc_ptr(ro->name);
+    sr_objc_add_base_methods(symrez, index, name, ro->base_methods, false);
+
+    const struct sr_objc_class *meta = sr_objc_ptr(cls->isa);
+    const struct sr_objc_class_ro *meta_ro = meta ? sr_objc_class_ro(meta) : NULL;
+    if (likely(meta_ro)) {
+        sr_objc_add_base_methods(symrez, index, name, meta_ro->base_methods, true);
+    }
+}
+
+// The runtime loads categories from __objc_catlist2 the same way as from __objc_catlist
+SR_INLINE bool
+sr_objc_list_section(section_t sec, bool categories) {
+    if (!categories) {
+        return !strncmp(sec->sectname, "__objc_classlist", sizeof(sec->sectname));
+    }
+
+    return !strncmp(sec->sectname, "__objc_catlist", sizeof(sec->sectname)) || !strncmp(sec->sectname, "__objc_catlist2", sizeof(sec->sectname));
+}
+
+static struct sr_objc_index *
+sr_objc_build(symrez_t symrez) {
+    struct sr_objc_index *index = sr_calloc(symrez, sizeof(struct sr_objc_index));
+    if (unlikely(!index)) {
+        return NULL;
+    }
+
+    // Categories are added last so they shadow the methods they override
+    for (int pass = 0; pass < 2; ++pass) {
+        for (uint32_t i = 1; i < symrez->nordinals; ++i) {
+            section_t sec = symrez->ordinals[i];
+            if (!sec || !sr_objc_list_section(sec, pass)) continue;
+
+            const uintptr_t *list = (const uintptr_t *)(sec->addr + symrez->slide);
+            for (uint64_t j = 0; j < sec->size / sizeof(uintptr_t); ++j) {
+                const void *entry = sr_objc_ptr(list[j]);
+                if (unlikely(!entry)) continue;
+
+                if (!pass) {
+                    sr_objc_add_class(symrez, index, entry);
+                    continue;
+                }
+
+                const struct sr_objc_category *cat = entry;
+                const struct sr_objc_class *cls = sr_objc_ptr(cat->cls);
+                const char *name = cls ? sr_objc_class_name(cls) : NULL;
+                if (unlikely(!name)) continue;
+
+                sr_objc_add_method_list(symrez, index, name, cat->instance_methods, false);
+                sr_objc_add_method_list(symrez, index, name, cat->class_methods, true);
+            }
+        }
+    }
+
+    return index;
+}
+
+static sr_ptr_t
+sr_objc_lookup(symrez_t symrez, const char *cls, const char *sel, bool class_method) {
+    // Metadata pointers in a snapshot are addresses in the other task
+    if (unlikely(symrez->snapshot)) {
+        return NULL;
+    }
+
+    if (unlikely(!symrez->objc)) {
+        if (unlikely(!(symrez->objc = sr_objc_build(symrez)))) {
+            return NULL;
+        }
+    }
+
+    struct sr_objc_index *index = symrez->objc;
+    uint32_t hash = sr_objc_hash(cls, sel, class_method);
+    for (uint32_t i = sr_table_first(&index->table, hash); i != SR_TABLE_NONE; i = sr_table_next(&index->table, index->table.next[i], hash)) {
+        const struct sr_objc_method *m = &index->methods[i];
+        if (m->meta != class_method) continue;
+        if (strcmp(m->sel, sel) || strcmp(m->cls, cls)) continue;
+
+        return m->imp;
+    }
+
+    return NULL;
+}
+
+sr_ptr_t sr_resolve_objc_method(symrez_t symrez, const char *cls, const char *sel, bool class_method) {
+    return sr_sign_symbol(symrez, sr_objc_lookup(symrez, cls, sel, class_method));
+}
+
+/*
+ `-[Class sel]`, `+[Class sel]` or `-[Class(Category) sel]`
+ */
+sr_ptr_t sr_objc_resolve_symbol(symrez_t symrez, const char *symbol) {
+    if ((symbol[0] != '-' && symbol[0] != '+') || symbol[1] != '[') {
+        return NULL;
+    }
+
+    const char *cls = &symbol[2];
+    const char *space = strchr(cls, ' ');
+    const char *end = space ? strchr(space, ']') : NULL;
+    if (unlikely(!space || !end)) {
+        return NULL;
+    }
+
+    const char *paren = memchr(cls, '(', space - cls);
+    size_t cls_len = (paren ? paren : space) - cls;
+    size_t sel_len = end - (space + 1);
+    if (unlikely(cls_len >= SR_OBJC_NAME_MAX || sel_len >= SR_OBJC_NAME_MAX)) {
+        return NULL;
+    }
+
+    char cls_name[SR_OBJC_NAME_MAX];
+    char sel_name[SR_OBJC_NAME_MAX];
+    memcpy(cls_name, cls, cls_len);
+    cls_name[cls_len] = '\0';
+    memcpy(sel_name, space + 1, sel_len);
+    sel_name[sel_len] = '\0';
+
+    return sr_objc_lookup(symrez, cls_name, sel_name, symbol[0] == '+');
+}
+
+void sr_objc_free(symrez_t symrez) {
+    struct sr_objc_index *index = symrez->objc;
+    if (!index) {
+        return;
+    }
+
+    sr_table_free(symrez, &index->table);
+    sr_dealloc(symrez, index->methods);
+    sr_dealloc(symrez, index);
+    symrez->objc = NULL;
+}
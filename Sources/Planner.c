@@ -0,0 +1,247 @@
+//
+//  Planner.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ How `sr_find_nlist` searches the symbol table is decided per object. A
+ new object starts with the cheapest plan that needs no memory. When the
+ linker's external definitions are available, and sorted by name as in any
+ linked image (checked once, when the plan is chosen), that is a scan of
+ the locals followed by a binary search of the external definitions.
+ Locals come first in the table, so this finds the same entry a full scan
+ would. Otherwise it is the full scan. Objects used once, like the ones
+ behind `symrez_resolve_once`, never pay for more.
+
+ Each lookup adds the number of entries it touched to the object's cost.
+ Once the cost passes the configured multiple of the symbol count, which is
+ about what building the name index costs, the index from `sr_resolve_all`
+ is built. Every later lookup is then one hash probe. The index can be
+ built on a background thread. Lookups keep the old plan until it is
+ ready, and it is adopted by the next lookup after that.
+ */
+
+#define SR_PLAN_MIN_EXTDEFS 16
+
+static struct {
+    sr_lock_t lock;
+    sr_planner_config_t config;
+} _g_planner = {
+    .lock = SR_LOCK_INIT,
+    .config = { .threshold = 4, .min_symbols = 0x400, .background = false },
+};
+
+// First entry named `symbol` with a value in [first, end)
+static nlist64_t
+sr_plan_scan(symrez_t symrez, uint32_t first, uint32_t end, const char *symbol, uint64_t *cost) {
+    strtab_t strtab = symrez->strtab;
+    size_t sym_len = strlen(symbol) + 1;
+    uint32_t sym_block = *(uint32_t*)symbol;
+
+    nlist64_t start = &symrez->symtab[first];
+    nlist64_t stop = &symrez->symtab[end];
+    for (nlist64_t nl = start; nl < stop; ++nl) {
+        const char *str = (const char *)strtab + nl->n_un.n_strx;
+        if (likely(*(uint32_t*)str != sym_block)) continue;
+
+        if (likely(sr_strneq(str, symbol, sym_len))) {
+            if (likely(nl->n_value > 0)) {
+                *cost += (uint64_t)(nl - start) + 1;
+                return nl;
+            }
+        }
+    }
+
+    *cost += end - first;
+    return NULL;
+}
+
+static bool
+sr_plan_extdef_usable(symrez_t symrez) {
+    const struct dysymtab_command *dysymtab = symrez->image.dysymtab;
+    if (!dysymtab || dysymtab->nextdefsym < SR_PLAN_MIN_EXTDEFS) {
+        return false;
+    }
+
+    uint64_t locals_end = (uint64_t)dysymtab->ilocalsym + dysymtab->nlocalsym;
+    uint64_t extdefs_end = (uint64_t)dysymtab->iextdefsym + dysymtab->nextdefsym;
+    if (locals_end > dysymtab->iextdefsym || extdefs_end > symrez->nsyms) {
+        return false;
+    }
+
+    // The binary search relies on the linker's order, which nothing else enforces
+    const char *strtab = symrez->strtab;
+    nlist64_t extdefs = &symrez->symtab[dysymtab->iextdefsym];
+    for (uint32_t i = 1; i < dysymtab->nextdefsym; ++i) {
+        if (unlikely(strcmp(strtab + extdefs[i - 1].n_un.n_strx, strtab + extdefs[i].n_un.n_strx) > 0)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static nlist64_t
+sr_plan_extdef(symrez_t symrez, const char *symbol, uint64_t *cost) {
+    const struct dysymtab_command *dysymtab = symrez->image.dysymtab;
+    nlist64_t found = sr_plan_scan(symrez, dysymtab->ilocalsym, dysymtab->ilocalsym + dysymtab->nlocalsym, symbol, cost);
+    if (found) {
+        return found;
+    }
+
+    // Leftmost external definition not less than `symbol`
+    const char *strtab = symrez->strtab;
+    nlist64_t symtab = symrez->symtab;
+    uint32_t lo = dysymtab->iextdefsym, n = dysymtab->nextdefsym;
+    uint32_t end = lo + n;
+    while (n > 0) {
+        uint32_t half = n / 2;
+        ++*cost;
+        if (strcmp(strtab + symtab[lo + half].n_un.n_strx, symbol) < 0) {
+            lo += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+
+    for (; lo < end && !strcmp(strtab + symtab[lo].n_un.n_strx, symbol); ++lo) {
+        ++*cost;
+        if (likely(symtab[lo].n_value > 0)) {
+            return &symtab[lo];
+        }
+    }
+
+    return NULL;
+}
+
+static void
+sr_plan_choose(symrez_t symrez) {
+    sr_lock(&_g_planner.lock);
+    sr_planner_config_t config = _g_planner.config;
+    sr_unlock(&_g_planner.lock);
+
+    struct sr_planner *planner = &symrez->planner;
+    planner->plan = sr_plan_extdef_usable(symrez) ? SR_PLAN_EXTDEF : SR_PLAN_SCAN;
+    planner->initial_plan = planner->plan;
+    planner->background = config.background;
+    if (config.threshold && symrez->nsyms >= config.min_symbols) {
+        planner->budget = (uint64_t)config.threshold * symrez->nsyms;
+    }
+}
+
+static void
+sr_plan_adopt(symrez_t symrez) {
+    struct sr_planner *planner = &symrez->planner;
+    pthread_join(planner->builder, NULL);
+    planner->building = false;
+
+    struct sr_definitions *built = planner->built;
+    planner->built = NULL;
+    if (unlikely(!built)) {
+        planner->budget = 0;
+        return;
+    }
+
+    if (symrez->definitions) {
+        sr_definitions_destroy(symrez, built);
+    } else {
+        symrez->definitions = built;
+    }
+    planner->plan = SR_PLAN_INDEX;
+}
+
+static void *
+sr_plan_build(void *context) {
+    symrez_t symrez = context;
+    uint64_t start = sr_ticks();
+    symrez->planner.built = sr_definitions_create(symrez);
+    symrez->planner.build_ns = sr_ticks_to_ns(sr_ticks() - start);
+    atomic_store_explicit(&symrez->planner.done, true, memory_order_release);
+    return NULL;
+}
+
+static void
+sr_plan_promote(symrez_t symrez) {
+    struct sr_planner *planner = &symrez->planner;
+    planner->promoted_at = planner->lookups;
+
+    // Custom allocators aren't assumed to be thread safe
+    if (planner->background && !symrez->allocator.alloc) {
+        atomic_store_explicit(&planner->done, false, memory_order_relaxed);
+        if (likely(!pthread_create(&planner->builder, NULL, sr_plan_build, symrez))) {
+            planner->building = true;
+            return;
+        }
+    }
+
+    uint64_t start = sr_ticks();
+    if (likely(sr_definitions_get(symrez))) {
+        planner->plan = SR_PLAN_INDEX;
+    } else {
+        planner->budget = 0;
+    }
+    planner->build_ns = sr_ticks_to_ns(sr_ticks() - start);
+}
+
+void sr_planner_sync(symrez_t symrez) {
+    if (unlikely(symrez->planner.building)) {
+        sr_plan_adopt(symrez);
+    }
+}
+
+nlist64_t sr_plan_find_nlist(symrez_t symrez, const char *symbol) {
+    struct sr_planner *planner = &symrez->planner;
+    if (unlikely(planner->building) && atomic_load_explicit(&planner->done, memory_order_acquire)) {
+        sr_plan_adopt(symrez);
+    }
+
+    if (unlikely(!planner->plan)) {
+        sr_plan_choose(symrez);
+    }
+
+    // `sr_resolve_all` may have built the index already
+    if (unlikely(symrez->definitions && planner->plan != SR_PLAN_INDEX)) {
+        planner->plan = SR_PLAN_INDEX;
+    }
+
+    ++planner->lookups;
+    if (planner->plan == SR_PLAN_INDEX) {
+        return sr_definitions_find_nlist(symrez, symbol);
+    }
+
+    uint64_t cost = 0;
+    nlist64_t found = planner->plan == SR_PLAN_EXTDEF
+        ? sr_plan_extdef(symrez, symbol, &cost)
+        : sr_plan_scan(symrez, 0, symrez->nsyms, symbol, &cost);
+
+    planner->cost += cost;
+    if (unlikely(planner->budget && planner->cost >= planner->budget && !planner->building)) {
+        sr_plan_promote(symrez);
+    }
+
+    return found;
+}
+
+void sr_planner_set_config(const sr_planner_config_t *config) {
+    sr_lock(&_g_planner.lock);
+    _g_planner.config = *config;
+    sr_unlock(&_g_planner.lock);
+}
+
+void sr_planner_get_stats(symrez_t symrez, sr_planner_stats_t *stats) {
+    const struct sr_planner *planner = &symrez->planner;
+    stats->plan = symrez->compact ? SR_PLAN_COMPACT : planner->plan;
+    stats->initial_plan = planner->initial_plan;
+    stats->lookups = planner->lookups;
+    stats->cost = planner->cost;
+    stats->budget = planner->budget;
+    stats->promoted_at = planner->promoted_at;
+    stats->build_ns = planner->building ? 0 : planner->build_ns;
+    stats->building = planner->building;
+}
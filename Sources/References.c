@@ -0,0 +1,260 @@
+//
+//  References.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__arm64__) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/*
+ Every pointer-aligned slot of the image's data sections is read once and
+ tested against all targets together. Targets are stripped and sorted with
+ their index. A slot is first checked against the span between the lowest
+ and the highest target, a couple of vector compares per group of slots
+ that rejects most data. Slots inside the span then go through a bitmap
+ of target hashes, and only bitmap hits are binary searched. The cost is
+ one pass over the data whatever the number of targets.
+
+ Fixups are applied in a loaded image, so slots hold plain pointers,
+ signed on arm64e. Signatures are masked off both sides like
+ `sr_strip_ptr` does.
+ */
+
+#if __has_feature(ptrauth_calls)
+#define SR_REFS_VALUE_MASK 0x000000FFFFFFFFFFULL
+#else
+#define SR_REFS_VALUE_MASK UINT64_MAX
+#endif
+
+#define SR_REFS_BITMAP_BITS 16
+
+struct sr_refs_target {
+    uint64_t value;
+    size_t index;
+};
+
+struct sr_refs_sweep {
+    const struct sr_refs_target *targets;
+    size_t ntargets;
+    uint64_t lo;
+    uint64_t span;
+    uint64_t bitmap[(1 << SR_REFS_BITMAP_BITS) / 64];
+    const sr_ptr_t *given;
+    void * _Nullable context;
+    sr_pointer_ref_function_t callback;
+    size_t found;
+    bool stop;
+};
+
+static int
+sr_refs_target_cmp(const void *a, const void *b) {
+    const struct sr_refs_target *ta = a;
+    const struct sr_refs_target *tb = b;
+    if (ta->value != tb->value) {
+        return ta->value < tb->value ? -1 : 1;
+    }
+
+    return (ta->index > tb->index) - (ta->index < tb->index);
+}
+
+SR_INLINE uint32_t
+sr_refs_hash(uint64_t value) {
+    return (uint32_t)((value * 0x9E3779B97F4A7C15ULL) >> (64 - SR_REFS_BITMAP_BITS));
+}
+
+// Report every target equal to `value`
+static void
+sr_refs_match(struct sr_refs_sweep *sweep, const uint64_t *slot, uint64_t value) {
+    uint32_t h = sr_refs_hash(value);
+    if (likely(!((sweep->bitmap[h >> 6] >> (h & 63)) & 1))) {
+        return;
+    }
+
+    size_t lo = 0, n = sweep->ntargets;
+    while (n > 0) {
+        size_t half = n / 2;
+        if (sweep->targets[lo + half].value < value) {
+            lo += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+
+    for (; lo < sweep->ntargets && sweep->targets[lo].value == value && !sweep->stop; ++lo) {
+        sr_pointer_ref_t ref = {
+            .slot = (sr_ptr_t)slot,
+            .target = sweep->given[sweep->targets[lo].index],
+            .index = sweep->targets[lo].index,
+        };
+
+        ++sweep->found;
+        sweep->stop = sweep->callback(&ref, sweep->context);
+    }
+}
+
+SR_INLINE void
+sr_refs_check(struct sr_refs_sweep *sweep, const uint64_t *slot) {
+    uint64_t value = *slot & SR_REFS_VALUE_MASK;
+    if (likely(value - sweep->lo > sweep->span)) {
+        return;
+    }
+
+    sr_refs_match(sweep, slot, value);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static const uint64_t *
+sr_refs_sweep_avx2(struct sr_refs_sweep *sweep, const uint64_t *p, const uint64_t *end) {
+    // Unsigned compares as signed ones, with the sign bit flipped
+    const __m256i sign = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    const __m256i mask = _mm256_set1_epi64x((long long)SR_REFS_VALUE_MASK);
+    const __m256i lo = _mm256_set1_epi64x((long long)sweep->lo);
+    const __m256i span = _mm256_xor_si256(_mm256_set1_epi64x((long long)sweep->span), sign);
+
+    for (; end - p >= 4 && !sweep->stop; p += 4) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)p), mask);
+        __m256i d = _mm256_xor_si256(_mm256_sub_epi64(v, lo), sign);
+        uint32_t outside = (uint32_t)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(d, span)));
+        if (likely(outside == 0xF)) continue;
+
+        for (uint32_t inside = ~outside & 0xF; inside && !sweep->stop; inside &= inside - 1) {
+            const uint64_t *slot = p + __builtin_ctz(inside);
+            sr_refs_match(sweep, slot, *slot & SR_REFS_VALUE_MASK);
+        }
+    }
+
+    return p;
+}
+
+static const uint64_t *
+sr_refs_sweep_vector(struct sr_refs_sweep *sweep, const uint64_t *p, const uint64_t *end) {
+    if (__builtin_cpu_supports("avx2")) {
+        return sr_refs_sweep_avx2(sweep, p, end);
+    }
+
+    // SSE2 has no 64-bit compares; the scalar loop is as fast
+    return p;
+}
+
+#elif defined(__arm64__) || defined(__aarch64__)
+
+static const uint64_t *
+sr_refs_sweep_vector(struct sr_refs_sweep *sweep, const uint64_t *p, const uint64_t *end) {
+    const uint64x2_t mask = vdupq_n_u64(SR_REFS_VALUE_MASK);
+    const uint64x2_t lo = vdupq_n_u64(sweep->lo);
+    const uint64x2_t span = vdupq_n_u64(sweep->span);
+
+    for (; end - p >= 4 && !sweep->stop; p += 4) {
+        uint64x2_t d0 = vsubq_u64(vandq_u64(vld1q_u64(p), mask), lo);
+        uint64x2_t d1 = vsubq_u64(vandq_u64(vld1q_u64(p + 2), mask), lo);
+        uint64x2_t inside = vorrq_u64(vcleq_u64(d0, span), vcleq_u64(d1, span));
+        if (likely(!(vgetq_lane_u64(inside, 0) | vgetq_lane_u64(inside, 1)))) continue;
+
+        for (uint32_t i = 0; i < 4 && !sweep->stop; ++i) {
+            sr_refs_check(sweep, p + i);
+        }
+    }
+
+    return p;
+}
+
+#else
+
+static const uint64_t *
+sr_refs_sweep_vector(struct sr_refs_sweep *sweep, const uint64_t *p, const uint64_t *end) {
+    return p;
+}
+
+#endif
+
+static void
+sr_refs_sweep_range(struct sr_refs_sweep *sweep, uintptr_t lo, uintptr_t hi) {
+    lo = (lo + sizeof(uint64_t) - 1) & ~(uintptr_t)(sizeof(uint64_t) - 1);
+    if (lo >= hi || hi - lo < sizeof(uint64_t)) {
+        return;
+    }
+
+    const uint64_t *p = (const uint64_t *)lo;
+    const uint64_t *end = p + (hi - lo) / sizeof(uint64_t);
+    p = sr_refs_sweep_vector(sweep, p, end);
+    for (; p < end && !sweep->stop; ++p) {
+        sr_refs_check(sweep, p);
+    }
+}
+
+// Sections with initialized data, outside __TEXT
+SR_INLINE bool
+sr_refs_section(section_t sec) {
+    switch (sec->flags & SECTION_TYPE) {
+        case S_ZEROFILL:
+        case S_GB_ZEROFILL:
+        case S_THREAD_LOCAL_ZEROFILL:
+            return false;
+    }
+
+    if (sr_section_is_code(sec)) {
+        return false;
+    }
+
+    return strncmp(sec->segname, SEG_TEXT, sizeof(sec->segname)) && strncmp(sec->segname, SEG_LINKEDIT, sizeof(sec->segname));
+}
+
+size_t sr_find_pointer_refs(symrez_t symrez, const sr_ptr_t *targets, size_t count, void *context, sr_pointer_ref_function_t callback) {
+    // A snapshot's data holds another task's addresses, unslid and unbound
+    if (unlikely(symrez->snapshot)) {
+        return SR_COUNT_ERROR;
+    }
+
+    if (unlikely(!count)) {
+        return 0;
+    }
+
+    struct sr_refs_target *sorted = sr_alloc(symrez, count * sizeof(struct sr_refs_target));
+    struct sr_refs_sweep *sweep = sr_calloc(symrez, sizeof(struct sr_refs_sweep));
+    if (unlikely(!sorted || !sweep)) {
+        sr_dealloc(symrez, sorted);
+        sr_dealloc(symrez, sweep);
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        sorted[i].value = (uint64_t)targets[i] & SR_REFS_VALUE_MASK;
+        sorted[i].index = i;
+
+        uint32_t h = sr_refs_hash(sorted[i].value);
+        sweep->bitmap[h >> 6] |= 1ULL << (h & 63);
+    }
+    qsort(sorted, count, sizeof(struct sr_refs_target), sr_refs_target_cmp);
+
+    sweep->targets = sorted;
+    sweep->ntargets = count;
+    sweep->lo = sorted[0].value;
+    sweep->span = sorted[count - 1].value - sorted[0].value;
+    sweep->given = targets;
+    sweep->context = context;
+    sweep->callback = callback;
+
+    for (uint32_t i = 1; i < symrez->nordinals && !sweep->stop; ++i) {
+        section_t sec = symrez->ordinals[i];
+        if (!sec || !sr_refs_section(sec)) continue;
+
+        uintptr_t lo = (uintptr_t)(sec->addr + symrez->slide);
+        sr_refs_sweep_range(sweep, lo, lo + sec->size);
+    }
+
+    size_t found = sweep->found;
+    sr_dealloc(symrez, sorted);
+    sr_dealloc(symrez, sweep);
+    return found;
+}
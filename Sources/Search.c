@@ -0,0 +1,310 @@
+//
+//  Search.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+#include <fnmatch.h>
+
+/*
+ The string table is one blob of NUL terminated names, so finding every
+ name containing a needle is a single memmem pass over it instead of a
+ strstr per symbol. Hits are mapped back to symbols through the strx
+ index: (strx, nlist index) pairs sorted by strx, built on first use.
+ Every symbol whose name starts between the start of the hit's string and
+ the hit contains the needle, which also covers names sharing the tail of
+ a longer string.
+
+ Export names are never rebuilt just to be tested. The trie is walked
+ once, and an edge label is only searched where it could complete a
+ match: its own bytes plus the needle's length minus one before them.
+ Everything below an edge that matched matches.
+
+ Globs run the same passes with the pattern's longest literal run as the
+ needle, and fnmatch(3) decides on the candidates. A literal prefix also
+ prunes trie edges that leave it.
+ */
+
+#define SR_SEARCH_MAX_NAME 0x2000
+#define SR_SEARCH_MAX_LITERAL 256
+
+struct sr_search {
+    symrez_t symrez;
+    const char * _Nullable needle;
+    size_t needle_len;
+    const char * _Nullable pattern;
+    char prefix[SR_SEARCH_MAX_LITERAL];
+    size_t prefix_len;
+    void * _Nullable context;
+    symrez_function_t callback;
+    size_t found;
+    bool stop;
+};
+
+static int
+sr_search_u64_cmp(const void *a, const void *b) {
+    uint64_t va = *(const uint64_t *)a;
+    uint64_t vb = *(const uint64_t *)b;
+    return (va > vb) - (va < vb);
+}
+
+// The symbol table entries `sr_for_each` visits
+SR_INLINE bool
+sr_search_listed(symrez_t symrez, nlist64_t nl) {
+    if ((nl->n_type & N_STAB) || nl->n_sect == 0 || ((nl->n_type & N_EXT) && symrez->exports)) {
+        return false;
+    }
+
+    return nl->n_un.n_strx < symrez->strsize;
+}
+
+static bool
+sr_search_build_strx_index(symrez_t symrez) {
+    if (symrez->strx_index) {
+        return true;
+    }
+
+    uint64_t *index = sr_alloc(symrez, (symrez->nsyms ? symrez->nsyms : 1) * sizeof(uint64_t));
+    if (unlikely(!index)) {
+        return false;
+    }
+
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < symrez->nsyms; ++i) {
+        nlist64_t nl = &symrez->symtab[i];
+        if (sr_search_listed(symrez, nl)) {
+            index[count++] = (uint64_t)nl->n_un.n_strx << 32 | i;
+        }
+    }
+
+    qsort(index, count, sizeof(uint64_t), sr_search_u64_cmp);
+    symrez->strx_index = index;
+    symrez->nstrx_index = count;
+    return true;
+}
+
+void sr_search_free(symrez_t symrez) {
+    sr_dealloc(symrez, symrez->strx_index);
+    symrez->strx_index = NULL;
+    symrez->nstrx_index = 0;
+}
+
+SR_INLINE uint32_t
+sr_search_strx_lower_bound(const uint64_t *index, uint32_t count, uint32_t strx) {
+    uint32_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if ((uint32_t)(index[mid] >> 32) < strx) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static void
+sr_search_report(struct sr_search *search, sr_symbol_t name, void *addr) {
+    if (search->pattern && fnmatch(search->pattern, name, 0)) {
+        return;
+    }
+
+    ++search->found;
+    search->stop = search->callback(name, addr, search->context);
+}
+
+// Report listed symbols whose name starts in [lo, hi]
+static void
+sr_search_report_strx(struct sr_search *search, uint32_t lo, uint32_t hi) {
+    symrez_t symrez = search->symrez;
+    const uint64_t *index = symrez->strx_index;
+    uint32_t count = symrez->nstrx_index;
+    char *strtab = symrez->strtab;
+
+    for (uint32_t i = sr_search_strx_lower_bound(index, count, lo); i < count && !search->stop; ++i) {
+        uint32_t strx = (uint32_t)(index[i] >> 32);
+        if (strx > hi) break;
+
+        nlist64_t nl = &symrez->symtab[(uint32_t)index[i]];
+        sr_search_report(search, strtab + strx, (void *)(nl->n_value + symrez->slide));
+    }
+}
+
+static void
+sr_search_strtab(struct sr_search *search) {
+    symrez_t symrez = search->symrez;
+    if (!search->needle) {
+        sr_search_report_strx(search, 0, UINT32_MAX);
+        return;
+    }
+
+    const char *strtab = symrez->strtab;
+    const char *end = strtab + symrez->strsize;
+    const char *string = NULL;
+    const char *string_end = NULL;
+    uint32_t reported = 0;
+
+    const char *p = strtab;
+    while (!search->stop && p < end) {
+        const char *hit = memmem(p, (size_t)(end - p), search->needle, search->needle_len);
+        if (!hit) break;
+
+        // Later hits in the same string only add the names starting after the previous one
+        uint32_t lo = reported;
+        if (hit >= string_end) {
+            string = hit;
+            while (string > strtab && string[-1]) --string;
+            string_end = hit + strnlen(hit, (size_t)(end - hit));
+            lo = (uint32_t)(string - strtab);
+        }
+
+        uint32_t hi = (uint32_t)(hit - strtab);
+        sr_search_report_strx(search, lo, hi);
+        reported = hi + 1;
+        p = hit + 1;
+    }
+}
+
+// Does the prefix still hold with `sym[len, new_len)` appended
+SR_INLINE bool
+sr_search_prefix_holds(const struct sr_search *search, const char *sym, size_t len, size_t new_len) {
+    if (len >= search->prefix_len) {
+        return true;
+    }
+
+    size_t n = (new_len < search->prefix_len ? new_len : search->prefix_len) - len;
+    return !memcmp(&sym[len], &search->prefix[len], n);
+}
+
+// Is there a match ending in `sym[len, new_len)`
+SR_INLINE bool
+sr_search_seam(const struct sr_search *search, const char *sym, size_t len, size_t new_len) {
+    size_t from = len + 1 >= search->needle_len ? len + 1 - search->needle_len : 0;
+    return memmem(&sym[from], new_len - from, search->needle, search->needle_len) != NULL;
+}
+
+static void
+sr_search_node(struct sr_search *search, const uint8_t *node, char *sym, size_t len, bool matched) {
+    symrez_t symrez = search->symrez;
+    const uint8_t *p = node;
+    uintptr_t terminal_size = read_uleb128((void **)&p);
+    const uint8_t *children = p + terminal_size;
+
+    if (terminal_size && matched) {
+        sr_search_report(search, sym, sr_export_address(symrez, p, sym));
+    }
+
+    p = children;
+    for (uint8_t child_count = *p++; child_count > 0 && !search->stop; --child_count) {
+        const char *label = (const char *)p;
+        size_t label_len = strlen(label);
+        p += label_len + 1;
+
+        uintptr_t offset = read_uleb128((void **)&p);
+        if (unlikely(!offset || len + label_len >= SR_SEARCH_MAX_NAME)) continue;
+
+        size_t new_len = len + label_len;
+        memcpy(&sym[len], label, label_len + 1);
+        if (!sr_search_prefix_holds(search, sym, len, new_len)) continue;
+
+        bool child_matched = matched || sr_search_seam(search, sym, len, new_len);
+        sr_search_node(search, (const uint8_t *)symrez->exports + offset, sym, new_len, child_matched);
+    }
+}
+
+static size_t
+sr_search_run(struct sr_search *search) {
+    symrez_t symrez = search->symrez;
+    if (unlikely(!sr_search_build_strx_index(symrez))) {
+        return 0;
+    }
+
+    sr_search_strtab(search);
+
+    if (!search->stop && symrez->exports_size) {
+        char sym[SR_SEARCH_MAX_NAME] = {0};
+        sr_search_node(search, symrez->exports, sym, 0, !search->needle);
+    }
+
+    return search->found;
+}
+
+size_t sr_search_substring(symrez_t symrez, const char *needle, void *context, symrez_function_t callback) {
+    struct sr_search search = {
+        .symrez = symrez,
+        .needle = *needle ? needle : NULL,
+        .needle_len = strlen(needle),
+        .context = context,
+        .callback = callback,
+    };
+
+    return sr_search_run(&search);
+}
+
+// Longest run of literal characters in a fnmatch(3) pattern, unescaped, and the run it starts with.
+// Runs are cut at `SR_SEARCH_MAX_LITERAL - 1` bytes, which keeps them literal
+static size_t
+sr_search_glob_literal(const char *pattern, char *best, char *prefix, size_t *prefix_len) {
+    char run[SR_SEARCH_MAX_LITERAL];
+    size_t run_len = 0, best_len = 0;
+    bool leading = true;
+
+    for (const char *p = pattern;;) {
+        char c = *p;
+        if (!c || c == '*' || c == '?' || c == '[') {
+            if (run_len > best_len) {
+                memcpy(best, run, run_len);
+                best_len = run_len;
+            }
+            if (leading) {
+                memcpy(prefix, run, run_len);
+                *prefix_len = run_len;
+                leading = false;
+            }
+            if (!c) break;
+
+            run_len = 0;
+            if (c == '[') {
+                ++p;
+                if (*p == '!') ++p;
+                if (*p == ']') ++p;
+                while (*p && *p != ']') ++p;
+                if (*p) ++p;
+            } else {
+                ++p;
+            }
+            continue;
+        }
+
+        if (c == '\\' && p[1]) {
+            c = *++p;
+        }
+
+        if (run_len < SR_SEARCH_MAX_LITERAL - 1) {
+            run[run_len++] = c;
+        }
+        ++p;
+    }
+
+    best[best_len] = '\0';
+    return best_len;
+}
+
+size_t sr_search_glob(symrez_t symrez, const char *pattern, void *context, symrez_function_t callback) {
+    struct sr_search search = {
+        .symrez = symrez,
+        .pattern = pattern,
+        .context = context,
+        .callback = callback,
+    };
+
+    char literal[SR_SEARCH_MAX_LITERAL];
+    search.needle_len = sr_search_glob_literal(pattern, literal, search.prefix, &search.prefix_len);
+    search.needle = search.needle_len ? literal : NULL;
+
+    return sr_search_run(&search);
+}
@@ -0,0 +1,183 @@
+//
+//  Sections.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ Every section, plus every segment without sections (__LINKEDIT, etc.), is
+ flattened into one array of unslid [start, end) ranges sorted by start.
+ Ranges never overlap, so classifying an address is a single binary search.
+ */
+
+static int
+sr_section_range_cmp(const void *a, const void *b) {
+    const struct sr_section_range *ra = a;
+    const struct sr_section_range *rb = b;
+    if (ra->start < rb->start) return -1;
+    return ra->start > rb->start;
+}
+
+bool sr_sections_build(symrez_t symrez) {
+    const struct sr_image *image = &symrez->image;
+    uint32_t count = 0;
+    uint32_t nsects = image->nsects;
+
+    for (uint32_t i = 0; i < image->nsegments; ++i) {
+        segment_command_t seg = image->segments[i];
+        count += seg->nsects ? seg->nsects : (seg->vmsize != 0);
+    }
+
+    symrez->sections = NULL;
+    symrez->nsections = 0;
+    symrez->ordinals = NULL;
+    symrez->nordinals = 0;
+    if (unlikely(!count)) {
+        return true;
+    }
+
+    // One allocation: the sorted ranges followed by the sections in
+    // load command order, indexable by nlist n_sect (1-based)
+    size_t ranges_size = count * sizeof(struct sr_section_range);
+    struct sr_section_range *ranges = sr_alloc(symrez, ranges_size + (nsects + 1) * sizeof(section_t));
+    if (unlikely(!ranges)) {
+        return false;
+    }
+
+    section_t *ordinals = (section_t *)((uint8_t *)ranges + ranges_size);
+    uint32_t ordinal = 0;
+    ordinals[0] = NULL;
+
+    struct sr_section_range *r = ranges;
+    for (uint32_t i = 0; i < image->nsegments; ++i) {
+        segment_command_t seg = image->segments[i];
+        if (!seg->nsects) {
+            if (!seg->vmsize) continue;
+            r->start = seg->vmaddr;
+            r->end = seg->vmaddr + seg->vmsize;
+            r->segment = seg;
+            r->section = NULL;
+            r->ordinal = 0;
+            ++r;
+            continue;
+        }
+
+        section_t sec = (section_t)((uint64_t)seg + sizeof(struct segment_command_64));
+        for (const section_t end = &sec[seg->nsects]; sec < end; ++sec) {
+            r->start = sec->addr;
+            r->end = sec->addr + sec->size;
+            r->segment = seg;
+            r->section = sec;
+            r->ordinal = ++ordinal;
+            ++r;
+            ordinals[ordinal] = sec;
+        }
+    }
+
+    qsort(ranges, count, sizeof(struct sr_section_range), sr_section_range_cmp);
+    symrez->sections = ranges;
+    symrez->nsections = count;
+    symrez->ordinals = ordinals;
+    symrez->nordinals = nsects + 1;
+    return true;
+}
+
+const struct sr_section_range *
+sr_sections_lookup(symrez_t symrez, sr_ptr_t ptr) {
+    uint64_t addr = (uint64_t)sr_strip_ptr(ptr) - symrez->slide;
+    const struct sr_section_range *base = symrez->sections;
+    uint32_t n = symrez->nsections;
+
+    if (unlikely(!n || addr < base->start)) {
+        return NULL;
+    }
+
+    // Find the last range starting at or before `addr`
+    while (n > 1) {
+        uint32_t half = n / 2;
+        if (base[half].start <= addr) {
+            base += half;
+            n -= half;
+        } else {
+            n = half;
+        }
+    }
+
+    return addr < base->end ? base : NULL;
+}
+
+bool sr_section_for_address(symrez_t symrez, sr_ptr_t addr, sr_section_info_t *info) {
+    const struct sr_section_range *r = sr_sections_lookup(symrez, addr);
+    if (unlikely(!r)) {
+        return false;
+    }
+
+    if (info) {
+        memcpy(info->segname, r->segment->segname, sizeof(r->segment->segname));
+        info->segname[sizeof(r->segment->segname)] = '\0';
+        info->sectname[0] = '\0';
+        info->flags = 0;
+        info->protection = r->segment->initprot;
+        info->start = (sr_ptr_t)(r->start + symrez->slide);
+        info->size = r->end - r->start;
+
+        if (likely(r->section)) {
+            memcpy(info->sectname, r->section->sectname, sizeof(r->section->sectname));
+            info->sectname[sizeof(r->section->sectname)] = '\0';
+            info->flags = r->section->flags;
+        }
+    }
+
+    return true;
+}
+
+void sr_filter_compile(symrez_t symrez, const sr_filter_t *filter, struct sr_filter_state *state) {
+    memset(state, 0, sizeof(*state));
+    state->mask = filter ? filter->mask : SR_FILTER_ALL;
+
+    const char *segname = filter ? filter->segname : NULL;
+    const char *sectname = filter ? filter->sectname : NULL;
+    uint32_t kinds = state->mask & (SR_FILTER_CODE | SR_FILTER_DATA);
+    if (!segname && !sectname && kinds == (SR_FILTER_CODE | SR_FILTER_DATA)) {
+        return;
+    }
+
+    state->by_section = true;
+    for (uint32_t i = 1; i < symrez->nordinals && i <= MAX_SECT; ++i) {
+        section_t sec = symrez->ordinals[i];
+        if (segname && strncmp(sec->segname, segname, sizeof(sec->segname))) continue;
+        if (sectname && strncmp(sec->sectname, sectname, sizeof(sec->sectname))) continue;
+        if (!(kinds & (sr_section_is_code(sec) ? SR_FILTER_CODE : SR_FILTER_DATA))) continue;
+        state->sections[i >> 6] |= (1ULL << (i & 63));
+    }
+}
+
+bool sr_filter_export_terminal(symrez_t symrez, const struct sr_filter_state *state, const uint8_t *terminal) {
+    const uint8_t *p = terminal;
+    uint64_t flags = read_uleb128((void**)&p);
+
+    // Re-exports live in another image, so only the source bit applies
+    if (flags & EXPORT_SYMBOL_FLAGS_REEXPORT) {
+        return state->mask & SR_FILTER_REEXPORTS;
+    }
+
+    if (!(state->mask & SR_FILTER_EXPORTS)) {
+        return false;
+    }
+
+    if (likely(!state->by_section)) {
+        return true;
+    }
+
+    if ((flags & EXPORT_SYMBOL_FLAGS_KIND_MASK) == EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE) {
+        return false;
+    }
+
+    uint64_t offset = read_uleb128((void**)&p);
+    const struct sr_section_range *r = sr_sections_lookup(symrez, (sr_ptr_t)((uint64_t)symrez->header + offset));
+    return r && sr_filter_section(state, r->ordinal);
+}
@@ -0,0 +1,329 @@
+//
+//  Signature.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__arm64__) || defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/*
+ Every signature is reduced to an anchor: its first pair of fully masked
+ bytes (or its first fully masked byte). A pass over the range compares a
+ vector of bytes, and the same vector shifted by one, against each anchor;
+ only positions where both match are checked against the whole masked
+ signature. All signatures are tested against each vector before moving
+ on, so the range is read once however many there are.
+ */
+
+struct sr_sig_plan {
+    const uint8_t *pattern;
+    const uint8_t *mask;
+    size_t size;
+    size_t anchor;
+    uint8_t b0;
+    uint8_t b1;
+    bool pair;
+    uint32_t index;
+};
+
+struct sr_sig_scan {
+    const struct sr_sig_plan *plans;
+    uint32_t nplans;
+    sr_signature_match_t *out;
+    size_t cap;
+    size_t found;
+};
+
+static bool
+sr_sig_plan_init(struct sr_sig_plan *plan, const sr_signature_t *sig, uint32_t index) {
+    plan->pattern = sig->pattern;
+    plan->mask = sig->mask;
+    plan->size = sig->size;
+    plan->index = index;
+
+    size_t single = SIZE_MAX;
+    for (size_t i = 0; i < sig->size; ++i) {
+        bool solid = !sig->mask || sig->mask[i] == 0xFF;
+        if (!solid) continue;
+
+        if (i + 1 < sig->size && (!sig->mask || sig->mask[i + 1] == 0xFF)) {
+            plan->anchor = i;
+            plan->b0 = sig->pattern[i];
+            plan->b1 = sig->pattern[i + 1];
+            plan->pair = true;
+            return true;
+        }
+
+        if (single == SIZE_MAX) {
+            single = i;
+        }
+    }
+
+    // All wildcards would match everywhere
+    if (single == SIZE_MAX) {
+        return false;
+    }
+
+    plan->anchor = single;
+    plan->b0 = sig->pattern[single];
+    plan->b1 = 0;
+    plan->pair = false;
+    return true;
+}
+
+SR_INLINE bool
+sr_sig_verify(const struct sr_sig_plan *plan, const uint8_t *p) {
+    const uint8_t *pattern = plan->pattern;
+    const uint8_t *mask = plan->mask;
+    if (!mask) {
+        return !memcmp(p, pattern, plan->size);
+    }
+
+    for (size_t i = 0; i < plan->size; ++i) {
+        if ((p[i] ^ pattern[i]) & mask[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// `pos` is where the anchor matched, in [lo, hi)
+SR_INLINE void
+sr_sig_candidate(struct sr_sig_scan *scan, const struct sr_sig_plan *plan, const uint8_t *lo, const uint8_t *hi, const uint8_t *pos) {
+    if (unlikely((size_t)(pos - lo) < plan->anchor)) {
+        return;
+    }
+
+    const uint8_t *start = pos - plan->anchor;
+    if (unlikely((size_t)(hi - start) < plan->size) || !sr_sig_verify(plan, start)) {
+        return;
+    }
+
+    if (scan->found < scan->cap) {
+        scan->out[scan->found].addr = (sr_ptr_t)start;
+        scan->out[scan->found].signature = plan->index;
+    }
+    ++scan->found;
+}
+
+static void
+sr_sig_scan_scalar(struct sr_sig_scan *scan, const uint8_t *lo, const uint8_t *hi, const uint8_t *from) {
+    for (const uint8_t *p = from; p < hi; ++p) {
+        for (uint32_t i = 0; i < scan->nplans; ++i) {
+            const struct sr_sig_plan *plan = &scan->plans[i];
+            if (*p != plan->b0) continue;
+            if (plan->pair && (p + 1 >= hi || p[1] != plan->b1)) continue;
+            sr_sig_candidate(scan, plan, lo, hi, p);
+        }
+    }
+}
+
+SR_INLINE void
+sr_sig_scan_bits(struct sr_sig_scan *scan, const struct sr_sig_plan *plan, const uint8_t *lo, const uint8_t *hi, const uint8_t *p, uint64_t bits) {
+    while (bits) {
+        sr_sig_candidate(scan, plan, lo, hi, p + __builtin_ctzll(bits));
+        bits &= bits - 1;
+    }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static const uint8_t *
+sr_sig_scan_avx2(struct sr_sig_scan *scan, const uint8_t *lo, const uint8_t *hi) {
+    const uint8_t *p = lo;
+    for (; hi - p > 32; p += 32) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 1));
+        for (uint32_t i = 0; i < scan->nplans; ++i) {
+            const struct sr_sig_plan *plan = &scan->plans[i];
+            __m256i eq = _mm256_cmpeq_epi8(v0, _mm256_set1_epi8((char)plan->b0));
+            if (plan->pair) {
+                eq = _mm256_and_si256(eq, _mm256_cmpeq_epi8(v1, _mm256_set1_epi8((char)plan->b1)));
+            }
+            uint32_t bits = (uint32_t)_mm256_movemask_epi8(eq);
+            sr_sig_scan_bits(scan, plan, lo, hi, p, bits);
+        }
+    }
+
+    return p;
+}
+
+static const uint8_t *
+sr_sig_scan_sse2(struct sr_sig_scan *scan, const uint8_t *lo, const uint8_t *hi) {
+    const uint8_t *p = lo;
+    for (; hi - p > 16; p += 16) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)p);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(p + 1));
+        for (uint32_t i = 0; i < scan->nplans; ++i) {
+            const struct sr_sig_plan *plan = &scan->plans[i];
+            __m128i eq = _mm_cmpeq_epi8(v0, _mm_set1_epi8((char)plan->b0));
+            if (plan->pair) {
+                eq = _mm_and_si128(eq, _mm_cmpeq_epi8(v1, _mm_set1_epi8((char)plan->b1)));
+            }
+            uint32_t bits = (uint32_t)_mm_movemask_epi8(eq);
+            sr_sig_scan_bits(scan, plan, lo, hi, p, bits);
+        }
+    }
+
+    return p;
+}
+
+static const uint8_t *
+sr_sig_scan_vector(struct sr_sig_scan *scan, const uint8_t *lo, const uint8_t *hi) {
+    if (__builtin_cpu_supports("avx2")) {
+        return sr_sig_scan_avx2(scan, lo, hi);
+    }
+
+    return sr_sig_scan_sse2(scan, lo, hi);
+}
+
+#elif defined(__arm64__) || defined(__aarch64__)
+
+static const uint8_t *
+sr_sig_scan_vector(struct sr_sig_scan *scan, const uint8_t *lo, const uint8_t *hi) {
+    const uint8_t *p = lo;
+    for (; hi - p > 16; p += 16) {
+        uint8x16_t v0 = vld1q_u8(p);
+        uint8x16_t v1 = vld1q_u8(p + 1);
+        for (uint32_t i = 0; i < scan->nplans; ++i) {
+            const struct sr_sig_plan *plan = &scan->plans[i];
+            uint8x16_t eq = vceqq_u8(v0, vdupq_n_u8(plan->b0));
+            if (plan->pair) {
+                eq = vandq_u8(eq, vceqq_u8(v1, vdupq_n_u8(plan->b1)));
+            }
+
+            // Narrow each byte to a nibble: 4 bits per lane in a 64-bit mask
+            uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            if (!nibbles) continue;
+
+            uint64_t bits = 0;
+            for (; nibbles; nibbles &= nibbles - 1) {
+                bits |= 1ull << (__builtin_ctzll(nibbles) >> 2);
+            }
+            sr_sig_scan_bits(scan, plan, lo, hi, p, bits);
+        }
+    }
+
+    return p;
+}
+
+#else
+
+static const uint8_t *
+sr_sig_scan_vector(struct sr_sig_scan *scan, const uint8_t *lo, const uint8_t *hi) {
+    return lo;
+}
+
+#endif
+
+static void
+sr_sig_scan_range(struct sr_sig_scan *scan, const uint8_t *lo, const uint8_t *hi) {
+    if (unlikely(lo >= hi)) {
+        return;
+    }
+
+    const uint8_t *p = sr_sig_scan_vector(scan, lo, hi);
+    sr_sig_scan_scalar(scan, lo, hi, p);
+}
+
+SR_INLINE bool
+sr_sig_section_matches(section_t sec, const char * _Nullable sectname) {
+    switch (sec->flags & SECTION_TYPE) {
+        case S_ZEROFILL:
+        case S_GB_ZEROFILL:
+        case S_THREAD_LOCAL_ZEROFILL:
+            return false;
+    }
+
+    if (!sectname) {
+        return sr_section_is_code(sec);
+    }
+
+    return !strncmp(sec->sectname, sectname, sizeof(sec->sectname));
+}
+
+size_t sr_find_signatures(symrez_t symrez, const sr_signature_t *signatures, size_t count, const sr_signature_scope_t *scope, sr_signature_match_t *out, size_t cap) {
+    struct sr_sig_plan *plans = sr_alloc(symrez, (count ? count : 1) * sizeof(struct sr_sig_plan));
+    if (unlikely(!plans)) {
+        return 0;
+    }
+
+    uint32_t nplans = 0;
+    for (size_t i = 0; i < count; ++i) {
+        nplans += sr_sig_plan_init(&plans[nplans], &signatures[i], (uint32_t)i);
+    }
+
+    struct sr_sig_scan scan = {
+        .plans = plans,
+        .nplans = nplans,
+        .out = out,
+        .cap = cap,
+    };
+
+    const char *sectname = scope ? scope->sectname : NULL;
+    uintptr_t window_lo = 0;
+    uintptr_t window_hi = UINTPTR_MAX;
+    if (scope && scope->anchor) {
+        // Unknown anchor: nothing to search around
+        uintptr_t anchor = (uintptr_t)sr_strip_ptr(sr_resolve_symbol(symrez, scope->anchor));
+        window_lo = anchor;
+        window_hi = anchor ? anchor + scope->window : 0;
+    }
+
+    for (uint32_t i = 1; nplans && i < symrez->nordinals; ++i) {
+        section_t sec = symrez->ordinals[i];
+        if (!sr_sig_section_matches(sec, sectname)) continue;
+
+        uintptr_t lo = (uintptr_t)(sec->addr + symrez->slide);
+        uintptr_t hi = lo + sec->size;
+        if (lo < window_lo) lo = window_lo;
+        if (hi > window_hi) hi = window_hi;
+
+        sr_sig_scan_range(&scan, (const uint8_t *)lo, (const uint8_t *)hi);
+    }
+
+    sr_dealloc(symrez, plans);
+    return scan.found;
+}
+
+size_t sr_find_signature(symrez_t symrez, const uint8_t *pattern, const uint8_t *mask, size_t size, const char *section, sr_ptr_t *out, size_t cap) {
+    sr_signature_t sig = { .pattern = pattern, .mask = mask, .size = size };
+    sr_signature_scope_t scope = { .sectname = section };
+    sr_signature_match_t *matches = NULL;
+    if (cap && unlikely(!(matches = sr_alloc(symrez, cap * sizeof(sr_signature_match_t))))) {
+        return 0;
+    }
+
+    size_t total = sr_find_signatures(symrez, &sig, 1, &scope, matches, cap);
+    for (size_t i = 0; i < total && i < cap; ++i) {
+        out[i] = matches[i].addr;
+    }
+
+    sr_dealloc(symrez, matches);
+    return total;
+}
+
+sr_ptr_t sr_resolve_symbol_or_signature(symrez_t symrez, const char *symbol, const sr_signature_t *signature, const sr_signature_scope_t *scope) {
+    sr_ptr_t addr = sr_resolve_symbol(symrez, symbol);
+    if (likely(addr)) {
+        return addr;
+    }
+
+    // Only trust a signature that is unique in scope
+    sr_signature_match_t match;
+    if (sr_find_signatures(symrez, signature, 1, scope, &match, 1) != 1) {
+        return NULL;
+    }
+
+    return sr_sign_symbol(symrez, match.addr);
+}
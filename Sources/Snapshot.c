@@ -0,0 +1,672 @@
+//
+//  Snapshot.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ A snapshot is a file plus a sorted list of (remote vmaddr -> file range)
+ regions, either the LC_SEGMENT_64s of an MH_CORE file or a map supplied by
+ the caller. The file is mapped once, read only; nothing is read until an
+ address in it is touched.
+
+ Images are given a private "view": a reservation as large as the image's
+ VM span, with the regions it overlaps mapped into it at the same relative
+ offsets. Inside a view the image looks exactly like a loaded one, just with
+ a different slide, so the regular symrez code paths work unchanged.
+ Pointers stored in the image still hold addresses in the other task; use
+ `sr_snapshot_read` / `sr_snapshot_remote_address` to cross over.
+
+ A dyld shared cache is opened the same way, with its mappings as regions
+ and its image table as the image list. Cache images are spread over every
+ mapping, so they all share one view of the whole cache instead.
+ */
+
+// The parts of dyld's cache header (dyld_cache_format.h) needed to find images
+struct sr_cache_header {
+    char magic[16];
+    uint32_t mappingOffset;
+    uint32_t mappingCount;
+    uint32_t imagesOffsetOld;
+    uint32_t imagesCountOld;
+};
+
+// Newer caches moved the image table here, after fields the reader doesn't need
+#define SR_CACHE_IMAGES_OFFSET 0x1c0
+
+struct sr_cache_mapping {
+    uint64_t address;
+    uint64_t size;
+    uint64_t fileOffset;
+    uint32_t maxProt;
+    uint32_t initProt;
+};
+
+struct sr_cache_image {
+    uint64_t address;
+    uint64_t modTime;
+    uint64_t inode;
+    uint32_t pathFileOffset;
+    uint32_t pad;
+};
+
+struct sr_snapshot_image {
+    uint64_t address;
+    uint64_t path;
+    uint64_t lo;
+    uint8_t *view;
+    size_t view_size;
+    symrez_t symrez;
+};
+
+struct sr_snapshot {
+    int fd;
+    const uint8_t *file;
+    size_t file_size;
+    sr_snapshot_region_t *regions;
+    uint32_t nregions;
+    bool images_loaded;
+    struct sr_snapshot_image *images;
+    uint32_t nimages;
+    uint32_t images_cap;
+    size_t page_size;
+    bool shared;
+    uint8_t *view;
+    size_t view_size;
+    uint64_t lo;
+};
+
+static int
+sr_snapshot_region_cmp(const void *a, const void *b) {
+    const sr_snapshot_region_t *ra = a;
+    const sr_snapshot_region_t *rb = b;
+    if (ra->vmaddr < rb->vmaddr) return -1;
+    return ra->vmaddr > rb->vmaddr;
+}
+
+SR_INLINE const sr_snapshot_region_t *
+sr_snapshot_region_for(sr_snapshot_t snapshot, uint64_t addr) {
+    const sr_snapshot_region_t *base = snapshot->regions;
+    uint32_t n = snapshot->nregions;
+    if (unlikely(!n || addr < base->vmaddr)) {
+        return NULL;
+    }
+
+    while (n > 1) {
+        uint32_t half = n / 2;
+        if (base[half].vmaddr <= addr) {
+            base += half;
+            n -= half;
+        } else {
+            n = half;
+        }
+    }
+
+    return (addr - base->vmaddr) < base->size ? base : NULL;
+}
+
+const void *sr_snapshot_read(sr_snapshot_t snapshot, uint64_t addr, size_t size) {
+    const sr_snapshot_region_t *r = sr_snapshot_region_for(snapshot, addr);
+    if (unlikely(!r || (addr - r->vmaddr) + size > r->size)) {
+        return NULL;
+    }
+
+    return snapshot->file + r->fileoff + (addr - r->vmaddr);
+}
+
+// NUL terminated string fully inside one region
+static const char *
+sr_snapshot_read_string(sr_snapshot_t snapshot, uint64_t addr) {
+    const sr_snapshot_region_t *r = sr_snapshot_region_for(snapshot, addr);
+    if (unlikely(!r)) {
+        return NULL;
+    }
+
+    const char *str = (const char *)snapshot->file + r->fileoff + (addr - r->vmaddr);
+    size_t max = r->size - (addr - r->vmaddr);
+    return memchr(str, '\0', max) ? str : NULL;
+}
+
+static sr_snapshot_t
+sr_snapshot_create(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (unlikely(fd < 0)) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (unlikely(fstat(fd, &st) || st.st_size < (off_t)sizeof(struct mach_header_64))) {
+        close(fd);
+        return NULL;
+    }
+
+    void *file = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (unlikely(file == MAP_FAILED)) {
+        close(fd);
+        return NULL;
+    }
+
+    sr_snapshot_t snapshot = calloc(1, sizeof(struct sr_snapshot));
+    if (unlikely(!snapshot)) {
+        munmap(file, (size_t)st.st_size);
+        close(fd);
+        return NULL;
+    }
+
+    snapshot->fd = fd;
+    snapshot->file = file;
+    snapshot->file_size = (size_t)st.st_size;
+    snapshot->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    return snapshot;
+}
+
+// Drop regions that point outside the file and sort the rest
+static void
+sr_snapshot_finish_regions(sr_snapshot_t snapshot) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < snapshot->nregions; ++i) {
+        sr_snapshot_region_t r = snapshot->regions[i];
+        if (r.fileoff >= snapshot->file_size || !r.size) continue;
+        if (r.size > snapshot->file_size - r.fileoff) {
+            r.size = snapshot->file_size - r.fileoff;
+        }
+        snapshot->regions[n++] = r;
+    }
+
+    snapshot->nregions = n;
+    qsort(snapshot->regions, n, sizeof(sr_snapshot_region_t), sr_snapshot_region_cmp);
+}
+
+// Whether [addr, addr + size) is fully present, possibly across adjacent regions
+static bool
+sr_snapshot_covers(sr_snapshot_t snapshot, uint64_t addr, uint64_t size) {
+    uint64_t end = addr + size;
+    while (addr < end) {
+        const sr_snapshot_region_t *r = sr_snapshot_region_for(snapshot, addr);
+        if (unlikely(!r)) {
+            return false;
+        }
+        addr = r->vmaddr + r->size;
+    }
+
+    return true;
+}
+
+static uint64_t
+sr_snapshot_fileoff_to_vmaddr(sr_snapshot_t snapshot, uint64_t fileoff) {
+    for (uint32_t i = 0; i < snapshot->nregions; ++i) {
+        const sr_snapshot_region_t *r = &snapshot->regions[i];
+        if (fileoff >= r->fileoff && fileoff - r->fileoff < r->size) {
+            return r->vmaddr + (fileoff - r->fileoff);
+        }
+    }
+
+    return 0;
+}
+
+static bool sr_snapshot_add_image(sr_snapshot_t snapshot, uint64_t address, uint64_t path);
+
+static sr_snapshot_t
+sr_snapshot_open_cache(sr_snapshot_t snapshot) {
+    const struct sr_cache_header *hdr = (const void *)snapshot->file;
+    if (unlikely(hdr->mappingOffset > snapshot->file_size ||
+                 hdr->mappingCount > (snapshot->file_size - hdr->mappingOffset) / sizeof(struct sr_cache_mapping))) {
+        sr_snapshot_close(snapshot);
+        return NULL;
+    }
+
+    uint32_t count = hdr->mappingCount;
+    snapshot->regions = malloc((count ? count : 1) * sizeof(sr_snapshot_region_t));
+    if (unlikely(!snapshot->regions)) {
+        sr_snapshot_close(snapshot);
+        return NULL;
+    }
+
+    const struct sr_cache_mapping *mappings = (const void *)(snapshot->file + hdr->mappingOffset);
+    for (uint32_t i = 0; i < count; ++i) {
+        sr_snapshot_region_t *r = &snapshot->regions[snapshot->nregions++];
+        r->vmaddr = mappings[i].address;
+        r->size = mappings[i].size;
+        r->fileoff = mappings[i].fileOffset;
+    }
+    sr_snapshot_finish_regions(snapshot);
+
+    uint32_t images_offset = hdr->imagesOffsetOld;
+    uint32_t images_count = hdr->imagesCountOld;
+    if (hdr->mappingOffset >= SR_CACHE_IMAGES_OFFSET + 2 * sizeof(uint32_t)) {
+        const uint32_t *images = (const void *)(snapshot->file + SR_CACHE_IMAGES_OFFSET);
+        if (images[1]) {
+            images_offset = images[0];
+            images_count = images[1];
+        }
+    }
+
+    snapshot->shared = true;
+    snapshot->images_loaded = true;
+    if (unlikely(images_offset > snapshot->file_size ||
+                 images_count > (snapshot->file_size - images_offset) / sizeof(struct sr_cache_image))) {
+        return snapshot;
+    }
+
+    const struct sr_cache_image *images = (const void *)(snapshot->file + images_offset);
+    for (uint32_t i = 0; i < images_count; ++i) {
+        uint64_t path = sr_snapshot_fileoff_to_vmaddr(snapshot, images[i].pathFileOffset);
+        if (unlikely(!sr_snapshot_add_image(snapshot, images[i].address, path))) {
+            break;
+        }
+    }
+
+    return snapshot;
+}
+
+sr_snapshot_t sr_snapshot_open(const char *path) {
+    sr_snapshot_t snapshot = sr_snapshot_create(path);
+    if (unlikely(!snapshot)) {
+        return NULL;
+    }
+
+    if (!strncmp((const char *)snapshot->file, "dyld_v1", 7)) {
+        return sr_snapshot_open_cache(snapshot);
+    }
+
+    mach_header_t mh = (mach_header_t)snapshot->file;
+    if (unlikely(mh->magic != MH_MAGIC_64 || mh->filetype != MH_CORE || !sr_lc_valid(mh, snapshot->file_size))) {
+        sr_snapshot_close(snapshot);
+        return NULL;
+    }
+
+    uint32_t count = 0;
+    mh_for_each_lc(mh, lc) {
+        count += (lc->cmd == LC_SEGMENT_64);
+    }
+
+    snapshot->regions = malloc((count ? count : 1) * sizeof(sr_snapshot_region_t));
+    if (unlikely(!snapshot->regions)) {
+        sr_snapshot_close(snapshot);
+        return NULL;
+    }
+
+    mh_for_each_lc(mh, lc) {
+        if (lc->cmd != LC_SEGMENT_64) continue;
+
+        segment_command_t seg = (segment_command_t)lc;
+        sr_snapshot_region_t *r = &snapshot->regions[snapshot->nregions++];
+        r->vmaddr = seg->vmaddr;
+        r->size = seg->filesize < seg->vmsize ? seg->filesize : seg->vmsize;
+        r->fileoff = seg->fileoff;
+    }
+
+    sr_snapshot_finish_regions(snapshot);
+    return snapshot;
+}
+
+sr_snapshot_t sr_snapshot_open_regions(const char *path, const sr_snapshot_region_t *regions, size_t count) {
+    sr_snapshot_t snapshot = sr_snapshot_create(path);
+    if (unlikely(!snapshot)) {
+        return NULL;
+    }
+
+    snapshot->regions = malloc((count ? count : 1) * sizeof(sr_snapshot_region_t));
+    if (unlikely(!snapshot->regions || count > UINT32_MAX)) {
+        sr_snapshot_close(snapshot);
+        return NULL;
+    }
+
+    memcpy(snapshot->regions, regions, count * sizeof(sr_snapshot_region_t));
+    snapshot->nregions = (uint32_t)count;
+    sr_snapshot_finish_regions(snapshot);
+    return snapshot;
+}
+
+static bool
+sr_snapshot_add_image(sr_snapshot_t snapshot, uint64_t address, uint64_t path) {
+    for (uint32_t i = 0; i < snapshot->nimages; ++i) {
+        if (snapshot->images[i].address == address) {
+            return true;
+        }
+    }
+
+    if (unlikely(snapshot->nimages == snapshot->images_cap)) {
+        uint32_t cap = snapshot->images_cap ? snapshot->images_cap * 2 : 0x100;
+        struct sr_snapshot_image *images = realloc(snapshot->images, cap * sizeof(struct sr_snapshot_image));
+        if (unlikely(!images)) {
+            return false;
+        }
+
+        snapshot->images = images;
+        snapshot->images_cap = cap;
+    }
+
+    struct sr_snapshot_image *img = &snapshot->images[snapshot->nimages++];
+    memset(img, 0, sizeof(*img));
+    img->address = address;
+    img->path = path;
+    return true;
+}
+
+/*
+ Map the remote range [lo, hi) into a fresh reservation. Regions whose file
+ offset doesn't share the page alignment of their place in the view are
+ copied instead of mapped.
+ */
+static uint8_t *
+sr_snapshot_map_span(sr_snapshot_t snapshot, uint64_t lo, uint64_t hi) {
+    size_t page_mask = snapshot->page_size - 1;
+    size_t size = (size_t)(hi - lo);
+    uint8_t *view = mmap(NULL, size, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (unlikely(view == MAP_FAILED)) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < snapshot->nregions; ++i) {
+        const sr_snapshot_region_t *r = &snapshot->regions[i];
+        uint64_t a = r->vmaddr > lo ? r->vmaddr : lo;
+        uint64_t b = (r->vmaddr + r->size) < hi ? (r->vmaddr + r->size) : hi;
+        if (a >= b) continue;
+
+        uint64_t off = r->fileoff + (a - r->vmaddr);
+        uint8_t *dst = view + (a - lo);
+        size_t len = (size_t)(b - a);
+
+        if (likely(!(((uintptr_t)dst | off) & page_mask))) {
+            if (likely(mmap(dst, len, PROT_READ, MAP_PRIVATE | MAP_FIXED, snapshot->fd, (off_t)off) != MAP_FAILED)) {
+                continue;
+            }
+        }
+
+        uint8_t *page = (uint8_t *)((uintptr_t)dst & ~(uintptr_t)page_mask);
+        size_t span = ((uintptr_t)dst + len + page_mask - (uintptr_t)page) & ~page_mask;
+        if (unlikely(mprotect(page, span, PROT_READ | PROT_WRITE))) {
+            munmap(view, size);
+            return NULL;
+        }
+
+        memcpy(dst, snapshot->file + off, len);
+        mprotect(page, span, PROT_READ);
+    }
+
+    return view;
+}
+
+// Every image of a shared cache lives in the one view of the whole cache
+static bool
+sr_snapshot_map_shared(sr_snapshot_t snapshot, struct sr_snapshot_image *img) {
+    if (unlikely(!snapshot->nregions)) {
+        return false;
+    }
+
+    if (!snapshot->view) {
+        const sr_snapshot_region_t *last = &snapshot->regions[snapshot->nregions - 1];
+        size_t page_mask = snapshot->page_size - 1;
+        uint64_t lo = snapshot->regions[0].vmaddr & ~(uint64_t)page_mask;
+        uint64_t hi = (last->vmaddr + last->size + page_mask) & ~(uint64_t)page_mask;
+
+        snapshot->view = sr_snapshot_map_span(snapshot, lo, hi);
+        if (unlikely(!snapshot->view)) {
+            return false;
+        }
+
+        snapshot->lo = lo;
+        snapshot->view_size = (size_t)(hi - lo);
+    }
+
+    img->lo = snapshot->lo;
+    img->view = snapshot->view;
+    img->view_size = snapshot->view_size;
+    return true;
+}
+
+// Map the VM span of the image at `address` (remote) into a view of its own
+static bool
+sr_snapshot_map_image(sr_snapshot_t snapshot, struct sr_snapshot_image *img) {
+    const struct mach_header_64 *mh = sr_snapshot_read(snapshot, img->address, sizeof(struct mach_header_64));
+    if (unlikely(!mh || mh->magic != MH_MAGIC_64)) {
+        return false;
+    }
+
+    size_t size = sizeof(struct mach_header_64) + mh->sizeofcmds;
+    mh = sr_snapshot_read(snapshot, img->address, size);
+    if (unlikely(!mh || !sr_lc_valid(mh, size))) {
+        return false;
+    }
+
+    segment_command_t text = find_lc_segment(mh, SEG_TEXT);
+    segment_command_t linkedit = find_lc_segment(mh, SEG_LINKEDIT);
+    if (unlikely(!text || !linkedit)) {
+        return false;
+    }
+
+    // Without its __LINKEDIT (i.e. in a split cache) an image has no symbols to read
+    intptr_t slide = (intptr_t)(img->address - text->vmaddr);
+    if (unlikely(!sr_snapshot_covers(snapshot, linkedit->vmaddr + slide, linkedit->filesize))) {
+        return false;
+    }
+
+    if (snapshot->shared) {
+        return sr_snapshot_map_shared(snapshot, img);
+    }
+
+    uint64_t lo = UINT64_MAX;
+    uint64_t hi = 0;
+    mh_for_each_lc(mh, lc) {
+        if (lc->cmd != LC_SEGMENT_64) continue;
+
+        segment_command_t seg = (segment_command_t)lc;
+        if (seg->initprot == VM_PROT_NONE || !seg->vmsize) continue;
+        if (seg->vmaddr + slide < lo) lo = seg->vmaddr + slide;
+        if (seg->vmaddr + slide + seg->vmsize > hi) hi = seg->vmaddr + slide + seg->vmsize;
+    }
+
+    size_t page_mask = snapshot->page_size - 1;
+    lo &= ~(uint64_t)page_mask;
+    hi = (hi + page_mask) & ~(uint64_t)page_mask;
+    if (unlikely(lo >= hi)) {
+        return false;
+    }
+
+    uint8_t *view = sr_snapshot_map_span(snapshot, lo, hi);
+    if (unlikely(!view)) {
+        return false;
+    }
+
+    img->lo = lo;
+    img->view = view;
+    img->view_size = (size_t)(hi - lo);
+    return true;
+}
+
+static symrez_t
+sr_snapshot_image_symrez(sr_snapshot_t snapshot, struct sr_snapshot_image *img) {
+    if (likely(img->symrez)) {
+        return img->symrez;
+    }
+
+    if (!img->view && !sr_snapshot_map_image(snapshot, img)) {
+        return NULL;
+    }
+
+    symrez_t symrez = symrez_new_mh((mach_header_t)(img->view + (img->address - img->lo)));
+    if (unlikely(!symrez)) {
+        return NULL;
+    }
+
+    symrez->snapshot = snapshot;
+    img->symrez = symrez;
+    return symrez;
+}
+
+// dyld keeps its dyld_all_image_infos in a section of its own
+static uint64_t
+sr_snapshot_find_all_image_infos(sr_snapshot_t snapshot, struct sr_snapshot_image *dyld) {
+    symrez_t symrez = sr_snapshot_image_symrez(snapshot, dyld);
+    if (unlikely(!symrez)) {
+        return 0;
+    }
+
+    sr_ptr_t local = NULL;
+    for (uint32_t i = 1; i < symrez->nordinals; ++i) {
+        section_t sec = symrez->ordinals[i];
+        if (!strncmp(sec->sectname, "__all_image_info", sizeof(sec->sectname))) {
+            local = (sr_ptr_t)(sec->addr + symrez->slide);
+            break;
+        }
+    }
+
+    if (!local) {
+        local = resolve_local_symbol(symrez, "_dyld_all_image_infos");
+    }
+
+    return local ? (uint64_t)((uint8_t *)local - dyld->view) + dyld->lo : 0;
+}
+
+/*
+ Find dyld by its header at the start of a region, then take the image list
+ from its dyld_all_image_infos. Without one (i.e. a partial snapshot), fall
+ back to every image header found at the start of a region.
+ */
+static void
+sr_snapshot_load_images(sr_snapshot_t snapshot) {
+    if (likely(snapshot->images_loaded)) {
+        return;
+    }
+    snapshot->images_loaded = true;
+
+    int64_t dyld = -1;
+    for (uint32_t i = 0; i < snapshot->nregions; ++i) {
+        const struct mach_header_64 *mh = sr_snapshot_read(snapshot, snapshot->regions[i].vmaddr, sizeof(struct mach_header_64));
+        if (!mh || mh->magic != MH_MAGIC_64 || mh->filetype != MH_DYLINKER) continue;
+
+        if (likely(sr_snapshot_add_image(snapshot, snapshot->regions[i].vmaddr, 0))) {
+            dyld = snapshot->nimages - 1;
+        }
+        break;
+    }
+
+    const struct dyld_all_image_infos *aii = NULL;
+    if (likely(dyld >= 0)) {
+        uint64_t addr = sr_snapshot_find_all_image_infos(snapshot, &snapshot->images[dyld]);
+        aii = addr ? sr_snapshot_read(snapshot, addr, sizeof(struct dyld_all_image_infos)) : NULL;
+    }
+
+    const struct dyld_image_info *infos = NULL;
+    if (likely(aii)) {
+        snapshot->images[dyld].path = (uint64_t)aii->dyldPath;
+        infos = sr_snapshot_read(snapshot, (uint64_t)aii->infoArray, aii->infoArrayCount * sizeof(struct dyld_image_info));
+    }
+
+    if (likely(infos)) {
+        for (uint32_t i = 0; i < aii->infoArrayCount; ++i) {
+            sr_snapshot_add_image(snapshot, (uint64_t)infos[i].imageLoadAddress, (uint64_t)infos[i].imageFilePath);
+        }
+        return;
+    }
+
+    for (uint32_t i = 0; i < snapshot->nregions; ++i) {
+        const struct mach_header_64 *mh = sr_snapshot_read(snapshot, snapshot->regions[i].vmaddr, sizeof(struct mach_header_64));
+        if (!mh || mh->magic != MH_MAGIC_64) continue;
+
+        switch (mh->filetype) {
+            case MH_EXECUTE:
+            case MH_DYLIB:
+            case MH_BUNDLE:
+                sr_snapshot_add_image(snapshot, snapshot->regions[i].vmaddr, 0);
+        }
+    }
+}
+
+uint32_t sr_snapshot_image_count(sr_snapshot_t snapshot) {
+    sr_snapshot_load_images(snapshot);
+    return snapshot->nimages;
+}
+
+uint64_t sr_snapshot_image_address(sr_snapshot_t snapshot, uint32_t image) {
+    sr_snapshot_load_images(snapshot);
+    return image < snapshot->nimages ? snapshot->images[image].address : 0;
+}
+
+const char *sr_snapshot_image_path(sr_snapshot_t snapshot, uint32_t image) {
+    sr_snapshot_load_images(snapshot);
+    if (unlikely(image >= snapshot->nimages || !snapshot->images[image].path)) {
+        return NULL;
+    }
+
+    return sr_snapshot_read_string(snapshot, snapshot->images[image].path);
+}
+
+symrez_t sr_snapshot_symrez(sr_snapshot_t snapshot, uint32_t image) {
+    sr_snapshot_load_images(snapshot);
+    if (unlikely(image >= snapshot->nimages)) {
+        return NULL;
+    }
+
+    return sr_snapshot_image_symrez(snapshot, &snapshot->images[image]);
+}
+
+uint64_t sr_snapshot_remote_address(sr_snapshot_t snapshot, uint32_t image, sr_ptr_t ptr) {
+    if (unlikely(image >= snapshot->nimages)) {
+        return 0;
+    }
+
+    const struct sr_snapshot_image *img = &snapshot->images[image];
+    uintptr_t local = (uintptr_t)sr_strip_ptr(ptr);
+    if (unlikely(!img->view || (local - (uintptr_t)img->view) >= img->view_size)) {
+        return 0;
+    }
+
+    return (uint64_t)(local - (uintptr_t)img->view) + img->lo;
+}
+
+mach_header_t sr_snapshot_find_image(sr_snapshot_t snapshot, const char *image_name) {
+    sr_snapshot_load_images(snapshot);
+
+    // Whole names only: "libobjc" is a prefix of "libobjc-trampolines.dylib" too
+    bool full_path = (*image_name == '/');
+    for (uint32_t i = 0; i < snapshot->nimages; ++i) {
+        const char *path = sr_snapshot_image_path(snapshot, i);
+        if (!path) continue;
+
+        const char *name = path;
+        if (!full_path) {
+            const char *slash = strrchr(path, '/');
+            name = slash ? slash + 1 : path;
+        }
+
+        if (strcmp(name, image_name)) continue;
+
+        symrez_t symrez = sr_snapshot_symrez(snapshot, i);
+        return symrez ? symrez->header : NULL;
+    }
+
+    return NULL;
+}
+
+void sr_snapshot_close(sr_snapshot_t snapshot) {
+    for (uint32_t i = 0; i < snapshot->nimages; ++i) {
+        struct sr_snapshot_image *img = &snapshot->images[i];
+        if (img->symrez) {
+            sr_free(img->symrez);
+        }
+
+        if (img->view && img->view != snapshot->view) {
+            munmap(img->view, img->view_size);
+        }
+    }
+
+    if (snapshot->view) {
+        munmap(snapshot->view, snapshot->view_size);
+    }
+
+    free(snapshot->images);
+    free(snapshot->regions);
+    munmap((void *)snapshot->file, snapshot->file_size);
+    close(snapshot->fd);
+    free(snapshot);
+}
@@ -0,0 +1,794 @@
+//
+//  Swift.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ Every type an image defines has a context descriptor listed in
+ __swift5_types, and every protocol one in __swift5_protos. Both sections
+ hold 32-bit offsets relative to the entry itself. A descriptor's name is
+ only its own identifier, so the full name is built by walking the parent
+ chain up to the module: "Module.Outer.Inner". Those names key a
+ `sr_table` built on first use. Nothing else in the image is read, and the
+ Swift runtime and its locks aren't involved.
+
+ A mangled name is parsed into the same dotted form before the lookup.
+ That is simpler than mangling each descriptor: the parser only has to
+ understand nominal type paths, with word and back-reference substitutions,
+ standard types (`Si`, `SS`, ...) and private discriminators. Types of an
+ extension on a type from another module are named after the extended type,
+ like the mangling does.
+
+ Private types of different files can share a dotted name. Their
+ descriptors sit under an anonymous context, which only records the file's
+ discriminator when the compiler gave it a mangled name, so each entry
+ keeps the discriminator if there is one. A lookup takes the entry whose
+ discriminator matches the name's, and otherwise only a name that leaves a
+ single candidate, rather than whichever entry the table holds first.
+ */
+
+#define SR_SWIFT_NAME_MAX   1024
+#define SR_SWIFT_MAX_DEPTH  32
+#define SR_SWIFT_STACK      16
+#define SR_SWIFT_SUBS       64
+#define SR_SWIFT_WORDS      26
+
+#define SR_SWIFT_KIND_MASK      0x1F
+#define SR_SWIFT_CTX_MODULE     0
+#define SR_SWIFT_CTX_EXTENSION  1
+#define SR_SWIFT_CTX_ANONYMOUS  2
+#define SR_SWIFT_NODE_IDENT     0x100
+
+#define SR_SWIFT_CTX_GENERIC            0x80
+#define SR_SWIFT_ANON_HAS_MANGLED_NAME  0x10000
+#define SR_SWIFT_NO_NAME                UINT32_MAX
+
+// __swift5_types entries are tagged with what they point to
+#define SR_SWIFT_RECORD_KIND_MASK   0x3
+#define SR_SWIFT_RECORD_DIRECT      0
+#define SR_SWIFT_RECORD_INDIRECT    1
+
+// Common prefix of the context descriptors this file reads
+struct sr_swift_context {
+    uint32_t flags;
+    int32_t parent;
+    int32_t name;       // extended type's mangled name for extensions, mangled name for anonymous contexts
+    int32_t accessor;   // types only
+};
+
+struct sr_swift_entry {
+    const struct sr_swift_context *descriptor;
+    uint32_t name;
+    uint32_t discriminator; // SR_SWIFT_NO_NAME if unknown
+    uint32_t kind;
+    bool is_private;
+};
+
+struct sr_swift_index {
+    struct sr_table table;
+    struct sr_swift_entry *entries;
+    char *names;
+    uint32_t names_size;
+    uint32_t names_capacity;
+};
+
+SR_INLINE const void *
+sr_swift_rel(const int32_t *field) {
+    return *field ? (const uint8_t *)field + *field : NULL;
+}
+
+// Low bit set means the target is a pointer to the descriptor, i.e. in another image
+SR_INLINE const void *
+sr_swift_rel_indirectable(const int32_t *field) {
+    int32_t offset = *field;
+    if (!offset) {
+        return NULL;
+    }
+
+    const uint8_t *target = (const uint8_t *)field + (offset & ~1);
+    return offset & 1 ? sr_strip_ptr(*(const sr_ptr_t *)target) : target;
+}
+
+SR_INLINE bool
+sr_swift_is_type(uint32_t kind) {
+    return kind == SR_SWIFT_KIND_CLASS || kind == SR_SWIFT_KIND_STRUCT || kind == SR_SWIFT_KIND_ENUM;
+}
+
+struct sr_swift_node {
+    uint16_t off;
+    uint16_t len;
+    uint32_t kind;
+};
+
+struct sr_swift_demangler {
+    const char *p;
+    const char *end;
+    struct sr_swift_node stack[SR_SWIFT_STACK];
+    uint32_t depth;
+    struct sr_swift_node subs[SR_SWIFT_SUBS];
+    uint32_t nsubs;
+    struct { const char *str; uint32_t len; } words[SR_SWIFT_WORDS];
+    uint32_t nwords;
+    struct sr_swift_node discriminator;
+    uint32_t used;
+    char text[SR_SWIFT_NAME_MAX * 2];
+};
+
+static const struct {
+    char code;
+    uint8_t kind;
+    const char *name;
+} _g_swift_standard[] = {
+    { 'A', SR_SWIFT_KIND_STRUCT, "AutoreleasingUnsafeMutablePointer" },
+    { 'a', SR_SWIFT_KIND_STRUCT, "Array" },
+    { 'b', SR_SWIFT_KIND_STRUCT, "Bool" },
+    { 'D', SR_SWIFT_KIND_STRUCT, "Dictionary" },
+    { 'd', SR_SWIFT_KIND_STRUCT, "Double" },
+    { 'f', SR_SWIFT_KIND_STRUCT, "Float" },
+    { 'h', SR_SWIFT_KIND_STRUCT, "Set" },
+    { 'I', SR_SWIFT_KIND_STRUCT, "DefaultIndices" },
+    { 'i', SR_SWIFT_KIND_STRUCT, "Int" },
+    { 'J', SR_SWIFT_KIND_STRUCT, "Character" },
+    { 'N', SR_SWIFT_KIND_STRUCT, "ClosedRange" },
+    { 'n', SR_SWIFT_KIND_STRUCT, "Range" },
+    { 'O', SR_SWIFT_KIND_STRUCT, "ObjectIdentifier" },
+    { 'P', SR_SWIFT_KIND_STRUCT, "UnsafePointer" },
+    { 'p', SR_SWIFT_KIND_STRUCT, "UnsafeMutablePointer" },
+    { 'R', SR_SWIFT_KIND_STRUCT, "UnsafeBufferPointer" },
+    { 'r', SR_SWIFT_KIND_STRUCT, "UnsafeMutableBufferPointer" },
+    { 'S', SR_SWIFT_KIND_STRUCT, "String" },
+    { 's', SR_SWIFT_KIND_STRUCT, "Substring" },
+    { 'u', SR_SWIFT_KIND_STRUCT, "UInt" },
+    { 'V', SR_SWIFT_KIND_STRUCT, "UnsafeRawPointer" },
+    { 'v', SR_SWIFT_KIND_STRUCT, "UnsafeMutableRawPointer" },
+    { 'W', SR_SWIFT_KIND_STRUCT, "UnsafeRawBufferPointer" },
+    { 'w', SR_SWIFT_KIND_STRUCT, "UnsafeMutableRawBufferPointer" },
+    { 'q', SR_SWIFT_KIND_ENUM, "Optional" },
+    { 'B', SR_SWIFT_KIND_PROTOCOL, "BinaryFloatingPoint" },
+    { 'E', SR_SWIFT_KIND_PROTOCOL, "Encodable" },
+    { 'e', SR_SWIFT_KIND_PROTOCOL, "Decodable" },
+    { 'F', SR_SWIFT_KIND_PROTOCOL, "FloatingPoint" },
+    { 'G', SR_SWIFT_KIND_PROTOCOL, "RandomNumberGenerator" },
+    { 'H', SR_SWIFT_KIND_PROTOCOL, "Hashable" },
+    { 'j', SR_SWIFT_KIND_PROTOCOL, "Numeric" },
+    { 'K', SR_SWIFT_KIND_PROTOCOL, "BidirectionalCollection" },
+    { 'k', SR_SWIFT_KIND_PROTOCOL, "RandomAccessCollection" },
+    { 'L', SR_SWIFT_KIND_PROTOCOL, "Comparable" },
+    { 'l', SR_SWIFT_KIND_PROTOCOL, "Collection" },
+    { 'M', SR_SWIFT_KIND_PROTOCOL, "MutableCollection" },
+    { 'm', SR_SWIFT_KIND_PROTOCOL, "RangeReplaceableCollection" },
+    { 'Q', SR_SWIFT_KIND_PROTOCOL, "Equatable" },
+    { 'T', SR_SWIFT_KIND_PROTOCOL, "Sequence" },
+    { 't', SR_SWIFT_KIND_PROTOCOL, "IteratorProtocol" },
+    { 'U', SR_SWIFT_KIND_PROTOCOL, "UnsignedInteger" },
+    { 'X', SR_SWIFT_KIND_PROTOCOL, "RangeExpression" },
+    { 'x', SR_SWIFT_KIND_PROTOCOL, "Strideable" },
+    { 'Y', SR_SWIFT_KIND_PROTOCOL, "RawRepresentable" },
+    { 'y', SR_SWIFT_KIND_PROTOCOL, "StringProtocol" },
+    { 'Z', SR_SWIFT_KIND_PROTOCOL, "SignedInteger" },
+    { 'z', SR_SWIFT_KIND_PROTOCOL, "BinaryInteger" },
+};
+
+SR_INLINE bool
+sr_swift_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+SR_INLINE bool
+sr_swift_is_lower(char c) {
+    return c >= 'a' && c <= 'z';
+}
+
+SR_INLINE bool
+sr_swift_is_upper(char c) {
+    return c >= 'A' && c <= 'Z';
+}
+
+SR_INLINE char
+sr_swift_peek(const struct sr_swift_demangler *d) {
+    return d->p < d->end ? *d->p : '\0';
+}
+
+static int
+sr_swift_natural(struct sr_swift_demangler *d) {
+    if (!sr_swift_is_digit(sr_swift_peek(d))) {
+        return -1;
+    }
+
+    int n = 0;
+    while (sr_swift_is_digit(sr_swift_peek(d))) {
+        n = n * 10 + (*d->p++ - '0');
+        if (unlikely(n > SR_SWIFT_NAME_MAX)) {
+            return -1;
+        }
+    }
+
+    return n;
+}
+
+// Appends to the node being built at the end of `text`
+static bool
+sr_swift_text_append(struct sr_swift_demangler *d, struct sr_swift_node *node, const char *str, size_t len) {
+    if (unlikely(d->used + len > sizeof(d->text) || node->len + len >= SR_SWIFT_NAME_MAX)) {
+        return false;
+    }
+
+    memcpy(d->text + d->used, str, len);
+    d->used += (uint32_t)len;
+    node->len += (uint16_t)len;
+    return true;
+}
+
+SR_INLINE struct sr_swift_node
+sr_swift_node_begin(const struct sr_swift_demangler *d, uint32_t kind) {
+    return (struct sr_swift_node){ .off = (uint16_t)d->used, .len = 0, .kind = kind };
+}
+
+static bool
+sr_swift_push(struct sr_swift_demangler *d, struct sr_swift_node node) {
+    if (unlikely(d->depth == SR_SWIFT_STACK)) {
+        return false;
+    }
+
+    d->stack[d->depth++] = node;
+    return true;
+}
+
+static void
+sr_swift_add_sub(struct sr_swift_demangler *d, struct sr_swift_node node) {
+    if (likely(d->nsubs < SR_SWIFT_SUBS)) {
+        d->subs[d->nsubs++] = node;
+    }
+}
+
+// Words are at least two characters, split on case changes and underscores
+static void
+sr_swift_add_words(struct sr_swift_demangler *d, const char *slice, int len) {
+    int start = -1;
+    for (int i = 0; i <= len; ++i) {
+        char c = i < len ? slice[i] : '\0';
+        if (start >= 0 && (c == '_' || c == '\0' || (!sr_swift_is_upper(slice[i - 1]) && sr_swift_is_upper(c)))) {
+            if (i - start >= 2 && d->nwords < SR_SWIFT_WORDS) {
+                d->words[d->nwords].str = slice + start;
+                d->words[d->nwords].len = i - start;
+                ++d->nwords;
+            }
+            start = -1;
+        }
+
+        if (start < 0 && c != '_' && c != '\0' && !sr_swift_is_digit(c)) {
+            start = i;
+        }
+    }
+}
+
+// `3Foo`, or `0` followed by literal parts and word substitutions, the last one upper case
+static bool
+sr_swift_identifier(struct sr_swift_demangler *d) {
+    bool substituted = false;
+    if (*d->p == '0') {
+        ++d->p;
+        // Punycode
+        if (sr_swift_peek(d) == '0') {
+            return false;
+        }
+        substituted = true;
+    }
+
+    struct sr_swift_node ident = sr_swift_node_begin(d, SR_SWIFT_NODE_IDENT);
+    do {
+        while (substituted && (sr_swift_is_lower(sr_swift_peek(d)) || sr_swift_is_upper(sr_swift_peek(d)))) {
+            char c = *d->p++;
+            uint32_t word = sr_swift_is_lower(c) ? (uint32_t)(c - 'a') : (uint32_t)(c - 'A');
+            substituted = sr_swift_is_lower(c);
+            if (unlikely(word >= d->nwords || !sr_swift_text_append(d, &ident, d->words[word].str, d->words[word].len))) {
+                return false;
+            }
+        }
+
+        if (sr_swift_peek(d) == '0') {
+            ++d->p;
+            break;
+        }
+
+        int len = sr_swift_natural(d);
+        if (unlikely(len <= 0 || len > d->end - d->p)) {
+            return false;
+        }
+
+        if (unlikely(!sr_swift_text_append(d, &ident, d->p, len))) {
+            return false;
+        }
+        sr_swift_add_words(d, d->p, len);
+        d->p += len;
+    } while (substituted);
+
+    sr_swift_add_sub(d, ident);
+    return sr_swift_push(d, ident);
+}
+
+static bool
+sr_swift_context_node(struct sr_swift_demangler *d, const char *module, const char * _Nullable name, uint32_t kind) {
+    struct sr_swift_node node = sr_swift_node_begin(d, kind);
+    if (!sr_swift_text_append(d, &node, module, strlen(module))) {
+        return false;
+    }
+
+    if (name && (!sr_swift_text_append(d, &node, ".", 1) || !sr_swift_text_append(d, &node, name, strlen(name)))) {
+        return false;
+    }
+
+    return sr_swift_push(d, node);
+}
+
+static bool
+sr_swift_standard(struct sr_swift_demangler *d) {
+    char c = sr_swift_peek(d);
+    ++d->p;
+    if (c == 'o') {
+        return sr_swift_context_node(d, "__C", NULL, SR_SWIFT_CTX_MODULE);
+    }
+    if (c == 'C') {
+        return sr_swift_context_node(d, "__C_Synthesized", NULL, SR_SWIFT_CTX_MODULE);
+    }
+
+    for (size_t i = 0; i < sizeof(_g_swift_standard) / sizeof(_g_swift_standard[0]); ++i) {
+        if (_g_swift_standard[i].code == c) {
+            return sr_swift_context_node(d, "Swift", _g_swift_standard[i].name, _g_swift_standard[i].kind);
+        }
+    }
+
+    // Concurrency types (`Sc`) and repeated standard types aren't handled
+    return false;
+}
+
+static bool
+sr_swift_push_sub(struct sr_swift_demangler *d, int repeat, uint32_t idx) {
+    if (unlikely(idx >= d->nsubs)) {
+        return false;
+    }
+
+    for (int i = 0; i < (repeat > 0 ? repeat : 1); ++i) {
+        if (unlikely(!sr_swift_push(d, d->subs[idx]))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// `AA`, `Aab`, `A3aB`, `A5_`
+static bool
+sr_swift_substitution(struct sr_swift_demangler *d) {
+    int repeat = -1;
+    while (d->p < d->end) {
+        char c = *d->p++;
+        if (sr_swift_is_lower(c)) {
+            if (!sr_swift_push_sub(d, repeat, c - 'a')) return false;
+            repeat = -1;
+        } else if (sr_swift_is_upper(c)) {
+            return sr_swift_push_sub(d, repeat, c - 'A');
+        } else if (c == '_') {
+            return sr_swift_push_sub(d, 1, (uint32_t)(repeat + 27));
+        } else {
+            --d->p;
+            if ((repeat = sr_swift_natural(d)) < 0) return false;
+        }
+    }
+
+    return false;
+}
+
+static bool
+sr_swift_nominal(struct sr_swift_demangler *d, uint32_t kind) {
+    if (unlikely(d->depth < 2 || d->stack[d->depth - 1].kind != SR_SWIFT_NODE_IDENT)) {
+        return false;
+    }
+
+    struct sr_swift_node name = d->stack[--d->depth];
+    struct sr_swift_node parent = d->stack[--d->depth];
+    struct sr_swift_node node = sr_swift_node_begin(d, kind);
+    if (!sr_swift_text_append(d, &node, d->text + parent.off, parent.len) ||
+        !sr_swift_text_append(d, &node, ".", 1) ||
+        !sr_swift_text_append(d, &node, d->text + name.off, name.len)) {
+        return false;
+    }
+
+    sr_swift_add_sub(d, node);
+    return sr_swift_push(d, node);
+}
+
+/*
+ Parse a mangled nominal type, without its `$s` prefix, into "Module.Type".
+ A trailing `N` or `M?` (metadata, descriptor, accessor, ...) is ignored.
+ The last private discriminator goes to `discriminator`, empty if there is
+ none. Returns the length of the name, or -1.
+ */
+static int
+sr_swift_demangle(const char *mangled, size_t len, char out[SR_SWIFT_NAME_MAX], uint32_t * _Nullable kind, char * _Nullable discriminator) {
+    struct sr_swift_demangler demangler = { .p = mangled, .end = mangled + len };
+    struct sr_swift_demangler *d = &demangler;
+
+    while (d->p < d->end) {
+        char c = *d->p;
+        size_t left = d->end - d->p;
+        bool ok;
+        if (sr_swift_is_digit(c)) {
+            ok = sr_swift_identifier(d);
+        } else if ((c == 'N' && left == 1) || (c == 'M' && left == 2)) {
+            break;
+        } else {
+            ++d->p;
+            switch (c) {
+                case 's': ok = sr_swift_context_node(d, "Swift", NULL, SR_SWIFT_CTX_MODULE); break;
+                case 'S': ok = sr_swift_standard(d); break;
+                case 'A': ok = sr_swift_substitution(d); break;
+                case 'C': ok = sr_swift_nominal(d, SR_SWIFT_KIND_CLASS); break;
+                case 'V': ok = sr_swift_nominal(d, SR_SWIFT_KIND_STRUCT); break;
+                case 'O': ok = sr_swift_nominal(d, SR_SWIFT_KIND_ENUM); break;
+                case 'P': ok = sr_swift_nominal(d, SR_SWIFT_KIND_PROTOCOL); break;
+                case 'E':
+                    // Extension in another module: keep the extended type
+                    ok = d->depth >= 2 && d->stack[--d->depth].kind == SR_SWIFT_NODE_IDENT;
+                    break;
+                case 'L':
+                    // Private discriminator after the name
+                    ok = sr_swift_peek(d) == 'L' && d->depth >= 2 && d->stack[--d->depth].kind == SR_SWIFT_NODE_IDENT;
+                    d->discriminator = d->stack[d->depth];
+                    ++d->p;
+                    break;
+                default:
+                    ok = false;
+                    break;
+            }
+        }
+
+        if (unlikely(!ok)) {
+            return -1;
+        }
+    }
+
+    if (d->depth != 1 || d->stack[0].kind == SR_SWIFT_NODE_IDENT) {
+        return -1;
+    }
+
+    const struct sr_swift_node *node = &d->stack[0];
+    memcpy(out, d->text + node->off, node->len);
+    out[node->len] = '\0';
+    if (kind) {
+        *kind = node->kind;
+    }
+    if (discriminator) {
+        memcpy(discriminator, d->text + d->discriminator.off, d->discriminator.len);
+        discriminator[d->discriminator.len] = '\0';
+    }
+    return node->len;
+}
+
+// `$s` mangled names, with or without prefix, or "Module.Type" as is. `kind` is 0 for the latter
+static int
+sr_swift_key(const char *name, char out[SR_SWIFT_NAME_MAX], uint32_t *kind, char discriminator[SR_SWIFT_NAME_MAX]) {
+    *kind = 0;
+    discriminator[0] = '\0';
+    if (name[0] == '_' && name[1] == '$') {
+        name += 1;
+    }
+
+    if (name[0] == '$' && (name[1] == 's' || name[1] == 'S')) {
+        name += 2;
+    } else if (strchr(name, '.')) {
+        size_t len = strlen(name);
+        if (unlikely(len >= SR_SWIFT_NAME_MAX)) {
+            return -1;
+        }
+
+        memcpy(out, name, len + 1);
+        return (int)len;
+    }
+
+    return sr_swift_demangle(name, strlen(name), out, kind, discriminator);
+}
+
+static int
+sr_swift_append(char buf[SR_SWIFT_NAME_MAX], int len, const char * _Nullable name) {
+    if (unlikely(!name || len < 0)) {
+        return -1;
+    }
+
+    size_t n = strlen(name);
+    if (unlikely(!n || len + n + 2 > SR_SWIFT_NAME_MAX)) {
+        return -1;
+    }
+
+    if (len) {
+        buf[len++] = '.';
+    }
+    memcpy(buf + len, name, n + 1);
+    return len + (int)n;
+}
+
+static int
+sr_swift_context_path(const struct sr_swift_context * _Nullable ctx, char buf[SR_SWIFT_NAME_MAX], uint32_t depth);
+
+// Name of the type an extension extends. Same image types are symbolic references
+static int
+sr_swift_extended_path(const char * _Nullable mangled, char buf[SR_SWIFT_NAME_MAX], uint32_t depth) {
+    if (unlikely(!mangled)) {
+        return -1;
+    }
+
+    if (mangled[0] == 0x01 || mangled[0] == 0x02) {
+        if (mangled[5] != '\0') {
+            return -1;
+        }
+
+        int32_t offset;
+        memcpy(&offset, mangled + 1, sizeof(offset));
+        const uint8_t *target = (const uint8_t *)mangled + 1 + offset;
+        if (mangled[0] == 0x02) {
+            target = sr_strip_ptr(*(const sr_ptr_t *)target);
+        }
+        return sr_swift_context_path((const struct sr_swift_context *)target, buf, depth + 1);
+    }
+
+    return sr_swift_demangle(mangled, strlen(mangled), buf, NULL, NULL);
+}
+
+static int
+sr_swift_context_path(const struct sr_swift_context *ctx, char buf[SR_SWIFT_NAME_MAX], uint32_t depth) {
+    if (unlikely(!ctx || depth > SR_SWIFT_MAX_DEPTH)) {
+        return -1;
+    }
+
+    uint32_t kind = ctx->flags & SR_SWIFT_KIND_MASK;
+    switch (kind) {
+        case SR_SWIFT_CTX_MODULE:
+            return sr_swift_append(buf, 0, sr_swift_rel(&ctx->name));
+        case SR_SWIFT_CTX_EXTENSION:
+            return sr_swift_extended_path(sr_swift_rel(&ctx->name), buf, depth);
+        case SR_SWIFT_CTX_ANONYMOUS:
+            // Private and local declarations
+            return sr_swift_context_path(sr_swift_rel_indirectable(&ctx->parent), buf, depth + 1);
+        case SR_SWIFT_KIND_PROTOCOL:
+        case SR_SWIFT_KIND_CLASS:
+        case SR_SWIFT_KIND_STRUCT:
+        case SR_SWIFT_KIND_ENUM: {
+            int len = sr_swift_context_path(sr_swift_rel_indirectable(&ctx->parent), buf, depth + 1);
+            return sr_swift_append(buf, len, sr_swift_rel(&ctx->name));
+        }
+        default:
+            return -1;
+    }
+}
+
+// Discriminator of the file a private type was declared in, from the nearest anonymous context with a mangled name
+static bool
+sr_swift_private_scope(const struct sr_swift_context *ctx, char discriminator[SR_SWIFT_NAME_MAX]) {
+    discriminator[0] = '\0';
+    const struct sr_swift_context *parent = sr_swift_rel_indirectable(&ctx->parent);
+    for (uint32_t depth = 0; parent && depth < SR_SWIFT_MAX_DEPTH; ++depth) {
+        uint32_t kind = parent->flags & SR_SWIFT_KIND_MASK;
+        if (kind == SR_SWIFT_CTX_MODULE || kind == SR_SWIFT_CTX_EXTENSION) {
+            return false;
+        }
+
+        if (kind == SR_SWIFT_CTX_ANONYMOUS) {
+            // Generic contexts put their header before the name
+            const char *mangled = (parent->flags & (SR_SWIFT_ANON_HAS_MANGLED_NAME | SR_SWIFT_CTX_GENERIC)) == SR_SWIFT_ANON_HAS_MANGLED_NAME ? sr_swift_rel(&parent->name) : NULL;
+            if (mangled) {
+                if (mangled[0] == '$' && (mangled[1] == 's' || mangled[1] == 'S')) {
+                    mangled += 2;
+                }
+
+                // `MXX` is the anonymous descriptor suffix
+                size_t len = strlen(mangled);
+                if (len > 3 && !strcmp(mangled + len - 3, "MXX")) {
+                    len -= 3;
+                }
+
+                char name[SR_SWIFT_NAME_MAX];
+                if (sr_swift_demangle(mangled, len, name, NULL, discriminator) < 0) {
+                    discriminator[0] = '\0';
+                }
+            }
+            return true;
+        }
+
+        parent = sr_swift_rel_indirectable(&parent->parent);
+    }
+
+    return false;
+}
+
+// Copies `len` bytes and a terminator into the index's names. Returns their offset, or SR_SWIFT_NO_NAME
+static uint32_t
+sr_swift_store(symrez_t symrez, struct sr_swift_index *index, const char *str, size_t len) {
+    if (unlikely(index->names_size + len + 1 > index->names_capacity)) {
+        uint32_t capacity = index->names_capacity ? index->names_capacity * 2 : 0x4000;
+        while (capacity < index->names_size + len + 1) capacity *= 2;
+
+        char *names = sr_realloc(symrez, index->names, index->names_capacity, capacity);
+        if (unlikely(!names)) {
+            return SR_SWIFT_NO_NAME;
+        }
+        index->names = names;
+        index->names_capacity = capacity;
+    }
+
+    uint32_t offset = index->names_size;
+    memcpy(index->names + offset, str, len);
+    index->names[offset + len] = '\0';
+    index->names_size += (uint32_t)len + 1;
+    return offset;
+}
+
+static bool
+sr_swift_add(symrez_t symrez, struct sr_swift_index *index, const struct sr_swift_context * _Nullable ctx, bool protocols) {
+    if (unlikely(!ctx)) {
+        return false;
+    }
+
+    uint32_t kind = ctx->flags & SR_SWIFT_KIND_MASK;
+    if (protocols ? kind != SR_SWIFT_KIND_PROTOCOL : !sr_swift_is_type(kind)) {
+        return false;
+    }
+
+    char name[SR_SWIFT_NAME_MAX];
+    int len = sr_swift_context_path(ctx, name, 0);
+    if (unlikely(len <= 0)) {
+        return false;
+    }
+
+    char discriminator[SR_SWIFT_NAME_MAX];
+    bool is_private = sr_swift_private_scope(ctx, discriminator);
+    uint32_t name_offset = sr_swift_store(symrez, index, name, len);
+    uint32_t discriminator_offset = discriminator[0] ? sr_swift_store(symrez, index, discriminator, strlen(discriminator)) : SR_SWIFT_NO_NAME;
+    if (unlikely(name_offset == SR_SWIFT_NO_NAME)) {
+        return false;
+    }
+
+    uint32_t idx = sr_table_insert(symrez, &index->table, sr_hash_symbol(name, NULL));
+    index->entries[idx].descriptor = ctx;
+    index->entries[idx].name = name_offset;
+    index->entries[idx].discriminator = discriminator_offset;
+    index->entries[idx].kind = kind;
+    index->entries[idx].is_private = is_private;
+    return true;
+}
+
+SR_INLINE bool
+sr_swift_section(section_t sec, bool *protocols) {
+    if (!strncmp(sec->sectname, "__swift5_protos", sizeof(sec->sectname))) {
+        *protocols = true;
+        return true;
+    }
+
+    *protocols = false;
+    return !strncmp(sec->sectname, "__swift5_types", sizeof(sec->sectname)) || !strncmp(sec->sectname, "__swift5_types2", sizeof(sec->sectname));
+}
+
+static struct sr_swift_index *
+sr_swift_build(symrez_t symrez) {
+    uint64_t count = 0;
+    bool protocols;
+    for (uint32_t i = 1; i < symrez->nordinals; ++i) {
+        section_t sec = symrez->ordinals[i];
+        if (sec && sr_swift_section(sec, &protocols)) {
+            count += sec->size / sizeof(int32_t);
+        }
+    }
+
+    struct sr_swift_index *index = sr_calloc(symrez, sizeof(struct sr_swift_index));
+    if (unlikely(!index)) {
+        return NULL;
+    }
+
+    uint32_t capacity = count ? (uint32_t)count : 1;
+    index->entries = sr_alloc(symrez, capacity * sizeof(struct sr_swift_entry));
+    if (unlikely(!index->entries || !sr_table_reserve(symrez, &index->table, capacity))) {
+        sr_table_free(symrez, &index->table);
+        sr_dealloc(symrez, index->entries);
+        sr_dealloc(symrez, index);
+        return NULL;
+    }
+
+    for (uint32_t i = 1; i < symrez->nordinals; ++i) {
+        section_t sec = symrez->ordinals[i];
+        if (!sec || !sr_swift_section(sec, &protocols)) continue;
+
+        const int32_t *records = (const int32_t *)(sec->addr + symrez->slide);
+        for (uint64_t j = 0; j < sec->size / sizeof(int32_t); ++j) {
+            const int32_t *record = &records[j];
+            if (protocols) {
+                sr_swift_add(symrez, index, sr_swift_rel_indirectable(record), true);
+                continue;
+            }
+
+            // Other kinds name Objective-C classes
+            uint32_t kind = *record & SR_SWIFT_RECORD_KIND_MASK;
+            if (kind > SR_SWIFT_RECORD_INDIRECT) continue;
+
+            const uint8_t *target = (const uint8_t *)record + (*record & ~SR_SWIFT_RECORD_KIND_MASK);
+            if (kind == SR_SWIFT_RECORD_INDIRECT) {
+                target = sr_strip_ptr(*(const sr_ptr_t *)target);
+            }
+            sr_swift_add(symrez, index, (const struct sr_swift_context *)target, false);
+        }
+    }
+
+    return index;
+}
+
+bool sr_resolve_swift_type(symrez_t symrez, const char *name, sr_swift_type_t *type) {
+    // Descriptors in a snapshot point into the other task
+    if (unlikely(symrez->snapshot)) {
+        return false;
+    }
+
+    char key[SR_SWIFT_NAME_MAX];
+    char discriminator[SR_SWIFT_NAME_MAX];
+    uint32_t kind;
+    if (unlikely(sr_swift_key(name, key, &kind, discriminator) <= 0)) {
+        return false;
+    }
+
+    if (unlikely(!symrez->swift)) {
+        if (unlikely(!(symrez->swift = sr_swift_build(symrez)))) {
+            return false;
+        }
+    }
+
+    // A mangled name says whether the type is private, and may name its file
+    struct sr_swift_index *index = symrez->swift;
+    const struct sr_swift_entry *found = NULL;
+    uint32_t candidates = 0;
+    uint32_t hash = sr_hash_symbol(key, NULL);
+    for (uint32_t i = sr_table_first(&index->table, hash); i != SR_TABLE_NONE; i = sr_table_next(&index->table, index->table.next[i], hash)) {
+        const struct sr_swift_entry *entry = &index->entries[i];
+        if (kind && entry->kind != kind) continue;
+        if (kind && entry->is_private != (discriminator[0] != '\0')) continue;
+        if (strcmp(index->names + entry->name, key)) continue;
+
+        if (discriminator[0] && entry->discriminator != SR_SWIFT_NO_NAME) {
+            if (strcmp(index->names + entry->discriminator, discriminator)) continue;
+
+            found = entry;
+            candidates = 1;
+            break;
+        }
+
+        found = entry;
+        ++candidates;
+    }
+
+    if (candidates != 1) {
+        return false;
+    }
+
+    if (type) {
+        const struct sr_swift_context *ctx = found->descriptor;
+        type->descriptor = (sr_ptr_t)ctx;
+        type->accessor = found->kind == SR_SWIFT_KIND_PROTOCOL ? NULL : sr_sign_symbol(symrez, (sr_ptr_t)sr_swift_rel(&ctx->accessor));
+        type->kind = found->kind;
+        type->flags = ctx->flags;
+    }
+    return true;
+}
+
+void sr_swift_free(symrez_t symrez) {
+    struct sr_swift_index *index = symrez->swift;
+    if (!index) {
+        return;
+    }
+
+    sr_table_free(symrez, &index->table);
+    sr_dealloc(symrez, index->entries);
+    sr_dealloc(symrez, index->names);
+    sr_dealloc(symrez, index);
+    symrez->swift = NULL;
+}
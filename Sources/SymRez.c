@@ -6,84 +6,14 @@
 //  Copyright © 2020 Jeremy Legendre. All rights reserved.
 //
 
-#include <SymRez/SymRez.h>
-#include <stdlib.h>
-#include <mach-o/dyld.h>
-#include <mach-o/dyld_images.h>
-#include <mach-o/nlist.h>
-#include <mach/mach_vm.h>
-
-#if __has_feature(ptrauth_calls)
-#include <ptrauth.h>
-#endif
-
-#ifndef EXPORT_SYMBOL_FLAGS_WEAK_REEXPORT
-#define EXPORT_SYMBOL_FLAGS_WEAK_REEXPORT 0xC
-#endif
-
-#ifndef SR_STATIC
-  #if defined(DEBUG)
-    #define SR_STATIC
-  #else
-    #define SR_STATIC static
-  #endif
-#endif
-
-#define ALIGN_64 __attribute__((__aligned__(64)))
+#include "SymRezPrivate.h"
 
 #ifndef SR_ITER_STACK_DEPTH
 #define SR_ITER_STACK_DEPTH 0x48
 #endif
 
-#define likely(x)   __builtin_expect(!!(x), 1)
-#define unlikely(x) __builtin_expect(!!(x), 0)
-
-#define _strlen strlen
-#undef strlen
-#define strlen(x) \
-__builtin_constant_p(x) ? sizeof(x) : _strlen(x)
-
-#define sr_strneq(x,y,z) \
-!strncmp(x,y,z)
-
-#define mh_for_each_lc(mh, lc) \
-for (struct load_command *lc = (struct load_command*)((uint64_t)mh + sizeof(struct mach_header_64)); \
-    (uint64_t)lc < (((uint64_t)mh + sizeof(struct mach_header_64)) + mh->sizeofcmds); \
-    lc = (void*)((uint64_t)lc + (uint64_t)lc->cmdsize))
-
-#define _sr_for_each_image_info(it, info) \
-dyld_all_image_infos_t info = get_all_image_infos(); \
-for(const struct dyld_image_info *it = info->infoArray; \
-    it < &info->infoArray[info->infoArrayCount]; \
-    ++it)
-
-#define sr_for_each_image_info(it) \
-    _sr_for_each_image_info(it, aii##__COUNTER__)
-
-extern const struct mach_header_64 _mh_execute_header;
-typedef struct load_command* load_command_t;
-typedef struct segment_command_64* segment_command_t;
-typedef struct section_64* section_t;
-typedef struct dyld_all_image_infos* dyld_all_image_infos_t;
-typedef struct nlist_64* nlist64_t;
-typedef void* strtab_t;
-
-SR_STATIC bool symrez_init_mh(symrez_t symrez, mach_header_t mach_header);
-
-struct ALIGN_64 symrez {
-    mach_header_t header;
-    intptr_t slide;
-    nlist64_t symtab;
-    strtab_t strtab;
-    uint32_t nsyms;
-    void *exports;
-    uintptr_t exports_size;
-    sr_iterator_t iterator;
-};
-
 struct sr_iter_result {
-    sr_ptr_t ptr;
-    sr_symbol_t symbol;
+    sr_entry_t entry;
 };
 
 typedef struct ALIGN_64 
@@ -102,11 +32,13 @@ sr_export_iterator {
         const uint8_t* node;
         char sym[2048];
         size_t sym_len;
+        bool terminal_done;
     } node_stack[SR_ITER_STACK_DEPTH];
 } *sr_export_iter_t;
 
 struct ALIGN_64 sr_iterator {
     symrez_t symrez;
+    struct sr_filter_state filter;
     struct sr_symtab_iterator symtab_iter;
     struct sr_export_iterator export_iter;
     struct sr_iter_result result;
@@ -126,22 +58,6 @@ sr_strrchr(const char *s, int c) {
     return NULL;
 }
 
-SR_INLINE uint64_t
-read_uleb128(void** ptr) {
-    uint8_t *p = *ptr;
-    uint64_t result = 0;
-    int bit = 0;
-    
-    do {
-        uint64_t slice = *p & 0x7f;
-        result |= (slice << bit);
-        bit += 7;
-    } while (*p++ & 0x80);
-    
-    *ptr = p;
-    return result;
-}
-
 SR_STATIC const uint8_t* 
 walk_export_trie(const uint8_t* start, const uint8_t* end, const char* symbol) {
     const uint8_t* p = start;
@@ -196,6 +112,7 @@ walk_export_trie(const uint8_t* start, const uint8_t* end, const char* symbol) {
     return NULL;
 }
 
+#if defined(__APPLE__)
 SR_STATIC OS_NOINLINE
 dyld_all_image_infos_t _get_dyld_info(void) {
     task_dyld_info_data_t dyld_info;
@@ -207,8 +124,22 @@ dyld_all_image_infos_t _get_dyld_info(void) {
     
     return (dyld_all_image_infos_t)(dyld_info.all_image_info_addr);
 }
+#else
+// No dyld: an empty image list, with only what `sr_test_set_shared_cache` fills in
+static struct dyld_all_image_infos _g_no_images;
 
-SR_STATIC OS_PURE
+SR_STATIC OS_NOINLINE
+dyld_all_image_infos_t _get_dyld_info(void) {
+    return &_g_no_images;
+}
+
+void sr_test_set_shared_cache(uintptr_t base) {
+    _g_no_images.version = 15;
+    _g_no_images.sharedCacheBaseAddress = base;
+}
+#endif
+
+OS_PURE
 dyld_all_image_infos_t get_all_image_infos(void) {
     static dyld_all_image_infos_t _g_all_image_infos = NULL;
     if (unlikely(!_g_all_image_infos)) {
@@ -217,100 +148,34 @@ dyld_all_image_infos_t get_all_image_infos(void) {
         __asm__ __volatile__("" ::: "memory");
     }
     
+#if __has_builtin(__builtin_assume)
     __builtin_assume(_g_all_image_infos != NULL);
+#endif
     return _g_all_image_infos;
 }
 
-SR_INLINE OS_OVERLOADABLE segment_command_t
-find_lc_segment(mach_header_t mh, const char *segname, size_t len) {
-    mh_for_each_lc(mh, lc) {
-        if (lc->cmd == LC_SEGMENT_64) {
-            segment_command_t seg = (segment_command_t)lc;
-            if (sr_strneq(seg->segname, segname, len)) {
-                return seg;
-            }
-        }
-    }
-    
-    return NULL;
-}
-
-SR_INLINE segment_command_t
-find_lc_segment(mach_header_t mh, const char *segname) {
-    return find_lc_segment(mh, segname, strlen(segname));
-}
-
-SR_INLINE load_command_t
-find_load_command(mach_header_t mh, uint32_t cmd) {
-    mh_for_each_lc(mh, lc) {
-        if (lc->cmd == cmd) {
-            return lc;
-        }
-    }
-    
-    return NULL;
-}
-
-SR_STATIC const char *
-dylib_name_for_ordinal(mach_header_t mh, uintptr_t ordinal) {
-    mh_for_each_lc(mh, lc) {
-        switch (lc->cmd) {
-            case LC_LOAD_DYLIB:
-            case LC_LOAD_WEAK_DYLIB:
-            case LC_REEXPORT_DYLIB:
-            case LC_LOAD_UPWARD_DYLIB: {
-                if (--ordinal == 0) {
-                    const struct dylib_command *dylibCmd = (void*)lc;
-                    return (const char*)((void*)dylibCmd + dylibCmd->dylib.name.offset);;
-                }
-            }
-        }
-    }
-
-    __builtin_unreachable();
-}
-
-SR_INLINE intptr_t
-compute_image_slide(mach_header_t mh) {
-    intptr_t res = 0;
-    uint64_t mh_addr = (uint64_t)(void*)mh;
-    segment_command_t seg = find_lc_segment(mh, SEG_TEXT);
-    res = mh_addr - (seg->vmaddr);
-    return res;
-}
-
 SR_STATIC int find_linkedit_commands(symrez_t symrez) {
-    mach_header_t mh = symrez->header;
-    intptr_t slide = symrez->slide;
-    
-    segment_command_t linkedit = find_lc_segment(mh, SEG_LINKEDIT);
-    if (unlikely(!linkedit)) {
-        return 0;
-    }
-    
-    struct symtab_command *symtab = (void*)find_load_command(mh, LC_SYMTAB);
-    if (unlikely(!symtab)) {
+    const struct sr_image *image = &symrez->image;
+    if (unlikely(!image->linkedit || !image->symtab)) {
         return 0;
     }
     
+    const struct symtab_command *symtab = image->symtab;
     symrez->nsyms = symtab->nsyms;
-    symrez->strtab = (strtab_t)((linkedit->vmaddr - linkedit->fileoff) + symtab->stroff + slide);
-    symrez->symtab = (nlist64_t)((linkedit->vmaddr - linkedit->fileoff) + symtab->symoff + slide);
+    symrez->strsize = symtab->strsize;
+    symrez->strtab = (strtab_t)sr_linkedit_ptr(symrez, symtab->stroff);
+    symrez->symtab = (nlist64_t)sr_linkedit_ptr(symrez, symtab->symoff);
     
-    struct linkedit_data_command *exportInfo = (struct linkedit_data_command *)find_load_command(mh, LC_DYLD_EXPORTS_TRIE);
+    const struct linkedit_data_command *exportInfo = image->exports_trie;
     if (likely(exportInfo)) {
-        symrez->exports = (void*)(linkedit->vmaddr - linkedit->fileoff) + exportInfo->dataoff + symrez->slide;
+        symrez->exports = (void *)sr_linkedit_ptr(symrez, exportInfo->dataoff);
         symrez->exports_size = exportInfo->datasize;
         return 1;
     }
     
-    struct dyld_info_command *dyld_info = (void*)find_load_command(mh, LC_DYLD_INFO_ONLY);
-    if (unlikely(!dyld_info)) {
-        dyld_info = (void*)find_load_command(mh, LC_DYLD_INFO);
-    }
-    
+    const struct dyld_info_command *dyld_info = image->dyld_info;
     if (unlikely(dyld_info)) {
-        symrez->exports = (void*)(linkedit->vmaddr - linkedit->fileoff) + dyld_info->export_off + symrez->slide;
+        symrez->exports = (void *)sr_linkedit_ptr(symrez, dyld_info->export_off);
         symrez->exports_size = dyld_info->export_size;
     }
     
@@ -333,7 +198,7 @@ find_image_by_name(const char *image_name, size_t len) {
     return NULL;
 }
 
-SR_STATIC mach_header_t
+mach_header_t
 find_image(const char *image_name) {
     size_t name_len = strlen(image_name);
     
@@ -354,10 +219,11 @@ find_image(const char *image_name) {
 SR_STATIC mach_header_t
 get_base_addr(void) {
     dyld_all_image_infos_t dyld_all_image_infos = get_all_image_infos();
-    if (likely(dyld_all_image_infos)) {
+    if (likely(dyld_all_image_infos && dyld_all_image_infos->infoArrayCount)) {
         return (mach_header_t)(dyld_all_image_infos->infoArray[0].imageLoadAddress);
     }
     
+#if defined(__APPLE__)
     // Fallback
     kern_return_t kr = KERN_FAILURE;
     vm_region_basic_info_data_t info = { 0 };
@@ -372,10 +238,34 @@ get_base_addr(void) {
     }
     
     return (mach_header_t)address;
+#else
+    return NULL;
+#endif
+}
+
+// Dependents of a snapshot image are looked up in the same snapshot
+SR_INLINE mach_header_t
+find_dependent(symrez_t owner, const char *dylib) {
+    if (unlikely(owner->snapshot)) {
+        return sr_snapshot_find_image(owner->snapshot, dylib);
+    }
+
+    return find_image(dylib);
+}
+
+SR_INLINE bool
+symrez_init_dependent(symrez_t owner, symrez_t sr, mach_header_t hdr) {
+    if (unlikely(!hdr || !symrez_init_mh_allocator(sr, hdr, &owner->allocator))) {
+        return false;
+    }
+
+    sr->snapshot = owner->snapshot;
+    return true;
 }
 
 SR_INLINE void *
-resolve_export_node(const uint8_t *node, mach_header_t mh, const char *symbol) {
+resolve_export_node(const uint8_t *node, symrez_t symrez, const char *symbol) {
+    mach_header_t mh = symrez->header;
     void *addr = NULL;
     uintptr_t flags = read_uleb128((void**)&node);
     if (unlikely(flags & EXPORT_SYMBOL_FLAGS_REEXPORT)) {
@@ -385,16 +275,20 @@ resolve_export_node(const uint8_t *node, mach_header_t mh, const char *symbol) {
             importedName = symbol;
         }
 
-        const char *dylib = dylib_name_for_ordinal(mh, ordinal);
+        const char *dylib = sr_image_dylib_name(symrez, ordinal);
         
         if (unlikely(!dylib)) return NULL;
         
+        uint64_t trace = sr_trace_begin();
+        mach_header_t target = find_dependent(symrez, dylib);
         struct symrez sr;
-        mach_header_t hdr = NULL;
-        if (unlikely(!(hdr = find_image(dylib)))) return NULL;
-        if (unlikely(!symrez_init_mh(&sr, hdr))) return NULL;
+        if (likely(symrez_init_dependent(symrez, &sr, target))) {
+            addr = sr_resolve_symbol(&sr, importedName);
+            symrez_destroy(&sr);
+        }
         
-        return sr_resolve_symbol(&sr, importedName);
+        sr_trace_end(trace, SR_TRACE_REEXPORT, mh, target, ordinal, importedName);
+        return addr;
     }
 
     switch (flags & EXPORT_SYMBOL_FLAGS_KIND_MASK) {
@@ -413,11 +307,20 @@ resolve_export_node(const uint8_t *node, mach_header_t mh, const char *symbol) {
     return addr;
 }
 
+SR_INLINE void
+_sr_iter_reset_exports(sr_iterator_t iterator, void *exports) {
+    iterator->export_iter.start = exports;
+    iterator->export_iter.stack_top = 1;
+    iterator->export_iter.node_stack[0].node = exports;
+    iterator->export_iter.node_stack[0].sym_len = 0;
+    iterator->export_iter.node_stack[0].terminal_done = false;
+}
+
 SR_INLINE void
 _sr_iter_init_from_sr(sr_iterator_t iterator, symrez_t symrez) {
     iterator->symrez = symrez;
-    iterator->result.ptr = NULL;
-    iterator->result.symbol = NULL;
+    memset(&iterator->result, 0, sizeof(iterator->result));
+    sr_filter_compile(symrez, NULL, &iterator->filter);
     
     nlist64_t symtab = symrez->symtab;
     void *exports = symrez->exports;
@@ -430,15 +333,16 @@ _sr_iter_init_from_sr(sr_iterator_t iterator, symrez_t symrez) {
     
     
     if (likely(exports)) {
-        iterator->export_iter.start = exports;
-        iterator->export_iter.stack_top = 1;
-        iterator->export_iter.node_stack[0].node = exports;
-        iterator->export_iter.node_stack[0].sym_len = 0;
+        _sr_iter_reset_exports(iterator, exports);
     }
 }
 
 sr_iterator_t sr_iterator_create(symrez_t symrez) {
-    sr_iterator_t iterator = calloc(1, sizeof(struct sr_iterator));
+    sr_iterator_t iterator = sr_calloc(symrez, sizeof(struct sr_iterator));
+    if (unlikely(!iterator)) {
+        return NULL;
+    }
+    
     _sr_iter_init_from_sr(iterator, symrez);
     return iterator;
 }
@@ -449,52 +353,68 @@ void sr_iter_reset(sr_iterator_t iterator) {
     
     void *exports = symrez->exports;
     if (likely(exports)) {
-        iterator->export_iter.stack_top = 1;
-        iterator->export_iter.node_stack[0].node = exports;
-        iterator->export_iter.node_stack[0].sym_len = 0;
+        _sr_iter_reset_exports(iterator, exports);
     }
 }
 
 sr_ptr_t sr_iter_get_ptr(sr_iterator_t iter) {
-    return iter->result.ptr;
+    return iter->result.entry.addr;
 }
 
 sr_symbol_t sr_iter_get_symbol(sr_iterator_t iter) {
-    return iter->result.symbol;
+    return (sr_symbol_t)iter->result.entry.name;
+}
+
+void sr_iter_set_filter(sr_iterator_t iterator, const sr_filter_t *filter) {
+    sr_filter_compile(iterator->symrez, filter, &iterator->filter);
+    sr_iter_reset(iterator);
 }
 
 size_t sr_iter_copy_symbol(sr_iterator_t iter, char *dest) {
-    if (!iter->result.symbol) return 0;
-    size_t ret = strlen(iter->result.symbol);
+    if (!iter->result.entry.name) return 0;
+    size_t ret = iter->result.entry.name_len;
     
     if (dest) {
-        strncpy(dest, iter->result.symbol, ret);
+        strncpy(dest, iter->result.entry.name, ret);
     }
     
     return ret;
 }
 
-SR_INLINE sr_iter_result_t
-sr_iter_get_next_nlist(sr_iterator_t iter) {
+SR_INLINE bool
+sr_iter_next_nlist_entry(sr_iterator_t iter, sr_entry_t *entry) {
     sr_symtab_iter_t it = &iter->symtab_iter;
     symrez_t sr = iter->symrez;
     strtab_t strtab = sr->strtab;
     intptr_t slide = sr->slide;
+    const struct sr_filter_state *filter = &iter->filter;
+    
+    if (unlikely(!(filter->mask & SR_FILTER_LOCALS))) {
+        it->curr = it->end;
+        return false;
+    }
     
     for (nlist64_t nl = it->curr; nl < it->end; ++nl) {
         if (nl->n_un.n_strx == 0) continue;
         if ((nl->n_type & N_STAB) || nl->n_sect == 0 || ((nl->n_type & N_EXT) && sr->exports)) {
             continue;
         }
+        
+        if (unlikely(!sr_filter_nlist(filter, nl))) {
+            continue;
+        }
 
-        char *str = (char *)strtab + nl->n_un.n_strx;
-        it->curr = ++nl;
-        iter->result.symbol = str;
-        iter->result.ptr = (void *)(nl->n_value + slide);
-        return &iter->result;
+        const char *str = (const char *)strtab + nl->n_un.n_strx;
+        it->curr = nl + 1;
+        entry->name = str;
+        entry->name_len = (uint32_t)strlen(str);
+        entry->flags = sr_entry_flags_for_nlist(nl);
+        entry->addr = (void *)(nl->n_value + slide);
+        return true;
     }
     
-    return NULL;
+    it->curr = it->end;
+    return false;
 }
 
 /*
@@ -517,29 +437,31 @@ The leaves of the tree represent complete symbols.
  
 Traverse the tree in iterative order, accumulating complete symbols by appending the
 suffix of the current node to the prefix of the parent node.
+ 
+Nodes can be terminals and still have children (i.e. `_foo` and `_foobar`). Those are
+visited twice: once to report the terminal, and again to push their children.
  */
-SR_INLINE sr_iter_result_t
-sr_iter_get_next_export(sr_iterator_t iter) {
+SR_INLINE bool
+sr_iter_next_export_entry(sr_iterator_t iter, sr_entry_t *entry) {
     sr_export_iter_t it = &iter->export_iter;
     if (unlikely(it->stack_top == 0)) {
-        return NULL;
+        return false;
     }
     
-    if (unlikely(it->stack_top >= SR_ITER_STACK_DEPTH)) {
-        #ifdef DEBUG
-        // Bump SR_ITER_STACK_DEPTH
-        abort();
-        #endif
-        return NULL;
+    if (unlikely(!(iter->filter.mask & (SR_FILTER_EXPORTS | SR_FILTER_REEXPORTS)))) {
+        it->stack_top = 0;
+        return false;
     }
     
     while (it->stack_top > 0) {
-        const uint8_t* node = it->node_stack[--it->stack_top].node;
+        struct stack_node *top = &it->node_stack[--it->stack_top];
+        const uint8_t* node = top->node;
         if (unlikely(!node)) {
-            return NULL;
+            it->stack_top = 0;
+            return false;
         }
-        char* sym = it->node_stack[it->stack_top].sym;
-        size_t sym_len = it->node_stack[it->stack_top].sym_len;
+        char* sym = top->sym;
+        size_t sym_len = top->sym_len;
         
         const uint8_t *p = node;
         uintptr_t terminal_size = *p++;
@@ -550,10 +472,32 @@ sr_iter_get_next_export(sr_iterator_t iter) {
         
         const uint8_t* children = p + terminal_size;
         uint8_t child_count = *children++;
-        if (unlikely(child_count == 0)) { // Handle leaf node
-            iter->result.symbol = sym;
-            iter->result.ptr = (void*)resolve_export_node(++node, iter->symrez->header, sym);
-            return &iter->result;
+        if (unlikely(terminal_size != 0 && !top->terminal_done)) {
+            bool keep = sr_filter_export_terminal(iter->symrez, &iter->filter, p);
+            if (child_count) {
+                // Come back for the children after this terminal is consumed
+                top->terminal_done = true;
+                ++it->stack_top;
+            }
+            
+            if (!keep) {
+                continue;
+            }
+            
+            entry->name = sym;
+            entry->name_len = (uint32_t)sym_len;
+            entry->flags = sr_entry_flags_for_export(p);
+            entry->addr = (void*)resolve_export_node(p, iter->symrez, sym);
+            return true;
+        }
+        
+        if (unlikely(it->stack_top + child_count > SR_ITER_STACK_DEPTH)) {
+            #ifdef DEBUG
+            // Bump SR_ITER_STACK_DEPTH
+            abort();
+            #endif
+            it->stack_top = 0;
+            return false;
         }
         
         p = children;
@@ -568,7 +512,8 @@ sr_iter_get_next_export(sr_iterator_t iter) {
         // by the last child.
         it->stack_top += child_count;
         for (int i = child_count; i > 0; --i) {
-            char *child_sym = it->node_stack[--it->stack_top].sym;
+            struct stack_node *child = &it->node_stack[--it->stack_top];
+            char *child_sym = child->sym;
             
             // At child_count, stack will be at original
             // (parent) stack_node, which already contains
@@ -581,7 +526,8 @@ sr_iter_get_next_export(sr_iterator_t iter) {
             size_t new_len = parent_len + child_len;
             memcpy(&child_sym[parent_len], (char*)p, child_len);
             
-            it->node_stack[it->stack_top].sym_len = new_len;
+            child->sym_len = new_len;
+            child->terminal_done = false;
             child_sym[new_len] = '\0';
             
             p += child_len+1;
@@ -589,31 +535,74 @@ sr_iter_get_next_export(sr_iterator_t iter) {
             uintptr_t nodeOffset = read_uleb128((void**)&p);
             if (likely(nodeOffset != 0)) {
                 const uint8_t *start = it->start;
-                it->node_stack[it->stack_top].node = &start[nodeOffset];
+                child->node = &start[nodeOffset];
             }
         }
         it->stack_top += child_count;
     }
-    return NULL; // No more nodes
+    return false; // No more nodes
+}
+
+SR_INLINE bool
+sr_iter_next_entry(sr_iterator_t it, sr_entry_t *entry) {
+    if (it->symtab_iter.curr < it->symtab_iter.end) {
+        if (likely(sr_iter_next_nlist_entry(it, entry))) {
+            return true;
+        }
+    }
+    
+    return sr_iter_next_export_entry(it, entry);
 }
 
 sr_iter_result_t sr_iter_get_next(sr_iterator_t it) {
-    it->result.ptr = NULL;
-    it->result.symbol = NULL;
+    memset(&it->result, 0, sizeof(it->result));
+    if (unlikely(!sr_iter_next_entry(it, &it->result.entry))) {
+        memset(&it->result, 0, sizeof(it->result));
+        return NULL;
+    }
+    
+    return &it->result;
+}
+
+size_t sr_iter_next_batch(sr_iterator_t it, sr_entry_t *out, size_t cap, char *arena, size_t arena_size) {
+    // Export names are built in the iterator's node stack and get
+    // overwritten as the walk continues, so they are copied to the
+    // arena. Only step while the arena can hold the longest name.
+    const size_t max_name = sizeof(((struct stack_node *)0)->sym);
+    if (unlikely(!cap || !arena || arena_size < max_name)) {
+        return SR_COUNT_ERROR;
+    }
     
-    struct sr_symtab_iterator symtab_iter = it->symtab_iter;
-    if (symtab_iter.curr < symtab_iter.end) {
-        sr_iter_result_t ret = sr_iter_get_next_nlist(it);
-        if (likely(ret != NULL)) {
-            return ret;
+    size_t count = 0;
+    size_t used = 0;
+    
+    while (count < cap && it->symtab_iter.curr < it->symtab_iter.end) {
+        if (unlikely(!sr_iter_next_nlist_entry(it, &out[count]))) {
+            break;
         }
+        ++count;
     }
-
-    return sr_iter_get_next_export(it);
+    
+    // Never empty-handed before the walk is over: an arena this size
+    // always has room for the first name
+    while (count < cap && (arena_size - used) >= max_name) {
+        sr_entry_t *entry = &out[count];
+        if (unlikely(!sr_iter_next_export_entry(it, entry))) {
+            break;
+        }
+        
+        char *name = &arena[used];
+        memcpy(name, entry->name, entry->name_len + 1);
+        entry->name = name;
+        used += entry->name_len + 1;
+        ++count;
+    }
+    
+    return count;
 }
 
 void sr_iterator_free(sr_iterator_t iterator) {
-    free(iterator);
+    sr_dealloc(iterator->symrez, iterator);
 }
 
 sr_iterator_t sr_get_iterator(symrez_t symrez) {
@@ -624,7 +613,11 @@ sr_iterator_t sr_get_iterator(symrez_t symrez) {
     return symrez->iterator;
 }
 
-static bool sr_for_each_handle_node(symrez_t symrez, const uint8_t *node, char *sym, size_t len, symrez_function_t work, void *context) {
+void *sr_export_address(symrez_t symrez, const uint8_t *terminal, const char *symbol) {
+    return resolve_export_node(terminal, symrez, symbol);
+}
+
+static bool sr_for_each_handle_node(symrez_t symrez, const struct sr_filter_state *filter, const uint8_t *node, char *sym, size_t len, symrez_function_t work, void *context) {
     bool stop = false;
     const uint8_t *p = node;
     uintptr_t terminal_size = *p++;
@@ -637,9 +630,14 @@ static bool sr_for_each_handle_node(symrez_t symrez, const uint8_t *node, char *
     const uint8_t* children = p + terminal_size;
     uint8_t child_count = *children++;
     
-    if (unlikely(child_count == 0)) { // Handle leaf node
-        void *addr = resolve_export_node(node, symrez->header, sym);
-        return work(sym, (void*)addr, context);
+    // Terminals can also have children, i.e. `_foo` and `_foobar`
+    if (unlikely(terminal_size != 0)) {
+        if (likely(sr_filter_export_terminal(symrez, filter, p))) {
+            void *addr = resolve_export_node(p, symrez, sym);
+            if (unlikely(work(sym, (void*)addr, context))) {
+                return true;
+            }
+        }
     }
     
     p = children;
@@ -650,8 +648,8 @@ static bool sr_for_each_handle_node(symrez_t symrez, const uint8_t *node, char *
         
         uintptr_t offset = read_uleb128((void**)&p);
         if (likely(offset != 0)) {
-            const uint8_t *n = &symrez->exports[offset];
-            stop = sr_for_each_handle_node(symrez, n, sym, len+child_len, work, context);
+            const uint8_t *n = (const uint8_t *)symrez->exports + offset;
+            stop = sr_for_each_handle_node(symrez, filter, n, sym, len+child_len, work, context);
             if (unlikely(stop)) break;
         }
     }
@@ -659,18 +657,25 @@ static bool sr_for_each_handle_node(symrez_t symrez, const uint8_t *node, char *
     return stop;
 }
 
-void sr_for_each(symrez_t symrez, void *context, symrez_function_t work) {
+void _sr_for_each(symrez_t symrez, const sr_filter_t *filter, void *context, symrez_function_t work) {
+    struct sr_filter_state state;
+    sr_filter_compile(symrez, filter, &state);
+    
     strtab_t strtab = symrez->strtab;
     nlist64_t symtab = symrez->symtab;
     intptr_t slide = symrez->slide;
 
     void *addr = NULL;
-    nlist64_t end = &symtab[symrez->nsyms];
+    nlist64_t end = (state.mask & SR_FILTER_LOCALS) ? &symtab[symrez->nsyms] : symtab;
     for (nlist64_t nl = symtab; nl < end; ++nl) {
         if ((nl->n_type & N_STAB) || nl->n_sect == 0 || ((nl->n_type & N_EXT) && symrez->exports)) {
             continue;
         }
         
+        if (unlikely(!sr_filter_nlist(&state, nl))) {
+            continue;
+        }
+        
         char *str = (char *)strtab + nl->n_un.n_strx;
         addr = (void *)(nl->n_value + slide);
         if (unlikely(work(str, addr, context))) {
@@ -678,133 +683,124 @@ void sr_for_each(symrez_t symrez, void *context, symrez_function_t work) {
         }
     }
     
-    if (likely(symrez->exports_size)) {
+    if (likely(symrez->exports_size && (state.mask & (SR_FILTER_EXPORTS | SR_FILTER_REEXPORTS)))) {
         void *exports = symrez->exports;
         const uint8_t *start = exports;
         char sym[0x2000] = {0};
-        sr_for_each_handle_node(symrez, start, sym, 0, work, context);
+        sr_for_each_handle_node(symrez, &state, start, sym, 0, work, context);
     }
 }
 
-SR_STATIC void * resolve_local_symbol(symrez_t symrez, const char *symbol) {
-    strtab_t strtab = symrez->strtab;
-    nlist64_t symtab = symrez->symtab;
-    intptr_t slide = symrez->slide;
+void sr_for_each(symrez_t symrez, void *context, symrez_function_t work) {
+    _sr_for_each(symrez, NULL, context, work);
+}
+
+void sr_for_each_filtered(symrez_t symrez, const sr_filter_t *filter, void *context, symrez_function_t work) {
+    _sr_for_each(symrez, filter, context, work);
+}
+
+nlist64_t sr_find_nlist(symrez_t symrez, const char *symbol) {
+    uint64_t trace = sr_trace_begin();
+    nlist64_t found = NULL;
     
-    size_t sym_len = strlen(symbol) + 1;
-    uint32_t sym_block = *(uint32_t*)symbol;
+    if (symrez->compact) {
+        found = sr_compact_find_nlist(symrez, symbol);
+    } else {
+        found = sr_plan_find_nlist(symrez, symbol);
+    }
     
-    nlist64_t end = &symtab[symrez->nsyms];
-    for (nlist64_t nl = symtab; nl < end; ++nl) {
-        const char *str = (const char *)strtab + nl->n_un.n_strx;
-        if (likely(*(uint32_t*)str != sym_block)) continue;
-        
-        if (likely(sr_strneq(str, symbol, sym_len))) {
-            uint64_t n_value = nl->n_value;
-            if (likely(n_value > 0)) {
-                return (void *)(n_value + slide);
-            }
-        }
+    sr_trace_end(trace, SR_TRACE_NLIST, symrez->header, NULL, 0, symbol);
+    return found;
+}
+
+void * resolve_local_symbol(symrez_t symrez, const char *symbol) {
+    nlist64_t nl = sr_find_nlist(symrez, symbol);
+    if (unlikely(!nl)) {
+        return NULL;
     }
     
-    return NULL;
+    return (void *)(nl->n_value + symrez->slide);
 }
- 
-sr_ptr_t sr_resolve_exported(symrez_t symrez, const char *symbol) {
+
+const uint8_t * sr_find_export(symrez_t symrez, const char *symbol) {
     if (unlikely(!symrez->exports_size)) {
         return NULL;
     }
 
-    void *addr = NULL;
     void *exportTrie = symrez->exports;
     void *end = (void*)((uintptr_t)exportTrie + symrez->exports_size);
+    uint64_t trace = sr_trace_begin();
     const uint8_t* node = walk_export_trie(exportTrie, end, symbol);
+    sr_trace_end(trace, SR_TRACE_TRIE, symrez->header, NULL, 0, symbol);
+    return node;
+}
+ 
+sr_ptr_t sr_resolve_exported(symrez_t symrez, const char *symbol) {
+    const uint8_t* node = sr_find_export(symrez, symbol);
     if (likely(node)) {
-        addr = resolve_export_node(node, symrez->header, symbol);
+        return resolve_export_node(node, symrez, symbol);
     }
     
-    return addr;
+    return NULL;
 }
 
 SR_STATIC void* resolve_dependent_symbol(symrez_t symrez, const char *symbol) {
     void *addr = NULL;
-    mh_for_each_lc(symrez->header, lc) {
-        switch (lc->cmd) {
-            case LC_REEXPORT_DYLIB:
-            case LC_LOAD_UPWARD_DYLIB: {
-                const struct dylib_command *dylibCmd = (void*)lc;
-                const char *dylib = (char*)((void*)lc + dylibCmd->dylib.name.offset);
-                if (unlikely(!dylib)) {
-                    break;
-                }
-                
-                struct symrez sr = { 0 };
-                mach_header_t hdr = NULL;
-                if(unlikely(!(hdr = find_image(dylib)))) {
-                    break;
-                }
-                
-                if (unlikely(!symrez_init_mh(&sr, hdr))) {
-                    break;
-                }
-                
-                if (lc->cmd == LC_REEXPORT_DYLIB) {
-                    addr = sr_resolve_symbol(&sr, symbol);
-                } else {
-                    addr = resolve_local_symbol(&sr, symbol);
-                    if (!addr) {
-                        addr = sr_resolve_exported(&sr, symbol);
-                    }
-                }
-                
-                if (likely(addr)) {
-                    return addr;
-                }
+    uint64_t trace = sr_trace_begin();
+    const struct sr_dylib *end = &symrez->image.dylibs[symrez->image.ndylibs];
+    for (const struct sr_dylib *d = symrez->image.dylibs; d < end; ++d) {
+        if (d->cmd != LC_REEXPORT_DYLIB && d->cmd != LC_LOAD_UPWARD_DYLIB) continue;
+        
+        mach_header_t hdr = find_dependent(symrez, d->name);
+        bool upward = (d->cmd == LC_LOAD_UPWARD_DYLIB);
+        
+        // Upward dylibs are only searched themselves, so their filter is conclusive
+        if (upward && !symrez->snapshot && sr_bloom_check(hdr, symbol) == SR_BLOOM_ABSENT) {
+            continue;
+        }
+        
+        struct symrez sr = { 0 };
+        if (unlikely(!symrez_init_dependent(symrez, &sr, hdr))) {
+            continue;
+        }
+        
+        if (!upward) {
+            addr = sr_resolve_symbol(&sr, symbol);
+        } else {
+            addr = resolve_local_symbol(&sr, symbol);
+            if (!addr) {
+                addr = sr_resolve_exported(&sr, symbol);
             }
+            
+            if (!addr) {
+                sr_bloom_build(&sr);
+            }
+        }
+        symrez_destroy(&sr);
+        
+        if (likely(addr)) {
+            break;
         }
     }
 
-    return NULL;
+    sr_trace_end(trace, SR_TRACE_DEPENDENTS, symrez->header, NULL, 0, symbol);
+    return addr;
 }
 
-#if __has_feature(ptrauth_calls)
-SR_INLINE bool
-is_symbol_code(symrez_t symrez, sr_ptr_t sym) {
-    uint64_t addr = ((uint64_t)sym & ~0xFFFFFF0000000000ULL);
-    mh_for_each_lc(symrez->header, lc) {
-        if (lc->cmd != LC_SEGMENT_64) continue;
-        
-        segment_command_t seg = (segment_command_t)lc;
-        uint64_t seg_max = (seg->vmaddr + symrez->slide) + seg->vmsize;
-        if (addr > seg_max) continue;
-        
-        section_t sec_start = (section_t)((uint64_t)seg + sizeof(struct segment_command_64));
-        const section_t sec_end   = &sec_start[seg->nsects];
-        for (section_t sec = sec_start; sec < sec_end; ++sec) {
-            uint64_t sec_max = (sec->addr + symrez->slide) + sec->size;
-            if (addr > sec_max) continue;
-            return ((sec->flags & S_ATTR_PURE_INSTRUCTIONS) || (sec->flags & S_ATTR_SOME_INSTRUCTIONS));
-        }
+bool sr_symbol_is_code(symrez_t symrez, sr_ptr_t sym) {
+    const struct sr_section_range *r = sr_sections_lookup(symrez, sym);
+    if (unlikely(!r || !r->section)) {
+        return false;
     }
     
-    __builtin_unreachable();
+    return sr_section_is_code(r->section);
 }
-#endif
 
-sr_ptr_t sr_resolve_symbol(symrez_t symrez, const char *symbol) {
-    void *addr = resolve_local_symbol(symrez, symbol);
-    
-    if (unlikely(!addr)) {
-        addr = sr_resolve_exported(symrez, symbol);
-        if (unlikely(!addr)) {
-            addr = resolve_dependent_symbol(symrez, symbol);
-        }
-    }
-    
+sr_ptr_t sr_sign_symbol(symrez_t symrez, sr_ptr_t addr) {
 #if __has_feature(ptrauth_calls)
     if (unlikely(!addr)) return addr;
     
-    if (likely(is_symbol_code(symrez, addr))) {
+    if (likely(sr_symbol_is_code(symrez, addr))) {
         addr = ptrauth_sign_unauthenticated(addr, ptrauth_key_function_pointer, 0);
     }
 #endif
@@ -812,6 +808,42 @@ sr_ptr_t sr_resolve_symbol(symrez_t symrez, const char *symbol) {
     return addr;
 }
 
+// `symtab` false skips the symbol table, for callers that already swept it
+sr_ptr_t sr_resolve_symbol_from(symrez_t symrez, const char *symbol, bool symtab) {
+    void *addr = NULL;
+    enum sr_bloom_result bloom = sr_bloom_check_symrez(symrez, symbol);
+    
+    if (likely(bloom != SR_BLOOM_ABSENT)) {
+        if (likely(symtab)) {
+            addr = resolve_local_symbol(symrez, symbol);
+        }
+        if (unlikely(!addr)) {
+            addr = sr_resolve_exported(symrez, symbol);
+        }
+        
+        // First miss pays for the filter so later ones are cheap
+        if (unlikely(!addr && bloom == SR_BLOOM_UNKNOWN)) {
+            sr_bloom_build(symrez);
+        }
+    }
+    
+    if (unlikely(!addr)) {
+        addr = sr_objc_resolve_symbol(symrez, symbol);
+    }
+    if (unlikely(!addr)) {
+        addr = sr_locals_resolve_symbol(symrez, symbol);
+    }
+    if (unlikely(!addr)) {
+        addr = resolve_dependent_symbol(symrez, symbol);
+    }
+    
+    return sr_sign_symbol(symrez, addr);
+}
+
+sr_ptr_t sr_resolve_symbol(symrez_t symrez, const char *symbol) {
+    return sr_resolve_symbol_from(symrez, symbol, true);
+}
+
 void sr_set_slide(symrez_t symrez, intptr_t slide) {
     symrez->slide = slide;
 }
@@ -820,15 +852,42 @@ intptr_t sr_get_slide(symrez_t symrez) {
     return symrez->slide;
 }
 
-void sr_free(symrez_t symrez) {
+void symrez_destroy(symrez_t symrez) {
+    sr_planner_sync(symrez);
+    
     if (symrez->iterator) {
         sr_iterator_free(symrez->iterator);
+        symrez->iterator = NULL;
     }
     
+    sr_image_free(symrez);
+    
+    sr_dealloc(symrez, symrez->sections);
+    symrez->sections = NULL;
+    symrez->nsections = 0;
+    symrez->ordinals = NULL;
+    symrez->nordinals = 0;
+    
+    sr_dealloc(symrez, symrez->functions);
+    symrez->functions = NULL;
+    symrez->nfunctions = 0;
+    
+    sr_search_free(symrez);
+    sr_definitions_free(symrez);
+    // The plan may point at the index just freed
+    memset(&symrez->planner, 0, sizeof(symrez->planner));
+    sr_bloom_free(symrez);
+    sr_objc_free(symrez);
+    sr_swift_free(symrez);
+    sr_compact_free(symrez);
+}
+
+void sr_free(symrez_t symrez) {
+    symrez_destroy(symrez);
     free(symrez);
 }
 
-bool symrez_init_mh(symrez_t symrez, mach_header_t mach_header) {
+bool symrez_init_mh_allocator(symrez_t symrez, mach_header_t mach_header, const sr_allocator_t * SR_NULLABLE allocator) {
     if (unlikely(!mach_header)) {
         return false;
     }
@@ -838,9 +897,30 @@ bool symrez_init_mh(symrez_t symrez, mach_header_t mach_header) {
     symrez->nsyms = 0;
     symrez->symtab = NULL;
     symrez->strtab = NULL;
+    symrez->strsize = 0;
     symrez->exports = NULL;
     symrez->exports_size = 0;
     symrez->iterator = NULL;
+    symrez->sections = NULL;
+    symrez->nsections = 0;
+    symrez->ordinals = NULL;
+    symrez->nordinals = 0;
+    symrez->functions = NULL;
+    symrez->nfunctions = 0;
+    symrez->strx_index = NULL;
+    symrez->nstrx_index = 0;
+    symrez->definitions = NULL;
+    memset(&symrez->planner, 0, sizeof(symrez->planner));
+    symrez->bloom = NULL;
+    symrez->objc = NULL;
+    symrez->swift = NULL;
+    symrez->compact = NULL;
+    symrez->snapshot = NULL;
+    if (allocator) {
+        symrez->allocator = *allocator;
+    } else {
+        memset(&symrez->allocator, 0, sizeof(symrez->allocator));
+    }
     mach_header_t hdr = mach_header;
     
     if (unlikely(hdr == SR_EXEC_HDR)) {
@@ -850,35 +930,55 @@ bool symrez_init_mh(symrez_t symrez, mach_header_t mach_header) {
         hdr = (mach_header_t)(aii->dyldImageLoadAddress);
     }
     
-    intptr_t slide = compute_image_slide(hdr);
+    if (unlikely(!hdr)) {
+        return false;
+    }
+    
+    uint64_t trace = sr_trace_begin();
+    if (unlikely(!sr_image_decode(symrez, hdr))) {
+        return false;
+    }
     
     symrez->header = hdr;
-    symrez->slide = slide;
+    symrez->slide = (intptr_t)hdr - symrez->image.text->vmaddr;
     
-    if (unlikely(!find_linkedit_commands(symrez))) {
+    if (unlikely(!find_linkedit_commands(symrez) || !sr_sections_build(symrez))) {
+        symrez_destroy(symrez);
         return false;
     }
     
+    sr_trace_end(trace, SR_TRACE_PARSE, hdr, NULL, 0, NULL);
     return true;
 }
 
-sr_ptr_t symrez_resolve_once_mh(mach_header_t header, const char *symbol) {
-    struct symrez sr;
-    if (unlikely(!symrez_init_mh(&sr, header))) {
+bool symrez_init_mh(symrez_t symrez, mach_header_t mach_header) {
+    return symrez_init_mh_allocator(symrez, mach_header, NULL);
+}
+
+size_t sr_sizeof(void) {
+    return sizeof(struct symrez);
+}
+
+symrez_t symrez_init_in(void *buf, mach_header_t mach_header) {
+    if (unlikely((uintptr_t)buf & (_Alignof(struct symrez) - 1))) {
         return NULL;
     }
     
-    return sr_resolve_symbol(&sr, symbol);
+    symrez_t symrez = buf;
+    return symrez_init_mh(symrez, mach_header) ? symrez : NULL;
 }
 
-sr_ptr_t symrez_resolve_once(const char *image_name, const char *symbol) {
-    mach_header_t hdr = NULL;
+bool sr_set_allocator(symrez_t symrez, const sr_allocator_t * SR_NULLABLE allocator) {
+    // Everything owned so far came from the previous allocator
+    symrez_destroy(symrez);
     
-    if(unlikely(!(hdr = find_image(image_name)))) {
-        return NULL;
+    if (allocator) {
+        symrez->allocator = *allocator;
+    } else {
+        memset(&symrez->allocator, 0, sizeof(symrez->allocator));
     }
     
-    return symrez_resolve_once_mh(hdr, symbol);
+    return sr_image_decode(symrez, symrez->header) && sr_sections_build(symrez);
 }
 
 symrez_t symrez_new_mh(mach_header_t mach_header) {
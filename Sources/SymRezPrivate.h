@@ -0,0 +1,552 @@
+//
+//  SymRezPrivate.h
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#ifndef __SYMREZ_PRIVATE__
+#define __SYMREZ_PRIVATE__
+
+#include <SymRez/SymRez.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mach-o/dyld_images.h>
+#include <mach-o/loader.h>
+#include <mach-o/nlist.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ Without dyld (i.e. on Linux) no Mach-O image is ever loaded in the process:
+ only snapshots and files are read, and the Mach-O headers come from
+ compat/. Locks and clocks fall back to pthread and clock_gettime.
+ */
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#include <mach/mach_time.h>
+#include <mach/mach_vm.h>
+#include <os/lock.h>
+#else
+#include <time.h>
+#endif
+
+#if __has_feature(ptrauth_calls)
+#include <ptrauth.h>
+#endif
+
+#if !__has_feature(nullability)
+#define _Nullable
+#define _Nonnull
+#endif
+
+#ifndef EXPORT_SYMBOL_FLAGS_WEAK_REEXPORT
+#define EXPORT_SYMBOL_FLAGS_WEAK_REEXPORT 0xC
+#endif
+
+#ifndef SR_STATIC
+  #if defined(DEBUG)
+    #define SR_STATIC
+  #else
+    #define SR_STATIC static
+  #endif
+#endif
+
+// Shared between translation units, but never exported from the dylib
+#define SR_HIDDEN __attribute__((__visibility__("hidden")))
+
+#define ALIGN_64 __attribute__((__aligned__(64)))
+
+#define likely(x)   __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define _strlen strlen
+#undef strlen
+#define strlen(x) \
+__builtin_constant_p(x) ? sizeof(x) : _strlen(x)
+
+#define sr_strneq(x,y,z) \
+!strncmp(x,y,z)
+
+#if defined(__APPLE__)
+typedef os_unfair_lock sr_lock_t;
+#define SR_LOCK_INIT OS_UNFAIR_LOCK_INIT
+#define sr_lock(lock) os_unfair_lock_lock(lock)
+#define sr_unlock(lock) os_unfair_lock_unlock(lock)
+#else
+typedef pthread_mutex_t sr_lock_t;
+#define SR_LOCK_INIT ((pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER)
+#define sr_lock(lock) pthread_mutex_lock(lock)
+#define sr_unlock(lock) pthread_mutex_unlock(lock)
+#endif
+
+// At most `ncmds` commands, stopping at the first one `sr_lc_check` rejects
+#define mh_for_each_lc(mh, lc) \
+for (uint32_t _lc_left = (mh)->ncmds; _lc_left; _lc_left = 0) \
+for (struct load_command *lc = sr_lc_check(mh, (mh) + 1); \
+    lc; \
+    lc = --_lc_left ? sr_lc_check(mh, (const uint8_t *)lc + lc->cmdsize) : NULL)
+
+#define _sr_for_each_image_info(it, info) \
+dyld_all_image_infos_t info = get_all_image_infos(); \
+for(const struct dyld_image_info *it = info->infoArray; \
+    it < &info->infoArray[info->infoArrayCount]; \
+    ++it)
+
+#define sr_for_each_image_info(it) \
+    _sr_for_each_image_info(it, aii##__COUNTER__)
+
+// Trace probes: while tracing is off each one costs a single predicted branch
+#define sr_trace_begin() \
+    (unlikely(_sr_trace_enabled) ? sr_trace_now() : 0)
+
+#define sr_trace_end(start, kind, image, target, ordinal, symbol) \
+    do { if (unlikely(start)) sr_trace_record(start, kind, image, target, ordinal, symbol); } while (0)
+
+extern const struct mach_header_64 _mh_execute_header;
+typedef struct load_command* load_command_t;
+typedef struct segment_command_64* segment_command_t;
+typedef struct section_64* section_t;
+typedef struct dyld_all_image_infos* dyld_all_image_infos_t;
+typedef struct nlist_64* nlist64_t;
+typedef void* strtab_t;
+
+/*
+ Load command at `p`, or NULL if it is too small to be one or runs past
+ `sizeofcmds`. Files and snapshots are untrusted: a zero `cmdsize` would
+ loop forever, a large one would walk off the commands.
+ */
+SR_INLINE load_command_t
+sr_lc_check(mach_header_t mh, const void *p) {
+    uintptr_t end = (uintptr_t)(mh + 1) + mh->sizeofcmds;
+    const struct load_command *lc = p;
+    if (unlikely(end - (uintptr_t)p < sizeof(*lc) || lc->cmdsize < sizeof(*lc) || lc->cmdsize > end - (uintptr_t)p)) {
+        return NULL;
+    }
+
+    return (load_command_t)lc;
+}
+
+// Whether all `ncmds` load commands, and the sections of every segment, lie within `size` bytes from `mh`
+SR_INLINE bool
+sr_lc_valid(mach_header_t mh, size_t size) {
+    if (unlikely(size < sizeof(*mh) || mh->sizeofcmds > size - sizeof(*mh))) {
+        return false;
+    }
+
+    uint32_t count = 0;
+    mh_for_each_lc(mh, lc) {
+        ++count;
+        if (lc->cmd != LC_SEGMENT_64) continue;
+
+        segment_command_t seg = (segment_command_t)lc;
+        if (unlikely(lc->cmdsize < sizeof(*seg) || seg->nsects > (lc->cmdsize - sizeof(*seg)) / sizeof(struct section_64))) {
+            return false;
+        }
+    }
+
+    return count == mh->ncmds;
+}
+
+struct sr_section_range {
+    uint64_t start;
+    uint64_t end;
+    segment_command_t segment;
+    section_t _Nullable section;
+    uint32_t ordinal;
+};
+
+/*
+ * `sr_filter_t` compiled against one image. Section name and code/data
+ * predicates are folded into a bitmap indexed by section ordinal (n_sect).
+ */
+struct sr_filter_state {
+    uint32_t mask;
+    bool by_section;
+    uint64_t sections[(MAX_SECT + 1) / 64];
+};
+
+struct sr_function {
+    uint64_t start;
+    uint32_t strx;
+};
+
+#define SR_TABLE_NONE UINT32_MAX
+
+struct sr_table {
+    uint32_t *buckets;
+    uint32_t *next;
+    uint32_t *hashes;
+    uint32_t nbuckets;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct sr_objc_index;
+struct sr_bloom;
+struct sr_swift_index;
+struct sr_compact_index;
+struct sr_definitions;
+
+enum sr_bloom_result {
+    SR_BLOOM_UNKNOWN,
+    SR_BLOOM_ABSENT,
+    SR_BLOOM_MAYBE,
+};
+
+// Trace event kinds. See Trace.c
+enum sr_trace_kind {
+    SR_TRACE_PARSE,
+    SR_TRACE_NLIST,
+    SR_TRACE_TRIE,
+    SR_TRACE_REEXPORT,
+    SR_TRACE_DEPENDENTS,
+};
+
+struct sr_dylib {
+    const char *name;
+    uint32_t cmd;
+};
+
+// Load commands, decoded once per image. See Image.c
+struct sr_image {
+    segment_command_t text;
+    segment_command_t linkedit;
+    const struct symtab_command *symtab;
+    const struct dysymtab_command *dysymtab;
+    const struct linkedit_data_command *exports_trie;
+    const struct dyld_info_command *dyld_info;
+    const struct linkedit_data_command *chained_fixups;
+    const struct linkedit_data_command *function_starts;
+    const uint8_t *uuid;
+    segment_command_t *segments;
+    uint32_t nsegments;
+    uint32_t nsects;
+    struct sr_dylib *dylibs;
+    uint32_t ndylibs;
+};
+
+// Lookup plan of one symrez object. See Planner.c
+struct sr_planner {
+    uint32_t plan;
+    uint32_t initial_plan;
+    uint64_t lookups;
+    uint64_t cost;
+    uint64_t budget;
+    uint64_t promoted_at;
+    uint64_t build_ns;
+    bool background;
+    bool building;
+    pthread_t _Nullable builder;
+    struct sr_definitions * _Nullable built;
+    _Atomic(bool) done;
+};
+
+struct ALIGN_64 symrez {
+    mach_header_t header;
+    intptr_t slide;
+    struct sr_image image;
+    nlist64_t symtab;
+    strtab_t strtab;
+    uint32_t strsize;
+    uint32_t nsyms;
+    void *exports;
+    uintptr_t exports_size;
+    sr_iterator_t iterator;
+    struct sr_section_range *sections;
+    uint32_t nsections;
+    section_t _Nullable *ordinals;
+    uint32_t nordinals;
+    struct sr_function *functions;
+    uint32_t nfunctions;
+    uint64_t * _Nullable strx_index;
+    uint32_t nstrx_index;
+    struct sr_definitions * _Nullable definitions;
+    struct sr_planner planner;
+    struct sr_bloom * _Nullable bloom;
+    struct sr_objc_index *objc;
+    struct sr_swift_index * _Nullable swift;
+    struct sr_compact_index * _Nullable compact;
+    sr_snapshot_t snapshot;
+    sr_allocator_t allocator;
+};
+
+/*
+ Everything a symrez object owns goes through its allocator. A NULL `alloc`
+ is the system allocator. Custom allocators have no realloc, so growing
+ needs the old size.
+ */
+SR_INLINE void *
+sr_alloc(symrez_t symrez, size_t size) {
+    if (likely(!symrez->allocator.alloc)) {
+        return malloc(size);
+    }
+
+    return symrez->allocator.alloc(size, symrez->allocator.context);
+}
+
+SR_INLINE void *
+sr_calloc(symrez_t symrez, size_t size) {
+    if (likely(!symrez->allocator.alloc)) {
+        return calloc(1, size);
+    }
+
+    void *ptr = symrez->allocator.alloc(size, symrez->allocator.context);
+    if (likely(ptr)) {
+        memset(ptr, 0, size);
+    }
+
+    return ptr;
+}
+
+SR_INLINE void
+sr_dealloc(symrez_t symrez, void *ptr) {
+    if (likely(!symrez->allocator.alloc)) {
+        free(ptr);
+    } else if (ptr && symrez->allocator.free) {
+        symrez->allocator.free(ptr, symrez->allocator.context);
+    }
+}
+
+SR_INLINE void *
+sr_realloc(symrez_t symrez, void *ptr, size_t old_size, size_t size) {
+    if (likely(!symrez->allocator.alloc)) {
+        return realloc(ptr, size);
+    }
+
+    void *ret = symrez->allocator.alloc(size, symrez->allocator.context);
+    if (likely(ret && ptr)) {
+        memcpy(ret, ptr, old_size < size ? old_size : size);
+        sr_dealloc(symrez, ptr);
+    }
+
+    return ret;
+}
+
+SR_INLINE bool
+sr_section_is_code(section_t _Nullable sec) {
+    return sec && (sec->flags & (S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS));
+}
+
+// Slid address of a __LINKEDIT file offset
+SR_INLINE const void *
+sr_linkedit_ptr(symrez_t symrez, uint64_t fileoff) {
+    segment_command_t linkedit = symrez->image.linkedit;
+    return (const void *)((linkedit->vmaddr - linkedit->fileoff) + fileoff + symrez->slide);
+}
+
+SR_INLINE const char * _Nullable
+sr_image_dylib_name(symrez_t symrez, uint64_t ordinal) {
+    if (unlikely(ordinal == 0 || ordinal > symrez->image.ndylibs)) {
+        return NULL;
+    }
+
+    return symrez->image.dylibs[ordinal - 1].name;
+}
+
+SR_INLINE bool
+sr_filter_section(const struct sr_filter_state *state, uint32_t ordinal) {
+    return (state->sections[ordinal >> 6] >> (ordinal & 63)) & 1;
+}
+
+SR_INLINE bool
+sr_filter_nlist(const struct sr_filter_state *state, nlist64_t nl) {
+    return !state->by_section || sr_filter_section(state, nl->n_sect);
+}
+
+SR_INLINE uint64_t
+read_uleb128(void** ptr) {
+    uint8_t *p = *ptr;
+    uint64_t result = 0;
+    int bit = 0;
+
+    do {
+        uint64_t slice = *p & 0x7f;
+        result |= (slice << bit);
+        bit += 7;
+    } while (*p++ & 0x80);
+
+    *ptr = p;
+    return result;
+}
+
+SR_INLINE uint32_t
+sr_entry_flags_for_nlist(nlist64_t nl) {
+    uint32_t flags = SR_ENTRY_SYMTAB;
+    if (nl->n_type & N_EXT) flags |= SR_ENTRY_EXTERNAL;
+    if (nl->n_desc & N_WEAK_DEF) flags |= SR_ENTRY_WEAK;
+    if ((nl->n_type & N_TYPE) == N_ABS) flags |= SR_ENTRY_ABSOLUTE;
+    return flags;
+}
+
+SR_INLINE uint32_t
+sr_entry_flags_for_export(const uint8_t *terminal) {
+    uint64_t export_flags = read_uleb128((void**)&terminal);
+    uint32_t flags = SR_ENTRY_EXPORT | SR_ENTRY_EXTERNAL;
+    if (export_flags & EXPORT_SYMBOL_FLAGS_REEXPORT) flags |= SR_ENTRY_REEXPORT;
+    if (export_flags & EXPORT_SYMBOL_FLAGS_WEAK_DEFINITION) flags |= SR_ENTRY_WEAK;
+    
+    switch (export_flags & EXPORT_SYMBOL_FLAGS_KIND_MASK) {
+        case EXPORT_SYMBOL_FLAGS_KIND_ABSOLUTE:
+            flags |= SR_ENTRY_ABSOLUTE;
+            break;
+        case EXPORT_SYMBOL_FLAGS_KIND_THREAD_LOCAL:
+            flags |= SR_ENTRY_THREAD_LOCAL;
+            break;
+    }
+    
+    return flags;
+}
+
+// Remove pointer authentication bits, if any
+SR_INLINE sr_ptr_t
+sr_strip_ptr(sr_ptr_t ptr) {
+#if __has_feature(ptrauth_calls)
+    return (sr_ptr_t)((uint64_t)ptr & ~0xFFFFFF0000000000ULL);
+#else
+    return ptr;
+#endif
+}
+
+// Monotonic clock for timings. See `sr_ticks_to_ns`
+SR_INLINE uint64_t
+sr_ticks(void) {
+#if defined(__APPLE__)
+    return mach_absolute_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+SR_INLINE uint64_t
+sr_ticks_to_ns(uint64_t ticks) {
+#if defined(__APPLE__)
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    return ticks * timebase.numer / timebase.denom;
+#else
+    return ticks;
+#endif
+}
+
+// FNV-1a. Also returns the length so callers don't pay for a second strlen.
+SR_INLINE uint32_t
+sr_hash_symbol(const char *symbol, size_t *len) {
+    const uint8_t *p = (const uint8_t *)symbol;
+    uint32_t hash = 0x811C9DC5;
+    while (*p) {
+        hash ^= *p++;
+        hash *= 0x01000193;
+    }
+
+    if (len) {
+        *len = (size_t)(p - (const uint8_t *)symbol);
+    }
+
+    return hash;
+}
+
+SR_INLINE segment_command_t
+find_lc_segment_len(mach_header_t mh, const char *segname, size_t len) {
+    mh_for_each_lc(mh, lc) {
+        if (lc->cmd == LC_SEGMENT_64) {
+            segment_command_t seg = (segment_command_t)lc;
+            if (sr_strneq(seg->segname, segname, len)) {
+                return seg;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+SR_INLINE segment_command_t
+find_lc_segment(mach_header_t mh, const char *segname) {
+    return find_lc_segment_len(mh, segname, strlen(segname));
+}
+
+SR_INLINE load_command_t
+find_load_command(mach_header_t mh, uint32_t cmd) {
+    mh_for_each_lc(mh, lc) {
+        if (lc->cmd == cmd) {
+            return lc;
+        }
+    }
+
+    return NULL;
+}
+
+SR_INLINE uint32_t
+sr_table_next(const struct sr_table *table, uint32_t idx, uint32_t hash) {
+    while (idx != SR_TABLE_NONE && table->hashes[idx] != hash) {
+        idx = table->next[idx];
+    }
+
+    return idx;
+}
+
+// Iterate candidates with `for (i = sr_table_first(); i != SR_TABLE_NONE; i = sr_table_next(t, t->next[i], h))`
+SR_INLINE uint32_t
+sr_table_first(const struct sr_table *table, uint32_t hash) {
+    if (unlikely(!table->nbuckets)) {
+        return SR_TABLE_NONE;
+    }
+
+    return sr_table_next(table, table->buckets[hash & (table->nbuckets - 1)], hash);
+}
+
+SR_HIDDEN bool sr_table_reserve(symrez_t symrez, struct sr_table *table, uint32_t capacity);
+SR_HIDDEN uint32_t sr_table_insert(symrez_t symrez, struct sr_table *table, uint32_t hash);
+SR_HIDDEN size_t sr_table_size(const struct sr_table *table);
+SR_HIDDEN void sr_table_free(symrez_t symrez, struct sr_table *table);
+
+SR_HIDDEN OS_PURE dyld_all_image_infos_t get_all_image_infos(void);
+#if !defined(__APPLE__)
+// Test hook: nothing reports a shared cache without dyld, so the portable tests name the one their fixture maps
+SR_HIDDEN void sr_test_set_shared_cache(uintptr_t base);
+#endif
+SR_HIDDEN mach_header_t find_image(const char *image_name);
+SR_HIDDEN bool symrez_init_mh(symrez_t symrez, mach_header_t mach_header);
+SR_HIDDEN bool symrez_init_mh_allocator(symrez_t symrez, mach_header_t mach_header, const sr_allocator_t * SR_NULLABLE allocator);
+SR_HIDDEN void * resolve_local_symbol(symrez_t symrez, const char *symbol);
+SR_HIDDEN nlist64_t SR_NULLABLE sr_find_nlist(symrez_t symrez, const char *symbol);
+SR_HIDDEN const uint8_t * SR_NULLABLE sr_find_export(symrez_t symrez, const char *symbol);
+SR_HIDDEN void * sr_export_address(symrez_t symrez, const uint8_t *terminal, const char *symbol);
+SR_HIDDEN bool sr_symbol_is_code(symrez_t symrez, sr_ptr_t sym);
+SR_HIDDEN sr_ptr_t sr_sign_symbol(symrez_t symrez, sr_ptr_t addr);
+SR_HIDDEN sr_ptr_t sr_resolve_symbol_from(symrez_t symrez, const char *symbol, bool symtab);
+SR_HIDDEN bool sr_image_decode(symrez_t symrez, mach_header_t mh);
+SR_HIDDEN void sr_image_free(symrez_t symrez);
+SR_HIDDEN bool sr_sections_build(symrez_t symrez);
+SR_HIDDEN const struct sr_section_range * SR_NULLABLE sr_sections_lookup(symrez_t symrez, sr_ptr_t ptr);
+SR_HIDDEN void sr_filter_compile(symrez_t symrez, const sr_filter_t * SR_NULLABLE filter, struct sr_filter_state *state);
+SR_HIDDEN bool sr_filter_export_terminal(symrez_t symrez, const struct sr_filter_state *state, const uint8_t *terminal);
+SR_HIDDEN sr_ptr_t sr_objc_resolve_symbol(symrez_t symrez, const char *symbol);
+SR_HIDDEN void sr_objc_free(symrez_t symrez);
+SR_HIDDEN void sr_swift_free(symrez_t symrez);
+SR_HIDDEN sr_ptr_t sr_locals_resolve_symbol(symrez_t symrez, const char *symbol);
+SR_HIDDEN nlist64_t SR_NULLABLE sr_locals_next_nlist(symrez_t symrez, const char *symbol, uint32_t *cursor);
+SR_HIDDEN nlist64_t SR_NULLABLE sr_compact_find_nlist(symrez_t symrez, const char *symbol);
+SR_HIDDEN void sr_compact_free(symrez_t symrez);
+SR_HIDDEN void sr_search_free(symrez_t symrez);
+SR_HIDDEN void sr_definitions_free(symrez_t symrez);
+SR_HIDDEN struct sr_definitions * SR_NULLABLE sr_definitions_create(symrez_t symrez);
+SR_HIDDEN struct sr_definitions * SR_NULLABLE sr_definitions_get(symrez_t symrez);
+SR_HIDDEN void sr_definitions_destroy(symrez_t symrez, struct sr_definitions *defs);
+SR_HIDDEN nlist64_t SR_NULLABLE sr_definitions_find_nlist(symrez_t symrez, const char *symbol);
+SR_HIDDEN nlist64_t SR_NULLABLE sr_plan_find_nlist(symrez_t symrez, const char *symbol);
+SR_HIDDEN void sr_planner_sync(symrez_t symrez);
+SR_HIDDEN enum sr_bloom_result sr_bloom_check(mach_header_t SR_NULLABLE header, const char *symbol);
+SR_HIDDEN enum sr_bloom_result sr_bloom_check_symrez(symrez_t symrez, const char *symbol);
+SR_HIDDEN void sr_bloom_build(symrez_t symrez);
+SR_HIDDEN void sr_bloom_free(symrez_t symrez);
+SR_HIDDEN mach_header_t SR_NULLABLE sr_snapshot_find_image(sr_snapshot_t snapshot, const char *image_name);
+SR_HIDDEN extern bool _sr_trace_enabled;
+SR_HIDDEN uint64_t sr_trace_now(void);
+SR_HIDDEN void sr_trace_record(uint64_t start, uint32_t kind, mach_header_t SR_NULLABLE image, mach_header_t SR_NULLABLE target, uint64_t ordinal, const char * SR_NULLABLE symbol);
+SR_HIDDEN void _sr_for_each(symrez_t symrez, const sr_filter_t * SR_NULLABLE filter, void * SR_NULLABLE context, symrez_function_t work);
+
+#endif
@@ -0,0 +1,94 @@
+//
+//  Table.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+
+/*
+ Chained hash table of entry indices. The table only knows hashes; callers
+ keep their payloads in a parallel array indexed by the value returned from
+ `sr_table_insert`. Chains are LIFO, so the most recent insert of a key is
+ found first.
+ */
+
+#define SR_TABLE_MIN_CAPACITY 0x100
+
+SR_INLINE uint32_t
+sr_table_round_pow2(uint32_t v) {
+    uint32_t ret = SR_TABLE_MIN_CAPACITY;
+    while (ret < v) ret <<= 1;
+    return ret;
+}
+
+static void
+sr_table_rechain(struct sr_table *table) {
+    uint32_t mask = table->nbuckets - 1;
+    memset(table->buckets, 0xFF, table->nbuckets * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < table->count; ++i) {
+        uint32_t bucket = table->hashes[i] & mask;
+        table->next[i] = table->buckets[bucket];
+        table->buckets[bucket] = i;
+    }
+}
+
+bool sr_table_reserve(symrez_t symrez, struct sr_table *table, uint32_t capacity) {
+    if (capacity <= table->capacity) {
+        return true;
+    }
+
+    capacity = sr_table_round_pow2(capacity);
+    size_t old_size = table->capacity * sizeof(uint32_t);
+    uint32_t *hashes = sr_realloc(symrez, table->hashes, old_size, capacity * sizeof(uint32_t));
+    if (unlikely(!hashes)) {
+        return false;
+    }
+    table->hashes = hashes;
+
+    uint32_t *next = sr_realloc(symrez, table->next, old_size, capacity * sizeof(uint32_t));
+    if (unlikely(!next)) {
+        return false;
+    }
+    table->next = next;
+
+    uint32_t *buckets = sr_realloc(symrez, table->buckets, old_size, capacity * sizeof(uint32_t));
+    if (unlikely(!buckets)) {
+        return false;
+    }
+    table->buckets = buckets;
+    table->nbuckets = capacity;
+    table->capacity = capacity;
+
+    sr_table_rechain(table);
+    return true;
+}
+
+uint32_t sr_table_insert(symrez_t symrez, struct sr_table *table, uint32_t hash) {
+    if (unlikely(table->count == table->capacity)) {
+        if (unlikely(!sr_table_reserve(symrez, table, table->count + 1))) {
+            return SR_TABLE_NONE;
+        }
+    }
+
+    uint32_t idx = table->count++;
+    uint32_t bucket = hash & (table->nbuckets - 1);
+    table->hashes[idx] = hash;
+    table->next[idx] = table->buckets[bucket];
+    table->buckets[bucket] = idx;
+    return idx;
+}
+
+size_t sr_table_size(const struct sr_table *table) {
+    return (size_t)table->capacity * sizeof(uint32_t) * 3;
+}
+
+void sr_table_free(symrez_t symrez, struct sr_table *table) {
+    sr_dealloc(symrez, table->hashes);
+    sr_dealloc(symrez, table->next);
+    sr_dealloc(symrez, table->buckets);
+    memset(table, 0, sizeof(*table));
+}
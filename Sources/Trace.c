@@ -0,0 +1,268 @@
+//
+//  Trace.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "SymRezPrivate.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/*
+ Every thread that records an event gets its own ring, so recording is a
+ plain store plus a release store of `head`. Rings are linked into a global
+ list once, under `lock`, for the drain. When the thread exits its ring is
+ marked retired, and the next drain frees it after writing its events.
+
+ The drain copies what it sees between `tail` and `head`, then re-reads
+ `head`, seqlock style, and discards anything the owning thread may have
+ overwritten while it was copying.
+ */
+
+#define SR_TRACE_RING_SIZE 2048
+#define SR_TRACE_SYMBOL_MAX 48
+
+struct sr_trace_event {
+    uint64_t start;
+    uint64_t end;
+    mach_header_t image;
+    mach_header_t target;
+    uint64_t ordinal;
+    uint32_t kind;
+    char symbol[SR_TRACE_SYMBOL_MAX];
+};
+
+struct sr_trace_ring {
+    struct sr_trace_ring *next;
+    uint64_t tid;
+    _Atomic(bool) retired;
+    _Atomic uint64_t head;
+    uint64_t tail;
+    struct sr_trace_event events[SR_TRACE_RING_SIZE];
+};
+
+bool _sr_trace_enabled = false;
+
+static struct {
+    sr_lock_t lock;
+    struct sr_trace_ring *rings;
+} _g_trace = { .lock = SR_LOCK_INIT };
+
+static _Thread_local struct sr_trace_ring *_t_ring = NULL;
+static pthread_key_t _g_trace_key;
+static pthread_once_t _g_trace_once = PTHREAD_ONCE_INIT;
+
+static const char *const sr_trace_names[] = {
+    [SR_TRACE_PARSE] = "image_parse",
+    [SR_TRACE_NLIST] = "nlist_scan",
+    [SR_TRACE_TRIE] = "trie_walk",
+    [SR_TRACE_REEXPORT] = "reexport_hop",
+    [SR_TRACE_DEPENDENTS] = "dependents",
+};
+
+// Keeps counting while asleep, like mach_continuous_time
+uint64_t sr_trace_now(void) {
+#if defined(__APPLE__)
+    return mach_continuous_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static uint64_t
+sr_trace_tid(void) {
+#if defined(__APPLE__)
+    uint64_t tid = 0;
+    pthread_threadid_np(NULL, &tid);
+    return tid;
+#else
+    return (uint64_t)gettid();
+#endif
+}
+
+// Thread exit. The drain owns the ring from here on
+static void
+sr_trace_ring_retire(void *context) {
+    struct sr_trace_ring *ring = context;
+    _t_ring = NULL;
+    atomic_store_explicit(&ring->retired, true, memory_order_release);
+}
+
+static void
+sr_trace_key_create(void) {
+    pthread_key_create(&_g_trace_key, sr_trace_ring_retire);
+}
+
+static struct sr_trace_ring *
+sr_trace_ring(void) {
+    if (likely(_t_ring)) {
+        return _t_ring;
+    }
+
+    struct sr_trace_ring *ring = calloc(1, sizeof(struct sr_trace_ring));
+    if (unlikely(!ring)) {
+        return NULL;
+    }
+
+    pthread_once(&_g_trace_once, sr_trace_key_create);
+    if (unlikely(pthread_setspecific(_g_trace_key, ring))) {
+        free(ring);
+        return NULL;
+    }
+
+    ring->tid = sr_trace_tid();
+    sr_lock(&_g_trace.lock);
+    ring->next = _g_trace.rings;
+    _g_trace.rings = ring;
+    sr_unlock(&_g_trace.lock);
+
+    _t_ring = ring;
+    return ring;
+}
+
+void sr_trace_record(uint64_t start, uint32_t kind, mach_header_t image, mach_header_t target, uint64_t ordinal, const char *symbol) {
+    uint64_t end = sr_trace_now();
+    struct sr_trace_ring *ring = sr_trace_ring();
+    if (unlikely(!ring)) {
+        return;
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct sr_trace_event *e = &ring->events[head % SR_TRACE_RING_SIZE];
+    e->start = start;
+    e->end = end;
+    e->image = image;
+    e->target = target;
+    e->ordinal = ordinal;
+    e->kind = kind;
+    e->symbol[0] = '\0';
+    if (symbol) {
+        strncpy(e->symbol, symbol, SR_TRACE_SYMBOL_MAX - 1);
+        e->symbol[SR_TRACE_SYMBOL_MAX - 1] = '\0';
+    }
+
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void sr_trace_set_enabled(bool enabled) {
+    _sr_trace_enabled = enabled;
+}
+
+static void
+sr_trace_write_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)str; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', out);
+            fputc(*p, out);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static const char *
+sr_trace_image_name(mach_header_t image) {
+    if (!image) {
+        return NULL;
+    }
+
+    sr_for_each_image_info(info) {
+        if ((mach_header_t)info->imageLoadAddress == image) {
+            const char *slash = strrchr(info->imageFilePath, '/');
+            return slash ? slash + 1 : info->imageFilePath;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+sr_trace_write_image(FILE *out, const char *key, mach_header_t image) {
+    const char *name = sr_trace_image_name(image);
+    fprintf(out, ",\"%s\":", key);
+    if (name) {
+        sr_trace_write_string(out, name);
+    } else {
+        fprintf(out, "\"%p\"", (const void *)image);
+    }
+}
+
+static void
+sr_trace_write_event(FILE *out, const struct sr_trace_event *e, uint64_t tid, double scale, bool first) {
+    fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"symrez\",\"ph\":\"X\",\"pid\":%d,\"tid\":%llu,\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+            first ? "" : ",\n", sr_trace_names[e->kind], (int)getpid(), (unsigned long long)tid,
+            (double)e->start * scale, (double)(e->end - e->start) * scale);
+
+    fputs("\"symbol\":", out);
+    sr_trace_write_string(out, e->symbol);
+    sr_trace_write_image(out, "image", e->image);
+    if (e->kind == SR_TRACE_REEXPORT) {
+        fprintf(out, ",\"ordinal\":%llu", (unsigned long long)e->ordinal);
+        sr_trace_write_image(out, "target", e->target);
+    }
+    fputs("}}", out);
+}
+
+size_t sr_trace_drain(FILE *out) {
+    // Microseconds per tick
+    double scale = (double)sr_ticks_to_ns(1000000) / 1e9;
+
+    struct sr_trace_event *copy = malloc(SR_TRACE_RING_SIZE * sizeof(struct sr_trace_event));
+    if (unlikely(!copy)) {
+        return 0;
+    }
+
+    size_t count = 0;
+    fputs("{\"traceEvents\":[\n", out);
+
+    sr_lock(&_g_trace.lock);
+    for (struct sr_trace_ring **link = &_g_trace.rings, *ring; (ring = *link);) {
+        // Read first: once retired, `head` is final
+        bool retired = atomic_load_explicit(&ring->retired, memory_order_acquire);
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t tail = ring->tail;
+        if (head - tail > SR_TRACE_RING_SIZE) {
+            tail = head - SR_TRACE_RING_SIZE;
+        }
+
+        for (uint64_t i = tail; i < head; ++i) {
+            copy[i - tail] = ring->events[i % SR_TRACE_RING_SIZE];
+        }
+
+        // While `head` is H the writer may be filling slot H % size, which held
+        // event H - size. Events up to `new_head - size` may have been rewritten mid-copy
+        atomic_thread_fence(memory_order_acquire);
+        uint64_t new_head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        uint64_t valid = tail;
+        if (new_head - tail >= SR_TRACE_RING_SIZE) {
+            valid = new_head - SR_TRACE_RING_SIZE + 1;
+        }
+
+        for (uint64_t i = valid > tail ? valid : tail; i < head; ++i) {
+            sr_trace_write_event(out, &copy[i - tail], ring->tid, scale, count == 0);
+            ++count;
+        }
+
+        ring->tail = head;
+        if (retired) {
+            *link = ring->next;
+            free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+    sr_unlock(&_g_trace.lock);
+
+    fputs("\n]}\n", out);
+    free(copy);
+    return count;
+}
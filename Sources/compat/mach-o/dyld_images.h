@@ -0,0 +1,69 @@
+//
+//  dyld_images.h
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+/*
+ The parts of <mach-o/dyld_images.h> symrez uses, for platforms without it.
+ Only snapshots of 64-bit tasks are read, so pointers are the host's.
+ */
+
+#ifndef __SYMREZ_COMPAT_MACHO_DYLD_IMAGES__
+#define __SYMREZ_COMPAT_MACHO_DYLD_IMAGES__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <mach-o/loader.h>
+
+struct dyld_image_info {
+    const struct mach_header *imageLoadAddress;
+    const char *imageFilePath;
+    uintptr_t imageFileModDate;
+};
+
+struct dyld_uuid_info {
+    const struct mach_header *imageLoadAddress;
+    uint8_t imageUUID[16];
+};
+
+struct dyld_all_image_infos {
+    uint32_t version;
+    uint32_t infoArrayCount;
+    const struct dyld_image_info *infoArray;
+    void *notification;
+    bool processDetachedFromSharedRegion;
+    bool libSystemInitialized;
+    const struct mach_header *dyldImageLoadAddress;
+    void *jitInfo;
+    const char *dyldVersion;
+    const char *errorMessage;
+    uintptr_t terminationFlags;
+    void *coreSymbolicationShmPage;
+    uintptr_t systemOrderFlag;
+    uintptr_t uuidArrayCount;
+    const struct dyld_uuid_info *uuidArray;
+    struct dyld_all_image_infos *dyldAllImageInfosAddress;
+    uintptr_t initialImageCount;
+    uintptr_t errorKind;
+    const char *errorClientOfDylibPath;
+    const char *errorTargetDylibPath;
+    const char *errorSymbol;
+    uintptr_t sharedCacheSlide;
+    uint8_t sharedCacheUUID[16];
+    uintptr_t sharedCacheBaseAddress;
+    uint64_t infoArrayChangeTimestamp;
+    const char *dyldPath;
+    uint32_t notifyPorts[8];
+    uintptr_t reserved[7];
+    uint64_t sharedCacheFSID;
+    uint64_t sharedCacheFSObjID;
+    uintptr_t compact_dyld_image_info_addr;
+    size_t compact_dyld_image_info_size;
+    uint32_t platform;
+};
+
+#endif
@@ -0,0 +1,45 @@
+//
+//  nlist.h
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+// The parts of <mach-o/nlist.h> symrez uses, for platforms without it
+
+#ifndef __SYMREZ_COMPAT_MACHO_NLIST__
+#define __SYMREZ_COMPAT_MACHO_NLIST__
+
+#include <stdint.h>
+
+struct nlist_64 {
+    union {
+        uint32_t n_strx;
+    } n_un;
+    uint8_t n_type;
+    uint8_t n_sect;
+    uint16_t n_desc;
+    uint64_t n_value;
+};
+
+#define N_STAB          0xe0
+#define N_PEXT          0x10
+#define N_TYPE          0x0e
+#define N_EXT           0x01
+
+#define N_UNDF          0x0
+#define N_ABS           0x2
+#define N_SECT          0xe
+#define N_PBUD          0xc
+#define N_INDR          0xa
+
+#define NO_SECT         0
+#define MAX_SECT        255
+
+#define N_NO_DEAD_STRIP 0x0020
+#define N_WEAK_REF      0x0040
+#define N_WEAK_DEF      0x0080
+#define N_ALT_ENTRY     0x0200
+
+#endif
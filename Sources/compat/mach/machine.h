@@ -0,0 +1,29 @@
+//
+//  machine.h
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+// The parts of <mach/machine.h> symrez uses, for platforms without it
+
+#ifndef __SYMREZ_COMPAT_MACH_MACHINE__
+#define __SYMREZ_COMPAT_MACH_MACHINE__
+
+#include <stdint.h>
+
+typedef int32_t cpu_type_t;
+typedef int32_t cpu_subtype_t;
+
+#define CPU_ARCH_MASK           0xff000000
+#define CPU_ARCH_ABI64          0x01000000
+#define CPU_ARCH_ABI64_32       0x02000000
+
+#define CPU_TYPE_X86            ((cpu_type_t) 7)
+#define CPU_TYPE_X86_64         (CPU_TYPE_X86 | CPU_ARCH_ABI64)
+#define CPU_TYPE_ARM            ((cpu_type_t) 12)
+#define CPU_TYPE_ARM64          (CPU_TYPE_ARM | CPU_ARCH_ABI64)
+#define CPU_TYPE_ARM64_32       (CPU_TYPE_ARM | CPU_ARCH_ABI64_32)
+
+#endif
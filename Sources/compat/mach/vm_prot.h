@@ -0,0 +1,21 @@
+//
+//  vm_prot.h
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+// The parts of <mach/vm_prot.h> symrez uses, for platforms without it
+
+#ifndef __SYMREZ_COMPAT_MACH_VM_PROT__
+#define __SYMREZ_COMPAT_MACH_VM_PROT__
+
+typedef int vm_prot_t;
+
+#define VM_PROT_NONE    ((vm_prot_t) 0x00)
+#define VM_PROT_READ    ((vm_prot_t) 0x01)
+#define VM_PROT_WRITE   ((vm_prot_t) 0x02)
+#define VM_PROT_EXECUTE ((vm_prot_t) 0x04)
+
+#endif
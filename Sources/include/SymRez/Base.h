@@ -3,7 +3,24 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+
+#if defined(__APPLE__)
 #include <os/base.h>
+#else
+#define OS_INLINE static __inline__
+#define OS_ALWAYS_INLINE __attribute__((__always_inline__))
+#define OS_NOINLINE __attribute__((__noinline__))
+#define OS_PURE __attribute__((__pure__))
+#define OS_MALLOC __attribute__((__malloc__))
+#define OS_WARN_RESULT __attribute__((__warn_unused_result__))
+#define OS_ASSUME_NONNULL_BEGIN
+#define OS_ASSUME_NONNULL_END
+#endif
+
+#ifndef __has_feature
+#define __has_feature(x) 0
+#endif
 
 #if __has_feature(nullability)
 #define SR_NULLABLE _Nullable
@@ -20,6 +37,7 @@
 typedef const struct mach_header_64* mach_header_t;
 typedef struct symrez* symrez_t;
 typedef struct sr_iterator* sr_iterator_t;
+typedef struct sr_snapshot* sr_snapshot_t;
 typedef struct sr_iter_result * SR_NULLABLE sr_iter_result_t;
 typedef void * SR_NULLABLE sr_ptr_t;
 typedef char* sr_symbol_t;
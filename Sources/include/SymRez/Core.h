@@ -19,9 +19,514 @@ OS_ASSUME_NONNULL_BEGIN
  */
 #define SR_DYLD_HDR ((mach_header_t)(void *) -2)
 
+/*!
+ * @define SR_COUNT_ERROR
+ *
+ * @abstract Returned instead of a count when a call can't be carried out with its arguments
+ */
+#define SR_COUNT_ERROR ((size_t) -1)
+
+/*!
+ * @typedef sr_section_info_t
+ *
+ * @abstract Segment/section an address belongs to. See `sr_section_for_address`
+ *
+ * @field segname Segment name, i.e. "__TEXT"
+ *
+ * @field sectname Section name, i.e. "__text". Empty for segments without sections, i.e. "__LINKEDIT"
+ *
+ * @field start Slid start address of the section
+ *
+ * @field size Size of the section
+ *
+ * @field flags Section flags (`S_ATTR_*` and section type)
+ *
+ * @field protection Initial VM protection of the containing segment
+ */
+typedef struct sr_section_info {
+    char segname[17];
+    char sectname[17];
+    sr_ptr_t start;
+    size_t size;
+    uint32_t flags;
+    int32_t protection;
+} sr_section_info_t;
+
+/*!
+ * @define SR_ENTRY_*
+ *
+ * @abstract Flags describing where a symbol came from and what kind it is. See `sr_entry_t`
+ */
+#define SR_ENTRY_SYMTAB       0x01 // nlist entry in LC_SYMTAB
+#define SR_ENTRY_EXPORT       0x02 // export trie terminal
+#define SR_ENTRY_REEXPORT     0x04 // re-exported from another image
+#define SR_ENTRY_WEAK         0x08 // weak definition
+#define SR_ENTRY_ABSOLUTE     0x10 // absolute value, not slid
+#define SR_ENTRY_THREAD_LOCAL 0x20 // thread local variable
+#define SR_ENTRY_EXTERNAL     0x40 // externally visible (N_EXT or exported)
+
+/*!
+ * @typedef sr_entry_t
+ *
+ * @abstract Symbol returned by `sr_iter_next_batch`
+ *
+ * @field name Symbol name. NUL terminated
+ *
+ * @field name_len strlen of `name`
+ *
+ * @field flags `SR_ENTRY_*` flags
+ *
+ * @field addr Symbol address
+ */
+typedef struct sr_entry {
+    const char *name;
+    uint32_t name_len;
+    uint32_t flags;
+    sr_ptr_t addr;
+} sr_entry_t;
+
+/*!
+ * @define SR_FILTER_*
+ *
+ * @abstract Predicates for `sr_filter_t`. Symbols must match at least one source and one kind
+ */
+#define SR_FILTER_LOCALS    0x01 // source: symbol table
+#define SR_FILTER_EXPORTS   0x02 // source: export trie, defined in this image
+#define SR_FILTER_REEXPORTS 0x04 // source: export trie, re-exported from another image
+#define SR_FILTER_CODE      0x08 // kind: in a section containing instructions
+#define SR_FILTER_DATA      0x10 // kind: anything else
+#define SR_FILTER_ALL       0x1F
+
+/*!
+ * @typedef sr_filter_t
+ *
+ * @abstract Restricts which symbols `sr_for_each_filtered` and iterators visit
+ *
+ * @field mask `SR_FILTER_*` flags
+ *
+ * @field segname Optional. Only symbols in this segment, i.e. "__DATA"
+ *
+ * @field sectname Optional. Only symbols in sections with this name, i.e. "__bss"
+ *
+ * @discussion
+ * Filters are applied before any work is done on a symbol: disabled sources are never walked,
+ *  symbol table entries are checked before their name is touched, and export trie terminals are
+ *  checked before they are resolved. Re-exports are only filtered by `SR_FILTER_REEXPORTS`, since
+ *  their section lives in another image.
+ */
+typedef struct sr_filter {
+    uint32_t mask;
+    const char * SR_NULLABLE segname;
+    const char * SR_NULLABLE sectname;
+} sr_filter_t;
+
+/*!
+ * @typedef sr_snapshot_region_t
+ *
+ * @abstract Where a range of the snapshotted task's memory is stored in the snapshot file
+ *
+ * @field vmaddr Address in the snapshotted task
+ *
+ * @field size Number of bytes present in the file
+ *
+ * @field fileoff Offset of the first byte in the file
+ */
+typedef struct sr_snapshot_region {
+    uint64_t vmaddr;
+    uint64_t size;
+    uint64_t fileoff;
+} sr_snapshot_region_t;
+
+/*!
+ * @typedef sr_allocator_t
+ *
+ * @abstract Allocator for everything a symrez object allocates after creation. See `sr_set_allocator`
+ *
+ * @field alloc Allocate `size` bytes, suitably aligned for any type
+ *
+ * @field free Optional. Release memory from `alloc`. NULL for arenas that are reset as a whole
+ *
+ * @field context Passed to `alloc` and `free`
+ */
+typedef struct sr_allocator {
+    void * SR_NULLABLE (*alloc)(size_t size, void * SR_NULLABLE context);
+    void (* SR_NULLABLE free)(void *ptr, void * SR_NULLABLE context);
+    void * SR_NULLABLE context;
+} sr_allocator_t;
+
+/*!
+ * @typedef sr_bloom_config_t
+ *
+ * @abstract Sizing of the per-image filters used to reject misses. See `sr_bloom_set_config`
+ *
+ * @field fp_rate Target false positive rate, i.e. 0.01. 0 disables building filters
+ *
+ * @field max_bytes Upper bound for one image's filter. The real rate is higher for images that hit it
+ */
+typedef struct sr_bloom_config {
+    double fp_rate;
+    size_t max_bytes;
+} sr_bloom_config_t;
+
+/*!
+ * @typedef sr_bloom_stats_t
+ *
+ * @abstract Shape of an image's filter. See `sr_bloom_get_stats`
+ *
+ * @field keys Number of names added
+ *
+ * @field bytes Size of the filter
+ *
+ * @field hashes Bits set per name
+ *
+ * @field fp_rate Expected false positive rate for the filter as built
+ */
+typedef struct sr_bloom_stats {
+    size_t keys;
+    size_t bytes;
+    uint32_t hashes;
+    double fp_rate;
+} sr_bloom_stats_t;
+
+/*!
+ * @typedef sr_compact_index_stats_t
+ *
+ * @abstract Shape of an image's compact index. See `sr_compact_index_get_stats`
+ *
+ * @field symbols Number of names indexed
+ *
+ * @field bytes Memory used by the index
+ *
+ * @field block_size Names per front coded block
+ *
+ * @field bytes_per_symbol `bytes` / `symbols`
+ */
+typedef struct sr_compact_index_stats {
+    size_t symbols;
+    size_t bytes;
+    uint32_t block_size;
+    double bytes_per_symbol;
+} sr_compact_index_stats_t;
+
+/*!
+ * @define SR_PLAN_*
+ *
+ * @abstract How a symrez object searches its symbol table. See `sr_planner_stats_t`
+ */
+#define SR_PLAN_SCAN    1 // every entry, in order
+#define SR_PLAN_EXTDEF  2 // scan of the locals, binary search of the sorted external definitions
+#define SR_PLAN_INDEX   3 // hash index of every definition
+#define SR_PLAN_COMPACT 4 // index from `sr_build_compact_index`
+
+/*!
+ * @typedef sr_planner_config_t
+ *
+ * @abstract When symrez objects build an index for their lookups. See `sr_planner_set_config`
+ *
+ * @field threshold Build the index once lookups have touched `threshold` times as many entries as
+ *  the symbol table has. 0 never builds it
+ *
+ * @field min_symbols Images with fewer symbols never build the index
+ *
+ * @field background Build the index on another thread. Ignored for objects with a custom allocator
+ */
+typedef struct sr_planner_config {
+    uint32_t threshold;
+    uint32_t min_symbols;
+    bool background;
+} sr_planner_config_t;
+
+/*!
+ * @typedef sr_planner_stats_t
+ *
+ * @abstract Lookup plan of a symrez object. See `sr_planner_get_stats`
+ *
+ * @field plan Current `SR_PLAN_*`, 0 before the first lookup
+ *
+ * @field initial_plan `SR_PLAN_*` chosen at the first lookup
+ *
+ * @field lookups Symbol table lookups so far
+ *
+ * @field cost Entries touched by lookups before the index was built
+ *
+ * @field budget `cost` at which the index is built, 0 if it never is
+ *
+ * @field promoted_at Lookup that started building the index, 0 if none did
+ *
+ * @field build_ns Time it took to build the index
+ *
+ * @field building The index is being built on another thread
+ */
+typedef struct sr_planner_stats {
+    uint32_t plan;
+    uint32_t initial_plan;
+    uint64_t lookups;
+    uint64_t cost;
+    uint64_t budget;
+    uint64_t promoted_at;
+    uint64_t build_ns;
+    bool building;
+} sr_planner_stats_t;
+
+/*!
+ * @define SR_DIFF_*
+ *
+ * @abstract How a symbol differs between two images. See `sr_diff_entry_t`
+ */
+#define SR_DIFF_ADDED   0x01 // only in the second image
+#define SR_DIFF_REMOVED 0x02 // only in the first image
+#define SR_DIFF_OFFSET  0x04 // moved relative to the start of __TEXT
+#define SR_DIFF_SECTION 0x08 // moved to a section with a different name
+#define SR_DIFF_KIND    0x10 // `SR_ENTRY_*` flags differ, i.e. became exported or weak
+
+/*!
+ * @typedef sr_diff_symbol_t
+ *
+ * @abstract One side of a `sr_diff_entry_t`. Zeroed for the side a symbol is missing from
+ *
+ * @field offset Offset from the start of __TEXT, or the value of absolute symbols. 0 for re-exports
+ *
+ * @field flags `SR_ENTRY_*` flags
+ *
+ * @field segname Segment of the symbol. Empty for re-exports and absolute symbols
+ *
+ * @field sectname Section of the symbol
+ */
+typedef struct sr_diff_symbol {
+    uint64_t offset;
+    uint32_t flags;
+    char segname[17];
+    char sectname[17];
+} sr_diff_symbol_t;
+
+/*!
+ * @typedef sr_diff_entry_t
+ *
+ * @abstract A symbol that differs between two images. See `sr_diff`
+ *
+ * @field name Symbol name. Only valid during the callback
+ *
+ * @field change `SR_DIFF_*` flags. Either ADDED, REMOVED or a combination of the others
+ *
+ * @field a The symbol in the first image
+ *
+ * @field b The symbol in the second image
+ */
+typedef struct sr_diff_entry {
+    const char *name;
+    uint32_t change;
+    sr_diff_symbol_t a;
+    sr_diff_symbol_t b;
+} sr_diff_entry_t;
+
+/*!
+ * @typedef sr_signature_t
+ *
+ * @abstract A byte pattern to search for. See `sr_find_signatures`
+ *
+ * @field pattern Bytes to match
+ *
+ * @field mask Optional. Bits of each byte that must match, i.e. 0xFF for exact and 0x00 for a
+ *  wildcard. NULL matches every byte exactly
+ *
+ * @field size Length of `pattern` and `mask`
+ */
+typedef struct sr_signature {
+    const uint8_t *pattern;
+    const uint8_t * SR_NULLABLE mask;
+    size_t size;
+} sr_signature_t;
+
+/*!
+ * @typedef sr_signature_scope_t
+ *
+ * @abstract Where `sr_find_signatures` searches
+ *
+ * @field sectname Optional. Only sections with this name, i.e. "__cstring". NULL searches every
+ *  section containing instructions
+ *
+ * @field anchor Optional. Only search `window` bytes starting at this symbol. Nothing is found if
+ *  it can't be resolved
+ *
+ * @field window Bytes searched from `anchor`
+ */
+typedef struct sr_signature_scope {
+    const char * SR_NULLABLE sectname;
+    const char * SR_NULLABLE anchor;
+    size_t window;
+} sr_signature_scope_t;
+
+/*!
+ * @typedef sr_signature_match_t
+ *
+ * @abstract Where a signature was found
+ *
+ * @field addr Address of the first byte of the match. Not signed
+ *
+ * @field signature Index of the signature that matched
+ */
+typedef struct sr_signature_match {
+    sr_ptr_t addr;
+    uint32_t signature;
+} sr_signature_match_t;
+
+/*!
+ * @typedef sr_symbol_handle_t
+ *
+ * @abstract A resolved symbol that stays valid across `sr_set_slide`. See `sr_resolve_symbol_handle`
+ *
+ * @field value Unslid address, or the value of absolute symbols
+ *
+ * @field address `value` under the slide it was last computed for. Not signed
+ *
+ * @field source Index in the symbol table, or offset of the terminal in the export trie
+ *
+ * @field flags `SR_ENTRY_*` flags. 0 for an invalid handle
+ */
+typedef struct sr_symbol_handle {
+    uint64_t value;
+    uint64_t address;
+    uint32_t source;
+    uint32_t flags;
+} sr_symbol_handle_t;
+
+/*!
+ * @define SR_MANIFEST_*
+ *
+ * @abstract Status of one request of `symrez_resolve_manifest`
+ */
+#define SR_MANIFEST_OK        0 // resolved
+#define SR_MANIFEST_NO_IMAGE  1 // image isn't loaded or couldn't be parsed
+#define SR_MANIFEST_NO_SYMBOL 2 // image found, symbol not
+
+/*!
+ * @typedef sr_request_t
+ *
+ * @abstract One symbol to resolve with `symrez_resolve_manifest`
+ *
+ * @field image Name or full path of the image, as for `symrez_new`. NULL for the current executable
+ *
+ * @field symbol Mangled symbol name
+ */
+typedef struct sr_request {
+    const char * SR_NULLABLE image;
+    const char *symbol;
+} sr_request_t;
+
+/*!
+ * @typedef sr_manifest_options_t
+ *
+ * @abstract Options and results of `symrez_resolve_manifest`
+ *
+ * @field threads Most threads to use, the calling one included. 0 for one per CPU
+ *
+ * @field status Optional. Array of one `SR_MANIFEST_*` per request
+ *
+ * @field elapsed_ns Set to the wall time the call took
+ */
+typedef struct sr_manifest_options {
+    uint32_t threads;
+    uint8_t * SR_NULLABLE status;
+    uint64_t elapsed_ns;
+} sr_manifest_options_t;
+
+/*!
+ * @define SR_TIER_*
+ *
+ * @abstract Where a definition was found, in the order `sr_resolve_symbol` tries them. See `sr_definition_t`
+ */
+#define SR_TIER_SYMTAB       1 // LC_SYMTAB
+#define SR_TIER_EXPORT       2 // export trie
+#define SR_TIER_OBJC         3 // Objective-C class data
+#define SR_TIER_CACHE_LOCALS 4 // shared cache local symbols
+
+/*!
+ * @typedef sr_definition_t
+ *
+ * @abstract One definition of a symbol. See `sr_resolve_all`
+ *
+ * @field addr Address, signed like the result of `sr_resolve_symbol`
+ *
+ * @field segname Segment of the definition, i.e. "__TEXT". Empty if it isn't in a section
+ *
+ * @field sectname Section of the definition, i.e. "__text". Empty if it isn't in a section
+ *
+ * @field n_type nlist type bits (`N_TYPE`, `N_EXT`, `N_PEXT`). Other tiers are described as
+ *  `N_SECT`, or `N_ABS`/`N_INDR` for absolute and re-exported symbols, with `N_EXT` for exports
+ *
+ * @field n_sect Section ordinal, or `NO_SECT`
+ *
+ * @field tier `SR_TIER_*`
+ *
+ * @field flags `SR_ENTRY_*` flags. 0 for Objective-C methods
+ */
+typedef struct sr_definition {
+    sr_ptr_t addr;
+    char segname[17];
+    char sectname[17];
+    uint8_t n_type;
+    uint8_t n_sect;
+    uint32_t tier;
+    uint32_t flags;
+} sr_definition_t;
+
+/*!
+ * @typedef sr_pointer_ref_t
+ *
+ * @abstract A data slot holding a pointer to a target. See `sr_find_pointer_refs`
+ *
+ * @field slot Address of the slot
+ *
+ * @field target The target it points to, as passed in
+ *
+ * @field index Index of the target in the array passed in
+ */
+typedef struct sr_pointer_ref {
+    sr_ptr_t slot;
+    sr_ptr_t target;
+    size_t index;
+} sr_pointer_ref_t;
+
+/*!
+ * @define SR_SWIFT_KIND_*
+ *
+ * @abstract Kind of a Swift context descriptor. See `sr_swift_type_t`
+ */
+#define SR_SWIFT_KIND_PROTOCOL 3
+#define SR_SWIFT_KIND_CLASS    16
+#define SR_SWIFT_KIND_STRUCT   17
+#define SR_SWIFT_KIND_ENUM     18
+
+/*!
+ * @typedef sr_swift_type_t
+ *
+ * @abstract A Swift type or protocol defined in an image. See `sr_resolve_swift_type`
+ *
+ * @field descriptor Nominal type or protocol descriptor
+ *
+ * @field accessor Metadata accessor function, signed. NULL for protocols. Generic types take
+ *  their arguments, i.e. `accessor(0, Int.self)`
+ *
+ * @field kind `SR_SWIFT_KIND_*`
+ *
+ * @field flags Descriptor flags as they are in the image
+ */
+typedef struct sr_swift_type {
+    sr_ptr_t descriptor;
+    sr_ptr_t SR_NULLABLE accessor;
+    uint32_t kind;
+    uint32_t flags;
+} sr_swift_type_t;
+
 // return true to stop loop
 typedef bool (*symrez_function_t)(sr_symbol_t symbol, sr_ptr_t ptr, void * SR_NULLABLE context);
 
+// return true to stop diffing
+typedef bool (*sr_diff_function_t)(const sr_diff_entry_t *entry, void * SR_NULLABLE context);
+
+// return true to stop searching
+typedef bool (*sr_pointer_ref_function_t)(const sr_pointer_ref_t *ref, void * SR_NULLABLE context);
+
 /*!
  * @function symrez_new
  *
@@ -33,59 +538,443 @@ symrez_t SR_NULLABLE OS_MALLOC OS_WARN_RESULT
 symrez_new(const char *image_name);
 
 /*!
- * @function symrez_new
+ * @function symrez_new
+ *
+ * @abstract Create new symrez object. Caller must free.
+ *
+ * @param header  Pointer to the mach_header_64 to symbolicate. Pass NULL for current executable
+ */
+symrez_t SR_NULLABLE OS_MALLOC OS_WARN_RESULT
+symrez_new_mh(mach_header_t header);
+
+/*!
+ * @function sr_sizeof
+ *
+ * @abstract Size of a symrez object, for use with `symrez_init_in`
+ */
+size_t sr_sizeof(void);
+
+/*!
+ * @function symrez_init_in
+ *
+ * @abstract Create a symrez object in caller provided memory
+ *
+ * @param buf At least `sr_sizeof()` bytes, 64 byte aligned
+ *
+ * @param header Pointer to the mach_header_64 to symbolicate
+ *
+ * @return `buf` as a symrez object, or NULL on error or if `buf` is misaligned
+ *
+ * @discussion Release with `symrez_destroy`, not `sr_free`.
+ */
+symrez_t SR_NULLABLE OS_WARN_RESULT
+symrez_init_in(void *buf, mach_header_t header);
+
+/*!
+ * @function symrez_destroy
+ *
+ * @abstract Release everything owned by a symrez object, but not the object itself
+ *
+ * @discussion Counterpart of `symrez_init_in`.
+ */
+void symrez_destroy(symrez_t symrez);
+
+/*!
+ * @function sr_set_allocator
+ *
+ * @abstract Route all of this object's allocations through `allocator`
+ *
+ * @param symrez symrez object created by symrez_new or symrez_init_in
+ *
+ * @param allocator Copied. NULL restores the system allocator
+ *
+ * @return false if the section table could not be rebuilt
+ *
+ * @discussion
+ * Covers the iterator, section and function tables, lazily built indexes and the temporary objects
+ *  used to search dependents. Anything already built is released first and rebuilt on demand.
+ *  With an arena that has no `free`, reset the arena only after `symrez_destroy`.
+ */
+bool sr_set_allocator(symrez_t symrez, const sr_allocator_t * SR_NULLABLE allocator);
+
+/*!
+ * @function sr_resolve_symbol
+ *
+ * @abstract Find symbol address
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param symbol Mangled symbol name
+ *
+ * @return Pointer to symbol location or NULL if not found
+ *
+ * @discussion Objective-C methods can be looked up by name even when the symbol table is stripped,
+ *  i.e. `-[NSObject description]` or `+[NSUserDefaults(Category) standardUserDefaults]`. Local
+ *  symbols stripped from shared cache images are found through the cache's local symbols.
+ * */
+sr_ptr_t sr_resolve_symbol(symrez_t symrez, const char *symbol);
+
+/*!
+ * @function sr_resolve_objc_method
+ *
+ * @abstract Find the implementation of an Objective-C method defined in this image
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param cls Class name
+ *
+ * @param sel Selector name
+ *
+ * @param class_method true for a class (`+`) method
+ *
+ * @return Pointer to method implementation or NULL if not found
+ *
+ * @discussion
+ * Reads class and category metadata (`__objc_classlist`, `__objc_catlist`) directly, without
+ *  the runtime, so categories defined in this image override the class' own methods. The index is
+ *  built on first use.
+ * */
+sr_ptr_t sr_resolve_objc_method(symrez_t symrez, const char *cls, const char *sel, bool class_method);
+
+/*!
+ * @function sr_resolve_swift_type
+ *
+ * @abstract Find a Swift type or protocol defined in this image, even if its symbols are stripped
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param name Mangled name, i.e. `$s10Foundation4DataV`, `SD5IndexV` or `$ss6MirrorVMn`, or a
+ *  fully qualified name, i.e. "Foundation.Data". Private types may be named without their discriminator
+ *
+ * @param type Optional. Set to the type found
+ *
+ * @return true if found
+ *
+ * @discussion
+ * Reads the context descriptors listed in `__swift5_types` and `__swift5_protos` directly, without
+ *  the Swift runtime or its locks. The index is built on first use. Only nominal type names are
+ *  understood, not generic arguments or function types. Private types of different files can share
+ *  a name; a mangled name's discriminator tells them apart when the image records it. Returns false
+ *  rather than pick one when the name matches several types.
+ * */
+bool sr_resolve_swift_type(symrez_t symrez, const char *name, sr_swift_type_t * SR_NULLABLE type);
+
+/*!
+ * @function sr_resolve_exported
+ *
+ * @abstract Find symbol address of public symbol
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param symbol Mangled symbol name
+ *
+ * @return Pointer to symbol location or NULL if not found
+ *
+ * @discussion
+ * Use this instead of `sr_resolve_symbol` if you want to search for ONLY
+ *  public symbols. This is the same behavior as `dlsym`
+ * */
+sr_ptr_t sr_resolve_exported(symrez_t symrez, const char *symbol);
+
+/*!
+ * @function sr_resolve_all
+ *
+ * @abstract Find every definition of a symbol in an image
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param symbol Mangled name of the symbol
+ *
+ * @param out Optional. Receives the first `cap` definitions
+ *
+ * @param cap Capacity of `out`
+ *
+ * @return Number of definitions, which can be more than `cap`
+ *
+ * @discussion
+ * `sr_resolve_symbol` returns the first definition it finds, which is not always the one wanted
+ *  when several file static functions or `N_PEXT` copies share a name. This returns all of them,
+ *  in symbol table order, then the export trie, Objective-C and shared cache local definitions.
+ *  An export or method at the address of a symbol table entry isn't repeated. Dependent images
+ *  aren't searched.
+ *
+ * Symbol table definitions are indexed by name on first use, so each call is one hash lookup.
+ * */
+size_t sr_resolve_all(symrez_t symrez, const char *symbol, sr_definition_t * SR_NULLABLE out, size_t cap);
+
+/*!
+ * @function sr_find_signatures
+ *
+ * @abstract Find byte patterns in this image's sections, i.e. to locate unexported code
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param signatures Patterns to search for. Patterns with no fully masked byte are ignored
+ *
+ * @param count Number of patterns
+ *
+ * @param scope Optional. Sections or window to search. NULL searches every code section
+ *
+ * @param out Array of at least `cap` matches, in address order within each section
+ *
+ * @param cap Size of `out`
+ *
+ * @return Number of matches found, which may be more than `cap`
+ *
+ * @discussion
+ * All patterns are searched in a single pass over each section, with SSE2, AVX2 or NEON when
+ *  available, so adding patterns is much cheaper than searching again. Matches may overlap.
+ * */
+size_t sr_find_signatures(symrez_t symrez, const sr_signature_t *signatures, size_t count, const sr_signature_scope_t * SR_NULLABLE scope, sr_signature_match_t * SR_NULLABLE out, size_t cap);
+
+/*!
+ * @function sr_find_signature
+ *
+ * @abstract Find one byte pattern. See `sr_find_signatures`
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param pattern Bytes to match
+ *
+ * @param mask Optional. Bits of each byte that must match. NULL matches every byte exactly
+ *
+ * @param size Length of `pattern` and `mask`
+ *
+ * @param section Optional. Only sections with this name. NULL searches every code section
+ *
+ * @param out Array of at least `cap` addresses, not signed
+ *
+ * @param cap Size of `out`
+ *
+ * @return Number of matches found, which may be more than `cap`
+ * */
+size_t sr_find_signature(symrez_t symrez, const uint8_t *pattern, const uint8_t * SR_NULLABLE mask, size_t size, const char * SR_NULLABLE section, sr_ptr_t * SR_NULLABLE out, size_t cap);
+
+/*!
+ * @function sr_resolve_symbol_or_signature
+ *
+ * @abstract Find a symbol, falling back to a signature when it can't be resolved
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param symbol Mangled symbol name
+ *
+ * @param signature Pattern to search for if `symbol` is missing, i.e. stripped
+ *
+ * @param scope Optional. Where to search. See `sr_find_signatures`
+ *
+ * @return Pointer to symbol location or NULL if not found. NULL if the signature matches more than once
+ * */
+sr_ptr_t sr_resolve_symbol_or_signature(symrez_t symrez, const char *symbol, const sr_signature_t *signature, const sr_signature_scope_t * SR_NULLABLE scope);
+
+/*!
+ * @function sr_lazy_function
+ *
+ * @abstract Get a function pointer now and resolve the symbol on its first call
+ *
+ * @param symrez symrez object created by symrez_new. Only its image is kept, it can be freed
+ *
+ * @param symbol Mangled name of a function
+ *
+ * @param handler Optional. Called instead, with the same arguments, if `symbol` can't be resolved.
+ *  If NULL, calling a missing function aborts
+ *
+ * @return A trampoline to call like the function itself, or NULL if all 256 are in use
+ *
+ * @discussion
+ * The first call resolves `symbol`, patches the trampoline to jump straight to it from then on and
+ *  forwards the call. Concurrent first calls are safe. Trampolines are preassembled in __TEXT, so
+ *  nothing is written to executable memory, and are never freed; asking again for the same symbol
+ *  in the same image returns the same one. Only plain functions can be forwarded: register and stack
+ *  arguments reach the target untouched, but nothing else may depend on the trampoline's address.
+ * */
+sr_ptr_t SR_NULLABLE sr_lazy_function(symrez_t symrez, const char *symbol, sr_ptr_t SR_NULLABLE handler);
+
+/*!
+ * @function sr_find_pointer_refs
+ *
+ * @abstract Find data that points to any of several addresses, i.e. vtables, method lists or
+ *  callback tables referencing a function
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param targets Addresses to look for, signed or not
+ *
+ * @param count Number of targets
+ *
+ * @param context Optional. Passed to `callback`
+ *
+ * @param callback Called with each slot and the target it holds. Called once per target
+ *  if the same address is passed more than once
+ *
+ * @return Number of references reported, or `SR_COUNT_ERROR` if `symrez` comes from a snapshot
+ *
+ * @discussion
+ * Every initialized data section outside __TEXT is read once, pointer-aligned slots only, with
+ *  AVX2 or NEON when available. Pointer authentication bits are ignored on both sides. The cost
+ *  hardly depends on the number of targets, so look for all of them in one call. Only images
+ *  loaded in this process can be searched: objects from `sr_snapshot_symrez`, whether the snapshot
+ *  was read from a file or another task, hold data that was never bound or slid here.
+ * */
+size_t sr_find_pointer_refs(symrez_t symrez, const sr_ptr_t *targets, size_t count, void * SR_NULLABLE context, sr_pointer_ref_function_t callback);
+
+/*!
+ * @function sr_section_for_address
+ *
+ * @abstract Classify an address by segment and section
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param addr Address to classify. Pointer authentication bits are ignored
+ *
+ * @param info Optional. Filled out with the segment/section containing `addr`
+ *
+ * @return true if `addr` is inside this image
+ *
+ * @discussion
+ * Sections are flattened into a sorted range table when the symrez object is created, so this
+ *  is a binary search and never touches the load commands.
+ * */
+bool sr_section_for_address(symrez_t symrez, sr_ptr_t addr, sr_section_info_t * SR_NULLABLE info);
+
+/*!
+ * @function sr_for_each
+ *
+ * @abstract Loop through all symbols with a callback
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param context user context for callback
+ *
+ * @param callback callback for processing each iteration. Return true to stop loop.
+ *
+ * @discussion More performant and efficient than `sr_iterator`, but less convenient. String passed to 'callback' should be considered ephemeral.
+ * */
+void sr_for_each(symrez_t symrez, void * SR_NULLABLE context, symrez_function_t callback);
+
+/*!
+ * @function sr_function_extent
+ *
+ * @abstract Find the function containing an address
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param addr Any address inside the function, i.e. a sampled PC
+ *
+ * @param start Optional. Set to the start of the function
+ *
+ * @param size Optional. Set to the size of the function
+ *
+ * @return true if `addr` is inside a known function
+ *
+ * @discussion
+ * Function boundaries come from `LC_FUNCTION_STARTS` merged with the symbol table, so this works
+ *  for stripped functions too. A function ends where the next one starts or where its section
+ *  ends. The boundary table is built on first use.
+ * */
+bool sr_function_extent(symrez_t symrez, sr_ptr_t addr, sr_ptr_t SR_NULLABLE * SR_NULLABLE start, size_t * SR_NULLABLE size);
+
+/*!
+ * @function sr_for_each_function
  *
- * @abstract Create new symrez object. Caller must free.
+ * @abstract Loop through all functions with a callback, in address order
  *
- * @param header  Pointer to the mach_header_64 to symbolicate. Pass NULL for current executable
- */
-symrez_t SR_NULLABLE OS_MALLOC OS_WARN_RESULT
-symrez_new_mh(mach_header_t header);
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param context user context for callback
+ *
+ * @param callback callback for processing each iteration. Return true to stop loop.
+ *
+ * @discussion Functions without a symbol are named `func_<addr>`, where addr is the unslid
+ *  address in hex. String passed to 'callback' should be considered ephemeral.
+ * */
+void sr_for_each_function(symrez_t symrez, void * SR_NULLABLE context, symrez_function_t callback);
 
 /*!
- * @function sr_resolve_symbol
+ * @function sr_for_each_filtered
  *
- * @abstract Find symbol address
+ * @abstract Loop through symbols matching a filter with a callback
  *
  * @param symrez symrez object created by symrez_new
  *
- * @param symbol Mangled symbol name
+ * @param filter Symbols to visit. NULL visits everything, like `sr_for_each`
  *
- * @return Pointer to symbol location or NULL if not found
+ * @param context user context for callback
+ *
+ * @param callback callback for processing each iteration. Return true to stop loop.
+ *
+ * @discussion Much cheaper than filtering in the callback. i.e. `SR_FILTER_LOCALS | SR_FILTER_DATA`
+ *  never walks the export trie.
  * */
-sr_ptr_t sr_resolve_symbol(symrez_t symrez, const char *symbol);
+void sr_for_each_filtered(symrez_t symrez, const sr_filter_t * SR_NULLABLE filter, void * SR_NULLABLE context, symrez_function_t callback);
 
 /*!
- * @function sr_resolve_exported
+ * @function sr_search_substring
  *
- * @abstract Find symbol address of public symbol
+ * @abstract Loop through symbols whose name contains a string
  *
  * @param symrez symrez object created by symrez_new
  *
- * @param symbol Mangled symbol name
+ * @param needle String to look for. An empty string matches every symbol
  *
- * @return Pointer to symbol location or NULL if not found
+ * @param context user context for callback
+ *
+ * @param callback callback for each match. Return true to stop loop.
+ *
+ * @return Number of matches passed to `callback`
  *
  * @discussion
- * Use this instead of `sr_resolve_symbol` if you want to search for ONLY
- *  public symbols. This is the same behavior as `dlsym`
+ * Visits the same symbols as `sr_for_each`, without testing them one by one: the string table
+ *  is searched in a single pass and hits are mapped back to symbols through an index built on
+ *  first use, and only the export trie edges that can complete a match are searched. Matches
+ *  from the symbol table come first, in string table order. String passed to 'callback' should
+ *  be considered ephemeral.
  * */
-sr_ptr_t sr_resolve_exported(symrez_t symrez, const char *symbol);
+size_t sr_search_substring(symrez_t symrez, const char *needle, void * SR_NULLABLE context, symrez_function_t callback);
 
 /*!
- * @function sr_for_each
+ * @function sr_search_glob
  *
- * @abstract Loop through all symbols with a callback
+ * @abstract Loop through symbols whose name matches a shell pattern
  *
  * @param symrez symrez object created by symrez_new
  *
+ * @param pattern fnmatch(3) pattern, i.e. `_CGS*Window*`
+ *
  * @param context user context for callback
  *
- * @param callback callback for processing each iteration. Return true to stop loop.
+ * @param callback callback for each match. Return true to stop loop.
  *
- * @discussion More performant and efficient than `sr_iterator`, but less convenient. String passed to 'callback' should be considered ephemeral.
+ * @return Number of matches passed to `callback`
+ *
+ * @discussion Works like `sr_search_substring` on the longest literal part of `pattern`, so
+ *  patterns with a literal part only test the names containing it. A literal start also skips
+ *  export trie branches that can't match.
  * */
-void sr_for_each(symrez_t symrez, void * SR_NULLABLE context, symrez_function_t callback);
+size_t sr_search_glob(symrez_t symrez, const char *pattern, void * SR_NULLABLE context, symrez_function_t callback);
+
+/*!
+ * @function sr_diff
+ *
+ * @abstract Report symbols added, removed or changed between two versions of an image
+ *
+ * @param a symrez object of the old image
+ *
+ * @param b symrez object of the new image
+ *
+ * @param context user context for callback
+ *
+ * @param callback called for each difference, in name order. Return true to stop.
+ *
+ * @return false if memory for the sorted views could not be allocated
+ *
+ * @discussion
+ * Compares the symbols `sr_for_each` visits. Both images are sorted by name once and then
+ *  merged in a single pass, so the cost is O(n log n) rather than a lookup per symbol. Images
+ *  with the same `LC_UUID` are identical and return without doing any work. Re-exports are
+ *  compared by kind only, without resolving them.
+ * */
+bool sr_diff(symrez_t a, symrez_t b, void * SR_NULLABLE context, sr_diff_function_t callback);
 
 /*!
  * @function sr_get_iterator
@@ -124,6 +1013,64 @@ void sr_set_slide(symrez_t symrez, intptr_t slide);
  */
 intptr_t sr_get_slide(symrez_t symrez);
 
+/*!
+ * @function sr_resolve_symbol_handle
+ *
+ * @abstract Find a symbol and keep enough to recompute its address under another slide
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param symbol Mangled symbol name
+ *
+ * @param out Receives the handle. Zeroed if not found
+ *
+ * @return true if the symbol is defined in this image's symbol table or export trie
+ *
+ * @discussion
+ * Unlike `sr_resolve_symbol`, Objective-C metadata and other images are not searched, since
+ *  their addresses don't follow this image's slide.
+ * */
+bool sr_resolve_symbol_handle(symrez_t symrez, const char *symbol, sr_symbol_handle_t *out);
+
+/*!
+ * @function sr_handle_address
+ *
+ * @abstract Address of a handle's symbol under the current slide, without looking it up again
+ *
+ * @param symrez symrez object the handle was resolved with
+ *
+ * @param handle Handle from `sr_resolve_symbol_handle`
+ *
+ * @return Pointer to symbol location, or NULL for an invalid handle
+ * */
+sr_ptr_t sr_handle_address(symrez_t symrez, sr_symbol_handle_t handle);
+
+/*!
+ * @function sr_handles_rebase
+ *
+ * @abstract Recompute the `address` of many handles for a new slide
+ *
+ * @param handles Handles to update in place
+ *
+ * @param count Number of handles
+ *
+ * @param slide New slide, as passed to `sr_set_slide`
+ *
+ * @discussion The loop has no branches or lookups, so it vectorizes. Addresses are not signed.
+ * */
+void sr_handles_rebase(sr_symbol_handle_t *handles, size_t count, intptr_t slide);
+
+/*!
+ * @function sr_get_uuid
+ *
+ * @abstract Get the image's `LC_UUID`
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @return 16 bytes owned by the image, or NULL if it has no UUID
+ */
+const uint8_t * SR_NULLABLE sr_get_uuid(symrez_t symrez);
+
 /*!
  * @function sr_free
  *
@@ -134,18 +1081,23 @@ void sr_free(symrez_t);
 /*!
  * @function symrez_resolve_once
  *
- * @abstract Lookup a single symbol. Does not allocate memory but not recommended for multiple lookups
+ * @abstract Lookup a single symbol
  *
  * @param image_name Name or full path of the library to symbolicate. Pass NULL for current executable
  *
  * @return Pointer to symbol location or NULL if not found
+ *
+ * @discussion
+ * Parsed images are kept in a small process-wide cache, keyed by header, along with the header
+ *  each recent `image_name` resolved to. Both are dropped when the image is unloaded, so repeated
+ *  calls cost about as much as a lookup on a held symrez object.
  */
 sr_ptr_t symrez_resolve_once(const char *image_name, const char *symbol);
 
 /*!
  * @function symrez_resolve_once_mh
  *
- * @abstract Lookup a single symbol. Does not allocate memory but not recommended for multiple lookups
+ * @abstract Lookup a single symbol. Shares the parsed image cache of `symrez_resolve_once`
  *
  * @param header  Pointer to the mach_header_64 to symbolicate. Pass NULL for current executable
  *
@@ -153,6 +1105,285 @@ sr_ptr_t symrez_resolve_once(const char *image_name, const char *symbol);
  * */
 sr_ptr_t symrez_resolve_once_mh(mach_header_t header, const char *symbol);
 
+/*!
+ * @function symrez_resolve_manifest
+ *
+ * @abstract Resolve a table of (image, symbol) pairs
+ *
+ * @param requests Pairs to resolve
+ *
+ * @param count Number of requests
+ *
+ * @param out Array of `count` pointers, in request order. NULL for requests that failed
+ *
+ * @param options Optional. Thread count in, per request status and wall time out
+ *
+ * @return Number of requests resolved
+ *
+ * @discussion
+ * Meant for resolving everything a program needs at launch. Requests are grouped by image, so each
+ *  image is found and parsed once, and its symbol table is searched for every name of the group in a
+ *  single pass. Groups are resolved in parallel. Results are the same as `sr_resolve_symbol`.
+ * */
+size_t symrez_resolve_manifest(const sr_request_t *requests, size_t count, sr_ptr_t SR_NULLABLE *out, sr_manifest_options_t * SR_NULLABLE options);
+
+/*!
+ * @function symrez_resolve_global
+ *
+ * @abstract Lookup a symbol in every loaded image
+ *
+ * @param symbol Mangled symbol name
+ *
+ * @param image_out Optional. Set to the header of the image defining `symbol`, or NULL if not found
+ *
+ * @return Pointer to symbol location or NULL if not found
+ *
+ * @discussion
+ * Backed by a process-wide index that is built incrementally, one image at a time in dyld's
+ *  load order, only as far as a lookup needs. Images are pruned from the index when they are
+ *  unloaded. Private (non-exported) symbols are included, so unlike `dlsym(RTLD_DEFAULT, ...)`
+ *  this can find file-static functions and globals. When more than one image defines `symbol`,
+ *  the one loaded first wins. A miss has to index every image, so the first miss is expensive.
+ * */
+sr_ptr_t symrez_resolve_global(const char *symbol, mach_header_t SR_NULLABLE * SR_NULLABLE image_out);
+
+/*!
+ * @function sr_bloom_set_config
+ *
+ * @abstract Configure the filters `sr_resolve_symbol` uses to skip images that can't contain a name
+ *
+ * @param config Copied. Applies to filters built afterwards
+ *
+ * @discussion
+ * Each image gets a Bloom filter over every name it defines the first time a lookup misses in it.
+ *  Later lookups skip the symbol table and export trie of an image whose filter rejects the name,
+ *  and skip upward dependents without parsing them. Filters are shared process-wide and dropped
+ *  when their image unloads. The default is a 1% false positive rate, capped at 4MB per image.
+ * */
+void sr_bloom_set_config(const sr_bloom_config_t *config);
+
+/*!
+ * @function sr_bloom_get_stats
+ *
+ * @abstract Report the size and expected false positive rate of an image's filter
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param stats Filled in on success
+ *
+ * @return false if filters are disabled for this image. Builds the filter if needed
+ * */
+bool sr_bloom_get_stats(symrez_t symrez, sr_bloom_stats_t *stats);
+
+/*!
+ * @function sr_get_cache_local_count
+ *
+ * @abstract Number of local symbols the dyld shared cache keeps for this image outside its symbol table
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @return Count of entries, or 0 if the image isn't in the shared cache or its local symbols can't be read
+ *
+ * @discussion
+ * The cache builder strips most local symbols from cache images; `sr_resolve_symbol` falls back to
+ *  the cache's local symbols (the `.symbols` subcache on split caches) when a name isn't found
+ *  otherwise. The file is mapped on first use and each image's index is built the first time it is
+ *  needed, as this call does.
+ * */
+size_t sr_get_cache_local_count(symrez_t symrez);
+
+/*!
+ * @function sr_build_compact_index
+ *
+ * @abstract Index this image's symbol table in at most `max_bytes`
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param max_bytes Upper bound for the index, counting the 4 bytes per symbol used to sort names while building it
+ *
+ * @return true if the index fits the budget. Otherwise lookups keep scanning the symbol table
+ *
+ * @discussion
+ * Names are sorted and front coded in blocks, usually a few bytes per symbol, and found with a binary
+ *  search over the first name of each block followed by a scan of one block. Lookups are much faster
+ *  than scanning the symbol table at a fraction of the memory of a hash table. The index is owned by
+ *  `symrez` and replaced by calling this again.
+ * */
+bool sr_build_compact_index(symrez_t symrez, size_t max_bytes);
+
+/*!
+ * @function sr_compact_index_get_stats
+ *
+ * @abstract Describe the index built by `sr_build_compact_index`
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param stats Receives the stats
+ *
+ * @return false if there is no compact index
+ * */
+bool sr_compact_index_get_stats(symrez_t symrez, sr_compact_index_stats_t *stats);
+
+/*!
+ * @function sr_planner_set_config
+ *
+ * @abstract Configure when symrez objects trade memory for faster symbol table lookups
+ *
+ * @param config Copied. Applies to objects that haven't looked anything up yet
+ *
+ * @discussion
+ * Each object starts with the cheapest way to search its symbol table, a binary search of the
+ *  external definitions when the image has them, or a scan, and counts the entries its lookups
+ *  touch. An object that keeps being used, relative to the size of its image, builds a hash
+ *  index of every definition, the one `sr_resolve_all` uses, and answers later lookups from it.
+ *  An object used for a few lookups never builds it. The default is a threshold of 4 for images
+ *  with at least 1024 symbols, built on the calling thread.
+ * */
+void sr_planner_set_config(const sr_planner_config_t *config);
+
+/*!
+ * @function sr_planner_get_stats
+ *
+ * @abstract Get the lookup plan of a symrez object and how it got there
+ *
+ * @param symrez symrez object created by symrez_new
+ *
+ * @param stats Filled in
+ * */
+void sr_planner_get_stats(symrez_t symrez, sr_planner_stats_t *stats);
+
+/*!
+ * @function sr_trace_set_enabled
+ *
+ * @abstract Turn lookup tracing on or off, process-wide. Off by default
+ *
+ * @param enabled true to start recording
+ *
+ * @discussion
+ * While enabled, image parses, symbol table scans, export trie walks, re-export hops and
+ *  dependent searches are timed into a per-thread ring of the last 2048 events. Recording
+ *  takes no locks. While disabled each probe is a single branch.
+ * */
+void sr_trace_set_enabled(bool enabled);
+
+/*!
+ * @function sr_trace_drain
+ *
+ * @abstract Write recorded events as Chrome trace-event JSON
+ *
+ * @param out Destination, i.e. a file opened for about://tracing or Perfetto
+ *
+ * @return number of events written
+ *
+ * @discussion
+ * Events are consumed: a second drain only writes events recorded since the first. Symbol
+ *  names are truncated to 47 characters. Events a thread overwrote before they were drained
+ *  are dropped.
+ * */
+size_t sr_trace_drain(FILE *out);
+
+/*!
+ * @function sr_snapshot_open
+ *
+ * @abstract Open a Mach-O core file (`MH_CORE`) or a dyld shared cache for offline symbolication
+ *
+ * @param path Path to the core file or shared cache
+ *
+ * @return snapshot reference or NULL if `path` is neither a 64-bit core file nor a shared cache
+ *
+ * @discussion
+ * The file is mmap'd, not read. Images are found through dyld's `dyld_all_image_infos` inside the
+ *  snapshot the first time they are asked for, and each image is only mapped once its symrez object
+ *  is requested. A shared cache lists its images itself; images whose `__LINKEDIT` lives in another
+ *  file of a split cache have no symrez object. Release with `sr_snapshot_close`.
+ * */
+sr_snapshot_t SR_NULLABLE sr_snapshot_open(const char *path);
+
+/*!
+ * @function sr_snapshot_open_regions
+ *
+ * @abstract Open a raw memory snapshot described by a region map
+ *
+ * @param path Path to the snapshot file
+ *
+ * @param regions Where each range of the task's memory lives in the file. Copied
+ *
+ * @param count Number of regions
+ *
+ * @return snapshot reference or NULL on error
+ * */
+sr_snapshot_t SR_NULLABLE sr_snapshot_open_regions(const char *path, const sr_snapshot_region_t *regions, size_t count);
+
+/*!
+ * @function sr_snapshot_read
+ *
+ * @abstract Translate an address in the snapshotted task to its bytes in the snapshot
+ *
+ * @param snapshot snapshot created by sr_snapshot_open
+ *
+ * @param addr Address in the snapshotted task
+ *
+ * @param size Number of bytes that must be readable
+ *
+ * @return Pointer to the bytes or NULL if not (fully) present
+ * */
+const void * SR_NULLABLE sr_snapshot_read(sr_snapshot_t snapshot, uint64_t addr, size_t size);
+
+/*!
+ * @function sr_snapshot_image_count
+ *
+ * @abstract Number of images found in the snapshot
+ * */
+uint32_t sr_snapshot_image_count(sr_snapshot_t snapshot);
+
+/*!
+ * @function sr_snapshot_image_address
+ *
+ * @abstract Header address of an image in the snapshotted task, or 0 if `image` is out of range
+ * */
+uint64_t sr_snapshot_image_address(sr_snapshot_t snapshot, uint32_t image);
+
+/*!
+ * @function sr_snapshot_image_path
+ *
+ * @abstract Path of an image, or NULL if unknown
+ * */
+const char * SR_NULLABLE sr_snapshot_image_path(sr_snapshot_t snapshot, uint32_t image);
+
+/*!
+ * @function sr_snapshot_symrez
+ *
+ * @abstract Get a symrez object for an image in the snapshot
+ *
+ * @param snapshot snapshot created by sr_snapshot_open
+ *
+ * @param image Index of the image, less than `sr_snapshot_image_count`
+ *
+ * @return symrez object owned by the snapshot. Do not call `sr_free` on it
+ *
+ * @discussion
+ * Works with every lookup and iteration function. Dependents and re-exports are resolved within
+ *  the snapshot. Returned addresses point into a local mapping of the image; convert them with
+ *  `sr_snapshot_remote_address`. Objective-C method lookup is not supported for snapshots.
+ * */
+symrez_t SR_NULLABLE sr_snapshot_symrez(sr_snapshot_t snapshot, uint32_t image);
+
+/*!
+ * @function sr_snapshot_remote_address
+ *
+ * @abstract Convert an address returned by an image's symrez object to an address in the snapshotted task
+ *
+ * @return Address in the snapshotted task, or 0 if `ptr` isn't inside the image
+ * */
+uint64_t sr_snapshot_remote_address(sr_snapshot_t snapshot, uint32_t image, sr_ptr_t ptr);
+
+/*!
+ * @function sr_snapshot_close
+ *
+ * @abstract Release the snapshot and every symrez object it created
+ * */
+void sr_snapshot_close(sr_snapshot_t snapshot);
+
 /*!
  * @function sr_iter_get_next
  *
@@ -175,6 +1406,17 @@ sr_iter_result_t sr_iter_get_next(sr_iterator_t iterator);
  * */
 void sr_iter_reset(sr_iterator_t iterator);
 
+/*!
+ * @function sr_iter_set_filter
+ *
+ * @abstract Restrict the symbols an iterator visits. Also resets the iterator
+ *
+ * @param iterator iterator
+ *
+ * @param filter Symbols to visit. NULL removes the filter
+ * */
+void sr_iter_set_filter(sr_iterator_t iterator, const sr_filter_t * SR_NULLABLE filter);
+
 /*!
  * @function sr_iter_get_ptr
  *
@@ -212,6 +1454,33 @@ sr_symbol_t sr_iter_get_symbol(sr_iterator_t iterator);
  * */
 size_t sr_iter_copy_symbol(sr_iterator_t iterator, char *dest);
 
+/*!
+ * @function sr_iter_next_batch
+ *
+ * @abstract Fill an array with the next symbols from the iterator
+ *
+ * @param iterator iterator
+ *
+ * @param out Array of at least `cap` entries
+ *
+ * @param cap Maximum number of entries to return
+ *
+ * @param arena Buffer for export trie names. Must hold at least the longest possible name (2KB)
+ *
+ * @param arena_size Size of `arena` in bytes
+ *
+ * @return Number of entries written, 0 when done, or `SR_COUNT_ERROR` if `cap` is 0 or `arena` is
+ *  NULL or smaller than 2KB
+ *
+ * @discussion
+ * Symbol table names point into the image and stay valid for the lifetime of the image. Export
+ *  trie names are copied into `arena`, which is reused from the start on every call, so they
+ *  are only valid until the next call with the same arena. Fewer than `cap` entries are returned
+ *  when there is no room left in `arena` for the longest possible name, so keep it comfortably
+ *  larger than that.
+ * */
+size_t sr_iter_next_batch(sr_iterator_t iterator, sr_entry_t *out, size_t cap, char *arena, size_t arena_size);
+
 /*!
  * @function sr_iter_next_symbol
  *
@@ -52,6 +52,33 @@ extern mach_header_t find_image(const char *image_name);
     sr_free(sr);
 }
 
+- (void)testPerformanceResolveSymbolCompactIndex {
+    symrez_t sr = symrez_new("AppKit");
+    sr_build_compact_index(sr, 8 << 20);
+    [self measureBlock:^{
+        sr_resolve_symbol(sr, "__nsBeginNSPSupport");
+    }];
+
+    sr_free(sr);
+}
+
+- (void)testPerformanceResolveManifest {
+    sr_request_t requests[] = {
+        { "AppKit", "__nsBeginNSPSupport" },
+        { "AppKit", "_NSApp" },
+        { "CoreFoundation", "___CFStringHash" },
+        { "CoreFoundation", "_CFRelease" },
+        { "Foundation", "-[NSXPCConnection _initWithPeerConnection:name:options:]" },
+        { "libsystem_c.dylib", "_printf" },
+        { "libxpc.dylib", "__xpc_endpoint_create" },
+    };
+    size_t n = sizeof(requests) / sizeof(*requests);
+    [self measureBlock:^{
+        sr_ptr_t out[n];
+        symrez_resolve_manifest(requests, n, out, NULL);
+    }];
+}
+
 - (void)testPerformanceResolveExported {
     symrez_t sr = symrez_new("AppKit");
     [self measureBlock:^{
@@ -89,4 +116,35 @@ extern mach_header_t find_image(const char *image_name);
     }];
 }
 
+- (void)testPerformanceResolveOnceLoop {
+    [self measureBlock:^{
+        for (int i = 0; i < 1000; ++i) {
+            void *p = symrez_resolve_once("libsystem_c.dylib", "_printf");
+            XCTAssertTrue(p);
+        }
+    }];
+}
+
+- (void)testPerformanceIteratorBatch {
+    symrez_t sr = symrez_new("AppKit");
+    sr_iterator_t it = sr_get_iterator(sr);
+    static sr_entry_t entries[1024];
+    static char arena[0x40000];
+    [self measureBlock:^{
+        sr_iter_reset(it);
+        while (sr_iter_next_batch(it, entries, 1024, arena, sizeof(arena))) {}
+    }];
+
+    sr_free(sr);
+}
+
+- (void)testPerformanceResolveGlobal {
+    // First lookup pays for indexing every image up to AppKit
+    symrez_resolve_global("__nsBeginNSPSupport", NULL);
+    [self measureBlock:^{
+        void *p = symrez_resolve_global("__nsBeginNSPSupport", NULL);
+        XCTAssertTrue(p);
+    }];
+}
+
 @end
@@ -0,0 +1,13 @@
+# cmake -DTOOL=<exe> -DARGS=<a;b> -DEXPECTED=<file> -P CompareOutput.cmake
+
+execute_process(COMMAND ${TOOL} ${ARGS}
+    OUTPUT_VARIABLE output
+    RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${TOOL} exited with ${result}")
+endif()
+
+file(READ ${EXPECTED} expected)
+if(NOT output STREQUAL expected)
+    message(FATAL_ERROR "Output differs from ${EXPECTED}:\n${output}")
+endif()
@@ -0,0 +1,398 @@
+#!/usr/bin/env python3
+#
+#  make_fixtures.py
+#  SymRez
+#
+#  Created by Jeremy Legendre on 4/14/20.
+#  Copyright © 2020 Jeremy Legendre. All rights reserved.
+#
+#  Writes the small Mach-O files the portable tests read, so they can be
+#  checked in and rebuilt without an Apple toolchain. Addresses are given
+#  as file offsets: every segment but __LINKEDIT sits at `base` plus its
+#  file offset.
+#
+#  python3 make_fixtures.py [output dir]
+
+import os
+import struct
+import sys
+
+MH_MAGIC_64 = 0xfeedfacf
+MH_DYLIB = 0x6
+CPU_TYPE_X86_64 = 0x01000007
+
+LC_SEGMENT_64 = 0x19
+LC_SYMTAB = 0x2
+LC_DYSYMTAB = 0xb
+LC_ID_DYLIB = 0xd
+LC_UUID = 0x1b
+
+S_ZEROFILL = 0x1
+S_ATTR_PURE_INSTRUCTIONS = 0x80000000
+S_ATTR_SOME_INSTRUCTIONS = 0x00000400
+
+N_EXT = 0x01
+N_SECT = 0xe
+
+SR_OBJC_ML_SMALL = 0x80000000
+SR_OBJC_ML_DIRECT_SELS = 0x40000000
+SR_OBJC_RO_META = 0x1
+SR_OBJC_RW_REALIZED = 0x80000000
+
+PAGE = 0x1000
+
+
+def align(value, to):
+    return (value + to - 1) & ~(to - 1)
+
+
+class Section:
+    def __init__(self, name, addr, data=b"", size=None, flags=0):
+        self.name = name
+        self.addr = addr
+        self.data = data
+        self.size = size if size is not None else len(data)
+        self.flags = flags
+        self.ordinal = 0
+
+
+class Segment:
+    def __init__(self, name, vmaddr, vmsize, prot, sections=()):
+        self.name = name
+        self.vmaddr = vmaddr
+        self.vmsize = vmsize
+        self.prot = prot
+        self.sections = list(sections)
+
+
+class Symbol:
+    def __init__(self, name, value, n_type, section=None):
+        self.name = name
+        self.value = value
+        self.n_type = n_type
+        self.section = section
+
+
+def write_dylib(path, install_name, segments, symbols, uuid, base=0):
+    ordinal = 1
+    for seg in segments:
+        for sect in seg.sections:
+            sect.ordinal = ordinal
+            ordinal += 1
+
+    # Locals, then external definitions, like ld lays them out
+    locals_ = [s for s in symbols if not s.n_type & N_EXT]
+    externs = [s for s in symbols if s.n_type & N_EXT]
+    ordered = locals_ + externs
+
+    strtab = b"\x20\x00"
+    strx = {}
+    for sym in ordered:
+        strx[sym.name] = len(strtab)
+        strtab += sym.name.encode() + b"\x00"
+    strtab = strtab.ljust(align(len(strtab), 8), b"\x00")
+
+    nlist = b""
+    for sym in ordered:
+        sect = sym.section.ordinal if sym.section else 0
+        nlist += struct.pack("<IBBHQ", strx[sym.name], sym.n_type, sect, 0, base + sym.value)
+
+    end = max(seg.vmaddr + seg.vmsize for seg in segments)
+    linkedit_addr = align(end, PAGE)
+    symoff = linkedit_addr
+    stroff = symoff + len(nlist)
+    linkedit_size = len(nlist) + len(strtab)
+
+    cmds = []
+    for seg in segments + [Segment("__LINKEDIT", linkedit_addr, align(linkedit_size, PAGE), 1)]:
+        filesize = linkedit_size if seg.vmaddr == linkedit_addr else seg.vmsize
+        zerofill = [s for s in seg.sections if (s.flags & 0xff) == S_ZEROFILL]
+        if zerofill:
+            filesize = min(s.addr for s in zerofill) - seg.vmaddr
+
+        cmd = struct.pack("<II16sQQQQiiII", LC_SEGMENT_64, 72 + 80 * len(seg.sections),
+                          seg.name.encode(), base + seg.vmaddr, seg.vmsize, seg.vmaddr, filesize,
+                          seg.prot, seg.prot, len(seg.sections), 0)
+        for sect in seg.sections:
+            offset = 0 if (sect.flags & 0xff) == S_ZEROFILL else sect.addr
+            cmd += struct.pack("<16s16sQQIIIIIIII", sect.name.encode(), seg.name.encode(),
+                               base + sect.addr, sect.size, offset, 3, 0, 0, sect.flags, 0, 0, 0)
+        cmds.append(cmd)
+
+    cmds.append(struct.pack("<IIIIII", LC_SYMTAB, 24, symoff, len(ordered), stroff, len(strtab)))
+    cmds.append(struct.pack("<II18I", LC_DYSYMTAB, 80, 0, len(locals_), len(locals_), len(externs),
+                            len(ordered), 0, *([0] * 12)))
+    name = install_name.encode() + b"\x00"
+    name = name.ljust(align(len(name), 8), b"\x00")
+    cmds.append(struct.pack("<IIIIII", LC_ID_DYLIB, 24 + len(name), 24, 2, 0x10000, 0x10000) + name)
+    cmds.append(struct.pack("<II16s", LC_UUID, 24, uuid))
+
+    commands = b"".join(cmds)
+    header = struct.pack("<IiiIIIII", MH_MAGIC_64, CPU_TYPE_X86_64, 3, MH_DYLIB,
+                         len(cmds), len(commands), 0, 0)
+
+    image = bytearray(linkedit_addr + len(nlist) + len(strtab))
+    image[0:len(header) + len(commands)] = header + commands
+    for seg in segments:
+        for sect in seg.sections:
+            image[sect.addr:sect.addr + len(sect.data)] = sect.data
+    image[symoff:symoff + len(nlist)] = nlist
+    image[stroff:stroff + len(strtab)] = strtab
+
+    with open(path, "wb") as f:
+        f.write(image)
+
+
+# Symbols of every kind nm tells apart, without an export trie
+def basic(out):
+    text = Section("__text", 0x800, b"\xc3" * 0x40, flags=S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS)
+    data = Section("__data", 0x1000, b"\x2a" + b"\x00" * 0x1f)
+    bss = Section("__bss", 0x1020, size=0x20, flags=S_ZEROFILL)
+    segments = [
+        Segment("__TEXT", 0, 0x1000, 5, [text]),
+        Segment("__DATA", 0x1000, 0x1000, 3, [data, bss]),
+    ]
+    symbols = [
+        Symbol("_helper", 0x810, N_SECT, text),
+        Symbol("_counter", 0x1020, N_SECT, bss),
+        Symbol("_fixture_add", 0x800, N_SECT | N_EXT, text),
+        Symbol("_fixture_value", 0x1000, N_SECT | N_EXT, data),
+    ]
+    write_dylib(os.path.join(out, "basic.dylib"), "/usr/lib/libbasic.dylib", segments, symbols,
+                bytes(range(16)))
+
+
+class Strings:
+    def __init__(self, addr):
+        self.addr = addr
+        self.data = b""
+
+    def add(self, string):
+        addr = self.addr + len(self.data)
+        self.data += string.encode() + b"\x00"
+        return addr
+
+
+# Objective-C metadata mapped at `base` with no slide, so its pointers are
+# already right. __cache_header stands in for the shared cache header
+# (dyld_cache_format.h) and its objc optimisation header, which locate the
+# selector that direct selector offsets are relative to.
+def objc(out):
+    base = 0x300000000
+    cache_addr = 0x600
+    text_addr = 0x900
+    imps = ["alpha", "beta", "class_beta", "gamma", "delta", "epsilon", "alpha_extra", "zeta"]
+    imp = {name: text_addr + 8 * i for i, name in enumerate(imps)}
+
+    methname = Strings(0xa00)
+    selector_base = methname.add("\U0001F92F")
+    sels = {name: methname.add(name) for name in ["alpha", "beta", "gamma", "delta", "epsilon", "zeta"]}
+
+    classname = Strings(0xb00)
+    names = {name: classname.add(name) for name in ["SRFixture", "SRSmall", "SRDirect", "SRRealized", "Extra", "More"]}
+
+    cache = bytearray(0x238)
+    cache[0:16] = b"dyld_v1  x86_64\x00"
+    struct.pack_into("<I", cache, 0x10, len(cache))
+    struct.pack_into("<QQ", cache, 0x1d0, 0x200, 0x38)
+    struct.pack_into("<II6Q", cache, 0x200, 1, 0, 0, 0, 0, 0, 0, selector_base - cache_addr)
+
+    # __objc_selrefs, for the relative list that doesn't use direct selectors
+    selrefs_addr = 0x4080
+    selref = {"gamma": selrefs_addr}
+    selrefs = struct.pack("<Q", base + sels["gamma"])
+
+    # Relative method lists: selector, types and imp are offsets from each field
+    methlist_addr = 0xc00
+    methlist = b""
+
+    def small_list(methods, direct):
+        nonlocal methlist
+        addr = methlist_addr + len(methlist)
+        flags = SR_OBJC_ML_SMALL | (SR_OBJC_ML_DIRECT_SELS if direct else 0)
+        methlist += struct.pack("<II", 12 | flags, len(methods))
+        for sel, target in methods:
+            entry = methlist_addr + len(methlist)
+            name = sels[sel] - selector_base if direct else selref[sel] - entry
+            methlist += struct.pack("<iii", name, 0, imp[target] - (entry + 8))
+        return addr
+
+    gamma_list = small_list([("gamma", "gamma")], False)
+    delta_list = small_list([("delta", "delta")], True)
+
+    # A relative list of lists holding the direct list: (offset << 16) | image index
+    lists_addr = methlist_addr + len(methlist)
+    methlist += struct.pack("<IIq", 8, 1, (delta_list - (lists_addr + 8)) << 16)
+
+    const_addr = 0x4100
+    const = b""
+
+    def emit(data):
+        nonlocal const
+        addr = const_addr + len(const)
+        const += data.ljust(align(len(data), 8), b"\x00")
+        return addr
+
+    def ptr(addr):
+        return base + addr if addr else 0
+
+    def big_list(methods):
+        data = struct.pack("<II", 24, len(methods))
+        for sel, target in methods:
+            data += struct.pack("<QQQ", ptr(sels[sel]), 0, ptr(imp[target]))
+        return emit(data)
+
+    def class_ro(flags, name, methods):
+        return emit(struct.pack("<IIIIQQQ", flags, 8, 8, 0, 0, ptr(name), methods) + b"\x00" * 32)
+
+    data_addr = 0x4800
+    data = b""
+
+    def emit_class(name, methods, meta_methods=0, realized=False):
+        nonlocal data
+        ro = class_ro(0, names[name], methods)
+        meta_ro = class_ro(SR_OBJC_RO_META, names[name], meta_methods)
+        bits = ptr(ro)
+        if realized:
+            ext = emit(struct.pack("<Q", ptr(ro)) + b"\x00" * 24)
+            bits = ptr(emit(struct.pack("<IHHQ", SR_OBJC_RW_REALIZED, 0, 0, ptr(ext) | 1)))
+
+        meta = data_addr + len(data)
+        data += struct.pack("<QQQQQ", 0, 0, 0, 0, ptr(meta_ro))
+        cls = data_addr + len(data)
+        data += struct.pack("<QQQQQ", ptr(meta), 0, 0, 0, bits)
+        return cls
+
+    classes = [
+        emit_class("SRFixture", ptr(big_list([("alpha", "alpha"), ("beta", "beta")])),
+                   ptr(big_list([("beta", "class_beta")]))),
+        emit_class("SRSmall", ptr(gamma_list)),
+        emit_class("SRDirect", ptr(lists_addr) | 1),
+        emit_class("SRRealized", ptr(big_list([("epsilon", "epsilon")])), realized=True),
+    ]
+
+    # A category on SRFixture, overriding -alpha and adding -zeta
+    extra = big_list([("alpha", "alpha_extra"), ("zeta", "zeta")])
+    category = emit(struct.pack("<QQQQ", ptr(names["Extra"]), ptr(classes[0]), ptr(extra), 0) + b"\x00" * 16)
+    # One on SRSmall listed in __objc_catlist2, adding -zeta
+    more = big_list([("zeta", "zeta")])
+    category2 = emit(struct.pack("<QQQQ", ptr(names["More"]), ptr(classes[1]), ptr(more), 0) + b"\x00" * 16)
+
+    classlist = b"".join(struct.pack("<Q", ptr(c)) for c in classes)
+    catlist = struct.pack("<Q", ptr(category))
+    catlist2 = struct.pack("<Q", ptr(category2))
+
+    cache_header = Section("__cache_header", cache_addr, bytes(cache))
+    text = Section("__text", text_addr, b"\xc3" * 0x40, flags=S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS)
+    segments = [
+        Segment("__TEXT", 0, 0x4000, 5, [
+            cache_header,
+            text,
+            Section("__objc_methname", methname.addr, methname.data),
+            Section("__objc_classname", classname.addr, classname.data),
+            Section("__objc_methlist", methlist_addr, methlist),
+        ]),
+        Segment("__DATA", 0x4000, 0x4000, 3, [
+            Section("__objc_classlist", 0x4000, classlist),
+            Section("__objc_catlist", 0x4040, catlist),
+            Section("__objc_catlist2", 0x4048, catlist2),
+            Section("__objc_selrefs", selrefs_addr, selrefs),
+            Section("__objc_const", const_addr, const),
+            Section("__objc_data", data_addr, data),
+        ]),
+    ]
+    symbols = [Symbol("_fixture_cache", cache_addr, N_SECT, cache_header)]
+    symbols += [Symbol("_imp_" + name, addr, N_SECT, text) for name, addr in imp.items()]
+    write_dylib(os.path.join(out, "objc.dylib"), "/usr/lib/libobjcfixture.dylib", segments, symbols,
+                bytes(range(16, 32)), base)
+
+
+# Swift context descriptors: only relative offsets, so the image can be
+# loaded anywhere. Module SwiftFixture defines
+#   struct Outer { enum Inner }
+#   private struct Hidden             (under an anonymous context)
+#   extension Outer { class Nested }  (extended type is a symbolic reference)
+#   struct FixtureValue
+#   protocol Shape
+def swift(out):
+    text_addr = 0x800
+    accessors = ["Outer", "Inner", "Hidden", "Nested", "FixtureValue", "TwinA", "TwinB"]
+    acc = {name: text_addr + 8 * i for i, name in enumerate(accessors)}
+
+    cstring = Strings(0xa00)
+    names = {name: cstring.add(name) for name in ["SwiftFixture", "Shape", "Twin"] + accessors}
+    # Only the compiler's anonymous context names carry the file's discriminator
+    twin_scope = cstring.add("12SwiftFixture4Twin33_AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAALLVMXX")
+
+    const_addr = 0x900
+    const = bytearray(0x100)
+    at = {}
+
+    def rel(field, target):
+        return target - field if target else 0
+
+    def desc(key, flags, parent=0, name=0, accessor=0):
+        addr = const_addr + 16 * len(at)
+        at[key] = addr
+        struct.pack_into("<Iiii", const, addr - const_addr, flags, rel(addr + 4, parent),
+                         rel(addr + 8, name), rel(addr + 12, accessor))
+        return addr
+
+    # Nominal types have the unique flag (0x40) set, like the compiler emits
+    module = desc("module", 0, 0, names["SwiftFixture"])
+    outer = desc("Outer", 0x40 | 17, module, names["Outer"], acc["Outer"])
+    desc("Inner", 0x40 | 18, outer, names["Inner"], acc["Inner"])
+    anonymous = desc("anonymous", 2, module)
+    desc("Hidden", 0x40 | 17, anonymous, names["Hidden"], acc["Hidden"])
+
+    # Private types of two files with the same name
+    twin_a_file = desc("twin_a_file", 0x10000 | 2, module, twin_scope)
+    desc("TwinA", 0x40 | 17, twin_a_file, names["Twin"], acc["TwinA"])
+    twin_b_file = desc("twin_b_file", 2, module)
+    desc("TwinB", 0x40 | 17, twin_b_file, names["Twin"], acc["TwinB"])
+
+    typeref_addr = 0xb80
+    typeref = b"\x01" + struct.pack("<i", outer - (typeref_addr + 1)) + b"\x00"
+    extension = desc("extension", 1, module, typeref_addr)
+    desc("Nested", 0x40 | 16, extension, names["Nested"], acc["Nested"])
+    desc("FixtureValue", 0x40 | 17, module, names["FixtureValue"], acc["FixtureValue"])
+    desc("Shape", 3, module, names["Shape"])
+
+    types_addr = 0xb00
+    types = b"".join(struct.pack("<i", at[name] - (types_addr + 4 * i)) for i, name in enumerate(accessors))
+    protos_addr = 0xb40
+    protos = struct.pack("<i", at["Shape"] - protos_addr)
+
+    text = Section("__text", text_addr, b"\xc3" * 0x40, flags=S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS)
+    segments = [
+        Segment("__TEXT", 0, 0x1000, 5, [
+            text,
+            Section("__const", const_addr, bytes(const[:16 * len(at)])),
+            Section("__cstring", cstring.addr, cstring.data),
+            Section("__swift5_types", types_addr, types),
+            Section("__swift5_protos", protos_addr, protos),
+            Section("__swift5_typeref", typeref_addr, typeref),
+        ]),
+    ]
+    symbols = [Symbol("_accessor_" + name, addr, N_SECT, text) for name, addr in acc.items()]
+    write_dylib(os.path.join(out, "swift.dylib"), "/usr/lib/swift/libswiftFixture.dylib", segments, symbols,
+                bytes(range(32, 48)))
+
+
+# More external definitions than the lookup planner needs for its binary
+# search, in name order like ld writes them
+def planner(out):
+    text = Section("__text", 0x800, b"\xc3" * 0x100, flags=S_ATTR_PURE_INSTRUCTIONS | S_ATTR_SOME_INSTRUCTIONS)
+    segments = [Segment("__TEXT", 0, 0x1000, 5, [text])]
+    symbols = [Symbol("_planner_local", 0x800, N_SECT, text)]
+    symbols += [Symbol("_extdef_%02d" % i, 0x808 + 8 * i, N_SECT | N_EXT, text) for i in range(24)]
+    write_dylib(os.path.join(out, "planner.dylib"), "/usr/lib/libplanner.dylib", segments, symbols,
+                bytes(range(48, 64)))
+
+
+if __name__ == "__main__":
+    out = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+    basic(out)
+    objc(out)
+    swift(out)
+    planner(out)
@@ -0,0 +1,139 @@
+//
+//  LazyTests.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "Test.h"
+#include <mach-o/nlist.h>
+#include <pthread.h>
+
+// lazy_tests <basic.dylib>
+static symrez_t _symrez;
+
+#define LAZY_THREADS 8
+
+// Seven integer and nine floating point arguments: `i6` and `d8` are passed on the stack
+static long
+lazy_sum(long i0, long i1, long i2, long i3, long i4, long i5, long i6,
+         double d0, double d1, double d2, double d3, double d4, double d5, double d6, double d7, double d8) {
+    return i0 + 2 * i1 + 3 * i2 + 4 * i3 + 5 * i4 + 6 * i5 + 7 * i6 +
+        (long)(d0 + 2 * d1 + 3 * d2 + 4 * d3 + 5 * d4 + 6 * d5 + 7 * d6 + 8 * d7 + 9 * d8);
+}
+
+static long
+lazy_missing_handler(long a, long b, long c, long d, long e, long f, long g) {
+    return a * b * c * d * e * f * g;
+}
+
+typedef long (*lazy_sum_t)(long, long, long, long, long, long, long,
+                           double, double, double, double, double, double, double, double, double);
+
+static long
+lazy_sum_call(lazy_sum_t fn, long k) {
+    return fn(k, 1, 2, 3, 4, 5, 6, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0, k);
+}
+
+// basic.dylib, loaded at a page boundary with `_fixture_add` pointing at `lazy_sum`
+static void *
+lazy_load_image(const char *path) {
+    size_t size = 0;
+    void *file = sr_test_read_file(path, &size);
+    if (!file) {
+        return NULL;
+    }
+
+    uint8_t *image = aligned_alloc(0x1000, (size + 0xFFF) & ~(size_t)0xFFF);
+    memcpy(image, file, size);
+    free(file);
+
+    struct mach_header_64 *mh = (struct mach_header_64 *)image;
+    struct load_command *lc = (struct load_command *)(mh + 1);
+    for (uint32_t i = 0; i < mh->ncmds; ++i) {
+        if (lc->cmd == LC_SYMTAB) {
+            struct symtab_command *symtab = (struct symtab_command *)lc;
+            struct nlist_64 *nl = (struct nlist_64 *)(image + symtab->symoff);
+            for (uint32_t j = 0; j < symtab->nsyms; ++j) {
+                if (!strcmp((char *)image + symtab->stroff + nl[j].n_un.n_strx, "_fixture_add")) {
+                    nl[j].n_value = (uintptr_t)lazy_sum - (uintptr_t)image;
+                }
+            }
+        }
+        lc = (struct load_command *)((uint8_t *)lc + lc->cmdsize);
+    }
+
+    return image;
+}
+
+static struct {
+    pthread_barrier_t barrier;
+    lazy_sum_t fn;
+} _g_race;
+
+static void *
+lazy_race(void *arg) {
+    long k = (long)(uintptr_t)arg;
+    pthread_barrier_wait(&_g_race.barrier);
+    return (void *)(uintptr_t)(lazy_sum_call(_g_race.fn, k) == lazy_sum(k, 1, 2, 3, 4, 5, 6, 1, 1, 1, 1, 1, 1, 1, 1, k));
+}
+
+static void
+test_lazy_threaded_first_call(void) {
+    lazy_sum_t fn = (lazy_sum_t)sr_lazy_function(_symrez, "_fixture_add", NULL);
+    SR_EXPECT(fn != NULL);
+    SR_EXPECT(fn != (lazy_sum_t)lazy_sum);
+    SR_EXPECT(sr_lazy_function(_symrez, "_fixture_add", NULL) == (sr_ptr_t)fn);
+    if (!fn) {
+        return;
+    }
+
+    _g_race.fn = fn;
+    pthread_barrier_init(&_g_race.barrier, NULL, LAZY_THREADS);
+    pthread_t threads[LAZY_THREADS];
+    for (long i = 0; i < LAZY_THREADS; ++i) {
+        pthread_create(&threads[i], NULL, lazy_race, (void *)(uintptr_t)(i + 1));
+    }
+    for (long i = 0; i < LAZY_THREADS; ++i) {
+        void *ok = NULL;
+        pthread_join(threads[i], &ok);
+        SR_EXPECT(ok != NULL);
+    }
+    pthread_barrier_destroy(&_g_race.barrier);
+
+    // Bound now: the same answers without the binder
+    SR_EXPECT(lazy_sum_call(fn, 100) == lazy_sum(100, 1, 2, 3, 4, 5, 6, 1, 1, 1, 1, 1, 1, 1, 1, 100));
+}
+
+static void
+test_lazy_missing_uses_handler(void) {
+    typedef long (*handler_t)(long, long, long, long, long, long, long);
+    handler_t fn = (handler_t)sr_lazy_function(_symrez, "_not_a_real_function", (sr_ptr_t)lazy_missing_handler);
+    SR_EXPECT(fn != NULL);
+    if (fn) {
+        SR_EXPECT(fn(1, 2, 3, 4, 5, 6, 7) == 5040);
+        SR_EXPECT(fn(2, 2, 2, 2, 2, 2, 3) == 192);
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s basic.dylib\n", argv[0]);
+        return 2;
+    }
+
+    void *image = lazy_load_image(argv[1]);
+    _symrez = image ? symrez_new_mh(image) : NULL;
+    if (!_symrez || sr_resolve_symbol(_symrez, "_fixture_add") != (sr_ptr_t)lazy_sum) {
+        fprintf(stderr, "%s: can't load %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    SR_RUN(test_lazy_threaded_first_call);
+    SR_RUN(test_lazy_missing_uses_handler);
+
+    sr_free(_symrez);
+    free(image);
+    return sr_test_failures ? 1 : 0;
+}
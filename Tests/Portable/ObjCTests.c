@@ -0,0 +1,114 @@
+//
+//  ObjCTests.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "Test.h"
+#include "SymRezPrivate.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+// objc_tests <objc.dylib>
+
+// Where make_fixtures.py links objc.dylib. Its metadata holds absolute pointers
+#define OBJC_FIXTURE_BASE 0x300000000ULL
+
+static symrez_t _symrez;
+
+static sr_ptr_t
+imp(const char *name) {
+    char symbol[64];
+    snprintf(symbol, sizeof(symbol), "_imp_%s", name);
+    sr_ptr_t addr = sr_resolve_symbol(_symrez, symbol);
+    SR_EXPECT(addr != NULL);
+    return addr;
+}
+
+static void *
+objc_map_fixture(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    void *image = mmap((void *)OBJC_FIXTURE_BASE, (size_t)size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_FIXED_NOREPLACE, fd, 0);
+    close(fd);
+    return image == (void *)OBJC_FIXTURE_BASE ? image : NULL;
+}
+
+static void
+test_objc_big_method_lists(void) {
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRFixture", "beta", false) == imp("beta"));
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRFixture", "beta", true) == imp("class_beta"));
+}
+
+static void
+test_objc_relative_method_lists(void) {
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRSmall", "gamma", false) == imp("gamma"));
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRSmall", "gamma", true) == NULL);
+}
+
+// Found through the shared cache's objc optimisation header, without libobjc
+static void
+test_objc_direct_selectors(void) {
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRDirect", "delta", false) == imp("delta"));
+}
+
+static void
+test_objc_realized_class(void) {
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRRealized", "epsilon", false) == imp("epsilon"));
+}
+
+static void
+test_objc_category_shadows_class(void) {
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRFixture", "alpha", false) == imp("alpha_extra"));
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRFixture", "zeta", false) == imp("zeta"));
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRFixture", "gamma", false) == NULL);
+}
+
+static void
+test_objc_catlist2(void) {
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRSmall", "zeta", false) == imp("zeta"));
+    SR_EXPECT(sr_resolve_objc_method(_symrez, "SRSmall", "gamma", false) == imp("gamma"));
+}
+
+static void
+test_objc_symbol_names(void) {
+    SR_EXPECT(sr_resolve_symbol(_symrez, "+[SRFixture beta]") == imp("class_beta"));
+    SR_EXPECT(sr_resolve_symbol(_symrez, "-[SRFixture(Extra) zeta]") == imp("zeta"));
+    SR_EXPECT(sr_resolve_symbol(_symrez, "-[SRDirect delta]") == imp("delta"));
+    SR_EXPECT(sr_resolve_symbol(_symrez, "-[SRMissing delta]") == NULL);
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s objc.dylib\n", argv[0]);
+        return 2;
+    }
+
+    void *image = objc_map_fixture(argv[1]);
+    _symrez = image ? symrez_new_mh(image) : NULL;
+    sr_ptr_t cache = _symrez ? sr_resolve_symbol(_symrez, "_fixture_cache") : NULL;
+    if (!cache) {
+        fprintf(stderr, "%s: can't map %s at %#llx\n", argv[0], argv[1], OBJC_FIXTURE_BASE);
+        return 1;
+    }
+
+    sr_test_set_shared_cache((uintptr_t)cache);
+
+    SR_RUN(test_objc_big_method_lists);
+    SR_RUN(test_objc_relative_method_lists);
+    SR_RUN(test_objc_direct_selectors);
+    SR_RUN(test_objc_realized_class);
+    SR_RUN(test_objc_category_shadows_class);
+    SR_RUN(test_objc_catlist2);
+    SR_RUN(test_objc_symbol_names);
+
+    sr_free(_symrez);
+    return sr_test_failures ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+//
+//  PlannerTests.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "Test.h"
+#include <mach-o/nlist.h>
+
+// planner_tests <planner.dylib>
+#define PLANNER_EXTDEFS 24
+
+static void *_file;
+static size_t _size;
+
+// A fresh page aligned copy of planner.dylib
+static uint8_t *
+planner_load_image(void) {
+    uint8_t *image = aligned_alloc(0x1000, (_size + 0xFFF) & ~(size_t)0xFFF);
+    memcpy(image, _file, _size);
+    return image;
+}
+
+// Swaps two external definitions, so the range is no longer sorted by name
+static void
+planner_swap_extdefs(uint8_t *image, uint32_t a, uint32_t b) {
+    struct mach_header_64 *mh = (struct mach_header_64 *)image;
+    struct load_command *lc = (struct load_command *)(mh + 1);
+    struct nlist_64 *nl = NULL;
+    uint32_t iextdefsym = 0;
+    for (uint32_t i = 0; i < mh->ncmds; ++i) {
+        if (lc->cmd == LC_SYMTAB) {
+            nl = (struct nlist_64 *)(image + ((struct symtab_command *)lc)->symoff);
+        } else if (lc->cmd == LC_DYSYMTAB) {
+            iextdefsym = ((struct dysymtab_command *)lc)->iextdefsym;
+        }
+        lc = (struct load_command *)((uint8_t *)lc + lc->cmdsize);
+    }
+
+    struct nlist_64 tmp = nl[iextdefsym + a];
+    nl[iextdefsym + a] = nl[iextdefsym + b];
+    nl[iextdefsym + b] = tmp;
+}
+
+static void
+expect_all_extdefs(symrez_t symrez, uint8_t *image) {
+    for (uint32_t i = 0; i < PLANNER_EXTDEFS; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "_extdef_%02u", i);
+        SR_EXPECT(sr_resolve_symbol(symrez, name) == image + 0x808 + 8 * i);
+    }
+    SR_EXPECT(sr_resolve_symbol(symrez, "_planner_local") == image + 0x800);
+    SR_EXPECT(sr_resolve_symbol(symrez, "_extdef_99") == NULL);
+}
+
+static void
+test_planner_sorted_extdefs(void) {
+    uint8_t *image = planner_load_image();
+    symrez_t symrez = symrez_new_mh((mach_header_t)image);
+    SR_EXPECT(symrez != NULL);
+    if (!symrez) {
+        return;
+    }
+
+    expect_all_extdefs(symrez, image);
+    sr_planner_stats_t stats;
+    sr_planner_get_stats(symrez, &stats);
+    SR_EXPECT(stats.initial_plan == SR_PLAN_EXTDEF);
+
+    sr_free(symrez);
+    free(image);
+}
+
+// A binary search would miss names on the wrong side of the swap
+static void
+test_planner_unsorted_extdefs_scan(void) {
+    uint8_t *image = planner_load_image();
+    planner_swap_extdefs(image, 3, 20);
+    symrez_t symrez = symrez_new_mh((mach_header_t)image);
+    SR_EXPECT(symrez != NULL);
+    if (!symrez) {
+        return;
+    }
+
+    expect_all_extdefs(symrez, image);
+    sr_planner_stats_t stats;
+    sr_planner_get_stats(symrez, &stats);
+    SR_EXPECT(stats.initial_plan == SR_PLAN_SCAN);
+
+    sr_free(symrez);
+    free(image);
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s planner.dylib\n", argv[0]);
+        return 2;
+    }
+
+    _file = sr_test_read_file(argv[1], &_size);
+    if (!_file) {
+        fprintf(stderr, "%s: can't read %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    SR_RUN(test_planner_sorted_extdefs);
+    SR_RUN(test_planner_unsorted_extdefs_scan);
+
+    free(_file);
+    return sr_test_failures ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+//
+//  SnapshotTests.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "Test.h"
+#include "SymRezPrivate.h"
+
+// snapshot_tests <basic.dylib>
+static const char *_basic_path;
+
+#define CORE_IMAGE_ADDR 0x100000
+#define CORE_BAD_ADDR 0x200000
+
+// An MH_CORE file: header and `ncmds` commands of `cmds_size` bytes, then `body` at 0x1000
+static char *
+write_core(const void *cmds, uint32_t ncmds, uint32_t cmds_size, const void *body, size_t body_size) {
+    size_t size = 0x1000 + body_size;
+    uint8_t *file = calloc(1, size);
+    struct mach_header_64 *mh = (struct mach_header_64 *)file;
+    mh->magic = MH_MAGIC_64;
+    mh->cputype = CPU_TYPE_X86_64;
+    mh->filetype = MH_CORE;
+    mh->ncmds = ncmds;
+    mh->sizeofcmds = cmds_size;
+    memcpy(mh + 1, cmds, cmds_size);
+    if (body) {
+        memcpy(file + 0x1000, body, body_size);
+    }
+
+    char *path = sr_test_write_file(file, size);
+    free(file);
+    return path;
+}
+
+static bool
+core_opens(const void *cmds, uint32_t ncmds, uint32_t cmds_size) {
+    char *path = write_core(cmds, ncmds, cmds_size, NULL, 0);
+    sr_snapshot_t snapshot = sr_snapshot_open(path);
+    if (snapshot) {
+        sr_snapshot_close(snapshot);
+    }
+    unlink(path);
+    free(path);
+    return snapshot != NULL;
+}
+
+static void
+test_core_zero_cmdsize(void) {
+    struct load_command lc = { .cmd = LC_SEGMENT_64, .cmdsize = 0 };
+    SR_EXPECT(!core_opens(&lc, 1, sizeof(lc)));
+}
+
+static void
+test_core_cmdsize_past_sizeofcmds(void) {
+    struct load_command lc[2] = { { .cmd = LC_UUID, .cmdsize = 8 }, { .cmd = LC_SEGMENT_64, .cmdsize = 72 } };
+    SR_EXPECT(!core_opens(lc, 2, sizeof(lc)));
+}
+
+static void
+test_core_ncmds_past_sizeofcmds(void) {
+    struct load_command lc[2] = { { .cmd = LC_UUID, .cmdsize = 8 }, { .cmd = LC_UUID, .cmdsize = 8 } };
+    SR_EXPECT(!core_opens(lc, 5, sizeof(lc)));
+    SR_EXPECT(core_opens(lc, 2, sizeof(lc)));
+}
+
+static void
+test_core_sections_past_cmdsize(void) {
+    struct segment_command_64 seg = {
+        .cmd = LC_SEGMENT_64,
+        .cmdsize = sizeof(seg),
+        .segname = "__DATA",
+        .nsects = 3,
+    };
+    SR_EXPECT(!core_opens(&seg, 1, sizeof(seg)));
+}
+
+static bool
+no_pointer_ref(const sr_pointer_ref_t *ref, void *context) {
+    return false;
+}
+
+// A core with a good image and, after it, an image whose load commands loop
+static void
+test_core_bad_image(void) {
+    size_t image_size = 0;
+    uint8_t *image = sr_test_read_file(_basic_path, &image_size);
+    SR_EXPECT(image != NULL);
+    if (!image) {
+        return;
+    }
+
+    size_t bad_offset = (image_size + 0xFFF) & ~(size_t)0xFFF;
+    size_t body_size = bad_offset + 0x1000;
+    uint8_t *body = calloc(1, body_size);
+    memcpy(body, image, image_size);
+
+    struct mach_header_64 *bad = (struct mach_header_64 *)(body + bad_offset);
+    bad->magic = MH_MAGIC_64;
+    bad->filetype = MH_DYLIB;
+    bad->ncmds = 2;
+    bad->sizeofcmds = 16;
+    ((struct load_command *)(bad + 1))->cmd = LC_SEGMENT_64;
+
+    struct segment_command_64 segs[2] = {
+        { .cmd = LC_SEGMENT_64, .cmdsize = sizeof(segs[0]), .vmaddr = CORE_IMAGE_ADDR, .vmsize = image_size,
+          .fileoff = 0x1000, .filesize = image_size, .initprot = VM_PROT_READ },
+        { .cmd = LC_SEGMENT_64, .cmdsize = sizeof(segs[1]), .vmaddr = CORE_BAD_ADDR, .vmsize = 0x1000,
+          .fileoff = 0x1000 + bad_offset, .filesize = 0x1000, .initprot = VM_PROT_READ },
+    };
+    char *path = write_core(segs, 2, sizeof(segs), body, body_size);
+    free(body);
+    free(image);
+
+    sr_snapshot_t snapshot = sr_snapshot_open(path);
+    SR_EXPECT(snapshot != NULL);
+    if (snapshot) {
+        SR_EXPECT(sr_snapshot_image_count(snapshot) == 2);
+        SR_EXPECT(sr_snapshot_image_address(snapshot, 1) == CORE_BAD_ADDR);
+        SR_EXPECT(sr_snapshot_symrez(snapshot, 1) == NULL);
+
+        symrez_t symrez = sr_snapshot_symrez(snapshot, 0);
+        SR_EXPECT(symrez != NULL);
+        if (symrez) {
+            sr_ptr_t add = sr_resolve_symbol(symrez, "_fixture_add");
+            SR_EXPECT(sr_snapshot_remote_address(snapshot, 0, add) == CORE_IMAGE_ADDR + 0x800);
+            SR_EXPECT(sr_find_pointer_refs(symrez, &add, 1, NULL, no_pointer_ref) == SR_COUNT_ERROR);
+        }
+        sr_snapshot_close(snapshot);
+    }
+
+    unlink(path);
+    free(path);
+}
+
+// Renames the first section called `from`
+static void
+rename_section(struct mach_header_64 *mh, const char *from, const char *to) {
+    struct load_command *lc = (struct load_command *)(mh + 1);
+    for (uint32_t i = 0; i < mh->ncmds; ++i) {
+        if (lc->cmd == LC_SEGMENT_64) {
+            struct section_64 *sect = (struct section_64 *)((struct segment_command_64 *)lc + 1);
+            for (uint32_t j = 0; j < ((struct segment_command_64 *)lc)->nsects; ++j) {
+                if (!strncmp(sect[j].sectname, from, sizeof(sect[j].sectname))) {
+                    strncpy(sect[j].sectname, to, sizeof(sect[j].sectname));
+                    return;
+                }
+            }
+        }
+        lc = (struct load_command *)((uint8_t *)lc + lc->cmdsize);
+    }
+}
+
+// A core whose dyld lists libbasic-extra.dylib before libbasic.dylib, both copies of basic.dylib
+static void
+test_core_find_image_by_name(void) {
+    size_t image_size = 0;
+    uint8_t *image = sr_test_read_file(_basic_path, &image_size);
+    SR_EXPECT(image != NULL);
+    if (!image) {
+        return;
+    }
+
+    // basic.dylib's vm size. The image list follows the three images
+    const uint64_t stride = 0x3000;
+    size_t body_size = 4 * stride;
+    uint8_t *body = calloc(1, body_size);
+    for (int i = 0; i < 3; ++i) {
+        memcpy(body + i * stride, image, image_size);
+    }
+    free(image);
+
+    // The first copy stands in for dyld, its __data for dyld_all_image_infos
+    struct mach_header_64 *dyld = (struct mach_header_64 *)body;
+    dyld->filetype = MH_DYLINKER;
+    rename_section(dyld, "__data", "__all_image_info");
+
+    uint64_t list_addr = CORE_IMAGE_ADDR + 3 * stride;
+    struct dyld_image_info *infos = (struct dyld_image_info *)(body + 3 * stride);
+    char *paths = (char *)(infos + 2);
+    strcpy(paths, "/usr/lib/libbasic-extra.dylib");
+    strcpy(paths + 0x40, "/usr/lib/libbasic.dylib");
+    for (int i = 0; i < 2; ++i) {
+        infos[i].imageLoadAddress = (const void *)(uintptr_t)(CORE_IMAGE_ADDR + (i + 1) * stride);
+        infos[i].imageFilePath = (const char *)(uintptr_t)(list_addr + (paths + 0x40 * i - (char *)infos));
+    }
+
+    struct dyld_all_image_infos *aii = (struct dyld_all_image_infos *)(body + 0x1000);
+    aii->version = 15;
+    aii->infoArrayCount = 2;
+    aii->infoArray = (const void *)(uintptr_t)list_addr;
+
+    // dyld is found at the start of a region
+    struct segment_command_64 segs[2] = {
+        { .cmd = LC_SEGMENT_64, .cmdsize = sizeof(segs[0]), .vmaddr = CORE_IMAGE_ADDR, .vmsize = stride,
+          .fileoff = 0x1000, .filesize = stride, .initprot = VM_PROT_READ },
+        { .cmd = LC_SEGMENT_64, .cmdsize = sizeof(segs[1]), .vmaddr = CORE_IMAGE_ADDR + stride, .vmsize = 3 * stride,
+          .fileoff = 0x1000 + stride, .filesize = 3 * stride, .initprot = VM_PROT_READ },
+    };
+    char *path = write_core(segs, 2, sizeof(segs), body, body_size);
+    free(body);
+
+    sr_snapshot_t snapshot = sr_snapshot_open(path);
+    SR_EXPECT(snapshot != NULL);
+    if (snapshot) {
+        SR_EXPECT(sr_snapshot_image_count(snapshot) == 3);
+        symrez_t extra = sr_snapshot_symrez(snapshot, 1);
+        symrez_t basic = sr_snapshot_symrez(snapshot, 2);
+        SR_EXPECT(extra != NULL && basic != NULL);
+        if (extra && basic) {
+            SR_EXPECT(sr_snapshot_find_image(snapshot, "/usr/lib/libbasic.dylib") == basic->header);
+            SR_EXPECT(sr_snapshot_find_image(snapshot, "libbasic.dylib") == basic->header);
+            SR_EXPECT(sr_snapshot_find_image(snapshot, "libbasic-extra.dylib") == extra->header);
+            SR_EXPECT(sr_snapshot_find_image(snapshot, "libbasic") == NULL);
+            SR_EXPECT(sr_snapshot_find_image(snapshot, "/usr/lib/libbasic") == NULL);
+        }
+        sr_snapshot_close(snapshot);
+    }
+
+    unlink(path);
+    free(path);
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s basic.dylib\n", argv[0]);
+        return 2;
+    }
+    _basic_path = argv[1];
+
+    SR_RUN(test_core_zero_cmdsize);
+    SR_RUN(test_core_cmdsize_past_sizeofcmds);
+    SR_RUN(test_core_ncmds_past_sizeofcmds);
+    SR_RUN(test_core_sections_past_cmdsize);
+    SR_RUN(test_core_bad_image);
+    SR_RUN(test_core_find_image_by_name);
+    return sr_test_failures ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+//
+//  SwiftTests.c
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include "Test.h"
+
+// swift_tests <swift.dylib>
+static symrez_t _symrez;
+
+// Descriptors only hold relative offsets, so any page aligned copy will do
+static void *
+swift_load_image(const char *path) {
+    size_t size = 0;
+    void *file = sr_test_read_file(path, &size);
+    if (!file) {
+        return NULL;
+    }
+
+    void *image = aligned_alloc(0x1000, (size + 0xFFF) & ~(size_t)0xFFF);
+    memcpy(image, file, size);
+    free(file);
+    return image;
+}
+
+static void
+expect_type(const char *name, const char *accessor, uint32_t kind) {
+    sr_swift_type_t type = { 0 };
+    bool found = sr_resolve_swift_type(_symrez, name, &type);
+    if (!found) {
+        fprintf(stderr, "%s: not found\n", name);
+    }
+    SR_EXPECT(found);
+    SR_EXPECT(type.kind == kind);
+    SR_EXPECT(type.accessor == (accessor ? sr_resolve_symbol(_symrez, accessor) : NULL));
+}
+
+static void
+test_swift_nested_type(void) {
+    expect_type("$s12SwiftFixture5OuterV5InnerOMn", "_accessor_Inner", SR_SWIFT_KIND_ENUM);
+    expect_type("SwiftFixture.Outer.Inner", "_accessor_Inner", SR_SWIFT_KIND_ENUM);
+    expect_type("$s12SwiftFixture5OuterVN", "_accessor_Outer", SR_SWIFT_KIND_STRUCT);
+    SR_EXPECT(!sr_resolve_swift_type(_symrez, "$s12SwiftFixture5InnerO", NULL));
+}
+
+static void
+test_swift_private_discriminator(void) {
+    expect_type("$s12SwiftFixture6Hidden33_0123456789ABCDEF0123456789ABCDEFLLVMn", "_accessor_Hidden", SR_SWIFT_KIND_STRUCT);
+    expect_type("SwiftFixture.Hidden", "_accessor_Hidden", SR_SWIFT_KIND_STRUCT);
+    SR_EXPECT(!sr_resolve_swift_type(_symrez, "$s12SwiftFixture6HiddenVMn", NULL));
+}
+
+// Only TwinA's anonymous context records its discriminator
+static void
+test_swift_private_collision(void) {
+    expect_type("$s12SwiftFixture4Twin33_AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAALLVMn", "_accessor_TwinA", SR_SWIFT_KIND_STRUCT);
+    expect_type("$s12SwiftFixture4Twin33_BBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBBLLVMn", "_accessor_TwinB", SR_SWIFT_KIND_STRUCT);
+    SR_EXPECT(!sr_resolve_swift_type(_symrez, "SwiftFixture.Twin", NULL));
+    SR_EXPECT(!sr_resolve_swift_type(_symrez, "$s12SwiftFixture4TwinVMn", NULL));
+}
+
+// The extension context names Outer with a symbolic reference, not a mangled name
+static void
+test_swift_extension_symbolic_reference(void) {
+    expect_type("$s12SwiftFixture5OuterV6NestedCMn", "_accessor_Nested", SR_SWIFT_KIND_CLASS);
+    expect_type("$s12SwiftFixture5OuterVAAE6NestedC", "_accessor_Nested", SR_SWIFT_KIND_CLASS);
+    expect_type("SwiftFixture.Outer.Nested", "_accessor_Nested", SR_SWIFT_KIND_CLASS);
+}
+
+// `0B` is the second word of "SwiftFixture", "Fixture"
+static void
+test_swift_word_substitution(void) {
+    expect_type("$s12SwiftFixture0B5ValueVMn", "_accessor_FixtureValue", SR_SWIFT_KIND_STRUCT);
+    expect_type("SwiftFixture.FixtureValue", "_accessor_FixtureValue", SR_SWIFT_KIND_STRUCT);
+}
+
+static void
+test_swift_protocol(void) {
+    expect_type("$s12SwiftFixture5ShapePMp", NULL, SR_SWIFT_KIND_PROTOCOL);
+    SR_EXPECT(!sr_resolve_swift_type(_symrez, "$s12SwiftFixture5OuterC", NULL));
+    SR_EXPECT(!sr_resolve_swift_type(_symrez, "SwiftFixture.Missing", NULL));
+}
+
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s swift.dylib\n", argv[0]);
+        return 2;
+    }
+
+    void *image = swift_load_image(argv[1]);
+    _symrez = image ? symrez_new_mh(image) : NULL;
+    if (!_symrez) {
+        fprintf(stderr, "%s: can't load %s\n", argv[0], argv[1]);
+        return 1;
+    }
+
+    SR_RUN(test_swift_nested_type);
+    SR_RUN(test_swift_private_discriminator);
+    SR_RUN(test_swift_private_collision);
+    SR_RUN(test_swift_extension_symbolic_reference);
+    SR_RUN(test_swift_word_substitution);
+    SR_RUN(test_swift_protocol);
+
+    sr_free(_symrez);
+    free(image);
+    return sr_test_failures ? 1 : 0;
+}
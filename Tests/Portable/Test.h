@@ -0,0 +1,81 @@
+//
+//  Test.h
+//  SymRez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+// Just enough of a harness for the portable tests: one executable per file, failures counted
+
+#ifndef __SYMREZ_TEST__
+#define __SYMREZ_TEST__
+
+#include <SymRez/SymRez.h>
+#include <mach-o/loader.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int sr_test_failures = 0;
+
+#define SR_EXPECT(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: expected %s\n", __FILE__, __LINE__, __func__, #cond); \
+            ++sr_test_failures; \
+        } \
+    } while (0)
+
+#define SR_RUN(test) \
+    do { \
+        int before = sr_test_failures; \
+        test(); \
+        printf("%s %s\n", sr_test_failures == before ? "pass" : "FAIL", #test); \
+    } while (0)
+
+// Writes `size` bytes to a new temporary file. The caller unlinks it
+static inline char *
+sr_test_write_file(const void *bytes, size_t size) {
+    char *path = strdup("/tmp/symrez-test-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        free(path);
+        return NULL;
+    }
+
+    bool ok = write(fd, bytes, size) == (ssize_t)size;
+    close(fd);
+    if (!ok) {
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+static inline void *
+sr_test_read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    void *bytes = len > 0 ? malloc((size_t)len) : NULL;
+    if (bytes && fread(bytes, 1, (size_t)len, f) != (size_t)len) {
+        free(bytes);
+        bytes = NULL;
+    }
+    fclose(f);
+
+    *size = (size_t)len;
+    return bytes;
+}
+
+#endif
@@ -9,6 +9,9 @@
 #import <XCTest/XCTest.h>
 #import <SymRez.h>
 #import <dlfcn.h>
+#import <fnmatch.h>
+#import <objc/runtime.h>
+#include <ptrauth.h>
 #include <mach-o/dyld.h>
 #include <mach-o/dyld_images.h>
 #include <mach-o/ldsyms.h>
@@ -34,6 +37,11 @@ extern mach_header_t find_image(const char *image_name);
     XCTAssertTrue(sym);
 }
 
+- (void)testResolveSymbolOnceMh_nullHeader {
+    XCTAssertTrue(symrez_resolve_once("libsystem_c.dylib", "_printf"));
+    XCTAssertTrue(symrez_resolve_once_mh(NULL, "_printf") == NULL);
+}
+
 - (void)testCallingResolvedSymbol_CFStringCreateWithCString {
     CFStringRef (*_CFStringCreateWithCString)(CFAllocatorRef alloc, const char *cStr, CFStringEncoding encoding) = NULL;
     symrez_t sr = symrez_new("CoreFoundation");
@@ -89,6 +97,347 @@ extern mach_header_t find_image(const char *image_name);
     XCTAssertNil((__bridge id)sr_sym);
 }
 
+- (void)testBloom_missThenHit {
+    symrez_t sr = symrez_new("libsystem_c.dylib");
+    XCTAssertEqual(sr_resolve_symbol(sr, "abc123"), NULL);
+
+    sr_bloom_stats_t stats;
+    XCTAssertTrue(sr_bloom_get_stats(sr, &stats));
+    XCTAssertTrue(stats.keys > 1000);
+    XCTAssertTrue(stats.bytes > 0);
+    XCTAssertTrue(stats.fp_rate < 0.05);
+
+    // Names defined in the symbol table and only in the export trie both pass the filter
+    XCTAssertEqual(sr_resolve_symbol(sr, "_printf"), (void*)printf);
+    XCTAssertEqual(sr_resolve_symbol(sr, "abc123"), NULL);
+    sr_free(sr);
+}
+
+- (void)testCacheLocals_onlyForCacheImages {
+    symrez_t cached = symrez_new("libsystem_c.dylib");
+    XCTAssertTrue(sr_get_cache_local_count(cached) > 100);
+    XCTAssertEqual(sr_resolve_symbol(cached, "abc123"), NULL);
+    sr_free(cached);
+
+    symrez_t main = symrez_new(NULL);
+    XCTAssertEqual(sr_get_cache_local_count(main), 0);
+    sr_free(main);
+}
+
+- (void)testTrace_drainChromeJSON {
+    sr_trace_set_enabled(true);
+    symrez_t sr = symrez_new("libsystem_c.dylib");
+    XCTAssertEqual(sr_resolve_symbol(sr, "_printf"), (void*)printf);
+    sr_free(sr);
+    sr_trace_set_enabled(false);
+
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&buf, &len);
+    XCTAssertTrue(sr_trace_drain(out) >= 2);
+    fclose(out);
+
+    NSData *data = [NSData dataWithBytesNoCopy:buf length:len freeWhenDone:YES];
+    NSDictionary *json = [NSJSONSerialization JSONObjectWithData:data options:0 error:nil];
+    NSArray *events = json[@"traceEvents"];
+    XCTAssertTrue([[events valueForKey:@"name"] containsObject:@"image_parse"]);
+    XCTAssertTrue([[events valueForKey:@"name"] containsObject:@"nlist_scan"]);
+
+    // Drained events aren't written twice
+    out = fopen("/dev/null", "w");
+    XCTAssertEqual(sr_trace_drain(out), 0);
+    fclose(out);
+}
+
+static void *trace_thread_resolve(void *context) {
+    symrez_t sr = symrez_new("libsystem_c.dylib");
+    *(sr_ptr_t *)context = sr_resolve_symbol(sr, "_printf");
+    sr_free(sr);
+    return NULL;
+}
+
+- (void)testTrace_exitedThreadsDrainOnce {
+    sr_trace_set_enabled(true);
+    sr_ptr_t found[8] = { 0 };
+    pthread_t threads[8];
+    for (int i = 0; i < 8; ++i) {
+        XCTAssertEqual(pthread_create(&threads[i], NULL, trace_thread_resolve, &found[i]), 0);
+    }
+    for (int i = 0; i < 8; ++i) {
+        pthread_join(threads[i], NULL);
+        XCTAssertEqual(found[i], (void*)printf);
+    }
+    sr_trace_set_enabled(false);
+
+    // Rings of exited threads are written, then freed
+    FILE *out = fopen("/dev/null", "w");
+    XCTAssertTrue(sr_trace_drain(out) >= 8);
+    XCTAssertEqual(sr_trace_drain(out), 0);
+    fclose(out);
+}
+
+static bool count_diff(const sr_diff_entry_t *entry, void *context) {
+    size_t *counts = context;
+    if (entry->change & SR_DIFF_ADDED) ++counts[0];
+    else if (entry->change & SR_DIFF_REMOVED) ++counts[1];
+    else ++counts[2];
+    return false;
+}
+
+- (void)testDiff_sameUUIDAndDifferentImages {
+    symrez_t a = symrez_new("libsystem_c.dylib");
+    symrez_t b = symrez_new("libsystem_c.dylib");
+    symrez_t c = symrez_new("libsystem_kernel.dylib");
+    XCTAssertTrue(sr_get_uuid(a) != NULL);
+
+    size_t counts[3] = { 0 };
+    XCTAssertTrue(sr_diff(a, b, counts, count_diff));
+    XCTAssertEqual(counts[0] + counts[1] + counts[2], 0);
+
+    XCTAssertTrue(sr_diff(a, c, counts, count_diff));
+    XCTAssertTrue(counts[0] > 100);
+    XCTAssertTrue(counts[1] > 100);
+
+    sr_free(a);
+    sr_free(b);
+    sr_free(c);
+}
+
+- (void)testFindSignature_printfPrologue {
+    symrez_t sr = symrez_new("libsystem_c.dylib");
+    const uint8_t *printf_ptr = (const uint8_t *)ptrauth_strip(sr_resolve_symbol(sr, "_printf"), ptrauth_key_function_pointer);
+    XCTAssertTrue(printf_ptr);
+
+    // Wildcard the second byte so the masked path is exercised too
+    uint8_t pattern[24], mask[24];
+    memcpy(pattern, printf_ptr, sizeof(pattern));
+    memset(mask, 0xFF, sizeof(mask));
+    mask[1] = 0x00;
+
+    sr_ptr_t found[4] = { 0 };
+    size_t n = sr_find_signature(sr, pattern, mask, sizeof(pattern), NULL, found, 4);
+    XCTAssertTrue(n >= 1);
+    BOOL hit = NO;
+    for (size_t i = 0; i < n && i < 4; ++i) {
+        hit |= found[i] == (sr_ptr_t)printf_ptr;
+    }
+    XCTAssertTrue(hit);
+
+    sr_signature_t sigs[2] = {
+        { .pattern = (const uint8_t *)"\xde\xad\xbe\xef\xde\xad\xbe\xef\xde\xad", .size = 10 },
+        { .pattern = pattern, .mask = mask, .size = sizeof(pattern) },
+    };
+    sr_signature_scope_t scope = { .anchor = "_printf", .window = 64 };
+    sr_signature_match_t match = { 0 };
+    XCTAssertEqual(sr_find_signatures(sr, sigs, 2, &scope, &match, 1), 1);
+    XCTAssertEqual(match.addr, (sr_ptr_t)printf_ptr);
+    XCTAssertEqual(match.signature, 1);
+
+    void *fallback = sr_resolve_symbol_or_signature(sr, "_not_a_real_symbol", &sigs[1], &scope);
+    XCTAssertEqual(ptrauth_strip(fallback, ptrauth_key_function_pointer), (sr_ptr_t)printf_ptr);
+    sr_free(sr);
+}
+
+- (void)testSymbolHandle_followsSlide {
+    symrez_t sr = symrez_new("libsystem_c.dylib");
+    intptr_t slide = sr_get_slide(sr);
+    const char *names[] = { "_printf", "_strlen", "__simple_dprintf" };
+    sr_symbol_handle_t handles[3];
+
+    for (int i = 0; i < 3; ++i) {
+        XCTAssertTrue(sr_resolve_symbol_handle(sr, names[i], &handles[i]));
+        void *addr = sr_resolve_symbol(sr, names[i]);
+        XCTAssertEqual(sr_handle_address(sr, handles[i]), addr);
+        XCTAssertEqual(handles[i].address, (uint64_t)ptrauth_strip(addr, ptrauth_key_function_pointer));
+    }
+
+    sr_set_slide(sr, slide + 0x4000);
+    sr_handles_rebase(handles, 3, slide + 0x4000);
+    for (int i = 0; i < 3; ++i) {
+        void *addr = ptrauth_strip(sr_handle_address(sr, handles[i]), ptrauth_key_function_pointer);
+        XCTAssertEqual(addr, ptrauth_strip(sr_resolve_symbol(sr, names[i]), ptrauth_key_function_pointer));
+        XCTAssertEqual(handles[i].address, (uint64_t)addr);
+    }
+
+    sr_symbol_handle_t missing;
+    XCTAssertFalse(sr_resolve_symbol_handle(sr, "_not_a_real_symbol", &missing));
+    XCTAssertEqual(sr_handle_address(sr, missing), NULL);
+    sr_free(sr);
+}
+
+- (void)testCompactIndex_matchesScan {
+    symrez_t scan = symrez_new("CoreFoundation");
+    symrez_t compact = symrez_new("CoreFoundation");
+    XCTAssertFalse(sr_build_compact_index(compact, 64));
+    XCTAssertTrue(sr_build_compact_index(compact, 16 << 20));
+
+    sr_compact_index_stats_t stats;
+    XCTAssertTrue(sr_compact_index_get_stats(compact, &stats));
+    XCTAssertTrue(stats.symbols > 1000);
+    XCTAssertTrue(stats.bytes_per_symbol > 0 && stats.bytes_per_symbol < 32);
+
+    const char *names[] = { "___CFStringHash", "_CFStringCreateWithCString", "_CFRelease", "abc123", "_" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(*names); ++i) {
+        XCTAssertEqual(sr_resolve_symbol(compact, names[i]), sr_resolve_symbol(scan, names[i]));
+    }
+
+    sr_free(scan);
+    sr_free(compact);
+}
+
+- (void)testResolveManifest_matchesResolveOnce {
+    sr_request_t requests[] = {
+        { "libsystem_c.dylib", "_printf" },
+        { "CoreFoundation", "___CFStringHash" },
+        { "libsystem_c.dylib", "__simple_dprintf" },
+        { "CoreFoundation", "_CFRelease" },
+        { "libsystem_c.dylib", "abc123" },
+        { "NotAnImage", "_printf" },
+        { "Foundation", "-[NSXPCConnection _initWithPeerConnection:name:options:]" },
+        { "libsystem_c.dylib", "_printf" },
+    };
+    size_t n = sizeof(requests) / sizeof(*requests);
+    sr_ptr_t out[n];
+    uint8_t status[n];
+    sr_manifest_options_t options = { .threads = 2, .status = status };
+
+    XCTAssertEqual(symrez_resolve_manifest(requests, n, out, &options), 6);
+    XCTAssertTrue(options.elapsed_ns > 0);
+    for (size_t i = 0; i < n; ++i) {
+        XCTAssertEqual(out[i], symrez_resolve_once(requests[i].image, requests[i].symbol));
+    }
+
+    XCTAssertEqual(status[0], SR_MANIFEST_OK);
+    XCTAssertEqual(status[4], SR_MANIFEST_NO_SYMBOL);
+    XCTAssertEqual(status[5], SR_MANIFEST_NO_IMAGE);
+    XCTAssertEqual(out[0], (void*)printf);
+}
+
+static long lazy_missing_handler(long a, long b) {
+    return a * b;
+}
+
+- (void)testLazyFunction_resolvesOnFirstCall {
+    symrez_t sr = symrez_new("libsystem_c.dylib");
+    size_t (*lazy_strlen)(const char *) = sr_lazy_function(sr, "_strlen", NULL);
+    XCTAssertTrue(lazy_strlen != NULL);
+    XCTAssertEqual(sr_lazy_function(sr, "_strlen", NULL), (void *)lazy_strlen);
+    sr_free(sr);
+
+    __block size_t total = 0;
+    dispatch_apply(16, DISPATCH_APPLY_AUTO, ^(size_t i) {
+        __atomic_fetch_add(&total, lazy_strlen("symrez"), __ATOMIC_RELAXED);
+    });
+    XCTAssertEqual(total, 16 * 6);
+    XCTAssertEqual(lazy_strlen(""), 0);
+
+    sr = symrez_new("libsystem_c.dylib");
+    long (*missing)(long, long) = sr_lazy_function(sr, "_not_a_real_function", (void *)lazy_missing_handler);
+    XCTAssertEqual(missing(6, 7), 42);
+    XCTAssertEqual(missing(2, 3), 6);
+    sr_free(sr);
+}
+
+static void *pointer_refs_table[] = { (void *)lazy_missing_handler, (void *)printf, (void *)lazy_missing_handler };
+
+static bool collect_pointer_ref(const sr_pointer_ref_t *ref, void *context) {
+    uint32_t *seen = context;
+    for (size_t i = 0; i < 3; ++i) {
+        if (ref->slot == (sr_ptr_t)&pointer_refs_table[i]) {
+            seen[i] |= 1 << ref->index;
+        }
+    }
+    return false;
+}
+
+- (void)testFindPointerRefs_testImageTable {
+    Dl_info info;
+    XCTAssertTrue(dladdr(pointer_refs_table, &info));
+    symrez_t sr = symrez_new_mh(info.dli_fbase);
+
+    sr_ptr_t targets[] = { (sr_ptr_t)printf, (sr_ptr_t)lazy_missing_handler, (sr_ptr_t)lazy_missing_handler };
+    uint32_t seen[3] = { 0 };
+    size_t n = sr_find_pointer_refs(sr, targets, 3, seen, collect_pointer_ref);
+    XCTAssertTrue(n >= 5);
+    XCTAssertEqual(seen[0], 0b110);
+    XCTAssertEqual(seen[1], 0b001);
+    XCTAssertEqual(seen[2], 0b110);
+    XCTAssertEqual(sr_find_pointer_refs(sr, targets, 0, NULL, collect_pointer_ref), 0);
+    sr_free(sr);
+}
+
+- (void)testResolveAll_firstMatchesResolveSymbol {
+    symrez_t sr = symrez_new("CoreFoundation");
+    sr_definition_t defs[8];
+    size_t n = sr_resolve_all(sr, "_CFStringCreateWithCString", defs, 8);
+    XCTAssertTrue(n >= 1);
+    XCTAssertEqual(defs[0].addr, sr_resolve_symbol(sr, "_CFStringCreateWithCString"));
+    XCTAssertEqual(strcmp(defs[0].sectname, "__text"), 0);
+    XCTAssertTrue(defs[0].n_type & N_EXT);
+    XCTAssertEqual(sr_resolve_all(sr, "_CFStringCreateWithCString", NULL, 0), n);
+    XCTAssertEqual(sr_resolve_all(sr, "_not_a_real_symbol_", defs, 8), 0);
+    sr_free(sr);
+}
+
+- (void)testPlanner_promotesHotObject {
+    sr_planner_config_t config = { .threshold = 1, .min_symbols = 0 };
+    sr_planner_set_config(&config);
+
+    symrez_t sr = symrez_new("CoreFoundation");
+    sr_planner_stats_t stats;
+    sr_planner_get_stats(sr, &stats);
+    XCTAssertEqual(stats.plan, 0);
+
+    sr_ptr_t first = sr_resolve_symbol(sr, "___CFStringHash");
+    sr_planner_get_stats(sr, &stats);
+    XCTAssertTrue(stats.initial_plan == SR_PLAN_SCAN || stats.initial_plan == SR_PLAN_EXTDEF);
+    XCTAssertTrue(stats.budget > 0);
+
+    for (int i = 0; i < 10000 && stats.plan != SR_PLAN_INDEX; ++i) {
+        XCTAssertEqual(sr_resolve_symbol(sr, "___CFStringHash"), first);
+        sr_planner_get_stats(sr, &stats);
+    }
+    XCTAssertEqual(stats.plan, SR_PLAN_INDEX);
+    XCTAssertTrue(stats.promoted_at > 0);
+    XCTAssertEqual(sr_resolve_symbol(sr, "___CFStringHash"), first);
+
+    // Rebuilding the object drops the index; lookups start over with a fresh plan
+    XCTAssertTrue(sr_set_allocator(sr, NULL));
+    sr_planner_get_stats(sr, &stats);
+    XCTAssertEqual(stats.plan, 0);
+    XCTAssertEqual(sr_resolve_symbol(sr, "___CFStringHash"), first);
+    sr_free(sr);
+
+    config = (sr_planner_config_t){ .threshold = 4, .min_symbols = 0x400 };
+    sr_planner_set_config(&config);
+}
+
+- (void)testResolveSwiftType_libswiftCore {
+    XCTAssertTrue(dlopen("/usr/lib/swift/libswiftCore.dylib", RTLD_LAZY));
+    symrez_t sr = symrez_new("libswiftCore.dylib");
+
+    sr_swift_type_t array;
+    XCTAssertTrue(sr_resolve_swift_type(sr, "$sSaMn", &array));
+    XCTAssertEqual(array.kind, SR_SWIFT_KIND_STRUCT);
+    XCTAssertTrue(array.accessor != NULL);
+
+    sr_swift_type_t type;
+    XCTAssertTrue(sr_resolve_swift_type(sr, "Swift.Array", &type));
+    XCTAssertEqual(type.descriptor, array.descriptor);
+
+    XCTAssertTrue(sr_resolve_swift_type(sr, "$ss6MirrorVMn", &type));
+    XCTAssertEqual(type.descriptor, ptrauth_strip(sr_resolve_symbol(sr, "_$ss6MirrorVMn"), ptrauth_key_function_pointer));
+
+    XCTAssertTrue(sr_resolve_swift_type(sr, "$sSD5IndexV", &type));
+    XCTAssertTrue(sr_resolve_swift_type(sr, "SQ", &type));
+    XCTAssertEqual(type.kind, SR_SWIFT_KIND_PROTOCOL);
+    XCTAssertTrue(type.accessor == NULL);
+
+    XCTAssertFalse(sr_resolve_swift_type(sr, "$ss6MirrorOMn", NULL));
+    XCTAssertFalse(sr_resolve_swift_type(sr, "Swift.NotARealType", NULL));
+    sr_free(sr);
+}
+
 - (void)testResolveSymbol_private_CFStringHash {
     void *_CFStringHash = NULL;
     symrez_t sr = symrez_new("CoreFoundation");
@@ -107,6 +456,259 @@ extern mach_header_t find_image(const char *image_name);
     XCTAssertTrue(_xpc_endpoint_create);
 }
 
+- (void)testResolveGlobal_private_CFStringHash {
+    mach_header_t image = NULL;
+    void *sym = symrez_resolve_global("___CFStringHash", &image);
+    void *sym2 = symrez_resolve_once("CoreFoundation", "___CFStringHash");
+    XCTAssertTrue(sym);
+    XCTAssertEqual(sym, sym2);
+    XCTAssertEqual(image, find_image("CoreFoundation"));
+}
+
+- (void)testResolveGlobal_notFound {
+    mach_header_t image = (mach_header_t)(void *)-1;
+    void *sym = symrez_resolve_global("abc123", &image);
+    XCTAssertTrue(sym == NULL);
+    XCTAssertTrue(image == NULL);
+}
+
+- (void)testSectionForAddress_printf {
+    sr_section_info_t info;
+    symrez_t sr = symrez_new("libsystem_c.dylib");
+    bool found = sr_section_for_address(sr, (void*)printf, &info);
+    bool found2 = sr_section_for_address(sr, (void*)CFStringCreateWithCString, NULL);
+    sr_free(sr);
+
+    XCTAssertTrue(found);
+    XCTAssertFalse(found2);
+    XCTAssertEqual(strcmp(info.segname, "__TEXT"), 0);
+    XCTAssertEqual(strcmp(info.sectname, "__text"), 0);
+    XCTAssertTrue(info.flags & S_ATTR_PURE_INSTRUCTIONS);
+}
+
+- (void)testFunctionExtent_printf {
+    void *start = NULL;
+    size_t size = 0;
+    symrez_t sr = symrez_new("libsystem_c.dylib");
+    bool found = sr_function_extent(sr, (void*)((uintptr_t)printf + 4), &start, &size);
+    sr_free(sr);
+
+    XCTAssertTrue(found);
+    XCTAssertEqual(start, (void*)printf);
+    XCTAssertTrue(size > 4);
+}
+
+- (void)testIteratorBatch_matches_getNext {
+    symrez_t sr = symrez_new("CoreFoundation");
+    sr_iterator_t it = sr_get_iterator(sr);
+
+    size_t expected = 0;
+    while (sr_iter_get_next(it)) {
+        ++expected;
+    }
+
+    sr_entry_t entries[256];
+    static char arena[0x10000];
+    size_t total = 0, n = 0;
+    sr_iter_reset(it);
+    while ((n = sr_iter_next_batch(it, entries, 256, arena, sizeof(arena)))) {
+        for (size_t i = 0; i < n; ++i) {
+            XCTAssertEqual(strlen(entries[i].name), entries[i].name_len);
+        }
+        total += n;
+    }
+    sr_free(sr);
+
+    XCTAssertTrue(expected > 0);
+    XCTAssertEqual(total, expected);
+}
+
+- (void)testIteratorBatch_arena_too_small {
+    symrez_t sr = symrez_new("CoreFoundation");
+    sr_iterator_t it = sr_get_iterator(sr);
+
+    sr_entry_t entries[256];
+    static char arena[2048];
+    XCTAssertEqual(sr_iter_next_batch(it, entries, 256, NULL, 0), SR_COUNT_ERROR);
+    XCTAssertEqual(sr_iter_next_batch(it, entries, 256, arena, sizeof(arena) - 1), SR_COUNT_ERROR);
+
+    // Room for one export name per call, but every symbol still comes out
+    size_t expected = 0;
+    while (sr_iter_get_next(it)) {
+        ++expected;
+    }
+
+    size_t total = 0, n = 0;
+    sr_iter_reset(it);
+    while ((n = sr_iter_next_batch(it, entries, 256, arena, sizeof(arena)))) {
+        XCTAssertNotEqual(n, SR_COUNT_ERROR);
+        total += n;
+    }
+    sr_free(sr);
+
+    XCTAssertEqual(total, expected);
+}
+
+static bool count_symbol(sr_symbol_t symbol, sr_ptr_t ptr, void *context) {
+    ++*(size_t *)context;
+    return false;
+}
+
+struct search_reference {
+    const char *needle;
+    const char *pattern;
+    size_t count;
+};
+
+static bool count_reference_match(sr_symbol_t symbol, sr_ptr_t ptr, void *context) {
+    struct search_reference *ref = context;
+    if (ref->needle ? strstr(symbol, ref->needle) != NULL : !fnmatch(ref->pattern, symbol, 0)) {
+        ++ref->count;
+    }
+    return false;
+}
+
+- (void)testSearch_matchesForEach {
+    symrez_t sr = symrez_new("CoreFoundation");
+    struct search_reference contains = { .needle = "Dictionary" };
+    struct search_reference glob = { .pattern = "_CFString*Create*" };
+    sr_for_each(sr, &contains, count_reference_match);
+    sr_for_each(sr, &glob, count_reference_match);
+
+    size_t found = 0, globbed = 0, all = 0, everything = 0;
+    XCTAssertEqual(sr_search_substring(sr, "Dictionary", &found, count_symbol), found);
+    XCTAssertEqual(sr_search_glob(sr, "_CFString*Create*", &globbed, count_symbol), globbed);
+    sr_search_substring(sr, "", &all, count_symbol);
+    sr_for_each(sr, &everything, count_symbol);
+    sr_free(sr);
+
+    XCTAssertTrue(contains.count > 0);
+    XCTAssertEqual(found, contains.count);
+    XCTAssertTrue(glob.count > 0);
+    XCTAssertEqual(globbed, glob.count);
+    XCTAssertEqual(all, everything);
+}
+
+- (void)testForEachFiltered_localData {
+    symrez_t sr = symrez_new("CoreFoundation");
+    size_t all = 0, locals = 0, local_data = 0;
+    sr_filter_t filter = { .mask = SR_FILTER_LOCALS | SR_FILTER_CODE | SR_FILTER_DATA };
+    sr_for_each(sr, &all, count_symbol);
+    sr_for_each_filtered(sr, &filter, &locals, count_symbol);
+    filter.mask = SR_FILTER_LOCALS | SR_FILTER_DATA;
+    sr_for_each_filtered(sr, &filter, &local_data, count_symbol);
+
+    sr_iterator_t it = sr_get_iterator(sr);
+    size_t iterated = 0;
+    sr_iter_set_filter(it, &filter);
+    while (sr_iter_get_next(it)) {
+        sr_section_info_t info;
+        XCTAssertTrue(sr_section_for_address(sr, sr_iter_get_ptr(it), &info));
+        XCTAssertFalse(info.flags & S_ATTR_PURE_INSTRUCTIONS);
+        ++iterated;
+    }
+    sr_iter_set_filter(it, NULL);
+    sr_free(sr);
+
+    XCTAssertTrue(local_data > 0);
+    XCTAssertTrue(local_data < locals);
+    XCTAssertTrue(locals < all);
+    XCTAssertEqual(iterated, local_data);
+}
+
+- (void)testResolveObjCMethod_NSUserDefaults {
+    IMP expected_class = method_getImplementation(class_getClassMethod([NSUserDefaults class], @selector(standardUserDefaults)));
+    IMP expected_inst = method_getImplementation(class_getInstanceMethod([NSUserDefaults class], @selector(objectForKey:)));
+
+    symrez_t sr = symrez_new("Foundation");
+    void *class_imp = sr_resolve_objc_method(sr, "NSUserDefaults", "standardUserDefaults", true);
+    void *inst_imp = sr_resolve_symbol(sr, "-[NSUserDefaults objectForKey:]");
+    void *missing = sr_resolve_objc_method(sr, "NSUserDefaults", "standardUserDefaults", false);
+    sr_free(sr);
+
+    XCTAssertEqual(class_imp, (void*)expected_class);
+    XCTAssertEqual(inst_imp, (void*)expected_inst);
+    XCTAssertEqual(missing, NULL);
+}
+
+- (void)testSnapshot_regions_localSymbol {
+    Dl_info dli;
+    XCTAssertTrue(dladdr((void*)count_symbol, &dli));
+    mach_header_t mh = (mach_header_t)dli.dli_fbase;
+
+    // Dump every segment of this test bundle, at its slid address, into one file
+    NSString *path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"symrez.snapshot"];
+    FILE *file = fopen(path.fileSystemRepresentation, "w");
+    sr_snapshot_region_t regions[16];
+    size_t count = 0;
+    intptr_t slide = 0;
+    const struct load_command *lc = (const void *)(mh + 1);
+    for (uint32_t i = 0; i < mh->ncmds; ++i, lc = (const void *)((uintptr_t)lc + lc->cmdsize)) {
+        const struct segment_command_64 *seg = (const void *)lc;
+        if (lc->cmd != LC_SEGMENT_64 || !seg->vmsize) continue;
+        if (!strcmp(seg->segname, SEG_TEXT)) slide = (intptr_t)mh - seg->vmaddr;
+    }
+    lc = (const void *)(mh + 1);
+    for (uint32_t i = 0; i < mh->ncmds; ++i, lc = (const void *)((uintptr_t)lc + lc->cmdsize)) {
+        const struct segment_command_64 *seg = (const void *)lc;
+        if (lc->cmd != LC_SEGMENT_64 || !seg->initprot || count == 16) continue;
+        regions[count].vmaddr = seg->vmaddr + slide;
+        regions[count].size = seg->filesize;
+        regions[count].fileoff = (uint64_t)ftello(file);
+        fwrite((void*)regions[count].vmaddr, 1, seg->filesize, file);
+        ++count;
+    }
+    fclose(file);
+
+    sr_snapshot_t snapshot = sr_snapshot_open_regions(path.fileSystemRepresentation, regions, count);
+    XCTAssertTrue(snapshot != NULL);
+    XCTAssertEqual(sr_snapshot_image_count(snapshot), 1);
+    XCTAssertEqual(sr_snapshot_image_address(snapshot, 0), (uint64_t)mh);
+
+    symrez_t sr = sr_snapshot_symrez(snapshot, 0);
+    void *local = sr_resolve_symbol(sr, "_count_symbol");
+    XCTAssertNotEqual(local, (void*)count_symbol);
+    XCTAssertEqual(sr_snapshot_remote_address(snapshot, 0, local), (uint64_t)(uintptr_t)ptrauth_strip((void*)count_symbol, ptrauth_key_function_pointer));
+    sr_snapshot_close(snapshot);
+    unlink(path.fileSystemRepresentation);
+}
+
+struct test_arena {
+    uint8_t buf[0x100000];
+    size_t used;
+    size_t allocs;
+};
+
+static void *test_arena_alloc(size_t size, void *context) {
+    struct test_arena *arena = context;
+    size = (size + 15) & ~(size_t)15;
+    if (arena->used + size > sizeof(arena->buf)) return NULL;
+    void *ret = &arena->buf[arena->used];
+    arena->used += size;
+    ++arena->allocs;
+    return ret;
+}
+
+- (void)testInitIn_arenaAllocator {
+    struct test_arena *arena = calloc(1, sizeof(struct test_arena));
+    sr_allocator_t allocator = { .alloc = test_arena_alloc, .free = NULL, .context = arena };
+    void *buf = aligned_alloc(64, sr_sizeof());
+
+    symrez_t sr = symrez_init_in(buf, find_image("libsystem_c.dylib"));
+    XCTAssertEqual((void*)sr, buf);
+    XCTAssertTrue(sr_set_allocator(sr, &allocator));
+    void *_printf = sr_resolve_symbol(sr, "_printf");
+    sr_ptr_t start = NULL;
+    XCTAssertTrue(sr_function_extent(sr, (void*)printf, &start, NULL));
+    symrez_destroy(sr);
+
+    XCTAssertEqual(_printf, (void*)printf);
+    XCTAssertEqual(start, (void*)printf);
+    XCTAssertTrue(arena->allocs >= 2);
+    free(buf);
+    free(arena);
+}
+
 - (void)testFindImage_name_path {
     mach_header_t hdr1 = find_image("/System/Library/Frameworks/Foundation.framework/Versions/C/Foundation");
     mach_header_t hdr2 = find_image("Foundation");
@@ -0,0 +1,1049 @@
+//
+//  main.c
+//  symrez
+//
+//  Created by Jeremy Legendre on 4/14/20.
+//  Copyright © 2020 Jeremy Legendre. All rights reserved.
+//
+
+#include <SymRez/SymRez.h>
+#include <mach-o/fat.h>
+#include <mach-o/loader.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ nm for many files at once. Every path is a task on a work-stealing pool:
+ directories push their entries, shared caches push one task per image,
+ and thin/fat files are dumped in place. Each worker owns a deque it pushes
+ to and pops from at the tail; idle workers steal from the head of the
+ others'. Output for one image is formatted into a private buffer and
+ written out in one piece, so images never interleave.
+
+ On-disk files are opened as snapshots: every LC_SEGMENT_64 of a slice is a
+ region at its unslid vmaddr, so addresses are the ones in the file.
+ */
+
+#define SR_CLI_BINARY_MAGIC "SRNM\0\0\0\1"
+
+enum sr_cli_format {
+    SR_CLI_TEXT,
+    SR_CLI_JSON,
+    SR_CLI_BINARY,
+};
+
+static struct {
+    enum sr_cli_format format;
+    const char *name;
+    const char *prefix;
+    size_t prefix_len;
+    uint64_t addr_lo;
+    uint64_t addr_hi;
+    bool stats;
+    bool diff;
+    unsigned jobs;
+} _g_opts = { .addr_hi = UINT64_MAX };
+
+enum sr_cli_task_kind {
+    SR_CLI_PATH,
+    SR_CLI_CACHE_IMAGE,
+    SR_CLI_DIFF,
+};
+
+struct sr_cli_cache {
+    sr_snapshot_t snapshot;
+    pthread_mutex_t lock;
+    char *path;
+    uint64_t size;
+    uint64_t start;
+    _Atomic uint32_t remaining;
+    _Atomic size_t symbols;
+};
+
+// An image of one side of a diff, keyed by install name or architecture
+struct sr_cli_image {
+    char *key;
+    symrez_t symrez;
+};
+
+struct sr_cli_task {
+    enum sr_cli_task_kind kind;
+    char *path;
+    struct sr_cli_cache *cache;
+    uint32_t image;
+    const struct sr_cli_image *a;
+    const struct sr_cli_image *b;
+};
+
+struct sr_cli_deque {
+    pthread_mutex_t lock;
+    struct sr_cli_task **tasks;
+    size_t head;
+    size_t tail;
+    size_t cap;
+};
+
+static struct {
+    struct sr_cli_deque *deques;
+    unsigned count;
+    _Atomic size_t pending;
+    pthread_mutex_t out_lock;
+} _g_pool = { .out_lock = PTHREAD_MUTEX_INITIALIZER };
+
+static uint64_t
+sr_cli_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#pragma mark - Pool
+
+static void
+sr_cli_push(unsigned worker, struct sr_cli_task *task) {
+    struct sr_cli_deque *d = &_g_pool.deques[worker];
+    atomic_fetch_add_explicit(&_g_pool.pending, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->cap) {
+        // Compact before growing; thieves leave a hole at the head
+        size_t live = d->tail - d->head;
+        if (d->head > d->cap / 2) {
+            memmove(d->tasks, &d->tasks[d->head], live * sizeof(*d->tasks));
+        } else {
+            size_t cap = d->cap ? d->cap * 2 : 64;
+            struct sr_cli_task **tasks = malloc(cap * sizeof(*tasks));
+            if (!tasks) {
+                perror("symrez");
+                exit(1);
+            }
+            memcpy(tasks, &d->tasks[d->head], live * sizeof(*tasks));
+            free(d->tasks);
+            d->tasks = tasks;
+            d->cap = cap;
+        }
+        d->head = 0;
+        d->tail = live;
+    }
+    d->tasks[d->tail++] = task;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static struct sr_cli_task *
+sr_cli_pop(unsigned worker) {
+    struct sr_cli_task *task = NULL;
+    struct sr_cli_deque *d = &_g_pool.deques[worker];
+
+    pthread_mutex_lock(&d->lock);
+    if (d->tail > d->head) {
+        task = d->tasks[--d->tail];
+    }
+    pthread_mutex_unlock(&d->lock);
+    if (task) {
+        return task;
+    }
+
+    for (unsigned i = 1; i < _g_pool.count && !task; ++i) {
+        struct sr_cli_deque *victim = &_g_pool.deques[(worker + i) % _g_pool.count];
+        pthread_mutex_lock(&victim->lock);
+        if (victim->tail > victim->head) {
+            task = victim->tasks[victim->head++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    return task;
+}
+
+#pragma mark - Output
+
+static void
+sr_cli_json_string(FILE *out, const char *str) {
+    fputc('"', out);
+    for (const unsigned char *p = (const unsigned char *)str; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', out);
+            fputc(*p, out);
+        } else if (*p < 0x20) {
+            fprintf(out, "\\u%04x", *p);
+        } else {
+            fputc(*p, out);
+        }
+    }
+    fputc('"', out);
+}
+
+struct sr_cli_dump {
+    FILE *out;
+    sr_snapshot_t snapshot;
+    uint32_t image;
+    const char *label;
+    size_t count;
+};
+
+// nm's letters: T for __TEXT,__text, D for __DATA,__data, B for zerofill,
+// S for any other section and A for absolute. Upper case when N_EXT or exported
+static char
+sr_cli_symbol_type(symrez_t symrez, const sr_entry_t *entry) {
+    char type = 'A';
+    sr_section_info_t info;
+    if (!(entry->flags & SR_ENTRY_ABSOLUTE) && sr_section_for_address(symrez, entry->addr, &info)) {
+        uint32_t kind = info.flags & SECTION_TYPE;
+        if (!strcmp(info.segname, SEG_TEXT) && !strcmp(info.sectname, SECT_TEXT)) {
+            type = 'T';
+        } else if (!strcmp(info.segname, SEG_DATA) && !strcmp(info.sectname, SECT_DATA)) {
+            type = 'D';
+        } else if (kind == S_ZEROFILL || kind == S_GB_ZEROFILL || kind == S_THREAD_LOCAL_ZEROFILL) {
+            type = 'B';
+        } else {
+            type = 'S';
+        }
+    }
+
+    return (entry->flags & SR_ENTRY_EXTERNAL) ? type : (char)(type - 'A' + 'a');
+}
+
+static void
+sr_cli_symbol(struct sr_cli_dump *dump, const sr_entry_t *entry, char type) {
+    const char *symbol = entry->name;
+    if (_g_opts.name && strcmp(symbol, _g_opts.name)) {
+        return;
+    }
+    if (_g_opts.prefix && strncmp(symbol, _g_opts.prefix, _g_opts.prefix_len)) {
+        return;
+    }
+
+    // Absolute symbols aren't inside the image, and are already unslid
+    uint64_t addr = sr_snapshot_remote_address(dump->snapshot, dump->image, entry->addr);
+    if (!addr) {
+        addr = (uint64_t)entry->addr;
+    }
+    if (addr < _g_opts.addr_lo || addr > _g_opts.addr_hi) {
+        return;
+    }
+
+    ++dump->count;
+    switch (_g_opts.format) {
+        case SR_CLI_TEXT:
+            fprintf(dump->out, "%016" PRIx64 " %c %s\n", addr, type, symbol);
+            break;
+        case SR_CLI_JSON:
+            fputs("{\"image\":", dump->out);
+            sr_cli_json_string(dump->out, dump->label);
+            fprintf(dump->out, ",\"addr\":\"0x%" PRIx64 "\",\"type\":\"%c\",\"name\":", addr, type);
+            sr_cli_json_string(dump->out, symbol);
+            fputs("}\n", dump->out);
+            break;
+        case SR_CLI_BINARY: {
+            uint32_t len = entry->name_len;
+            fputc('S', dump->out);
+            fputc(type, dump->out);
+            fwrite(&addr, sizeof(addr), 1, dump->out);
+            fwrite(&len, sizeof(len), 1, dump->out);
+            fwrite(symbol, 1, len, dump->out);
+            break;
+        }
+    }
+}
+
+#define SR_CLI_BATCH 256
+#define SR_CLI_ARENA (64 * 1024)
+
+static size_t
+sr_cli_dump_image(sr_snapshot_t snapshot, uint32_t image, const char *label) {
+    symrez_t symrez = sr_snapshot_symrez(snapshot, image);
+    if (!symrez) {
+        return 0;
+    }
+
+    sr_iterator_t it = sr_get_iterator(symrez);
+    sr_entry_t *entries = malloc(SR_CLI_BATCH * sizeof(sr_entry_t));
+    char *arena = malloc(SR_CLI_ARENA);
+    if (!it || !entries || !arena) {
+        free(entries);
+        free(arena);
+        return 0;
+    }
+
+    char *buf = NULL;
+    size_t size = 0;
+    struct sr_cli_dump dump = {
+        .out = open_memstream(&buf, &size),
+        .snapshot = snapshot,
+        .image = image,
+        .label = label,
+    };
+    if (!dump.out) {
+        free(entries);
+        free(arena);
+        return 0;
+    }
+
+    if (_g_opts.format == SR_CLI_TEXT) {
+        fprintf(dump.out, "\n%s:\n", label);
+    } else if (_g_opts.format == SR_CLI_BINARY) {
+        uint32_t len = (uint32_t)strlen(label);
+        fputc('I', dump.out);
+        fwrite(&len, sizeof(len), 1, dump.out);
+        fwrite(label, 1, len, dump.out);
+    }
+
+    // One pass. The iterator skips N_EXT symtab entries that the trie also
+    // has. Re-exports would have to resolve other images, which may not be in this file
+    sr_filter_t filter = { .mask = SR_FILTER_LOCALS | SR_FILTER_EXPORTS | SR_FILTER_CODE | SR_FILTER_DATA };
+    sr_iter_set_filter(it, &filter);
+    for (size_t n; (n = sr_iter_next_batch(it, entries, SR_CLI_BATCH, arena, SR_CLI_ARENA));) {
+        for (size_t i = 0; i < n; ++i) {
+            sr_cli_symbol(&dump, &entries[i], sr_cli_symbol_type(symrez, &entries[i]));
+        }
+    }
+    fclose(dump.out);
+    free(entries);
+    free(arena);
+
+    if (dump.count || _g_opts.format == SR_CLI_BINARY) {
+        pthread_mutex_lock(&_g_pool.out_lock);
+        fwrite(buf, 1, size, stdout);
+        pthread_mutex_unlock(&_g_pool.out_lock);
+    }
+    free(buf);
+    return dump.count;
+}
+
+static void
+sr_cli_report(const char *path, size_t symbols, uint64_t bytes, uint64_t start) {
+    if (!_g_opts.stats) {
+        return;
+    }
+
+    double ms = (double)(sr_cli_now() - start) / 1e6;
+    double mb = (double)bytes / (1024.0 * 1024.0);
+    pthread_mutex_lock(&_g_pool.out_lock);
+    fprintf(stderr, "%s: %zu symbols, %.1f MB in %.2f ms (%.1f MB/s)\n",
+            path, symbols, mb, ms, ms > 0 ? mb / (ms / 1000.0) : 0);
+    pthread_mutex_unlock(&_g_pool.out_lock);
+}
+
+#pragma mark - Files
+
+static const char *
+sr_cli_arch_name(cpu_type_t cputype) {
+    switch (cputype) {
+        case CPU_TYPE_X86_64: return "x86_64";
+        case CPU_TYPE_ARM64: return "arm64";
+        default: return "unknown";
+    }
+}
+
+// One 64-bit Mach-O at `offset`, with each segment as a region at its unslid address
+static sr_snapshot_t
+sr_cli_open_slice(const char *path, int fd, uint64_t offset) {
+    struct mach_header_64 mh;
+    if (pread(fd, &mh, sizeof(mh), (off_t)offset) != sizeof(mh) || mh.magic != MH_MAGIC_64) {
+        return NULL;
+    }
+
+    uint8_t *cmds = malloc(mh.sizeofcmds);
+    sr_snapshot_region_t *regions = malloc((mh.ncmds ? mh.ncmds : 1) * sizeof(sr_snapshot_region_t));
+    if (!cmds || !regions || pread(fd, cmds, mh.sizeofcmds, (off_t)(offset + sizeof(mh))) != (ssize_t)mh.sizeofcmds) {
+        free(cmds);
+        free(regions);
+        return NULL;
+    }
+
+    size_t nregions = 0;
+    const uint8_t *end = cmds + mh.sizeofcmds;
+    const struct load_command *lc = (const void *)cmds;
+    for (uint32_t i = 0; i < mh.ncmds; ++i) {
+        if ((const uint8_t *)lc + sizeof(*lc) > end || lc->cmdsize < sizeof(*lc) || (const uint8_t *)lc + lc->cmdsize > end) break;
+
+        if (lc->cmd == LC_SEGMENT_64) {
+            const struct segment_command_64 *seg = (const void *)lc;
+            sr_snapshot_region_t *r = &regions[nregions++];
+            r->vmaddr = seg->vmaddr;
+            r->size = seg->filesize < seg->vmsize ? seg->filesize : seg->vmsize;
+            r->fileoff = seg->fileoff + offset;
+        }
+        lc = (const void *)((const uint8_t *)lc + lc->cmdsize);
+    }
+    free(cmds);
+
+    sr_snapshot_t snapshot = sr_snapshot_open_regions(path, regions, nregions);
+    free(regions);
+    return snapshot;
+}
+
+typedef void (*sr_cli_slice_function_t)(const char *path, int fd, cpu_type_t cputype, uint64_t offset, uint64_t size, void *context);
+
+// Every 64-bit slice of a thin or fat file
+static void
+sr_cli_for_each_slice(const char *path, int fd, uint32_t magic, uint64_t file_size, void *context, sr_cli_slice_function_t work) {
+    if (magic == MH_MAGIC_64) {
+        struct mach_header_64 mh;
+        if (pread(fd, &mh, sizeof(mh), 0) == sizeof(mh)) {
+            work(path, fd, mh.cputype, 0, file_size, context);
+        }
+        return;
+    }
+
+    bool wide = (magic == FAT_CIGAM_64);
+    struct fat_header hdr;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        return;
+    }
+
+    uint32_t nfat = __builtin_bswap32(hdr.nfat_arch);
+    size_t arch_size = wide ? sizeof(struct fat_arch_64) : sizeof(struct fat_arch);
+    for (uint32_t i = 0; i < nfat; ++i) {
+        struct fat_arch_64 arch;
+        if (pread(fd, &arch, arch_size, (off_t)(sizeof(hdr) + i * arch_size)) != (ssize_t)arch_size) {
+            return;
+        }
+
+        cpu_type_t cputype = (cpu_type_t)__builtin_bswap32((uint32_t)arch.cputype);
+        if (!(cputype & CPU_ARCH_ABI64)) continue;
+
+        uint64_t offset, size;
+        if (wide) {
+            offset = __builtin_bswap64(arch.offset);
+            size = __builtin_bswap64(arch.size);
+        } else {
+            const struct fat_arch *narrow = (const void *)&arch;
+            offset = __builtin_bswap32(narrow->offset);
+            size = __builtin_bswap32(narrow->size);
+        }
+
+        work(path, fd, cputype, offset, size, context);
+    }
+}
+
+static void
+sr_cli_dump_slice(const char *path, int fd, cpu_type_t cputype, uint64_t offset, uint64_t size, void *context) {
+    char label[PATH_MAX + 32];
+    if (*(const bool *)context) {
+        snprintf(label, sizeof(label), "%s (%s)", path, sr_cli_arch_name(cputype));
+    } else {
+        snprintf(label, sizeof(label), "%s", path);
+    }
+
+    uint64_t start = sr_cli_now();
+    size_t symbols = 0;
+    sr_snapshot_t snapshot = sr_cli_open_slice(path, fd, offset);
+    if (snapshot) {
+        for (uint32_t i = 0; i < sr_snapshot_image_count(snapshot); ++i) {
+            symbols += sr_cli_dump_image(snapshot, i, label);
+        }
+        sr_snapshot_close(snapshot);
+    }
+
+    sr_cli_report(label, symbols, size, start);
+}
+
+static void
+sr_cli_cache(unsigned worker, const char *path, uint64_t size) {
+    uint64_t start = sr_cli_now();
+    sr_snapshot_t snapshot = sr_snapshot_open(path);
+    if (!snapshot) {
+        return;
+    }
+
+    uint32_t count = sr_snapshot_image_count(snapshot);
+    struct sr_cli_cache *cache = calloc(1, sizeof(struct sr_cli_cache));
+    if (!cache || !count || !(cache->path = strdup(path))) {
+        free(cache);
+        sr_snapshot_close(snapshot);
+        return;
+    }
+
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->snapshot = snapshot;
+    cache->size = size;
+    cache->start = start;
+    cache->remaining = count;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        struct sr_cli_task *task = calloc(1, sizeof(struct sr_cli_task));
+        if (!task) {
+            perror("symrez");
+            exit(1);
+        }
+        task->kind = SR_CLI_CACHE_IMAGE;
+        task->cache = cache;
+        task->image = i;
+        sr_cli_push(worker, task);
+    }
+}
+
+static void
+sr_cli_cache_image(struct sr_cli_cache *cache, uint32_t image) {
+    // Mapping the cache and creating symrez objects isn't thread safe, walking them is
+    pthread_mutex_lock(&cache->lock);
+    symrez_t symrez = sr_snapshot_symrez(cache->snapshot, image);
+    pthread_mutex_unlock(&cache->lock);
+
+    if (symrez) {
+        const char *label = sr_snapshot_image_path(cache->snapshot, image);
+        size_t symbols = sr_cli_dump_image(cache->snapshot, image, label ? label : cache->path);
+        atomic_fetch_add_explicit(&cache->symbols, symbols, memory_order_relaxed);
+    }
+
+    if (atomic_fetch_sub_explicit(&cache->remaining, 1, memory_order_acq_rel) == 1) {
+        sr_cli_report(cache->path, cache->symbols, cache->size, cache->start);
+        sr_snapshot_close(cache->snapshot);
+        pthread_mutex_destroy(&cache->lock);
+        free(cache->path);
+        free(cache);
+    }
+}
+
+static void
+sr_cli_directory(unsigned worker, const char *path) {
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) continue;
+
+        size_t len = strlen(path) + strlen(ent->d_name) + 2;
+        struct sr_cli_task *task = calloc(1, sizeof(struct sr_cli_task));
+        if (!task || !(task->path = malloc(len))) {
+            perror("symrez");
+            exit(1);
+        }
+        snprintf(task->path, len, "%s/%s", path, ent->d_name);
+        task->kind = SR_CLI_PATH;
+        sr_cli_push(worker, task);
+    }
+    closedir(dir);
+}
+
+// Symlinks are skipped, so a directory tree can't loop
+static void
+sr_cli_path(unsigned worker, const char *path) {
+    struct stat st;
+    if (lstat(path, &st)) {
+        return;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        sr_cli_directory(worker, path);
+        return;
+    }
+
+    if (!S_ISREG(st.st_mode) || st.st_size < (off_t)sizeof(struct mach_header_64)) {
+        return;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    char magic[16] = { 0 };
+    if (pread(fd, magic, sizeof(magic), 0) == sizeof(magic)) {
+        uint32_t m;
+        memcpy(&m, magic, sizeof(m));
+
+        if (!strncmp(magic, "dyld_v1", 7)) {
+            sr_cli_cache(worker, path, (uint64_t)st.st_size);
+        } else if (m == FAT_CIGAM || m == FAT_CIGAM_64 || m == MH_MAGIC_64) {
+            bool fat = (m != MH_MAGIC_64);
+            sr_cli_for_each_slice(path, fd, m, (uint64_t)st.st_size, &fat, sr_cli_dump_slice);
+        }
+    }
+    close(fd);
+}
+
+#pragma mark - Diff
+
+/*
+ Diff mode pairs the images of two files by key: the install name for
+ shared caches, the architecture otherwise, followed by the image's path or
+ position when a slice holds more than one image. Every symrez object is
+ created up front on the main thread, so the diff tasks only read them.
+ Pairs with the same LC_UUID produce no output.
+ */
+
+struct sr_cli_side {
+    sr_snapshot_t *snapshots;
+    uint32_t nsnapshots;
+    uint32_t snapshots_cap;
+    struct sr_cli_image *images;
+    uint32_t count;
+    uint32_t cap;
+};
+
+static void *
+sr_cli_grow(void *ptr, uint32_t *cap, size_t size) {
+    uint32_t new_cap = *cap ? *cap * 2 : 16;
+    void *grown = realloc(ptr, new_cap * size);
+    if (!grown) {
+        perror("symrez");
+        exit(1);
+    }
+
+    *cap = new_cap;
+    return grown;
+}
+
+static void
+sr_cli_side_add_snapshot(struct sr_cli_side *side, sr_snapshot_t snapshot) {
+    if (side->nsnapshots == side->snapshots_cap) {
+        side->snapshots = sr_cli_grow(side->snapshots, &side->snapshots_cap, sizeof(sr_snapshot_t));
+    }
+    side->snapshots[side->nsnapshots++] = snapshot;
+}
+
+static void
+sr_cli_side_add_image(struct sr_cli_side *side, const char *key, symrez_t symrez) {
+    if (side->count == side->cap) {
+        side->images = sr_cli_grow(side->images, &side->cap, sizeof(struct sr_cli_image));
+    }
+
+    struct sr_cli_image *img = &side->images[side->count++];
+    img->symrez = symrez;
+    if (!(img->key = strdup(key))) {
+        perror("symrez");
+        exit(1);
+    }
+}
+
+static void
+sr_cli_side_slice(const char *path, int fd, cpu_type_t cputype, uint64_t offset, uint64_t size, void *context) {
+    (void)size;
+    struct sr_cli_side *side = context;
+    sr_snapshot_t snapshot = sr_cli_open_slice(path, fd, offset);
+    if (!snapshot) {
+        return;
+    }
+
+    sr_cli_side_add_snapshot(side, snapshot);
+    const char *arch = sr_cli_arch_name(cputype);
+    uint32_t count = sr_snapshot_image_count(snapshot);
+    for (uint32_t i = 0; i < count; ++i) {
+        symrez_t symrez = sr_snapshot_symrez(snapshot, i);
+        if (!symrez) continue;
+
+        char key[PATH_MAX + 32];
+        const char *image_path = sr_snapshot_image_path(snapshot, i);
+        if (count == 1) {
+            snprintf(key, sizeof(key), "%s", arch);
+        } else if (image_path) {
+            snprintf(key, sizeof(key), "%s %s", arch, image_path);
+        } else {
+            snprintf(key, sizeof(key), "%s #%u", arch, i);
+        }
+        sr_cli_side_add_image(side, key, symrez);
+    }
+}
+
+static int
+sr_cli_image_cmp(const void *a, const void *b) {
+    return strcmp(((const struct sr_cli_image *)a)->key, ((const struct sr_cli_image *)b)->key);
+}
+
+static bool
+sr_cli_side_open(const char *path, struct sr_cli_side *side) {
+    memset(side, 0, sizeof(*side));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+
+    struct stat st;
+    char magic[16] = { 0 };
+    if (fstat(fd, &st) || pread(fd, magic, sizeof(magic), 0) != sizeof(magic)) {
+        close(fd);
+        return false;
+    }
+
+    uint32_t m;
+    memcpy(&m, magic, sizeof(m));
+    if (!strncmp(magic, "dyld_v1", 7)) {
+        sr_snapshot_t snapshot = sr_snapshot_open(path);
+        if (snapshot) {
+            sr_cli_side_add_snapshot(side, snapshot);
+            for (uint32_t i = 0; i < sr_snapshot_image_count(snapshot); ++i) {
+                symrez_t symrez = sr_snapshot_symrez(snapshot, i);
+                const char *key = sr_snapshot_image_path(snapshot, i);
+                if (symrez && key) {
+                    sr_cli_side_add_image(side, key, symrez);
+                }
+            }
+        }
+    } else if (m == FAT_CIGAM || m == FAT_CIGAM_64 || m == MH_MAGIC_64) {
+        sr_cli_for_each_slice(path, fd, m, (uint64_t)st.st_size, side, sr_cli_side_slice);
+    }
+    close(fd);
+
+    if (!side->count) {
+        fprintf(stderr, "symrez: %s: no 64-bit Mach-O images\n", path);
+        return false;
+    }
+
+    qsort(side->images, side->count, sizeof(struct sr_cli_image), sr_cli_image_cmp);
+    return true;
+}
+
+static void
+sr_cli_side_close(struct sr_cli_side *side) {
+    for (uint32_t i = 0; i < side->count; ++i) {
+        free(side->images[i].key);
+    }
+    for (uint32_t i = 0; i < side->nsnapshots; ++i) {
+        sr_snapshot_close(side->snapshots[i]);
+    }
+    free(side->images);
+    free(side->snapshots);
+}
+
+static void
+sr_cli_uuid(const uint8_t *uuid, char out[37]) {
+    if (!uuid) {
+        strcpy(out, "-");
+        return;
+    }
+
+    snprintf(out, 37, "%02X%02X%02X%02X-%02X%02X-%02X%02X-%02X%02X-%02X%02X%02X%02X%02X%02X",
+             uuid[0], uuid[1], uuid[2], uuid[3], uuid[4], uuid[5], uuid[6], uuid[7],
+             uuid[8], uuid[9], uuid[10], uuid[11], uuid[12], uuid[13], uuid[14], uuid[15]);
+}
+
+struct sr_cli_diff {
+    FILE *out;
+    const char *key;
+    char uuid_a[37];
+    char uuid_b[37];
+    size_t count;
+};
+
+static void
+sr_cli_diff_json_side(FILE *out, const char *key, const sr_diff_symbol_t *sym) {
+    fprintf(out, ",\"%s\":{\"offset\":\"0x%" PRIx64 "\",\"section\":\"%s,%s\",\"flags\":%u}",
+            key, sym->offset, sym->segname, sym->sectname, sym->flags);
+}
+
+static bool
+sr_cli_diff_entry(const sr_diff_entry_t *entry, void *context) {
+    struct sr_cli_diff *diff = context;
+    if (_g_opts.name && strcmp(entry->name, _g_opts.name)) {
+        return false;
+    }
+    if (_g_opts.prefix && strncmp(entry->name, _g_opts.prefix, _g_opts.prefix_len)) {
+        return false;
+    }
+
+    FILE *out = diff->out;
+    const sr_diff_symbol_t *a = &entry->a;
+    const sr_diff_symbol_t *b = &entry->b;
+    if (_g_opts.format == SR_CLI_JSON) {
+        fputs("{\"image\":", out);
+        sr_cli_json_string(out, diff->key);
+        fprintf(out, ",\"uuid_a\":\"%s\",\"uuid_b\":\"%s\",\"name\":", diff->uuid_a, diff->uuid_b);
+        sr_cli_json_string(out, entry->name);
+        if (entry->change & SR_DIFF_ADDED) {
+            fputs(",\"change\":\"added\"", out);
+            sr_cli_diff_json_side(out, "b", b);
+        } else if (entry->change & SR_DIFF_REMOVED) {
+            fputs(",\"change\":\"removed\"", out);
+            sr_cli_diff_json_side(out, "a", a);
+        } else {
+            fprintf(out, ",\"change\":\"changed\",\"offset\":%s,\"section\":%s,\"kind\":%s",
+                    (entry->change & SR_DIFF_OFFSET) ? "true" : "false",
+                    (entry->change & SR_DIFF_SECTION) ? "true" : "false",
+                    (entry->change & SR_DIFF_KIND) ? "true" : "false");
+            sr_cli_diff_json_side(out, "a", a);
+            sr_cli_diff_json_side(out, "b", b);
+        }
+        fputs("}\n", out);
+    } else {
+        if (!diff->count) {
+            fprintf(out, "\n%s %s -> %s:\n", diff->key, diff->uuid_a, diff->uuid_b);
+        }
+
+        if (entry->change & SR_DIFF_ADDED) {
+            fprintf(out, "+ %016" PRIx64 " %s,%s %s\n", b->offset, b->segname, b->sectname, entry->name);
+        } else if (entry->change & SR_DIFF_REMOVED) {
+            fprintf(out, "- %016" PRIx64 " %s,%s %s\n", a->offset, a->segname, a->sectname, entry->name);
+        } else {
+            fprintf(out, "~ %016" PRIx64 " %s,%s -> %016" PRIx64 " %s,%s %s",
+                    a->offset, a->segname, a->sectname, b->offset, b->segname, b->sectname, entry->name);
+            if (entry->change & SR_DIFF_KIND) {
+                fprintf(out, " (flags 0x%x -> 0x%x)", a->flags, b->flags);
+            }
+            fputc('\n', out);
+        }
+    }
+
+    ++diff->count;
+    return false;
+}
+
+static void
+sr_cli_diff_pair(const struct sr_cli_image *a, const struct sr_cli_image *b) {
+    char *buf = NULL;
+    size_t size = 0;
+    struct sr_cli_diff diff = {
+        .out = open_memstream(&buf, &size),
+        .key = a->key,
+    };
+    if (!diff.out) {
+        return;
+    }
+
+    sr_cli_uuid(sr_get_uuid(a->symrez), diff.uuid_a);
+    sr_cli_uuid(sr_get_uuid(b->symrez), diff.uuid_b);
+
+    uint64_t start = sr_cli_now();
+    if (!sr_diff(a->symrez, b->symrez, &diff, sr_cli_diff_entry)) {
+        fprintf(stderr, "symrez: %s: out of memory\n", a->key);
+    }
+    fclose(diff.out);
+
+    pthread_mutex_lock(&_g_pool.out_lock);
+    fwrite(buf, 1, size, stdout);
+    if (_g_opts.stats) {
+        fprintf(stderr, "%s: %zu differences in %.2f ms\n", a->key, diff.count, (double)(sr_cli_now() - start) / 1e6);
+    }
+    pthread_mutex_unlock(&_g_pool.out_lock);
+    free(buf);
+}
+
+// Images missing from one side are reported right away; pairs become tasks
+static void
+sr_cli_diff_push(const struct sr_cli_side *a, const struct sr_cli_side *b) {
+    uint32_t i = 0, j = 0, n = 0;
+    while (i < a->count || j < b->count) {
+        int cmp = i == a->count ? 1 : j == b->count ? -1 : strcmp(a->images[i].key, b->images[j].key);
+        if (cmp) {
+            const struct sr_cli_image *img = cmp < 0 ? &a->images[i++] : &b->images[j++];
+            if (_g_opts.format == SR_CLI_JSON) {
+                fputs("{\"image\":", stdout);
+                sr_cli_json_string(stdout, img->key);
+                fprintf(stdout, ",\"change\":\"%s\"}\n", cmp < 0 ? "removed" : "added");
+            } else {
+                fprintf(stdout, "%c image %s\n", cmp < 0 ? '-' : '+', img->key);
+            }
+            continue;
+        }
+
+        struct sr_cli_task *task = calloc(1, sizeof(struct sr_cli_task));
+        if (!task) {
+            perror("symrez");
+            exit(1);
+        }
+        task->kind = SR_CLI_DIFF;
+        task->a = &a->images[i++];
+        task->b = &b->images[j++];
+        sr_cli_push(n++ % _g_pool.count, task);
+    }
+}
+
+static void *
+sr_cli_worker(void *arg) {
+    unsigned worker = (unsigned)(uintptr_t)arg;
+    while (atomic_load_explicit(&_g_pool.pending, memory_order_acquire)) {
+        struct sr_cli_task *task = sr_cli_pop(worker);
+        if (!task) {
+            // Someone else is still working and may push more
+            nanosleep(&(struct timespec){ .tv_nsec = 50000 }, NULL);
+            continue;
+        }
+
+        switch (task->kind) {
+            case SR_CLI_PATH:
+                sr_cli_path(worker, task->path);
+                break;
+            case SR_CLI_CACHE_IMAGE:
+                sr_cli_cache_image(task->cache, task->image);
+                break;
+            case SR_CLI_DIFF:
+                sr_cli_diff_pair(task->a, task->b);
+                break;
+        }
+
+        free(task->path);
+        free(task);
+        atomic_fetch_sub_explicit(&_g_pool.pending, 1, memory_order_release);
+    }
+
+    return NULL;
+}
+
+
+#pragma mark - Main
+
+static void
+sr_cli_usage(FILE *out) {
+    fputs("usage: symrez [-f text|json|binary] [-n name] [-p prefix] [-a addr[-end]] [-j jobs] [-s] path...\n"
+          "       symrez -d [-f text|json] [-n name] [-p prefix] [-j jobs] [-s] old new\n"
+          "\n"
+          "Lists the symbols of 64-bit Mach-O files, fat files and dyld shared caches.\n"
+          "Directories are searched recursively.\n"
+          "\n"
+          "  -d  diff two files instead. Images are paired by install name (shared caches) or\n"
+          "      architecture, and path or position in slices holding several. Offsets are\n"
+          "      from the start of __TEXT\n"
+          "  -f  output format. text (nm style, default), json (one object per line) or binary\n"
+          "  -n  only symbols with this exact name\n"
+          "  -p  only symbols starting with prefix\n"
+          "  -a  only symbols at addr, or in [addr, end]. Addresses are unslid\n"
+          "  -j  number of worker threads. Defaults to the number of CPUs\n"
+          "  -s  report per-file symbol count and throughput on stderr\n"
+          "\n"
+          "binary: \"SRNM\\0\\0\\0\\1\", then per image 'I' u32 len, path; per symbol 'S' type, u64 addr,\n"
+          "        u32 len, name. Integers are little endian.\n", out);
+}
+
+static bool
+sr_cli_parse_range(const char *arg) {
+    char *end;
+    _g_opts.addr_lo = strtoull(arg, &end, 0);
+    if (end == arg) {
+        return false;
+    }
+
+    _g_opts.addr_hi = _g_opts.addr_lo;
+    if (*end == '-') {
+        const char *hi = end + 1;
+        _g_opts.addr_hi = strtoull(hi, &end, 0);
+        if (end == hi) {
+            return false;
+        }
+    }
+
+    return *end == '\0' && _g_opts.addr_lo <= _g_opts.addr_hi;
+}
+
+int main(int argc, char *argv[]) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    _g_opts.jobs = cpus > 0 ? (unsigned)cpus : 1;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "f:n:p:a:j:dsh")) != -1) {
+        switch (ch) {
+            case 'f':
+                if (!strcmp(optarg, "text")) {
+                    _g_opts.format = SR_CLI_TEXT;
+                } else if (!strcmp(optarg, "json")) {
+                    _g_opts.format = SR_CLI_JSON;
+                } else if (!strcmp(optarg, "binary")) {
+                    _g_opts.format = SR_CLI_BINARY;
+                } else {
+                    sr_cli_usage(stderr);
+                    return 1;
+                }
+                break;
+            case 'n':
+                _g_opts.name = optarg;
+                break;
+            case 'p':
+                _g_opts.prefix = optarg;
+                _g_opts.prefix_len = strlen(optarg);
+                break;
+            case 'a':
+                if (!sr_cli_parse_range(optarg)) {
+                    sr_cli_usage(stderr);
+                    return 1;
+                }
+                break;
+            case 'j':
+                _g_opts.jobs = (unsigned)strtoul(optarg, NULL, 0);
+                if (!_g_opts.jobs) {
+                    _g_opts.jobs = 1;
+                }
+                break;
+            case 'd':
+                _g_opts.diff = true;
+                break;
+            case 's':
+                _g_opts.stats = true;
+                break;
+            case 'h':
+                sr_cli_usage(stdout);
+                return 0;
+            default:
+                sr_cli_usage(stderr);
+                return 1;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+    if (!argc || (_g_opts.diff && (argc != 2 || _g_opts.format == SR_CLI_BINARY))) {
+        sr_cli_usage(stderr);
+        return 1;
+    }
+
+    static char outbuf[1 << 20];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+    if (_g_opts.format == SR_CLI_BINARY) {
+        fwrite(SR_CLI_BINARY_MAGIC, 1, sizeof(SR_CLI_BINARY_MAGIC) - 1, stdout);
+    }
+
+    _g_pool.count = _g_opts.jobs;
+    _g_pool.deques = calloc(_g_pool.count, sizeof(struct sr_cli_deque));
+    pthread_t *threads = calloc(_g_pool.count, sizeof(pthread_t));
+    if (!_g_pool.deques || !threads) {
+        perror("symrez");
+        return 1;
+    }
+
+    for (unsigned i = 0; i < _g_pool.count; ++i) {
+        pthread_mutex_init(&_g_pool.deques[i].lock, NULL);
+    }
+
+    struct sr_cli_side sides[2];
+    if (_g_opts.diff) {
+        if (!sr_cli_side_open(argv[0], &sides[0])) {
+            return 1;
+        }
+        if (!sr_cli_side_open(argv[1], &sides[1])) {
+            sr_cli_side_close(&sides[0]);
+            return 1;
+        }
+        sr_cli_diff_push(&sides[0], &sides[1]);
+    } else {
+        for (int i = 0; i < argc; ++i) {
+            struct sr_cli_task *task = calloc(1, sizeof(struct sr_cli_task));
+            if (!task || !(task->path = strdup(argv[i]))) {
+                perror("symrez");
+                return 1;
+            }
+            task->kind = SR_CLI_PATH;
+            sr_cli_push((unsigned)i % _g_pool.count, task);
+        }
+    }
+
+    // Deques of workers that failed to start are drained by stealing
+    unsigned started = 1;
+    for (; started < _g_pool.count; ++started) {
+        if (pthread_create(&threads[started], NULL, sr_cli_worker, (void *)(uintptr_t)started)) break;
+    }
+    sr_cli_worker((void *)0);
+    for (unsigned i = 1; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+
+    if (_g_opts.diff) {
+        sr_cli_side_close(&sides[0]);
+        sr_cli_side_close(&sides[1]);
+    }
+
+    fflush(stdout);
+    return 0;
+}